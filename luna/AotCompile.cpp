@@ -0,0 +1,629 @@
+#include "AotCompile.h"
+#include "Function.h"
+#include "String.h"
+#include "OpCode.h"
+#include <limits>
+#include <vector>
+#include <sstream>
+#include <unordered_map>
+#include <assert.h>
+#include <string.h>
+
+namespace luna
+{
+    // Compile each function prototype into a C++ function, which works
+    // as machine code of baseline JIT: it runs from an instruction
+    // index, executes instructions on registers of the frame in place,
+    // and exits to the interpreter for calls, returns, closures and
+    // errors by returning the instruction index
+    class AotCompiler
+    {
+    public:
+        explicit AotCompiler(Function *module)
+        {
+            CollectPrototypes(module);
+        }
+
+        std::string Compile();
+
+    private:
+        // Collect prototypes in preorder, the first is module function
+        void CollectPrototypes(Function *proto);
+
+        void CompileFunction(int index);
+        void CompileData(int index);
+
+        // Compile instruction at index into 'os', return count of
+        // instruction words used by the instruction
+        int CompileInstruction(std::ostringstream &os, const Instruction *code,
+                               int index);
+
+        // C++ string literal of bytes
+        static std::string Quote(const char *str, std::size_t len);
+        static std::string Quote(const String *str)
+        { return Quote(str->GetCStr(), str->GetLength()); }
+
+        std::vector<Function *> prototypes_;
+        std::unordered_map<const Function *, int> indexes_;
+        std::ostringstream out_;
+
+        // Instructions of current function which need labels, and
+        // consts, inline caches, upvalues or VM are used or not
+        std::vector<bool> labels_;
+        bool use_consts_;
+        bool use_caches_;
+        bool use_upvalues_;
+        bool use_vm_;
+        // The last compiled instruction jumps or exits unconditionally
+        bool terminal_;
+    };
+
+#define REG(x)          "base + " << (x)
+#define CONST(x)        "k + " << (x)
+#define EXIT(index)     " return " << (index) << ";"
+
+    std::string AotCompiler::Compile()
+    {
+        auto module = prototypes_[0]->GetModule()->GetStdString();
+        out_ << "// Compiled from " << module << " by luna --emit-cpp, build it into\n"
+             << "// a native module, and load the native module in place of the\n"
+             << "// module source:\n"
+             << "//   c++ -std=c++11 -O2 -fPIC -shared -I<luna sources> "
+             << "module.cpp -o module.so\n"
+             << "#include \"AotModule.h\"\n\n"
+             << "namespace\n{\n"
+             << "    using namespace luna;\n"
+             << "    using namespace luna::aot;\n";
+
+        int count = prototypes_.size();
+        for (int i = 0; i < count; ++i)
+            CompileFunction(i);
+        for (int i = 0; i < count; ++i)
+            CompileData(i);
+
+        out_ << "\n    const Prototype kPrototypes[] = {\n";
+        for (int i = 0; i < count; ++i)
+        {
+            auto proto = prototypes_[i];
+            out_ << "        { Function" << i << ", kCode" << i << ", kLines" << i
+                 << ", " << proto->OpCodeSize() << ",\n          ";
+#define ARRAY(name, size) \
+            ((size) ? name + std::to_string(i) : std::string("nullptr")) << ", " << (size)
+            out_ << ARRAY("kConsts", proto->GetConstValueCount()) << ", "
+                 << ARRAY("kLocalVars", proto->GetLocalVarCount()) << ", "
+                 << ARRAY("kUpvalues", proto->GetUpvalueCount()) << ", "
+                 << ARRAY("kChildren", proto->GetChildFunctionCount()) << ",\n          "
+                 << proto->GetLine() << ", " << proto->FixedArgCount() << ", "
+                 << proto->GetRegisterCount() << ", "
+                 << (proto->HasVararg() ? "true" : "false") << " },\n";
+#undef ARRAY
+        }
+        out_ << "    };\n"
+             << "} // namespace\n\n"
+             << "extern \"C\" LUNA_AOT_EXPORT const luna::aot::Module luna_aot_module = {\n"
+             << "    luna::aot::kVersion, sizeof(luna::Value), "
+             << Quote(module.c_str(), module.size()) << ", kPrototypes, "
+             << count << "\n};\n";
+        return out_.str();
+    }
+
+    void AotCompiler::CollectPrototypes(Function *proto)
+    {
+        indexes_[proto] = prototypes_.size();
+        prototypes_.push_back(proto);
+
+        auto count = proto->GetChildFunctionCount();
+        for (std::size_t i = 0; i < count; ++i)
+            CollectPrototypes(proto->GetChildFunction(i));
+    }
+
+    void AotCompiler::CompileFunction(int index)
+    {
+        auto proto = prototypes_[index];
+        auto code = proto->GetOpCodes();
+        int size = proto->OpCodeSize();
+
+        labels_.assign(size + 1, false);
+        use_consts_ = false;
+        use_caches_ = false;
+        use_upvalues_ = false;
+        use_vm_ = false;
+
+        // Interpreter enters at the function start and after the
+        // instructions which exit to it and then continue the frame,
+        // other labels are targets of jumps
+        std::vector<int> entries(1, 0);
+        for (int i = 0; i < size; ++i)
+        {
+            auto op = Instruction::GetOpCode(ToCheckedInstruction(code[i]));
+            if (op == OpType_Call || op == OpType_VarArg || op == OpType_Closure)
+                entries.push_back(i + 1);
+            else if (HasDataWord(op))
+                ++i;
+            else if ((op >= OpType_JmpLess && op <= OpType_JmpEqualRK) ||
+                     op == OpType_Intrinsic)
+                labels_[i + 2] = true;
+            else if ((op >= OpType_JmpFalse && op <= OpType_Jmp) ||
+                     (op >= OpType_ForInit && op <= OpType_ForLoopDec))
+                labels_[i + Instruction::GetJumpDiff(code[i])] = true;
+        }
+        for (auto entry : entries)
+            labels_[entry] = true;
+
+        // Instructions after a jump or an exit are unreachable until
+        // the next label, they are not compiled, and unused parameters
+        // are not named
+        std::ostringstream body;
+        bool reachable = true;
+        for (int i = 0; i < size; )
+        {
+            if (labels_[i])
+            {
+                body << "    L" << i << ":\n";
+                reachable = true;
+            }
+            if (!reachable)
+            {
+                i += HasDataWord(Instruction::GetOpCode(code[i])) ? 2 : 1;
+                continue;
+            }
+            body << "       ";
+            i += CompileInstruction(body, code, i);
+            body << "\n";
+            reachable = !terminal_;
+        }
+
+        out_ << "\n    // " << proto->GetModule()->GetStdString() << ":"
+             << proto->GetLine() << "\n"
+             << "    int Function" << index
+             << "(Value *" << (body.str().find("base") != std::string::npos ? "base" : "")
+             << ", Closure *"
+             << (use_consts_ || use_caches_ || use_upvalues_ ? "cl" : "")
+             << ", VM *" << (use_vm_ ? "vm" : "") << ", long index)\n    {\n";
+        if (use_consts_)
+            out_ << "        Value *k = cl->GetPrototype()->GetConstValues();\n";
+        if (use_caches_)
+            out_ << "        TableCache *caches = cl->GetPrototype()->GetTableCaches();\n";
+        out_ << "        switch (index)\n        {\n";
+        for (auto entry : entries)
+            out_ << "            case " << entry << ": goto L" << entry << ";\n";
+        out_ << "            default: return index;\n        }\n"
+             << body.str();
+        out_ << "    }\n";
+    }
+
+    void AotCompiler::CompileData(int index)
+    {
+        auto proto = prototypes_[index];
+        auto code = proto->GetOpCodes();
+        int size = proto->OpCodeSize();
+
+        out_ << "\n    const unsigned int kCode" << index << "[] = {";
+        for (int i = 0; i < size; ++i)
+            out_ << (i % 8 ? " " : "\n        ") << "0x" << std::hex
+                 << code[i].opcode_ << std::dec << "u,";
+        out_ << "\n    };\n";
+
+        out_ << "    const int kLines" << index << "[] = {";
+        for (int i = 0; i < size; ++i)
+            out_ << (i % 16 ? " " : "\n        ") << proto->GetInstructionLine(i) << ",";
+        out_ << "\n    };\n";
+
+        auto const_count = proto->GetConstValueCount();
+        if (const_count)
+        {
+            out_ << "    const Const kConsts" << index << "[] = {\n";
+            auto consts = proto->GetConstValues();
+            for (std::size_t i = 0; i < const_count; ++i)
+            {
+                const Value &k = consts[i];
+                switch (k.type_) {
+                    case ValueT_Number:
+                    {
+                        double num = k.num_;
+                        unsigned long long bits;
+                        memcpy(&bits, &num, sizeof(bits));
+                        out_ << "        { ValueT_Number, 0, 0x" << std::hex << bits
+                             << std::dec << "ull, nullptr, 0 },\n";
+                        break;
+                    }
+                    case ValueT_Integer:
+                    {
+                        long long integer = k.integer_;
+                        // -2^63 is not a literal of long long
+                        if (integer == std::numeric_limits<long long>::min())
+                            out_ << "        { ValueT_Integer, -9223372036854775807ll - 1";
+                        else
+                            out_ << "        { ValueT_Integer, " << integer << "ll";
+                        out_ << ", 0, nullptr, 0 },\n";
+                        break;
+                    }
+                    case ValueT_String:
+                        out_ << "        { ValueT_String, 0, 0, " << Quote(k.str_)
+                             << ", " << k.str_->GetLength() << " },\n";
+                        break;
+                    case ValueT_Bool:
+                        out_ << "        { ValueT_Bool, " << (k.bvalue_ ? 1 : 0)
+                             << ", 0, nullptr, 0 },\n";
+                        break;
+                    default:
+                        assert(k.type_ == ValueT_Nil);
+                        out_ << "        { ValueT_Nil, 0, 0, nullptr, 0 },\n";
+                        break;
+                }
+            }
+            out_ << "    };\n";
+        }
+
+        auto local_var_count = proto->GetLocalVarCount();
+        if (local_var_count)
+        {
+            out_ << "    const LocalVar kLocalVars" << index << "[] = {\n";
+            for (std::size_t i = 0; i < local_var_count; ++i)
+            {
+                auto var = proto->GetLocalVar(i);
+                out_ << "        { " << Quote(var->name_) << ", " << var->register_id_
+                     << ", " << var->begin_pc_ << ", " << var->end_pc_ << " },\n";
+            }
+            out_ << "    };\n";
+        }
+
+        auto upvalue_count = proto->GetUpvalueCount();
+        if (upvalue_count)
+        {
+            out_ << "    const UpvalueInfo kUpvalues" << index << "[] = {\n";
+            for (std::size_t i = 0; i < upvalue_count; ++i)
+            {
+                auto upvalue = proto->GetUpvalue(i);
+                out_ << "        { " << Quote(upvalue->name_) << ", "
+                     << (upvalue->parent_local_ ? "true" : "false") << ", "
+                     << upvalue->register_index_ << " },\n";
+            }
+            out_ << "    };\n";
+        }
+
+        auto child_count = proto->GetChildFunctionCount();
+        if (child_count)
+        {
+            out_ << "    const int kChildren" << index << "[] = {";
+            for (std::size_t i = 0; i < child_count; ++i)
+                out_ << " " << indexes_[proto->GetChildFunction(i)] << ",";
+            out_ << " };\n";
+        }
+    }
+
+    int AotCompiler::CompileInstruction(std::ostringstream &os, const Instruction *code,
+                                        int index)
+    {
+        Instruction i = ToCheckedInstruction(code[index]);
+        int a = Instruction::GetParamA(i);
+        int b = Instruction::GetParamB(i);
+        int c = Instruction::GetParamC(i);
+        int bx = Instruction::GetParamBx(i);
+        int target = index + Instruction::GetJumpDiff(i);
+
+        // Operands of arithmetic, comparison and table instructions
+        std::ostringstream rb, rc, kb, kc;
+        rb << REG(b);
+        rc << REG(c);
+        kb << CONST(b);
+        kc << CONST(c);
+
+#define JUMP(to)        " goto L" << (to) << ";"
+#define USE_CONSTS()    (use_consts_ = true)
+#define USE_CACHES()    (use_caches_ = true)
+#define USE_UPVALUES()  (use_upvalues_ = true)
+#define USE_VM()        (use_vm_ = true)
+
+// Set register A by template which returns false on error
+#define SET_OP(name, ob, oc)                                            \
+        os << " if (!" name "(" << REG(a) << ", " << ob.str() << ", "   \
+           << oc.str() << "))" << EXIT(index);                          \
+        return 1
+
+// Set register A by result of comparison template
+#define SET_COMPARE_OP(name, ob, oc)                                    \
+        os << " { int r = " name "(" << ob.str() << ", " << oc.str()   \
+           << "); if (r < 0)" << EXIT(index) << " base[" << a           \
+           << "].SetBool(r != 0); }";                                   \
+        return 1
+
+// Skip the next Jmp when result of comparison is not A
+#define COMPARE_JMP_OP(name, ob, oc)                                    \
+        os << " { int r = " name "(" << ob.str() << ", " << oc.str()   \
+           << "); if (r < 0)" << EXIT(index) << " if (r != "            \
+           << (a != 0) << ")" << JUMP(index + 2) << " }";               \
+        return 1
+
+        terminal_ = false;
+        switch (Instruction::GetOpCode(i)) {
+            case OpType_LoadNil:
+                os << " base[" << a << "].SetNil();";
+                return 1;
+            case OpType_FillNil:
+                USE_VM();
+                os << " FillNil(vm, " << REG(a) << ", " << REG(b) << ");";
+                return 1;
+            case OpType_LoadBool:
+                os << " base[" << a << "].SetBool(" << (b ? "true" : "false") << ");";
+                return 1;
+            case OpType_LoadInt:
+                os << " base[" << a << "].SetInteger(" << code[index + 1].opcode_ << "ll);";
+                return 2;
+            case OpType_LoadConst:
+                USE_CONSTS();
+                os << " base[" << a << "] = k[" << bx << "];";
+                return 1;
+            case OpType_LoadConstX:
+                USE_CONSTS();
+                os << " base[" << a << "] = k[" << code[index + 1].opcode_ << "];";
+                return 2;
+            case OpType_Move:
+                os << " base[" << a << "] = base[" << b << "];";
+                return 1;
+            case OpType_GetUpvalue:
+                USE_UPVALUES();
+                os << " base[" << a << "] = *cl->GetUpvalue(" << b << ")->GetValue();";
+                return 1;
+            case OpType_SetUpvalue:
+                USE_UPVALUES();
+                os << " *cl->GetUpvalue(" << b << ")->GetValue() = base[" << a << "];";
+                return 1;
+            case OpType_GetGlobal:
+            case OpType_SetGlobal:
+                USE_CONSTS();
+                USE_CACHES();
+                USE_VM();
+                os << " NativeHelper::"
+                   << (Instruction::GetOpCode(i) == OpType_GetGlobal ? "GetGlobal" : "SetGlobal")
+                   << "(vm, " << REG(a) << ", " << CONST(bx) << ", caches + " << index << ");";
+                return 1;
+            case OpType_GetGlobalX:
+            case OpType_SetGlobalX:
+                USE_CONSTS();
+                USE_CACHES();
+                USE_VM();
+                os << " NativeHelper::"
+                   << (Instruction::GetOpCode(i) == OpType_GetGlobalX ? "GetGlobal" : "SetGlobal")
+                   << "(vm, " << REG(a) << ", " << CONST(code[index + 1].opcode_)
+                   << ", caches + " << index << ");";
+                return 2;
+            case OpType_JmpFalse:
+                os << " if (base[" << a << "].IsFalse())" << JUMP(target);
+                return 1;
+            case OpType_JmpTrue:
+                os << " if (!base[" << a << "].IsFalse())" << JUMP(target);
+                return 1;
+            case OpType_JmpNil:
+                os << " if (base[" << a << "].IsNil())" << JUMP(target);
+                return 1;
+            case OpType_Jmp:
+                terminal_ = true;
+                os << JUMP(target);
+                return 1;
+            case OpType_JmpLess:
+                COMPARE_JMP_OP("Less", rb, rc);
+            case OpType_JmpLessRK:
+                USE_CONSTS();
+                COMPARE_JMP_OP("Less", rb, kc);
+            case OpType_JmpLessKR:
+                USE_CONSTS();
+                COMPARE_JMP_OP("Less", kb, rc);
+            case OpType_JmpGreater:
+                COMPARE_JMP_OP("Greater", rb, rc);
+            case OpType_JmpGreaterRK:
+                USE_CONSTS();
+                COMPARE_JMP_OP("Greater", rb, kc);
+            case OpType_JmpGreaterKR:
+                USE_CONSTS();
+                COMPARE_JMP_OP("Greater", kb, rc);
+            case OpType_JmpLessEqual:
+                COMPARE_JMP_OP("LessEqual", rb, rc);
+            case OpType_JmpLessEqualRK:
+                USE_CONSTS();
+                COMPARE_JMP_OP("LessEqual", rb, kc);
+            case OpType_JmpLessEqualKR:
+                USE_CONSTS();
+                COMPARE_JMP_OP("LessEqual", kb, rc);
+            case OpType_JmpGreaterEqual:
+                COMPARE_JMP_OP("GreaterEqual", rb, rc);
+            case OpType_JmpGreaterEqualRK:
+                USE_CONSTS();
+                COMPARE_JMP_OP("GreaterEqual", rb, kc);
+            case OpType_JmpGreaterEqualKR:
+                USE_CONSTS();
+                COMPARE_JMP_OP("GreaterEqual", kb, rc);
+            case OpType_JmpEqual:
+                os << " if ((base[" << b << "] == base[" << c << "]) != "
+                   << (a != 0 ? "true" : "false") << ")" << JUMP(index + 2);
+                return 1;
+            case OpType_JmpEqualRK:
+                USE_CONSTS();
+                os << " if ((base[" << b << "] == k[" << c << "]) != "
+                   << (a != 0 ? "true" : "false") << ")" << JUMP(index + 2);
+                return 1;
+            case OpType_Neg:
+                os << " if (!Neg(" << REG(a) << "))" << EXIT(index);
+                return 1;
+            case OpType_Not:
+                os << " base[" << a << "].SetBool(base[" << a << "].IsFalse());";
+                return 1;
+            case OpType_Len:
+                os << " if (!NativeHelper::Len(" << REG(a) << "))" << EXIT(index);
+                return 1;
+            case OpType_Add: SET_OP("Add", rb, rc);
+            case OpType_Sub: SET_OP("Sub", rb, rc);
+            case OpType_Mul: SET_OP("Mul", rb, rc);
+            case OpType_Div: SET_OP("Div", rb, rc);
+            case OpType_Pow: SET_OP("Pow", rb, rc);
+            case OpType_Mod: SET_OP("Mod", rb, rc);
+            case OpType_AddRK: USE_CONSTS(); SET_OP("Add", rb, kc);
+            case OpType_AddKR: USE_CONSTS(); SET_OP("Add", kb, rc);
+            case OpType_SubRK: USE_CONSTS(); SET_OP("Sub", rb, kc);
+            case OpType_SubKR: USE_CONSTS(); SET_OP("Sub", kb, rc);
+            case OpType_MulRK: USE_CONSTS(); SET_OP("Mul", rb, kc);
+            case OpType_MulKR: USE_CONSTS(); SET_OP("Mul", kb, rc);
+            case OpType_DivRK: USE_CONSTS(); SET_OP("Div", rb, kc);
+            case OpType_DivKR: USE_CONSTS(); SET_OP("Div", kb, rc);
+            case OpType_PowRK: USE_CONSTS(); SET_OP("Pow", rb, kc);
+            case OpType_PowKR: USE_CONSTS(); SET_OP("Pow", kb, rc);
+            case OpType_ModRK: USE_CONSTS(); SET_OP("Mod", rb, kc);
+            case OpType_ModKR: USE_CONSTS(); SET_OP("Mod", kb, rc);
+            case OpType_Concat:
+                USE_VM();
+                os << " if (!NativeHelper::Concat(vm, " << REG(a) << ", " << rb.str()
+                   << ", " << rc.str() << "))" << EXIT(index);
+                return 1;
+            case OpType_Less: SET_COMPARE_OP("Less", rb, rc);
+            case OpType_Greater: SET_COMPARE_OP("Greater", rb, rc);
+            case OpType_LessEqual: SET_COMPARE_OP("LessEqual", rb, rc);
+            case OpType_GreaterEqual: SET_COMPARE_OP("GreaterEqual", rb, rc);
+            case OpType_LessRK: USE_CONSTS(); SET_COMPARE_OP("Less", rb, kc);
+            case OpType_LessKR: USE_CONSTS(); SET_COMPARE_OP("Less", kb, rc);
+            case OpType_GreaterRK: USE_CONSTS(); SET_COMPARE_OP("Greater", rb, kc);
+            case OpType_GreaterKR: USE_CONSTS(); SET_COMPARE_OP("Greater", kb, rc);
+            case OpType_LessEqualRK: USE_CONSTS(); SET_COMPARE_OP("LessEqual", rb, kc);
+            case OpType_LessEqualKR: USE_CONSTS(); SET_COMPARE_OP("LessEqual", kb, rc);
+            case OpType_GreaterEqualRK: USE_CONSTS(); SET_COMPARE_OP("GreaterEqual", rb, kc);
+            case OpType_GreaterEqualKR: USE_CONSTS(); SET_COMPARE_OP("GreaterEqual", kb, rc);
+            case OpType_Equal:
+            case OpType_UnEqual:
+                os << " base[" << a << "].SetBool(base[" << b
+                   << (Instruction::GetOpCode(i) == OpType_Equal ? "] == " : "] != ")
+                   << "base[" << c << "]);";
+                return 1;
+            case OpType_EqualRK:
+            case OpType_UnEqualRK:
+                USE_CONSTS();
+                os << " base[" << a << "].SetBool(base[" << b
+                   << (Instruction::GetOpCode(i) == OpType_EqualRK ? "] == " : "] != ")
+                   << "k[" << c << "]);";
+                return 1;
+            case OpType_NewTable:
+                USE_VM();
+                os << " NativeHelper::NewTable(vm, " << REG(a) << ");";
+                return 1;
+            case OpType_SetTable:
+            case OpType_SetTableRK:
+            case OpType_SetTableKR:
+            case OpType_SetTableKK:
+            {
+                auto op = Instruction::GetOpCode(i);
+                bool const_key = op == OpType_SetTableKR || op == OpType_SetTableKK;
+                bool const_value = op == OpType_SetTableRK || op == OpType_SetTableKK;
+                if (const_key || const_value)
+                    USE_CONSTS();
+                os << " if (!NativeHelper::SetTable(" << REG(a) << ", "
+                   << (const_key ? kb : rb).str() << ", "
+                   << (const_value ? kc : rc).str() << "))" << EXIT(index);
+                return 1;
+            }
+            case OpType_GetTable:
+            case OpType_GetTableKR:
+            {
+                bool const_key = Instruction::GetOpCode(i) == OpType_GetTableKR;
+                if (const_key)
+                    USE_CONSTS();
+                os << " if (!NativeHelper::GetTable(" << REG(a) << ", "
+                   << (const_key ? kb : rb).str() << ", " << rc.str() << "))"
+                   << EXIT(index);
+                return 1;
+            }
+            case OpType_GetField:
+            case OpType_SetField:
+                USE_CONSTS();
+                USE_CACHES();
+                USE_VM();
+                os << " if (!"
+                   << (Instruction::GetOpCode(i) == OpType_GetField ? "GetField" : "SetField")
+                   << "(vm, " << REG(a) << ", " << kb.str() << ", " << rc.str()
+                   << ", caches + " << index << "))" << EXIT(index);
+                return 1;
+            case OpType_Self:
+                USE_CONSTS();
+                USE_CACHES();
+                USE_VM();
+                os << " if (!NativeHelper::Self(vm, " << REG(a) << ", " << kb.str()
+                   << ", caches + " << index << "))" << EXIT(index);
+                return 1;
+            case OpType_ForInit:
+                USE_VM();
+                os << " { int r = NativeHelper::ForInit(vm, " << REG(a) << "); if (r < 0)"
+                   << EXIT(index) << " if (r == 0)" << JUMP(target) << " }";
+                return 1;
+            case OpType_ForLoop:
+                os << " if (ForLoop(" << REG(a) << "))" << JUMP(target);
+                return 1;
+            case OpType_ForLoopInc:
+                os << " if (ForLoopInc(" << REG(a) << "))" << JUMP(target);
+                return 1;
+            case OpType_ForLoopDec:
+                os << " if (ForLoopDec(" << REG(a) << "))" << JUMP(target);
+                return 1;
+            case OpType_ConcatRange:
+                USE_VM();
+                os << " if (!NativeHelper::ConcatRange(vm, " << REG(a) << ", " << REG(b)
+                   << ", " << c << "))" << EXIT(index);
+                return 1;
+            case OpType_Intrinsic:
+                // Skip the call when the intrinsic is calculated
+                USE_VM();
+                os << " if (NativeHelper::Intrinsic(vm, " << REG(a) << ", " << b
+                   << ", " << c << "))" << JUMP(index + 2);
+                return 1;
+            default:
+                // Calls, returns, varargs and closures are executed by
+                // the interpreter
+                terminal_ = true;
+                os << EXIT(index);
+                return 1;
+        }
+
+#undef JUMP
+#undef USE_CONSTS
+#undef USE_CACHES
+#undef USE_UPVALUES
+#undef USE_VM
+#undef SET_OP
+#undef SET_COMPARE_OP
+#undef COMPARE_JMP_OP
+    }
+
+    std::string AotCompiler::Quote(const char *str, std::size_t len)
+    {
+        static const char digits[] = "01234567";
+        std::string quoted = "\"";
+        for (std::size_t i = 0; i < len; ++i)
+        {
+            unsigned char ch = str[i];
+            if (ch == '"' || ch == '\\' || ch == '?')
+            {
+                quoted.push_back('\\');
+                quoted.push_back(ch);
+            }
+            else if (ch >= 0x20 && ch < 0x7F)
+                quoted.push_back(ch);
+            else
+            {
+                // Octal escape has at most 3 digits, so it never
+                // takes the next character
+                quoted.push_back('\\');
+                quoted.push_back(digits[ch >> 6]);
+                quoted.push_back(digits[(ch >> 3) & 7]);
+                quoted.push_back(digits[ch & 7]);
+            }
+        }
+        quoted.push_back('"');
+        return quoted;
+    }
+
+#undef REG
+#undef CONST
+#undef EXIT
+
+    std::string AotCompile(Function *module)
+    {
+        AotCompiler compiler(module);
+        return compiler.Compile();
+    }
+} // namespace luna
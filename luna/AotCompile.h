@@ -0,0 +1,16 @@
+#ifndef AOT_COMPILE_H
+#define AOT_COMPILE_H
+
+#include <string>
+
+namespace luna
+{
+    class Function;
+
+    // Compile function of module and all functions in it into a C++
+    // translation unit, which is built into a native module and loaded
+    // by ModuleManager in place of the module source
+    std::string AotCompile(Function *module);
+} // namespace luna
+
+#endif // AOT_COMPILE_H
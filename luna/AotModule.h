@@ -0,0 +1,259 @@
+#ifndef AOT_MODULE_H
+#define AOT_MODULE_H
+
+#include "Value.h"
+#include "OpCode.h"
+#include "Function.h"
+#include "Table.h"
+#include "Upvalue.h"
+#include "NativeCode.h"
+#include "Arith.h"
+#include <stddef.h>
+
+#if defined(_WIN32)
+#define LUNA_AOT_EXPORT __declspec(dllexport)
+#else
+#define LUNA_AOT_EXPORT __attribute__((visibility("default")))
+#endif
+
+// Name of the module symbol exported by native module
+#define LUNA_AOT_MODULE_SYMBOL "luna_aot_module"
+
+namespace luna {
+namespace aot {
+
+    // Version of the layout of module, and native code of the module
+    // depends on it, a native module is loaded only when its version
+    // and size of Value are same with the loader
+    const int kVersion = 5;
+
+    // Const value of function, 'bits_' is bits of float
+    struct Const
+    {
+        ValueT type_;
+        long long integer_;
+        unsigned long long bits_;
+        const char *str_;
+        size_t len_;
+    };
+
+    struct LocalVar
+    {
+        const char *name_;
+        int register_id_;
+        int begin_pc_;
+        int end_pc_;
+    };
+
+    struct UpvalueInfo
+    {
+        const char *name_;
+        bool parent_local_;
+        int register_index_;
+    };
+
+    // Function prototype compiled ahead of time, arrays are nullptr
+    // when counts are 0, children are indexes of prototypes of module
+    struct Prototype
+    {
+        NativeCode::EntryType entry_;
+        const unsigned int *code_;
+        const int *lines_;
+        int code_size_;
+        const Const *consts_;
+        int const_count_;
+        const LocalVar *local_vars_;
+        int local_var_count_;
+        const UpvalueInfo *upvalues_;
+        int upvalue_count_;
+        const int *children_;
+        int child_count_;
+        int line_;
+        int args_;
+        int register_count_;
+        bool vararg_;
+    };
+
+    // Module compiled ahead of time, the first prototype is the
+    // function of module
+    struct Module
+    {
+        int version_;
+        size_t value_size_;
+        const char *name_;
+        const Prototype *prototypes_;
+        int prototype_count_;
+    };
+
+    // Templates of instructions used by code compiled ahead of time,
+    // templates which return bool or int return false or -1 when the
+    // instruction reports an error, then native code exits to the
+    // interpreter to report the error
+
+#define AOT_ARITH(name, kind, int_calc, num_calc)                       \
+    inline bool name(Value *a, const Value *b, const Value *c)          \
+    {                                                                   \
+        if (b->type_ == ValueT_Integer && c->type_ == ValueT_Integer)   \
+        {                                                               \
+            long long integer = int_calc(b->integer_, c->integer_);     \
+            if (!IntegerFitsValue(integer))                             \
+                return false;                                           \
+            a->SetInteger(integer);                                     \
+        }                                                               \
+        else if (b->type_ == ValueT_Number && c->type_ == ValueT_Number)\
+            a->SetNumber(b->num_ num_calc c->num_);                     \
+        else                                                            \
+            return NativeHelper::Arith(kind, a, b, c) != 0;             \
+        return true;                                                    \
+    }
+
+    AOT_ARITH(Add, Arith_Add, IntegerAdd, +)
+    AOT_ARITH(Sub, Arith_Sub, IntegerSub, -)
+    AOT_ARITH(Mul, Arith_Mul, IntegerMul, *)
+#undef AOT_ARITH
+
+    inline bool Div(Value *a, const Value *b, const Value *c)
+    {
+        if (b->type_ == ValueT_Number && c->type_ == ValueT_Number)
+            a->SetNumber(b->num_ / c->num_);
+        else
+            return NativeHelper::Arith(Arith_Div, a, b, c) != 0;
+        return true;
+    }
+
+    inline bool Pow(Value *a, const Value *b, const Value *c)
+    {
+        return NativeHelper::Arith(Arith_Pow, a, b, c) != 0;
+    }
+
+    inline bool Mod(Value *a, const Value *b, const Value *c)
+    {
+        if (b->type_ == ValueT_Integer && c->type_ == ValueT_Integer &&
+            c->integer_ != 0)
+            a->SetInteger(IntegerMod(b->integer_, c->integer_));
+        else
+            return NativeHelper::Arith(Arith_Mod, a, b, c) != 0;
+        return true;
+    }
+
+    inline bool Neg(Value *a)
+    {
+        if (a->type_ == ValueT_Integer)
+        {
+            long long integer = IntegerSub(0, a->integer_);
+            if (!IntegerFitsValue(integer))
+                return false;
+            a->integer_ = integer;
+        }
+        else if (a->type_ == ValueT_Number)
+            a->num_ = -a->num_;
+        else
+            return false;
+        return true;
+    }
+
+#define AOT_COMPARE(name, kind, cmp)                                    \
+    inline int name(const Value *b, const Value *c)                     \
+    {                                                                   \
+        if (b->type_ == ValueT_Integer && c->type_ == ValueT_Integer)   \
+            return b->integer_ cmp c->integer_;                         \
+        if (b->type_ == ValueT_Number && c->type_ == ValueT_Number)     \
+            return b->num_ cmp c->num_;                                 \
+        return NativeHelper::Compare(kind, b, c);                       \
+    }
+
+    AOT_COMPARE(Less, Compare_Less, <)
+    AOT_COMPARE(LessEqual, Compare_LessEqual, <=)
+    AOT_COMPARE(Greater, Compare_Greater, >)
+    AOT_COMPARE(GreaterEqual, Compare_GreaterEqual, >=)
+#undef AOT_COMPARE
+
+    inline void FillNil(VM *vm, Value *a, Value *b)
+    {
+        NativeHelper::CloseUpvalue(vm, a);
+        while (a < b)
+            (a++)->SetNil();
+    }
+
+    inline bool GetField(VM *vm, Value *t, const Value *key, Value *v, TableCache *cache)
+    {
+        if (t->type_ == ValueT_Table && cache->version_ == t->table_->GetVersion())
+        {
+            *v = *cache->value_;
+            return true;
+        }
+        return NativeHelper::GetField(vm, t, key, v, cache) != 0;
+    }
+
+    inline bool SetField(VM *vm, Value *t, const Value *key, const Value *v, TableCache *cache)
+    {
+        // Assign nil erases the key, so it is not cached
+        if (t->type_ == ValueT_Table && cache->version_ == t->table_->GetVersion() &&
+            v->type_ != ValueT_Nil)
+        {
+            *cache->value_ = *v;
+            return true;
+        }
+        return NativeHelper::SetField(vm, t, key, v, cache) != 0;
+    }
+
+    // Numeric 'for' loop steps var, return true when loop body runs
+    inline bool ForLoop(Value *a)
+    {
+        if (a->type_ == ValueT_Integer)
+        {
+            if (!((a + 2)->integer_ > 0 ?
+                  IntegerForLoopInc(a->integer_, (a + 1)->integer_, (a + 2)->integer_) :
+                  IntegerForLoopDec(a->integer_, (a + 1)->integer_, (a + 2)->integer_)))
+                return false;
+            a->integer_ += (a + 2)->integer_;
+            (a + 3)->SetInteger(a->integer_);
+            return true;
+        }
+
+        a->num_ += (a + 2)->num_;
+        if ((a + 2)->num_ > 0.0 ? a->num_ > (a + 1)->num_ : a->num_ < (a + 1)->num_)
+            return false;
+        (a + 3)->SetNumber(a->num_);
+        return true;
+    }
+
+    inline bool ForLoopInc(Value *a)
+    {
+        if (a->type_ == ValueT_Integer)
+        {
+            if (!IntegerForLoopInc(a->integer_, (a + 1)->integer_, (a + 2)->integer_))
+                return false;
+            a->integer_ += (a + 2)->integer_;
+            (a + 3)->SetInteger(a->integer_);
+            return true;
+        }
+
+        a->num_ += (a + 2)->num_;
+        if (a->num_ > (a + 1)->num_)
+            return false;
+        (a + 3)->SetNumber(a->num_);
+        return true;
+    }
+
+    inline bool ForLoopDec(Value *a)
+    {
+        if (a->type_ == ValueT_Integer)
+        {
+            if (!IntegerForLoopDec(a->integer_, (a + 1)->integer_, (a + 2)->integer_))
+                return false;
+            a->integer_ += (a + 2)->integer_;
+            (a + 3)->SetInteger(a->integer_);
+            return true;
+        }
+
+        a->num_ += (a + 2)->num_;
+        if (a->num_ < (a + 1)->num_)
+            return false;
+        (a + 3)->SetNumber(a->num_);
+        return true;
+    }
+} // namespace aot
+} // namespace luna
+
+#endif // AOT_MODULE_H
@@ -0,0 +1,43 @@
+#ifndef ARITH_H
+#define ARITH_H
+
+namespace luna
+{
+    // Integer arithmetic wraps around on overflow
+    inline long long IntegerAdd(long long x, long long y)
+    {
+        return static_cast<long long>(static_cast<unsigned long long>(x) + y);
+    }
+
+    inline long long IntegerSub(long long x, long long y)
+    {
+        return static_cast<long long>(static_cast<unsigned long long>(x) - y);
+    }
+
+    inline long long IntegerMul(long long x, long long y)
+    {
+        return static_cast<long long>(static_cast<unsigned long long>(x) * y);
+    }
+
+    // Same sign with the dividend like fmod, 'y' is not 0
+    inline long long IntegerMod(long long x, long long y)
+    {
+        return y == -1 ? 0 : x % y;
+    }
+
+    // Integer 'for' loop steps when 'var' + 'step' does not pass
+    // 'limit', compare the distance to avoid overflow of 'var' + 'step'
+    inline bool IntegerForLoopInc(long long var, long long limit, long long step)
+    {
+        return static_cast<unsigned long long>(limit) - var >=
+               static_cast<unsigned long long>(step);
+    }
+
+    inline bool IntegerForLoopDec(long long var, long long limit, long long step)
+    {
+        return static_cast<unsigned long long>(var) - limit >=
+               0 - static_cast<unsigned long long>(step);
+    }
+} // namespace luna
+
+#endif // ARITH_H
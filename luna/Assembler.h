@@ -0,0 +1,392 @@
+#ifndef ASSEMBLER_H
+#define ASSEMBLER_H
+
+#include <vector>
+#include <utility>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+// Machine code is x86-64 only, JIT never compiles any code on other
+// platforms or with NaN-boxed Value
+#if defined(__x86_64__) && defined(__linux__) && !defined(LUNA_NAN_BOXING)
+#define LUNA_JIT_SUPPORTED
+#include <sys/mman.h>
+#endif
+
+namespace luna
+{
+    // Machine code copied into executable memory
+    class ExecutableCode
+    {
+    public:
+        ExecutableCode() : code_(nullptr), size_(0) { }
+
+        ~ExecutableCode()
+        {
+#ifdef LUNA_JIT_SUPPORTED
+            if (code_)
+                munmap(code_, size_);
+#endif
+        }
+
+        ExecutableCode(const ExecutableCode&) = delete;
+        void operator = (const ExecutableCode&) = delete;
+
+        // Copy code into new executable memory, return false when
+        // the memory is not available
+        bool Load(const std::vector<unsigned char> &code)
+        {
+#ifdef LUNA_JIT_SUPPORTED
+            auto size = code.size();
+            auto mem = mmap(nullptr, size, PROT_READ | PROT_WRITE,
+                            MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if (mem == MAP_FAILED)
+                return false;
+
+            code_ = mem;
+            size_ = size;
+            memcpy(mem, &code[0], size);
+            return mprotect(mem, size, PROT_READ | PROT_EXEC) == 0;
+#else
+            (void)code;
+            return false;
+#endif
+        }
+
+        void * GetEntry() const
+        { return code_; }
+
+    private:
+        void *code_;
+        std::size_t size_;
+    };
+} // namespace luna
+
+#ifdef LUNA_JIT_SUPPORTED
+namespace luna {
+namespace x64 {
+
+    // x86-64 general registers
+    enum Reg
+    {
+        RAX, RCX, RDX, RBX, RSP, RBP, RSI, RDI,
+        R8, R9, R10, R11, R12, R13, R14, R15,
+    };
+
+    // SSE registers
+    enum Xmm { XMM0, XMM1, XMM2, XMM3 };
+
+    // Condition codes of jcc and setcc
+    enum Cond
+    {
+        CC_B = 0x2, CC_AE = 0x3, CC_E = 0x4, CC_NE = 0x5,
+        CC_A = 0x7, CC_P = 0xA, CC_NP = 0xB,
+        CC_L = 0xC, CC_GE = 0xD, CC_LE = 0xE, CC_G = 0xF,
+    };
+
+    inline Cond NegateCond(Cond cc)
+    {
+        return static_cast<Cond>(cc ^ 1);
+    }
+
+    // Condition of flags after comparison, float equality needs the
+    // parity flag for unordered operands
+    struct Condition
+    {
+        enum Parity { None, AndNotParity, OrParity };
+
+        Cond cc_;
+        Parity parity_;
+
+        Condition(Cond cc, Parity parity = None) : cc_(cc), parity_(parity) { }
+
+        Condition Negate() const
+        {
+            if (parity_ == AndNotParity)
+                return Condition(NegateCond(cc_), OrParity);
+            if (parity_ == OrParity)
+                return Condition(NegateCond(cc_), AndNotParity);
+            return Condition(NegateCond(cc_));
+        }
+    };
+
+
+    // Emit x86-64 machine code, memory operands are always
+    // [base + disp32]
+    class Assembler
+    {
+    public:
+        const std::vector<unsigned char> & GetCode() const
+        { return code_; }
+
+        int NewLabel()
+        {
+            labels_.push_back(-1);
+            return labels_.size() - 1;
+        }
+
+        void Bind(int label)
+        { labels_[label] = code_.size(); }
+
+        // Patch all jumps and label offsets after all labels are bound
+        void ResolveLabels()
+        {
+            for (const auto &fixup : fixups_)
+            {
+                int rel = labels_[fixup.second] - (fixup.first + 4);
+                memcpy(&code_[fixup.first], &rel, sizeof(rel));
+            }
+
+            for (const auto &offset : offsets_)
+            {
+                int rel = labels_[offset.label_] - labels_[offset.from_];
+                memcpy(&code_[offset.pos_], &rel, sizeof(rel));
+            }
+        }
+
+        // Emit 32 bits offset of 'label' from label 'from'
+        void EmitLabelOffset(int label, int from)
+        {
+            LabelOffset offset = { static_cast<int>(code_.size()), label, from };
+            offsets_.push_back(offset);
+            Emit32(0);
+        }
+
+        // Pad code by int3 to multiple of 'alignment'
+        void Align(std::size_t alignment)
+        {
+            while (code_.size() % alignment)
+                Emit(0xCC);
+        }
+
+        void Jmp(int label)
+        { Emit(0xE9); Fixup(label); }
+
+        void Jcc(Cond cc, int label)
+        { Emit(0x0F); Emit(0x80 | cc); Fixup(label); }
+
+        // Jump when condition is true
+        void JumpIf(const Condition &cond, int label)
+        {
+            if (cond.parity_ == Condition::AndNotParity)
+            {
+                int skip = NewLabel();
+                Jcc(CC_P, skip);
+                Jcc(cond.cc_, label);
+                Bind(skip);
+            }
+            else
+            {
+                Jcc(cond.cc_, label);
+                if (cond.parity_ == Condition::OrParity)
+                    Jcc(CC_P, label);
+            }
+        }
+
+        void JmpReg(Reg r)
+        { Rex(0, r); Emit(0xFF); ModRMReg(4, r); }
+
+        // lea dst, [rip + label]
+        void LeaRegLabel(Reg dst, int label)
+        { RexW(dst, 0); Emit(0x8D); Emit(0x05 | ((dst & 7) << 3)); Fixup(label); }
+
+        // movsxd dst, dword [base + index * 4], base is not rbp or r13
+        void MovsxdRegIndex4(Reg dst, Reg base, Reg index)
+        {
+            Emit(0x48 | ((dst >> 3) << 2) | ((index >> 3) << 1) | (base >> 3));
+            Emit(0x63);
+            Emit(0x04 | ((dst & 7) << 3));
+            Emit(0x80 | ((index & 7) << 3) | (base & 7));
+        }
+
+        void MovRegMem(Reg dst, Reg base, int disp)
+        { RexW(dst, base); Emit(0x8B); ModRMMem(dst, base, disp); }
+
+        void MovMemReg(Reg base, int disp, Reg src)
+        { RexW(src, base); Emit(0x89); ModRMMem(src, base, disp); }
+
+        // mov r32, dword [base + disp]
+        void MovReg32Mem(Reg dst, Reg base, int disp)
+        { Rex(dst, base); Emit(0x8B); ModRMMem(dst, base, disp); }
+
+        // mov dword [base + disp], r32
+        void MovMem32Reg(Reg base, int disp, Reg src)
+        { Rex(src, base); Emit(0x89); ModRMMem(src, base, disp); }
+
+        void MovRegReg(Reg dst, Reg src)
+        { RexW(src, dst); Emit(0x89); ModRMReg(src, dst); }
+
+        void MovRegImm(Reg dst, uint64_t imm)
+        { RexW(0, dst); Emit(0xB8 | (dst & 7)); Emit64(imm); }
+
+        void MovEaxImm(int imm)
+        { Emit(0xB8); Emit32(imm); }
+
+        void LeaRegMem(Reg dst, Reg base, int disp)
+        { RexW(dst, base); Emit(0x8D); ModRMMem(dst, base, disp); }
+
+        // mov dword [base + disp], imm
+        void MovMem32Imm(Reg base, int disp, int imm)
+        { Rex(0, base); Emit(0xC7); ModRMMem(0, base, disp); Emit32(imm); }
+
+        // cmp dword [base + disp], imm
+        void CmpMem32Imm(Reg base, int disp, int imm)
+        { Rex(0, base); Emit(0x81); ModRMMem(7, base, disp); Emit32(imm); }
+
+        // cmp byte [base + disp], imm
+        void CmpMem8Imm(Reg base, int disp, int imm)
+        { Rex(0, base); Emit(0x80); ModRMMem(7, base, disp); Emit(imm); }
+
+        void AddRegReg(Reg dst, Reg src) { AluRegReg(0x01, dst, src); }
+        void SubRegReg(Reg dst, Reg src) { AluRegReg(0x29, dst, src); }
+        void CmpRegReg(Reg dst, Reg src) { AluRegReg(0x39, dst, src); }
+        void TestRegReg(Reg dst, Reg src) { AluRegReg(0x85, dst, src); }
+        void XorRegReg(Reg dst, Reg src) { AluRegReg(0x31, dst, src); }
+
+        void ImulRegReg(Reg dst, Reg src)
+        { RexW(dst, src); Emit(0x0F); Emit(0xAF); ModRMReg(dst, src); }
+
+        void CmpRegImm8(Reg r, int imm)
+        { RexW(0, r); Emit(0x83); ModRMReg(7, r); Emit(imm); }
+
+        void CmpReg32Imm8(Reg r, int imm)
+        { Rex(0, r); Emit(0x83); ModRMReg(7, r); Emit(imm); }
+
+        void TestReg32Reg32(Reg dst, Reg src)
+        { Rex(src, dst); Emit(0x85); ModRMReg(src, dst); }
+
+        void AddRspImm8(int imm)
+        { RexW(0, RSP); Emit(0x83); ModRMReg(0, RSP); Emit(imm); }
+
+        void SubRspImm8(int imm)
+        { RexW(0, RSP); Emit(0x83); ModRMReg(5, RSP); Emit(imm); }
+
+        void NegReg(Reg r)
+        { RexW(0, r); Emit(0xF7); ModRMReg(3, r); }
+
+        // rdx:rax / r, remainder in rdx
+        void CqoIdivReg(Reg r)
+        { Emit(0x48); Emit(0x99); RexW(0, r); Emit(0xF7); ModRMReg(7, r); }
+
+        void BtcRegImm8(Reg r, int bit)
+        { RexW(0, r); Emit(0x0F); Emit(0xBA); ModRMReg(7, r); Emit(bit); }
+
+        // Byte registers al, cl, dl and bl only
+        void Setcc(Cond cc, Reg r)
+        { Emit(0x0F); Emit(0x90 | cc); ModRMReg(0, r); }
+
+        void AndReg8Reg8(Reg dst, Reg src)
+        { Emit(0x20); ModRMReg(src, dst); }
+
+        void OrReg8Reg8(Reg dst, Reg src)
+        { Emit(0x08); ModRMReg(src, dst); }
+
+        // movzx r32, r8, zero extends to 64 bits
+        void MovzxRegReg8(Reg dst, Reg src)
+        { Emit(0x0F); Emit(0xB6); ModRMReg(dst, src); }
+
+        void CallReg(Reg r)
+        { Rex(0, r); Emit(0xFF); ModRMReg(2, r); }
+
+        void Push(Reg r)
+        { Rex(0, r); Emit(0x50 | (r & 7)); }
+
+        void Pop(Reg r)
+        { Rex(0, r); Emit(0x58 | (r & 7)); }
+
+        void Ret()
+        { Emit(0xC3); }
+
+        void Ud2()
+        { Emit(0x0F); Emit(0x0B); }
+
+        void MovsdXmmMem(Xmm dst, Reg base, int disp)
+        { Emit(0xF2); Rex(dst, base); Emit(0x0F); Emit(0x10); ModRMMem(dst, base, disp); }
+
+        void MovsdMemXmm(Reg base, int disp, Xmm src)
+        { Emit(0xF2); Rex(src, base); Emit(0x0F); Emit(0x11); ModRMMem(src, base, disp); }
+
+        void AddsdXmmXmm(Xmm dst, Xmm src) { SseRegReg(0xF2, 0x58, dst, src); }
+        void SubsdXmmXmm(Xmm dst, Xmm src) { SseRegReg(0xF2, 0x5C, dst, src); }
+        void MulsdXmmXmm(Xmm dst, Xmm src) { SseRegReg(0xF2, 0x59, dst, src); }
+        void DivsdXmmXmm(Xmm dst, Xmm src) { SseRegReg(0xF2, 0x5E, dst, src); }
+        void UcomisdXmmXmm(Xmm x, Xmm y) { SseRegReg(0x66, 0x2E, x, y); }
+        void XorpdXmmXmm(Xmm dst, Xmm src) { SseRegReg(0x66, 0x57, dst, src); }
+
+        void Cvtsi2sdXmmReg(Xmm dst, Reg src)
+        { Emit(0xF2); RexW(dst, src); Emit(0x0F); Emit(0x2A); ModRMReg(dst, src); }
+
+        void MovqXmmReg(Xmm dst, Reg src)
+        { Emit(0x66); RexW(dst, src); Emit(0x0F); Emit(0x6E); ModRMReg(dst, src); }
+
+    private:
+        void Emit(int byte)
+        { code_.push_back(static_cast<unsigned char>(byte)); }
+
+        void Emit32(int value)
+        {
+            for (int i = 0; i < 4; ++i)
+                Emit((value >> (i * 8)) & 0xFF);
+        }
+
+        void Emit64(uint64_t value)
+        {
+            for (int i = 0; i < 8; ++i)
+                Emit((value >> (i * 8)) & 0xFF);
+        }
+
+        void Fixup(int label)
+        {
+            fixups_.push_back(std::make_pair(static_cast<int>(code_.size()), label));
+            Emit32(0);
+        }
+
+        void Rex(int reg, int rm)
+        {
+            int rex = 0x40 | ((reg >> 3) << 2) | (rm >> 3);
+            if (rex != 0x40)
+                Emit(rex);
+        }
+
+        void RexW(int reg, int rm)
+        { Emit(0x48 | ((reg >> 3) << 2) | (rm >> 3)); }
+
+        void ModRMMem(int reg, int base, int disp)
+        {
+            Emit(0x80 | ((reg & 7) << 3) | (base & 7));
+            if ((base & 7) == RSP)
+                Emit(0x24);
+            Emit32(disp);
+        }
+
+        void ModRMReg(int reg, int rm)
+        { Emit(0xC0 | ((reg & 7) << 3) | (rm & 7)); }
+
+        void AluRegReg(int op, Reg dst, Reg src)
+        { RexW(src, dst); Emit(op); ModRMReg(src, dst); }
+
+        void SseRegReg(int prefix, int op, Xmm dst, Xmm src)
+        { Emit(prefix); Emit(0x0F); Emit(op); ModRMReg(dst, src); }
+
+        struct LabelOffset
+        {
+            int pos_;
+            int label_;
+            int from_;
+        };
+
+        std::vector<unsigned char> code_;
+        // Code offset of labels, -1 when label is not bound
+        std::vector<int> labels_;
+        // Code offset of rel32 and the target label
+        std::vector<std::pair<int, int>> fixups_;
+        // Code offset of label offsets
+        std::vector<LabelOffset> offsets_;
+    };
+
+} // namespace x64
+} // namespace luna
+#endif // LUNA_JIT_SUPPORTED
+
+#endif // ASSEMBLER_H
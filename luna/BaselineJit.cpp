@@ -0,0 +1,900 @@
+#include "BaselineJit.h"
+#include "State.h"
+#include "VM.h"
+#include "Table.h"
+#include "Function.h"
+#include <limits>
+#include <vector>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+namespace luna
+{
+#ifdef LUNA_JIT_SUPPORTED
+    using namespace x64;
+
+    static_assert(sizeof(Value) == 16 && offsetof(Value, type_) == 8,
+                  "templates assume 8 bytes payload and then type of Value");
+
+    // Compile instructions of a function by templates, rbx keeps base
+    // of registers, r12 keeps the closure and r13 keeps the VM
+    class BaselineJit::Compiler
+    {
+    public:
+        Compiler(State *state, Function *proto)
+            : state_(state), code_(proto->GetOpCodes()),
+              size_(proto->OpCodeSize()), consts_(proto->GetConstValues()),
+              caches_(proto->GetTableCaches())
+        {
+            // One more label for the end of code
+            for (int i = 0; i <= size_; ++i)
+                labels_.push_back(asm_.NewLabel());
+            exit_labels_.assign(size_, -1);
+            epilogue_ = asm_.NewLabel();
+            table_ = asm_.NewLabel();
+        }
+
+        // Compile all instructions, return nullptr when failed
+        std::unique_ptr<NativeCode> Compile();
+
+    private:
+        // Operand B or C of instruction, register or const
+        struct Operand
+        {
+            int reg_;
+            const Value *k_;
+
+            Operand(int reg) : reg_(reg), k_(nullptr) { }
+            Operand(const Value *k) : reg_(-1), k_(k) { }
+        };
+
+        static int Payload(int reg)
+        { return reg * sizeof(Value); }
+
+        static int TypeOf(int reg)
+        { return reg * sizeof(Value) + offsetof(Value, type_); }
+
+        // Operand may be 'type' at runtime
+        static bool MayBe(const Operand &o, ValueT type)
+        { return o.reg_ >= 0 || o.k_->type_ == type; }
+
+        // Compile instruction at index, return count of instruction
+        // words used by the instruction
+        int CompileInstruction(int index);
+
+        int CompileArith(int index, ArithKind kind, const Operand &b, const Operand &c);
+        int CompileCompare(int index, CompareKind kind, const Operand &b, const Operand &c);
+        int CompileCompareJmp(int index, CompareKind kind, const Operand &b, const Operand &c);
+        int CompileForLoop(int index);
+        int CompileGetTable(int index, const Operand &k);
+        int CompileSetTable(int index, const Operand &k, const Operand &v);
+
+        // Get label of exit which resumes interpreter at index
+        int ExitLabel(int index);
+        // Label of instruction which jumps by diff of instruction at index
+        int JumpLabel(int index, int from)
+        { return labels_[from + Instruction::GetJumpDiff(code_[index])]; }
+
+        void JumpIfNotType(const Operand &o, ValueT type, int label);
+        void StoreType(int reg, ValueT type);
+        void StoreInteger(int reg, Reg r);
+        void StoreFloat(int reg, Xmm x);
+        void LoadInteger(Reg r, const Operand &o);
+        void LoadFloat(Xmm x, const Operand &o);
+        void LoadAddress(Reg r, const Operand &o);
+        void CallHelper(const void *helper);
+        // Call helper which returns 0 on error, exit at index on error
+        void CallCheckedHelper(const void *helper, int index);
+
+        // Emit comparison of numbers in rax and rcx, or in xmm0 and
+        // xmm1, return condition of result true
+        Condition EmitCompare(CompareKind kind, bool integer);
+
+        State *state_;
+        const Instruction *code_;
+        int size_;
+        Value *consts_;
+        TableCache *caches_;
+        Assembler asm_;
+
+        // Label of each instruction and exit label of each instruction
+        std::vector<int> labels_;
+        std::vector<int> exit_labels_;
+        int epilogue_;
+        // Table of instruction entries
+        int table_;
+    };
+
+#define REG_B(i)        Operand(Instruction::GetParamB(i))
+#define REG_C(i)        Operand(Instruction::GetParamC(i))
+#define CONST_B(i)      Operand(consts_ + Instruction::GetParamB(i))
+#define CONST_C(i)      Operand(consts_ + Instruction::GetParamC(i))
+#define HELPER(f)       reinterpret_cast<const void *>(NativeHelper::f)
+
+    std::unique_ptr<NativeCode> BaselineJit::Compiler::Compile()
+    {
+        // Prologue, keep base, closure and VM, then stack is aligned,
+        // and jump to the entry of instruction index by entry table
+        asm_.Push(RBX);
+        asm_.Push(R12);
+        asm_.Push(R13);
+        asm_.MovRegReg(RBX, RDI);
+        asm_.MovRegReg(R12, RSI);
+        asm_.MovRegReg(R13, RDX);
+        asm_.LeaRegLabel(RAX, table_);
+        asm_.MovsxdRegIndex4(RDX, RAX, RCX);
+        asm_.AddRegReg(RDX, RAX);
+        asm_.JmpReg(RDX);
+
+        for (int index = 0; index < size_; )
+        {
+            asm_.Bind(labels_[index]);
+            int count = CompileInstruction(index);
+            // Words after the instruction are never entered
+            for (int i = 1; i < count; ++i)
+                asm_.Bind(labels_[index + i]);
+            index += count;
+        }
+
+        // The last instruction is always Ret, code never goes here
+        asm_.Bind(labels_[size_]);
+        asm_.Ud2();
+
+        // Exits return index of the instruction
+        for (int index = 0; index < size_; ++index)
+        {
+            if (exit_labels_[index] >= 0)
+            {
+                asm_.Bind(exit_labels_[index]);
+                asm_.MovEaxImm(index);
+                asm_.Jmp(epilogue_);
+            }
+        }
+
+        asm_.Bind(epilogue_);
+        asm_.Pop(R13);
+        asm_.Pop(R12);
+        asm_.Pop(RBX);
+        asm_.Ret();
+
+        asm_.Align(4);
+        asm_.Bind(table_);
+        for (int index = 0; index < size_; ++index)
+            asm_.EmitLabelOffset(labels_[index], table_);
+        asm_.ResolveLabels();
+
+        std::unique_ptr<NativeCode> native(new NativeCode);
+        if (!native->Load(asm_.GetCode()))
+            return std::unique_ptr<NativeCode>();
+        return native;
+    }
+
+    int BaselineJit::Compiler::ExitLabel(int index)
+    {
+        if (exit_labels_[index] < 0)
+            exit_labels_[index] = asm_.NewLabel();
+        return exit_labels_[index];
+    }
+
+    void BaselineJit::Compiler::JumpIfNotType(const Operand &o, ValueT type, int label)
+    {
+        if (o.reg_ >= 0)
+        {
+            asm_.CmpMem32Imm(RBX, TypeOf(o.reg_), type);
+            asm_.Jcc(CC_NE, label);
+        }
+        else if (o.k_->type_ != type)
+        {
+            asm_.Jmp(label);
+        }
+    }
+
+    void BaselineJit::Compiler::StoreType(int reg, ValueT type)
+    {
+        asm_.MovMem32Imm(RBX, TypeOf(reg), type);
+    }
+
+    void BaselineJit::Compiler::StoreInteger(int reg, Reg r)
+    {
+        asm_.MovMemReg(RBX, Payload(reg), r);
+        StoreType(reg, ValueT_Integer);
+    }
+
+    void BaselineJit::Compiler::StoreFloat(int reg, Xmm x)
+    {
+        asm_.MovsdMemXmm(RBX, Payload(reg), x);
+        StoreType(reg, ValueT_Number);
+    }
+
+    void BaselineJit::Compiler::LoadInteger(Reg r, const Operand &o)
+    {
+        if (o.reg_ >= 0)
+            asm_.MovRegMem(r, RBX, Payload(o.reg_));
+        else
+            asm_.MovRegImm(r, o.k_->integer_);
+    }
+
+    void BaselineJit::Compiler::LoadFloat(Xmm x, const Operand &o)
+    {
+        if (o.reg_ >= 0)
+        {
+            asm_.MovsdXmmMem(x, RBX, Payload(o.reg_));
+        }
+        else
+        {
+            uint64_t bits;
+            memcpy(&bits, &o.k_->num_, sizeof(bits));
+            asm_.MovRegImm(RAX, bits);
+            asm_.MovqXmmReg(x, RAX);
+        }
+    }
+
+    void BaselineJit::Compiler::LoadAddress(Reg r, const Operand &o)
+    {
+        if (o.reg_ >= 0)
+            asm_.LeaRegMem(r, RBX, Payload(o.reg_));
+        else
+            asm_.MovRegImm(r, reinterpret_cast<uint64_t>(o.k_));
+    }
+
+    void BaselineJit::Compiler::CallHelper(const void *helper)
+    {
+        asm_.MovRegImm(RAX, reinterpret_cast<uint64_t>(helper));
+        asm_.CallReg(RAX);
+    }
+
+    void BaselineJit::Compiler::CallCheckedHelper(const void *helper, int index)
+    {
+        CallHelper(helper);
+        asm_.TestReg32Reg32(RAX, RAX);
+        asm_.Jcc(CC_E, ExitLabel(index));
+    }
+
+    Condition BaselineJit::Compiler::EmitCompare(CompareKind kind, bool integer)
+    {
+        if (integer)
+        {
+            asm_.CmpRegReg(RAX, RCX);
+            switch (kind) {
+                case Compare_Less: return Condition(CC_L);
+                case Compare_LessEqual: return Condition(CC_LE);
+                case Compare_Greater: return Condition(CC_G);
+                case Compare_GreaterEqual: return Condition(CC_GE);
+                case Compare_Equal: return Condition(CC_E);
+                default: return Condition(CC_NE);
+            }
+        }
+
+        // Unordered comparison is false, except unequal
+        switch (kind) {
+            case Compare_Less:
+                asm_.UcomisdXmmXmm(XMM1, XMM0);
+                return Condition(CC_A);
+            case Compare_LessEqual:
+                asm_.UcomisdXmmXmm(XMM1, XMM0);
+                return Condition(CC_AE);
+            case Compare_Greater:
+                asm_.UcomisdXmmXmm(XMM0, XMM1);
+                return Condition(CC_A);
+            case Compare_GreaterEqual:
+                asm_.UcomisdXmmXmm(XMM0, XMM1);
+                return Condition(CC_AE);
+            case Compare_Equal:
+                asm_.UcomisdXmmXmm(XMM0, XMM1);
+                return Condition(CC_E, Condition::AndNotParity);
+            default:
+                asm_.UcomisdXmmXmm(XMM0, XMM1);
+                return Condition(CC_NE, Condition::OrParity);
+        }
+    }
+
+    int BaselineJit::Compiler::CompileArith(int index, ArithKind kind,
+                                            const Operand &b, const Operand &c)
+    {
+        int a = Instruction::GetParamA(code_[index]);
+        int next = labels_[index + 1];
+        int slow = asm_.NewLabel();
+
+        // Integers
+        if (kind != Arith_Div && kind != Arith_Pow &&
+            MayBe(b, ValueT_Integer) && MayBe(c, ValueT_Integer))
+        {
+            int not_integer = asm_.NewLabel();
+            JumpIfNotType(b, ValueT_Integer, not_integer);
+            JumpIfNotType(c, ValueT_Integer, not_integer);
+            LoadInteger(RAX, b);
+            LoadInteger(RCX, c);
+            if (kind == Arith_Add)
+                asm_.AddRegReg(RAX, RCX);
+            else if (kind == Arith_Sub)
+                asm_.SubRegReg(RAX, RCX);
+            else if (kind == Arith_Mul)
+                asm_.ImulRegReg(RAX, RCX);
+            else
+            {
+                // Interpreter reports modulo by zero
+                int div = asm_.NewLabel();
+                int done = asm_.NewLabel();
+                if (c.reg_ >= 0 || c.k_->integer_ == 0)
+                {
+                    asm_.TestRegReg(RCX, RCX);
+                    asm_.Jcc(CC_E, ExitLabel(index));
+                }
+                if (c.reg_ >= 0 || c.k_->integer_ == -1)
+                {
+                    asm_.CmpRegImm8(RCX, -1);
+                    asm_.Jcc(CC_NE, div);
+                    asm_.XorRegReg(RDX, RDX);
+                    asm_.Jmp(done);
+                }
+                asm_.Bind(div);
+                asm_.CqoIdivReg(RCX);
+                asm_.Bind(done);
+                asm_.MovRegReg(RAX, RDX);
+            }
+            StoreInteger(a, RAX);
+            asm_.Jmp(next);
+            asm_.Bind(not_integer);
+        }
+
+        // Floats
+        if (kind != Arith_Pow && kind != Arith_Mod &&
+            MayBe(b, ValueT_Number) && MayBe(c, ValueT_Number))
+        {
+            JumpIfNotType(b, ValueT_Number, slow);
+            JumpIfNotType(c, ValueT_Number, slow);
+            LoadFloat(XMM0, b);
+            LoadFloat(XMM1, c);
+            if (kind == Arith_Add)
+                asm_.AddsdXmmXmm(XMM0, XMM1);
+            else if (kind == Arith_Sub)
+                asm_.SubsdXmmXmm(XMM0, XMM1);
+            else if (kind == Arith_Mul)
+                asm_.MulsdXmmXmm(XMM0, XMM1);
+            else
+                asm_.DivsdXmmXmm(XMM0, XMM1);
+            StoreFloat(a, XMM0);
+            asm_.Jmp(next);
+        }
+
+        // Mixed numbers, power and float modulo
+        asm_.Bind(slow);
+        asm_.MovRegImm(RDI, kind);
+        asm_.LeaRegMem(RSI, RBX, Payload(a));
+        LoadAddress(RDX, b);
+        LoadAddress(RCX, c);
+        CallCheckedHelper(HELPER(Arith), index);
+        return 1;
+    }
+
+    int BaselineJit::Compiler::CompileCompare(int index, CompareKind kind,
+                                              const Operand &b, const Operand &c)
+    {
+        int a = Instruction::GetParamA(code_[index]);
+        asm_.MovRegImm(RDI, kind);
+        asm_.LeaRegMem(RSI, RBX, Payload(a));
+        LoadAddress(RDX, b);
+        LoadAddress(RCX, c);
+        CallCheckedHelper(HELPER(SetCompare), index);
+        return 1;
+    }
+
+    int BaselineJit::Compiler::CompileCompareJmp(int index, CompareKind kind,
+                                                 const Operand &b, const Operand &c)
+    {
+        // Jump by the next instruction when result is A, otherwise
+        // skip the next instruction
+        bool expect = Instruction::GetParamA(code_[index]) != 0;
+        int taken = JumpLabel(index + 1, index + 1);
+        int skip = labels_[index + 2];
+        int slow = asm_.NewLabel();
+
+        if (MayBe(b, ValueT_Integer) && MayBe(c, ValueT_Integer))
+        {
+            int not_integer = asm_.NewLabel();
+            JumpIfNotType(b, ValueT_Integer, not_integer);
+            JumpIfNotType(c, ValueT_Integer, not_integer);
+            LoadInteger(RAX, b);
+            LoadInteger(RCX, c);
+            auto cond = EmitCompare(kind, true);
+            asm_.JumpIf(expect ? cond : cond.Negate(), taken);
+            asm_.Jmp(skip);
+            asm_.Bind(not_integer);
+        }
+
+        if (MayBe(b, ValueT_Number) && MayBe(c, ValueT_Number))
+        {
+            JumpIfNotType(b, ValueT_Number, slow);
+            JumpIfNotType(c, ValueT_Number, slow);
+            LoadFloat(XMM0, b);
+            LoadFloat(XMM1, c);
+            auto cond = EmitCompare(kind, false);
+            asm_.JumpIf(expect ? cond : cond.Negate(), taken);
+            asm_.Jmp(skip);
+        }
+
+        asm_.Bind(slow);
+        asm_.MovRegImm(RDI, kind);
+        LoadAddress(RSI, b);
+        LoadAddress(RDX, c);
+        CallHelper(HELPER(Compare));
+        asm_.CmpReg32Imm8(RAX, -1);
+        asm_.Jcc(CC_E, ExitLabel(index));
+        asm_.CmpReg32Imm8(RAX, expect ? 1 : 0);
+        asm_.Jcc(CC_E, taken);
+        asm_.Jmp(skip);
+        return 2;
+    }
+
+    int BaselineJit::Compiler::CompileForLoop(int index)
+    {
+        Instruction i = code_[index];
+        int a = Instruction::GetParamA(i);
+        int op = Instruction::GetOpCode(i);
+        int body = JumpLabel(index, index);
+        int next = labels_[index + 1];
+        int number = asm_.NewLabel();
+        int inc = asm_.NewLabel();
+        int dec = asm_.NewLabel();
+        int ok = asm_.NewLabel();
+
+        asm_.CmpMem32Imm(RBX, TypeOf(a), ValueT_Integer);
+        asm_.Jcc(CC_NE, number);
+
+        // Integer loop continues when distance to limit is not below step
+        if (op == OpType_ForLoop)
+        {
+            asm_.MovRegMem(RCX, RBX, Payload(a + 2));
+            asm_.TestRegReg(RCX, RCX);
+            asm_.Jcc(CC_LE, dec);
+        }
+        if (op != OpType_ForLoopDec)
+        {
+            asm_.MovRegMem(RAX, RBX, Payload(a + 1));
+            asm_.MovRegMem(RCX, RBX, Payload(a));
+            asm_.SubRegReg(RAX, RCX);
+            asm_.MovRegMem(RCX, RBX, Payload(a + 2));
+            asm_.CmpRegReg(RAX, RCX);
+            asm_.Jcc(CC_B, next);
+            asm_.Jmp(ok);
+        }
+        asm_.Bind(dec);
+        if (op != OpType_ForLoopInc)
+        {
+            asm_.MovRegMem(RAX, RBX, Payload(a));
+            asm_.MovRegMem(RCX, RBX, Payload(a + 1));
+            asm_.SubRegReg(RAX, RCX);
+            asm_.MovRegMem(RCX, RBX, Payload(a + 2));
+            asm_.NegReg(RCX);
+            asm_.CmpRegReg(RAX, RCX);
+            asm_.Jcc(CC_B, next);
+        }
+        asm_.Bind(ok);
+        asm_.MovRegMem(RAX, RBX, Payload(a));
+        asm_.MovRegMem(RCX, RBX, Payload(a + 2));
+        asm_.AddRegReg(RAX, RCX);
+        asm_.MovMemReg(RBX, Payload(a), RAX);
+        StoreInteger(a + 3, RAX);
+        asm_.Jmp(body);
+
+        // Float loop steps var before the check, continue unless var
+        // passes limit, NaN never passes
+        asm_.Bind(number);
+        asm_.MovsdXmmMem(XMM0, RBX, Payload(a));
+        asm_.MovsdXmmMem(XMM2, RBX, Payload(a + 2));
+        asm_.AddsdXmmXmm(XMM0, XMM2);
+        asm_.MovsdMemXmm(RBX, Payload(a), XMM0);
+        asm_.MovsdXmmMem(XMM1, RBX, Payload(a + 1));
+        ok = asm_.NewLabel();
+        dec = asm_.NewLabel();
+        if (op == OpType_ForLoop)
+        {
+            asm_.XorpdXmmXmm(XMM3, XMM3);
+            asm_.UcomisdXmmXmm(XMM2, XMM3);
+            asm_.Jcc(CC_A, inc);
+            asm_.Jmp(dec);
+        }
+        if (op != OpType_ForLoopDec)
+        {
+            asm_.Bind(inc);
+            asm_.UcomisdXmmXmm(XMM0, XMM1);
+            asm_.Jcc(CC_A, next);
+            asm_.Jmp(ok);
+        }
+        asm_.Bind(dec);
+        if (op != OpType_ForLoopInc)
+        {
+            asm_.UcomisdXmmXmm(XMM1, XMM0);
+            asm_.Jcc(CC_A, next);
+        }
+        asm_.Bind(ok);
+        StoreFloat(a + 3, XMM0);
+        asm_.Jmp(body);
+        return 1;
+    }
+
+    int BaselineJit::Compiler::CompileGetTable(int index, const Operand &k)
+    {
+        Instruction i = code_[index];
+        asm_.LeaRegMem(RDI, RBX, Payload(Instruction::GetParamA(i)));
+        LoadAddress(RSI, k);
+        asm_.LeaRegMem(RDX, RBX, Payload(Instruction::GetParamC(i)));
+        CallCheckedHelper(HELPER(GetTable), index);
+        return 1;
+    }
+
+    int BaselineJit::Compiler::CompileSetTable(int index, const Operand &k, const Operand &v)
+    {
+        asm_.LeaRegMem(RDI, RBX, Payload(Instruction::GetParamA(code_[index])));
+        LoadAddress(RSI, k);
+        LoadAddress(RDX, v);
+        CallCheckedHelper(HELPER(SetTable), index);
+        return 1;
+    }
+
+    int BaselineJit::Compiler::CompileInstruction(int index)
+    {
+        Instruction i = ToCheckedInstruction(code_[index]);
+        int a = Instruction::GetParamA(i);
+        int next = labels_[index + 1];
+
+        switch (Instruction::GetOpCode(i)) {
+            case OpType_LoadNil:
+                asm_.XorRegReg(RAX, RAX);
+                asm_.MovMemReg(RBX, Payload(a), RAX);
+                StoreType(a, ValueT_Nil);
+                return 1;
+            case OpType_FillNil:
+            {
+                // Close upvalues only when any upvalue is open
+                int fill = asm_.NewLabel();
+                asm_.MovRegImm(RAX, reinterpret_cast<uint64_t>(&state_->open_upvalues_));
+                asm_.MovRegMem(RAX, RAX, 0);
+                asm_.TestRegReg(RAX, RAX);
+                asm_.Jcc(CC_E, fill);
+                asm_.MovRegReg(RDI, R13);
+                asm_.LeaRegMem(RSI, RBX, Payload(a));
+                CallHelper(HELPER(CloseUpvalue));
+                asm_.Bind(fill);
+                asm_.XorRegReg(RAX, RAX);
+                for (int r = a; r < Instruction::GetParamB(i); ++r)
+                {
+                    asm_.MovMemReg(RBX, Payload(r), RAX);
+                    StoreType(r, ValueT_Nil);
+                }
+                return 1;
+            }
+            case OpType_LoadBool:
+                asm_.MovRegImm(RAX, Instruction::GetParamB(i) ? 1 : 0);
+                asm_.MovMemReg(RBX, Payload(a), RAX);
+                StoreType(a, ValueT_Bool);
+                return 1;
+            case OpType_LoadInt:
+                asm_.MovRegImm(RAX, static_cast<long long>(code_[index + 1].opcode_));
+                StoreInteger(a, RAX);
+                return 2;
+            case OpType_LoadConst:
+            case OpType_LoadConstX:
+            {
+                bool wide = Instruction::GetOpCode(i) == OpType_LoadConstX;
+                auto k = consts_ + (wide ? code_[index + 1].opcode_ : Instruction::GetParamBx(i));
+                uint64_t bits;
+                memcpy(&bits, k, sizeof(bits));
+                asm_.MovRegImm(RAX, bits);
+                asm_.MovMemReg(RBX, Payload(a), RAX);
+                StoreType(a, k->type_);
+                return wide ? 2 : 1;
+            }
+            case OpType_Move:
+            {
+                // Copy payload and type separately, since 16 bytes load
+                // after smaller stores can not be forwarded
+                int b = Instruction::GetParamB(i);
+                asm_.MovRegMem(RAX, RBX, Payload(b));
+                asm_.MovReg32Mem(RCX, RBX, TypeOf(b));
+                asm_.MovMemReg(RBX, Payload(a), RAX);
+                asm_.MovMem32Reg(RBX, TypeOf(a), RCX);
+                return 1;
+            }
+            case OpType_GetUpvalue:
+            case OpType_SetUpvalue:
+            {
+                bool get = Instruction::GetOpCode(i) == OpType_GetUpvalue;
+                asm_.MovRegReg(RDI, R12);
+                asm_.MovRegImm(RSI, Instruction::GetParamB(i));
+                asm_.LeaRegMem(RDX, RBX, Payload(a));
+                CallHelper(get ? HELPER(GetUpvalue) : HELPER(SetUpvalue));
+                return 1;
+            }
+            case OpType_GetGlobal:
+            case OpType_SetGlobal:
+            case OpType_GetGlobalX:
+            case OpType_SetGlobalX:
+            {
+                int op = Instruction::GetOpCode(i);
+                bool get = op == OpType_GetGlobal || op == OpType_GetGlobalX;
+                bool wide = op == OpType_GetGlobalX || op == OpType_SetGlobalX;
+                auto k = consts_ + (wide ? code_[index + 1].opcode_ : Instruction::GetParamBx(i));
+                asm_.MovRegReg(RDI, R13);
+                asm_.LeaRegMem(RSI, RBX, Payload(a));
+                asm_.MovRegImm(RDX, reinterpret_cast<uint64_t>(k));
+                asm_.MovRegImm(RCX, reinterpret_cast<uint64_t>(caches_ + index));
+                CallHelper(get ? HELPER(GetGlobal) : HELPER(SetGlobal));
+                return wide ? 2 : 1;
+            }
+            case OpType_JmpFalse:
+            {
+                int target = JumpLabel(index, index);
+                asm_.CmpMem32Imm(RBX, TypeOf(a), ValueT_Nil);
+                asm_.Jcc(CC_E, target);
+                asm_.CmpMem32Imm(RBX, TypeOf(a), ValueT_Bool);
+                asm_.Jcc(CC_NE, next);
+                asm_.CmpMem8Imm(RBX, Payload(a), 0);
+                asm_.Jcc(CC_E, target);
+                return 1;
+            }
+            case OpType_JmpTrue:
+            {
+                int target = JumpLabel(index, index);
+                asm_.CmpMem32Imm(RBX, TypeOf(a), ValueT_Nil);
+                asm_.Jcc(CC_E, next);
+                asm_.CmpMem32Imm(RBX, TypeOf(a), ValueT_Bool);
+                asm_.Jcc(CC_NE, target);
+                asm_.CmpMem8Imm(RBX, Payload(a), 0);
+                asm_.Jcc(CC_NE, target);
+                return 1;
+            }
+            case OpType_JmpNil:
+                asm_.CmpMem32Imm(RBX, TypeOf(a), ValueT_Nil);
+                asm_.Jcc(CC_E, JumpLabel(index, index));
+                return 1;
+            case OpType_Jmp:
+                asm_.Jmp(JumpLabel(index, index));
+                return 1;
+            case OpType_JmpLess:
+                return CompileCompareJmp(index, Compare_Less, REG_B(i), REG_C(i));
+            case OpType_JmpLessRK:
+                return CompileCompareJmp(index, Compare_Less, REG_B(i), CONST_C(i));
+            case OpType_JmpLessKR:
+                return CompileCompareJmp(index, Compare_Less, CONST_B(i), REG_C(i));
+            case OpType_JmpGreater:
+                return CompileCompareJmp(index, Compare_Greater, REG_B(i), REG_C(i));
+            case OpType_JmpGreaterRK:
+                return CompileCompareJmp(index, Compare_Greater, REG_B(i), CONST_C(i));
+            case OpType_JmpGreaterKR:
+                return CompileCompareJmp(index, Compare_Greater, CONST_B(i), REG_C(i));
+            case OpType_JmpLessEqual:
+                return CompileCompareJmp(index, Compare_LessEqual, REG_B(i), REG_C(i));
+            case OpType_JmpLessEqualRK:
+                return CompileCompareJmp(index, Compare_LessEqual, REG_B(i), CONST_C(i));
+            case OpType_JmpLessEqualKR:
+                return CompileCompareJmp(index, Compare_LessEqual, CONST_B(i), REG_C(i));
+            case OpType_JmpGreaterEqual:
+                return CompileCompareJmp(index, Compare_GreaterEqual, REG_B(i), REG_C(i));
+            case OpType_JmpGreaterEqualRK:
+                return CompileCompareJmp(index, Compare_GreaterEqual, REG_B(i), CONST_C(i));
+            case OpType_JmpGreaterEqualKR:
+                return CompileCompareJmp(index, Compare_GreaterEqual, CONST_B(i), REG_C(i));
+            case OpType_JmpEqual:
+                return CompileCompareJmp(index, Compare_Equal, REG_B(i), REG_C(i));
+            case OpType_JmpEqualRK:
+                return CompileCompareJmp(index, Compare_Equal, REG_B(i), CONST_C(i));
+            case OpType_Neg:
+            {
+                int number = asm_.NewLabel();
+                asm_.MovRegMem(RAX, RBX, Payload(a));
+                asm_.CmpMem32Imm(RBX, TypeOf(a), ValueT_Integer);
+                asm_.Jcc(CC_NE, number);
+                asm_.NegReg(RAX);
+                asm_.MovMemReg(RBX, Payload(a), RAX);
+                asm_.Jmp(next);
+                asm_.Bind(number);
+                asm_.CmpMem32Imm(RBX, TypeOf(a), ValueT_Number);
+                asm_.Jcc(CC_NE, ExitLabel(index));
+                asm_.BtcRegImm8(RAX, 63);
+                asm_.MovMemReg(RBX, Payload(a), RAX);
+                return 1;
+            }
+            case OpType_Not:
+            {
+                int is_false = asm_.NewLabel();
+                int store = asm_.NewLabel();
+                asm_.XorRegReg(RAX, RAX);
+                asm_.CmpMem32Imm(RBX, TypeOf(a), ValueT_Nil);
+                asm_.Jcc(CC_E, is_false);
+                asm_.CmpMem32Imm(RBX, TypeOf(a), ValueT_Bool);
+                asm_.Jcc(CC_NE, store);
+                asm_.CmpMem8Imm(RBX, Payload(a), 0);
+                asm_.Jcc(CC_NE, store);
+                asm_.Bind(is_false);
+                asm_.MovEaxImm(1);
+                asm_.Bind(store);
+                asm_.MovMemReg(RBX, Payload(a), RAX);
+                StoreType(a, ValueT_Bool);
+                return 1;
+            }
+            case OpType_Len:
+                asm_.LeaRegMem(RDI, RBX, Payload(a));
+                CallCheckedHelper(HELPER(Len), index);
+                return 1;
+            case OpType_Add:
+                return CompileArith(index, Arith_Add, REG_B(i), REG_C(i));
+            case OpType_Sub:
+                return CompileArith(index, Arith_Sub, REG_B(i), REG_C(i));
+            case OpType_Mul:
+                return CompileArith(index, Arith_Mul, REG_B(i), REG_C(i));
+            case OpType_Div:
+                return CompileArith(index, Arith_Div, REG_B(i), REG_C(i));
+            case OpType_Pow:
+                return CompileArith(index, Arith_Pow, REG_B(i), REG_C(i));
+            case OpType_Mod:
+                return CompileArith(index, Arith_Mod, REG_B(i), REG_C(i));
+            case OpType_AddRK:
+                return CompileArith(index, Arith_Add, REG_B(i), CONST_C(i));
+            case OpType_AddKR:
+                return CompileArith(index, Arith_Add, CONST_B(i), REG_C(i));
+            case OpType_SubRK:
+                return CompileArith(index, Arith_Sub, REG_B(i), CONST_C(i));
+            case OpType_SubKR:
+                return CompileArith(index, Arith_Sub, CONST_B(i), REG_C(i));
+            case OpType_MulRK:
+                return CompileArith(index, Arith_Mul, REG_B(i), CONST_C(i));
+            case OpType_MulKR:
+                return CompileArith(index, Arith_Mul, CONST_B(i), REG_C(i));
+            case OpType_DivRK:
+                return CompileArith(index, Arith_Div, REG_B(i), CONST_C(i));
+            case OpType_DivKR:
+                return CompileArith(index, Arith_Div, CONST_B(i), REG_C(i));
+            case OpType_PowRK:
+                return CompileArith(index, Arith_Pow, REG_B(i), CONST_C(i));
+            case OpType_PowKR:
+                return CompileArith(index, Arith_Pow, CONST_B(i), REG_C(i));
+            case OpType_ModRK:
+                return CompileArith(index, Arith_Mod, REG_B(i), CONST_C(i));
+            case OpType_ModKR:
+                return CompileArith(index, Arith_Mod, CONST_B(i), REG_C(i));
+            case OpType_Concat:
+                asm_.MovRegReg(RDI, R13);
+                asm_.LeaRegMem(RSI, RBX, Payload(a));
+                asm_.LeaRegMem(RDX, RBX, Payload(Instruction::GetParamB(i)));
+                asm_.LeaRegMem(RCX, RBX, Payload(Instruction::GetParamC(i)));
+                CallCheckedHelper(HELPER(Concat), index);
+                return 1;
+            case OpType_Less:
+                return CompileCompare(index, Compare_Less, REG_B(i), REG_C(i));
+            case OpType_Greater:
+                return CompileCompare(index, Compare_Greater, REG_B(i), REG_C(i));
+            case OpType_Equal:
+                return CompileCompare(index, Compare_Equal, REG_B(i), REG_C(i));
+            case OpType_UnEqual:
+                return CompileCompare(index, Compare_UnEqual, REG_B(i), REG_C(i));
+            case OpType_LessEqual:
+                return CompileCompare(index, Compare_LessEqual, REG_B(i), REG_C(i));
+            case OpType_GreaterEqual:
+                return CompileCompare(index, Compare_GreaterEqual, REG_B(i), REG_C(i));
+            case OpType_LessRK:
+                return CompileCompare(index, Compare_Less, REG_B(i), CONST_C(i));
+            case OpType_LessKR:
+                return CompileCompare(index, Compare_Less, CONST_B(i), REG_C(i));
+            case OpType_GreaterRK:
+                return CompileCompare(index, Compare_Greater, REG_B(i), CONST_C(i));
+            case OpType_GreaterKR:
+                return CompileCompare(index, Compare_Greater, CONST_B(i), REG_C(i));
+            case OpType_EqualRK:
+                return CompileCompare(index, Compare_Equal, REG_B(i), CONST_C(i));
+            case OpType_UnEqualRK:
+                return CompileCompare(index, Compare_UnEqual, REG_B(i), CONST_C(i));
+            case OpType_LessEqualRK:
+                return CompileCompare(index, Compare_LessEqual, REG_B(i), CONST_C(i));
+            case OpType_LessEqualKR:
+                return CompileCompare(index, Compare_LessEqual, CONST_B(i), REG_C(i));
+            case OpType_GreaterEqualRK:
+                return CompileCompare(index, Compare_GreaterEqual, REG_B(i), CONST_C(i));
+            case OpType_GreaterEqualKR:
+                return CompileCompare(index, Compare_GreaterEqual, CONST_B(i), REG_C(i));
+            case OpType_NewTable:
+                asm_.MovRegReg(RDI, R13);
+                asm_.LeaRegMem(RSI, RBX, Payload(a));
+                CallHelper(HELPER(NewTable));
+                return 1;
+            case OpType_SetTable:
+                return CompileSetTable(index, REG_B(i), REG_C(i));
+            case OpType_GetTable:
+                return CompileGetTable(index, REG_B(i));
+            case OpType_SetTableRK:
+                return CompileSetTable(index, REG_B(i), CONST_C(i));
+            case OpType_SetTableKR:
+                return CompileSetTable(index, CONST_B(i), REG_C(i));
+            case OpType_SetTableKK:
+                return CompileSetTable(index, CONST_B(i), CONST_C(i));
+            case OpType_GetTableKR:
+                return CompileGetTable(index, CONST_B(i));
+            case OpType_GetField:
+            case OpType_SetField:
+            {
+                bool get = Instruction::GetOpCode(i) == OpType_GetField;
+                asm_.MovRegReg(RDI, R13);
+                asm_.LeaRegMem(RSI, RBX, Payload(a));
+                asm_.MovRegImm(RDX, reinterpret_cast<uint64_t>(consts_ + Instruction::GetParamB(i)));
+                asm_.LeaRegMem(RCX, RBX, Payload(Instruction::GetParamC(i)));
+                asm_.MovRegImm(R8, reinterpret_cast<uint64_t>(caches_ + index));
+                CallCheckedHelper(get ? HELPER(GetField) : HELPER(SetField), index);
+                return 1;
+            }
+            case OpType_Self:
+                asm_.MovRegReg(RDI, R13);
+                asm_.LeaRegMem(RSI, RBX, Payload(a));
+                asm_.MovRegImm(RDX, reinterpret_cast<uint64_t>(consts_ + Instruction::GetParamB(i)));
+                asm_.MovRegImm(RCX, reinterpret_cast<uint64_t>(caches_ + index));
+                CallCheckedHelper(HELPER(Self), index);
+                return 1;
+            case OpType_ForInit:
+                asm_.MovRegReg(RDI, R13);
+                asm_.LeaRegMem(RSI, RBX, Payload(a));
+                CallHelper(HELPER(ForInit));
+                asm_.CmpReg32Imm8(RAX, -1);
+                asm_.Jcc(CC_E, ExitLabel(index));
+                asm_.TestReg32Reg32(RAX, RAX);
+                asm_.Jcc(CC_E, JumpLabel(index, index));
+                return 1;
+            case OpType_ForLoop:
+            case OpType_ForLoopInc:
+            case OpType_ForLoopDec:
+                return CompileForLoop(index);
+            case OpType_ConcatRange:
+                asm_.MovRegReg(RDI, R13);
+                asm_.LeaRegMem(RSI, RBX, Payload(a));
+                asm_.LeaRegMem(RDX, RBX, Payload(Instruction::GetParamB(i)));
+                asm_.MovRegImm(RCX, Instruction::GetParamC(i));
+                CallCheckedHelper(HELPER(ConcatRange), index);
+                return 1;
+            case OpType_Intrinsic:
+                // Skip the call when the intrinsic is calculated,
+                // otherwise the call exits to the interpreter
+                asm_.MovRegReg(RDI, R13);
+                asm_.LeaRegMem(RSI, RBX, Payload(a));
+                asm_.MovRegImm(RDX, Instruction::GetParamB(i));
+                asm_.MovRegImm(RCX, Instruction::GetParamC(i));
+                CallHelper(HELPER(Intrinsic));
+                asm_.TestReg32Reg32(RAX, RAX);
+                asm_.Jcc(CC_NE, labels_[index + 2]);
+                return 1;
+            default:
+                // Calls, returns, varargs and closures change frames or
+                // open upvalues, the interpreter executes them
+                asm_.Jmp(ExitLabel(index));
+                return 1;
+        }
+    }
+
+#undef REG_B
+#undef REG_C
+#undef CONST_B
+#undef CONST_C
+#undef HELPER
+#endif // LUNA_JIT_SUPPORTED
+
+    BaselineJit::BaselineJit(State *state)
+        : state_(state), threshold_(kDefaultThreshold), compiled_count_(0)
+    {
+    }
+
+    NativeCode * BaselineJit::Compile(Function *proto)
+    {
+#ifdef LUNA_JIT_SUPPORTED
+        Compiler compiler(state_, proto);
+        auto native = compiler.Compile();
+        if (native)
+        {
+            ++compiled_count_;
+            proto->SetNativeCode(std::move(native));
+            return proto->GetNativeCode();
+        }
+#endif
+
+        // Never compile the function again
+        proto->ResetCallCount(std::numeric_limits<int>::min());
+        return nullptr;
+    }
+} // namespace luna
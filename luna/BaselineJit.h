@@ -0,0 +1,64 @@
+#ifndef BASELINE_JIT_H
+#define BASELINE_JIT_H
+
+#include "Value.h"
+#include "OpCode.h"
+#include "Function.h"
+#include "NativeCode.h"
+#include <memory>
+
+namespace luna
+{
+    class State;
+
+    // Baseline JIT compiles all instructions of a function into machine
+    // code when the function is called enough times. Each instruction
+    // is compiled by the template of its OpType, templates work on the
+    // registers of the frame in place and handle common types inline,
+    // other types are handled by helper functions. Calls, returns,
+    // closures and errors exit to the interpreter, which executes the
+    // instruction and then enters machine code again.
+    class BaselineJit
+    {
+    public:
+        explicit BaselineJit(State *state);
+
+        BaselineJit(const BaselineJit&) = delete;
+        void operator = (const BaselineJit&) = delete;
+
+        // Set and get count of calls to compile a function
+        void SetThreshold(int calls)
+        { threshold_ = calls; }
+        int GetThreshold() const
+        { return threshold_; }
+
+        // Get count of compiled functions
+        std::size_t GetCompiledCount() const
+        { return compiled_count_; }
+
+        // Count a call of 'proto' when its frame starts, compile it
+        // when it is called enough times, return machine code of it or
+        // nullptr when it is not compiled
+        NativeCode * CountCall(Function *proto)
+        {
+            if (proto->CountCall() < threshold_)
+                return nullptr;
+            return Compile(proto);
+        }
+
+    private:
+        class Compiler;
+
+        // Default count of calls to compile a function
+        static const int kDefaultThreshold = 10;
+
+        // Compile the function, return nullptr when failed
+        NativeCode * Compile(Function *proto);
+
+        State *state_;
+        int threshold_;
+        std::size_t compiled_count_;
+    };
+} // namespace luna
+
+#endif // BASELINE_JIT_H
@@ -4,18 +4,24 @@
 #include "Function.h"
 #include "Exception.h"
 #include "Guard.h"
+#include "Peephole.h"
+#include "TypeInference.h"
 #include <vector>
 #include <stack>
 #include <list>
 #include <limits>
 #include <utility>
+#include <algorithm>
 #include <unordered_map>
+#include <unordered_set>
 #include <assert.h>
 
 namespace luna
 {
 #define MAX_FUNCTION_REGISTER_COUNT 250
 #define MAX_CLOSURE_UPVALUE_COUNT 250
+#define MAX_CONST_OPERAND_INDEX 255
+#define MAX_INLINE_INSTRUCTION_COUNT 32
 
 #define CHECK_UPVALUE_MAX_COUNT(index, function)                        \
     if (index >= MAX_CLOSURE_UPVALUE_COUNT)                             \
@@ -31,10 +37,22 @@ namespace luna
         int register_id_;
         // Name begin instruction
         int begin_pc_;
+        // Prototype of local function which calls can be inlined,
+        // nullptr when the name is not such a function
+        Function *inline_function_;
 
         explicit LocalNameInfo(int register_id = 0, int begin_pc = 0)
             : register_id_(register_id),
-              begin_pc_(begin_pc) { }
+              begin_pc_(begin_pc),
+              inline_function_(nullptr) { }
+    };
+
+    // Operand kind of instruction copied by inlining
+    enum InlineOperand
+    {
+        InlineOperand_None,
+        InlineOperand_Register,
+        InlineOperand_Const,
     };
 
     // Loop AST info data in GenerateBlock
@@ -99,6 +117,8 @@ namespace luna
         int register_max_;
         // To be filled loop jump info
         std::list<LoopJumpInfo> loop_jumps_;
+        // Index of OpType_Jmp of conditional jumps to be refilled
+        std::unordered_set<int> conditional_jumps_;
 
         GenerateFunction()
             : parent_(nullptr), current_block_(nullptr),
@@ -179,6 +199,17 @@ namespace luna
         // Clean up when leave lexical function
         void LeaveFunction()
         {
+            // Add one return instruction to the end of function, then
+            // VM never runs past the last instruction
+            auto instruction = Instruction::AsBxCode(OpType_Ret, 0, 0);
+            GetCurrentFunction()->AddInstruction(instruction, 0);
+            PeepholeOptimize(GetCurrentFunction());
+            InferNumberTypes(GetCurrentFunction());
+
+            // VM makes sure the stack has enough space for registers
+            // when calls this function
+            GetCurrentFunction()->SetRegisterCount(current_function_->register_max_);
+
             DeleteCurrentFunction();
         }
 
@@ -247,9 +278,9 @@ namespace luna
                         else if (it->jump_type_ == LoopJumpInfo::JumpTail)
                             diff = end_index - it->instruction_index_;
 
-                        // Get instruction and refill its jump diff
-                        auto i = function->GetMutableInstruction(it->instruction_index_);
-                        i->RefillsBx(diff);
+                        // Refill jump diff of the instruction
+                        RefillJump(it->instruction_index_,
+                                   it->instruction_index_ + diff);
 
                         // Remove it from loop_jumps when it refilled
                         loop_jumps.erase(it++);
@@ -297,6 +328,19 @@ namespace luna
             }
         }
 
+        // Set begin instruction of names in current block which
+        // registers are in [register_begin, register_end)
+        void SetNamesBeginPc(int register_begin, int register_end, int begin_pc)
+        {
+            auto block = current_function_->current_block_;
+            for (auto it = block->names_.begin(); it != block->names_.end(); ++it)
+            {
+                if (it->second.register_id_ >= register_begin &&
+                    it->second.register_id_ < register_end)
+                    it->second.begin_pc_ = begin_pc;
+            }
+        }
+
         // Search name in current lexical function
         const LocalNameInfo * SearchLocalName(String *name) const
         {
@@ -466,18 +510,532 @@ namespace luna
             }
         }
 
+        // Add string to const values and return the const index when
+        // the index can be operand B or C of instruction, otherwise
+        // return -1
+        int AddConstOperand(String *str)
+        {
+            auto function = GetCurrentFunction();
+            auto index = function->AddConstString(str);
+            return index > MAX_CONST_OPERAND_INDEX ? -1 : index;
+        }
+
+        // Same as above for number or string Terminator expression,
+        // return -1 for other expressions, which need to be calculated
+        // into register
+        int AddConstOperand(SyntaxTree *exp)
+        {
+            auto term = dynamic_cast<Terminator *>(exp);
+            if (!term)
+                return -1;
+
+            auto function = GetCurrentFunction();
+            int index = -1;
+            if (term->token_.token_ == Token_Number)
+                index = function->AddConstNumber(term->token_.number_);
+            else if (term->token_.token_ == Token_Integer)
+                index = function->AddConstInteger(term->token_.integer_);
+            else if (term->token_.token_ == Token_String)
+                index = function->AddConstString(term->token_.str_);
+            return index > MAX_CONST_OPERAND_INDEX ? -1 : index;
+        }
+
+        // Add OpType_LoadConst, OpType_GetGlobal or OpType_SetGlobal
+        // instruction, use the wide form when const index is out of Bx
+        int AddConstInstruction(OpType op_type, int register_id,
+                                int const_index, int line)
+        {
+            auto function = GetCurrentFunction();
+            if (const_index <= kMaxBx)
+            {
+                auto instruction = Instruction::ABxCode(op_type, register_id, const_index);
+                return function->AddInstruction(instruction, line);
+            }
+
+            auto wide_op = OpType_LoadConstX;
+            if (op_type == OpType_GetGlobal)
+                wide_op = OpType_GetGlobalX;
+            else if (op_type == OpType_SetGlobal)
+                wide_op = OpType_SetGlobalX;
+
+            auto instruction = Instruction::ACode(wide_op, register_id);
+            int index = function->AddInstruction(instruction, line);
+            // Const index
+            instruction.opcode_ = const_index;
+            function->AddInstruction(instruction, line);
+            return index;
+        }
+
+        // Add conditional jump instruction which jump diff will be
+        // refilled by RefillJump, sBx of it only skips one instruction:
+        //     instruction +2
+        //     Jmp +2
+        //     Jmp sAx
+        // return index of the last OpType_Jmp
+        int AddConditionalJump(Instruction instruction, int line)
+        {
+            auto function = GetCurrentFunction();
+            instruction.RefillsBx(2);
+            function->AddInstruction(instruction, line);
+            function->AddInstruction(Instruction::sAxCode(OpType_Jmp, 2), line);
+            int index = function->AddInstruction(Instruction::sAxCode(OpType_Jmp, 0), line);
+            current_function_->conditional_jumps_.insert(index);
+            return index;
+        }
+
+        // Refill OpType_Jmp at index to jump to target, the conditional
+        // jump added by AddConditionalJump jumps to target directly when
+        // the diff is in range of sBx, then the peephole optimizer
+        // removes the left jumps
+        void RefillJump(int index, int target)
+        {
+            auto function = GetCurrentFunction();
+            auto jmp = function->GetMutableInstruction(index);
+            assert(Instruction::GetOpCode(*jmp) == OpType_Jmp);
+
+            int diff = target - index;
+            if (diff < -kMaxsAx || diff > kMaxsAx)
+            {
+                throw CodeGenerateException(
+                    function->GetModule()->GetCStr(),
+                    function->GetInstructionLine(index),
+                    "function is too large");
+            }
+            jmp->RefillsAx(diff);
+
+            auto &conditional_jumps = current_function_->conditional_jumps_;
+            auto it = conditional_jumps.find(index);
+            if (it == conditional_jumps.end())
+                return ;
+            conditional_jumps.erase(it);
+
+            if (diff + 2 >= -kMaxsBx && diff + 2 <= kMaxsBx)
+                function->GetMutableInstruction(index - 2)->RefillsBx(diff + 2);
+        }
+
+        // Return statement which only returns all results of a function
+        // call can call the function by tail call
+        static bool IsTailCall(ReturnStatement *ret_stmt)
+        {
+            if (ret_stmt->exp_value_count_ != EXP_VALUE_COUNT_ANY)
+                return false;
+
+            auto exp_list = static_cast<ExpressionList *>(ret_stmt->exp_list_.get());
+            if (exp_list->exp_list_.size() != 1)
+                return false;
+
+            auto exp = exp_list->exp_list_.front().get();
+            return dynamic_cast<NormalFuncCall *>(exp) ||
+                   dynamic_cast<MemberFuncCall *>(exp);
+        }
+
+        // Kinds of operands A, B(Bx) and C of instruction which is
+        // copied by inlining, const operand of instruction which has
+        // a data word is the data word, return false when the
+        // instruction can not be copied into other function
+        static bool GetInlineOperands(int op, InlineOperand *a,
+                                      InlineOperand *b, InlineOperand *c)
+        {
+            *a = InlineOperand_Register;
+            *b = InlineOperand_None;
+            *c = InlineOperand_None;
+            switch (op)
+            {
+                case OpType_LoadNil: case OpType_LoadBool: case OpType_LoadInt:
+                case OpType_Call: case OpType_Ret:
+                case OpType_JmpFalse: case OpType_JmpTrue: case OpType_JmpNil:
+                case OpType_Neg: case OpType_Not: case OpType_Len:
+                case OpType_NewTable: case OpType_Intrinsic:
+                case OpType_ForInit: case OpType_ForLoop:
+                case OpType_ForLoopInc: case OpType_ForLoopDec:
+                    return true;
+                case OpType_FillNil: case OpType_Move: case OpType_ConcatRange:
+                    *b = InlineOperand_Register;
+                    return true;
+                case OpType_LoadConst: case OpType_GetGlobal: case OpType_SetGlobal:
+                case OpType_LoadConstX: case OpType_GetGlobalX: case OpType_SetGlobalX:
+                case OpType_Self:
+                    *b = InlineOperand_Const;
+                    return true;
+                case OpType_Jmp:
+                    *a = InlineOperand_None;
+                    return true;
+                case OpType_JmpLess: case OpType_JmpGreater:
+                case OpType_JmpLessEqual: case OpType_JmpGreaterEqual:
+                case OpType_JmpEqual:
+                    *a = InlineOperand_None;
+                    *b = InlineOperand_Register;
+                    *c = InlineOperand_Register;
+                    return true;
+                case OpType_JmpLessRK: case OpType_JmpGreaterRK:
+                case OpType_JmpLessEqualRK: case OpType_JmpGreaterEqualRK:
+                case OpType_JmpEqualRK:
+                    *a = InlineOperand_None;
+                    *b = InlineOperand_Register;
+                    *c = InlineOperand_Const;
+                    return true;
+                case OpType_JmpLessKR: case OpType_JmpGreaterKR:
+                case OpType_JmpLessEqualKR: case OpType_JmpGreaterEqualKR:
+                    *a = InlineOperand_None;
+                    *b = InlineOperand_Const;
+                    *c = InlineOperand_Register;
+                    return true;
+                case OpType_Add: case OpType_Sub: case OpType_Mul:
+                case OpType_Div: case OpType_Pow: case OpType_Mod:
+                case OpType_Concat:
+                case OpType_Less: case OpType_Greater:
+                case OpType_Equal: case OpType_UnEqual:
+                case OpType_LessEqual: case OpType_GreaterEqual:
+                case OpType_SetTable: case OpType_GetTable:
+                    *b = InlineOperand_Register;
+                    *c = InlineOperand_Register;
+                    return true;
+                case OpType_AddRK: case OpType_SubRK: case OpType_MulRK:
+                case OpType_DivRK: case OpType_PowRK: case OpType_ModRK:
+                case OpType_LessRK: case OpType_GreaterRK:
+                case OpType_EqualRK: case OpType_UnEqualRK:
+                case OpType_LessEqualRK: case OpType_GreaterEqualRK:
+                case OpType_SetTableRK:
+                    *b = InlineOperand_Register;
+                    *c = InlineOperand_Const;
+                    return true;
+                case OpType_AddKR: case OpType_SubKR: case OpType_MulKR:
+                case OpType_DivKR: case OpType_PowKR: case OpType_ModKR:
+                case OpType_LessKR: case OpType_GreaterKR:
+                case OpType_LessEqualKR: case OpType_GreaterEqualKR:
+                case OpType_SetTableKR: case OpType_GetTableKR:
+                case OpType_GetField: case OpType_SetField:
+                    *b = InlineOperand_Const;
+                    *c = InlineOperand_Register;
+                    return true;
+                case OpType_SetTableKK:
+                    *b = InlineOperand_Const;
+                    *c = InlineOperand_Const;
+                    return true;
+                default:
+                    // Upvalue, closure, vararg and tail call instructions
+                    // need the frame of the function
+                    return false;
+            }
+        }
+
+        // Function can be inlined when it is small, has no vararg, no
+        // upvalue (then it is not recursive) and no child function, and
+        // returns fixed count of results
+        static bool CanInline(const Function *function)
+        {
+            if (function->HasVararg() || function->GetUpvalueCount() != 0 ||
+                function->GetChildFunctionCount() != 0 ||
+                function->OpCodeSize() > MAX_INLINE_INSTRUCTION_COUNT)
+                return false;
+
+            auto code = function->GetOpCodes();
+            auto size = function->OpCodeSize();
+            for (std::size_t i = 0; i < size; ++i)
+            {
+                InlineOperand a, b, c;
+                int op = Instruction::GetOpCode(ToCheckedInstruction(code[i]));
+                if (!GetInlineOperands(op, &a, &b, &c))
+                    return false;
+                if (op == OpType_Ret && Instruction::GetParamsBx(code[i]) < 0)
+                    return false;
+                if (HasDataWord(op))
+                    ++i;
+            }
+            return true;
+        }
+
+        // Get prototype of function which calls can be inlined when
+        // caller is a name of local function, otherwise return nullptr
+        Function * GetInlineFunction(SyntaxTree *caller) const
+        {
+            auto term = dynamic_cast<Terminator *>(caller);
+            if (!term || term->token_.token_ != Token_Id ||
+                term->scoping_ != LexicalScoping_Local)
+                return nullptr;
+
+            auto local_name = SearchLocalName(term->token_.str_);
+            return local_name ? local_name->inline_function_ : nullptr;
+        }
+
+        // Copy instructions of 'callee' into current function instead of
+        // call instruction, registers of callee are moved to start from
+        // 'base', which is the register of the first arg, results are
+        // moved to 'base - 1' like call instruction, line of each copied
+        // instruction is kept, return false when callee can not be
+        // inlined here
+        bool InlineCall(Function *callee, int base, int arg_count,
+                        int results, int line)
+        {
+            auto function = GetCurrentFunction();
+            auto register_count = std::max(callee->GetRegisterCount(),
+                                           std::max(arg_count, results));
+            if (base + register_count > MAX_FUNCTION_REGISTER_COUNT)
+                return false;
+
+            // Indexes of consts added into current function are always
+            // in range of operand B and C
+            auto const_count = callee->GetConstValueCount();
+            if (function->GetConstValueCount() + const_count > MAX_CONST_OPERAND_INDEX + 1)
+                return false;
+
+            std::vector<int> const_map(const_count);
+            for (std::size_t k = 0; k < const_count; ++k)
+            {
+                auto v = callee->GetConstValue(k);
+                switch (v->type_)
+                {
+                    case ValueT_Number: const_map[k] = function->AddConstNumber(v->num_); break;
+                    case ValueT_Integer: const_map[k] = function->AddConstInteger(v->integer_); break;
+                    case ValueT_String: const_map[k] = function->AddConstString(v->str_); break;
+                    default: const_map[k] = function->AddConstValue(*v); break;
+                }
+            }
+
+            auto &register_max = current_function_->register_max_;
+            register_max = std::max(register_max, base + register_count);
+
+            // Missing args are nil
+            auto fixed_args = callee->FixedArgCount();
+            if (arg_count < fixed_args)
+            {
+                auto i = Instruction::ABCode(OpType_FillNil, base + arg_count, base + fixed_args);
+                function->AddInstruction(i, line);
+            }
+
+            // Return instruction is replaced by moving results and jump
+            // to the end, calculate index of each copied instruction
+            auto code = callee->GetOpCodes();
+            int size = callee->OpCodeSize();
+            std::vector<int> index_map(size + 1);
+            int index = function->OpCodeSize();
+            for (int i = 0; i < size; ++i)
+            {
+                index_map[i] = index;
+                int op = Instruction::GetOpCode(code[i]);
+                if (op == OpType_Ret)
+                {
+                    int moves = std::min(Instruction::GetParamsBx(code[i]), results);
+                    index += moves + (moves < results ? 1 : 0) + (i + 1 < size ? 1 : 0);
+                }
+                else
+                    ++index;
+            }
+            index_map[size] = index;
+
+            std::vector<int> end_jumps;
+            for (int i = 0; i < size; ++i)
+            {
+                // Unchecked numeric instructions are specialized by types
+                // of callee, type inference of caller specializes again
+                auto ins = ToCheckedInstruction(code[i]);
+                int op = Instruction::GetOpCode(ins);
+                if (op == OpType_Ret)
+                {
+                    int src = base + Instruction::GetParamA(ins);
+                    int moves = std::min(Instruction::GetParamsBx(ins), results);
+                    for (int k = 0; k < moves; ++k)
+                    {
+                        auto move = Instruction::ABCode(OpType_Move, base - 1 + k, src + k);
+                        function->AddInstruction(move, line);
+                    }
+                    if (moves < results)
+                    {
+                        auto fill = Instruction::ABCode(OpType_FillNil, base - 1 + moves,
+                                                        base - 1 + results);
+                        function->AddInstruction(fill, line);
+                    }
+                    if (i + 1 < size)
+                    {
+                        auto jmp = Instruction::sAxCode(OpType_Jmp, 0);
+                        end_jumps.push_back(function->AddInstruction(jmp, line));
+                    }
+                    continue;
+                }
+
+                InlineOperand a, b, c;
+                GetInlineOperands(op, &a, &b, &c);
+                auto remap = [&](InlineOperand kind, int value) {
+                    if (kind == InlineOperand_Register)
+                        return base + value;
+                    if (kind == InlineOperand_Const)
+                        return const_map[value];
+                    return value;
+                };
+
+                Instruction copy = ins;
+                switch (op)
+                {
+                    case OpType_JmpFalse: case OpType_JmpTrue: case OpType_JmpNil:
+                    case OpType_ForInit: case OpType_ForLoop:
+                    case OpType_ForLoopInc: case OpType_ForLoopDec:
+                    case OpType_Jmp:
+                    {
+                        int target = i + Instruction::GetJumpDiff(ins);
+                        if (op != OpType_Jmp)
+                            copy = Instruction::AsBxCode(static_cast<OpType>(op),
+                                                         remap(a, Instruction::GetParamA(ins)), 0);
+                        copy.RefillJumpDiff(index_map[target] - index_map[i]);
+                        break;
+                    }
+                    case OpType_LoadConst: case OpType_GetGlobal: case OpType_SetGlobal:
+                        copy = Instruction::ABxCode(static_cast<OpType>(op),
+                                                    remap(a, Instruction::GetParamA(ins)),
+                                                    remap(b, Instruction::GetParamBx(ins)));
+                        break;
+                    default:
+                        if (HasDataWord(op))
+                            copy = Instruction::ACode(static_cast<OpType>(op),
+                                                      remap(a, Instruction::GetParamA(ins)));
+                        else
+                            copy = Instruction::ABCCode(static_cast<OpType>(op),
+                                                        remap(a, Instruction::GetParamA(ins)),
+                                                        remap(b, Instruction::GetParamB(ins)),
+                                                        remap(c, Instruction::GetParamC(ins)));
+                        break;
+                }
+                function->AddInstruction(copy, callee->GetInstructionLine(i));
+
+                if (HasDataWord(op))
+                {
+                    // Data word is a const index except of OpType_LoadInt
+                    auto word = code[++i];
+                    if (op != OpType_LoadInt)
+                        word.opcode_ = const_map[word.opcode_];
+                    function->AddInstruction(word, callee->GetInstructionLine(i));
+                }
+            }
+
+            for (auto jmp : end_jumps)
+                function->GetMutableInstruction(jmp)->RefillsAx(index_map[size] - jmp);
+
+            // Local variables of callee name registers in runtime errors
+            for (std::size_t k = 0; k < callee->GetLocalVarCount(); ++k)
+            {
+                auto var = callee->GetLocalVar(k);
+                function->AddLocalVar(var->name_, base + var->register_id_,
+                                      index_map[var->begin_pc_],
+                                      index_map[var->end_pc_]);
+            }
+            return true;
+        }
+
+        // Get intrinsic of call math.xxx(...) with 'arg_count'
+        // arguments, return -1 when caller is not a function of global
+        // math which has an intrinsic
+        static int GetIntrinsic(SyntaxTree *caller, int arg_count)
+        {
+            auto accessor = dynamic_cast<MemberAccessor *>(caller);
+            if (!accessor)
+                return -1;
+
+            auto term = dynamic_cast<Terminator *>(accessor->table_.get());
+            if (!term || term->token_.token_ != Token_Id ||
+                term->scoping_ != LexicalScoping_Global ||
+                term->token_.str_->GetStdString() != "math")
+                return -1;
+
+            return GetMathIntrinsic(accessor->member_.str_->GetStdString(), arg_count);
+        }
+
+        // Collect operands of concat chain 'bin_exp' from left to right,
+        // concat is left associative, so the chain is the left spine of
+        // concat expressions
+        static std::vector<SyntaxTree *> GetConcatOperands(BinaryExpression *bin_exp)
+        {
+            std::vector<SyntaxTree *> operands;
+            SyntaxTree *exp = bin_exp;
+            while (bin_exp && bin_exp->op_token_.token_ == Token_Concat)
+            {
+                operands.push_back(bin_exp->right_.get());
+                exp = bin_exp->left_.get();
+                bin_exp = dynamic_cast<BinaryExpression *>(exp);
+            }
+            operands.push_back(exp);
+            std::reverse(operands.begin(), operands.end());
+            return operands;
+        }
+
+        // Choose OpType by kinds of operands, rk when right operand
+        // is const, kr when left operand is const, otherwise rr
+        static OpType ChooseOpType(OpType rr, OpType rk, OpType kr,
+                                   int left_const, int right_const)
+        {
+            return right_const >= 0 ? rk : (left_const >= 0 ? kr : rr);
+        }
+
+        // Generate code to calculate operands of binary expression,
+        // left_const and right_const are const indexes of const
+        // operands or -1, return operand B and C of the instruction
+        std::pair<int, int> BinaryOperands(BinaryExpression *bin_exp,
+                                           int register_id, int end_register,
+                                           int &left_const, int &right_const);
+
+        // Generate code to jump when value of the expression is
+        // jmp_when, return the index of instruction which has jump diff
+        // to refill
+        int JmpCondition(SyntaxTree *exp, bool jmp_when, int register_id, int line);
+
+        int JmpFalse(SyntaxTree *exp, int register_id, int line)
+        { return JmpCondition(exp, false, register_id, line); }
+
+        // Get value of condition when the expression is a const
+        static bool GetConstCondition(SyntaxTree *exp, bool &value)
+        {
+            auto term = dynamic_cast<Terminator *>(exp);
+            if (!term)
+                return false;
+
+            switch (term->token_.token_)
+            {
+                case Token_Nil: case Token_False:
+                    value = false;
+                    return true;
+                case Token_True: case Token_Number:
+                case Token_Integer: case Token_String:
+                    value = true;
+                    return true;
+                default:
+                    return false;
+            }
+        }
+
+        // Get value of number literal or negative number literal
+        static bool GetConstNumber(SyntaxTree *exp, double &number)
+        {
+            if (auto unexp = dynamic_cast<UnaryExpression *>(exp))
+            {
+                if (unexp->op_token_.token_ != '-' ||
+                    !GetConstNumber(unexp->exp_.get(), number))
+                    return false;
+                number = -number;
+                return true;
+            }
+
+            auto term = dynamic_cast<Terminator *>(exp);
+            if (!term)
+                return false;
+            if (term->token_.token_ == Token_Number)
+                number = term->token_.number_;
+            else if (term->token_.token_ == Token_Integer)
+                number = static_cast<double>(term->token_.integer_);
+            else
+                return false;
+            return true;
+        }
+
         template<typename StatementType>
         void IfStatementGenerateCode(StatementType *if_stmt);
 
         template<typename TableFieldType>
         void SetTableFieldValue(TableFieldType *field,
                                 int table_register,
-                                int key_register,
+                                int key, bool key_const,
                                 int line);
 
         template<typename TableAccessorType, typename LoadKey>
         void AccessTableField(TableAccessorType *accessor,
-                              void *data, int line,
+                              void *data, int line, int key_const,
                               const LoadKey &load_key);
 
         template<typename FuncCallType, typename CallerArgAdjuster>
@@ -576,6 +1134,135 @@ namespace luna
             : func_register_(func_register) { }
     };
 
+    std::pair<int, int>
+    CodeGenerateVisitor::BinaryOperands(BinaryExpression *bin_exp,
+                                        int register_id, int end_register,
+                                        int &left_const, int &right_const)
+    {
+        auto left = bin_exp->left_.get();
+        auto right = bin_exp->right_.get();
+
+        // Number and string const operands are encoded into instruction
+        // directly, except operands of concat
+        auto token = bin_exp->op_token_.token_;
+        if (token != Token_Concat)
+        {
+            right_const = AddConstOperand(right);
+            if (right_const < 0)
+                left_const = AddConstOperand(left);
+
+            // Equality is commutative, so always put the const operand
+            // at right, left const operand has no side effects when
+            // calculate the right expression first
+            if (left_const >= 0 &&
+                (token == Token_Equal || token == Token_NotEqual))
+            {
+                std::swap(left, right);
+                std::swap(left_const, right_const);
+            }
+        }
+
+        int left_register = 0;
+        // Generate code to calculate left expression
+        if (left_const < 0)
+        {
+            ExpVarData exp_var_data{ register_id, register_id + 1 };
+            left->Accept(this, &exp_var_data);
+            left_register = register_id;
+        }
+
+        int right_register = 0;
+        // Generate code to calculate right expression
+        if (right_const < 0)
+        {
+            if (left_const >= 0)
+            {
+                // Left operand is const, then use the dst register as
+                // temp register of right expression
+                ExpVarData exp_var_data{ register_id, register_id + 1 };
+                right->Accept(this, &exp_var_data);
+                right_register = register_id;
+            }
+            else if (end_register != EXP_VALUE_COUNT_ANY && register_id + 1 < end_register)
+            {
+                // If parent AST provide more than one register, then use the second
+                // register as temp register of right expression
+                ExpVarData exp_var_data{ register_id + 1, register_id + 2 };
+                right->Accept(this, &exp_var_data);
+                right_register = register_id + 1;
+            }
+            else
+            {
+                // No more register, then generate a new register as temp register of
+                // right expression
+                REGISTER_GENERATOR_GUARD();
+                right_register = GenerateRegisterId();
+                ExpVarData exp_var_data{ right_register, right_register + 1 };
+                right->Accept(this, &exp_var_data);
+            }
+        }
+
+        return { left_const >= 0 ? left_const : left_register,
+                 right_const >= 0 ? right_const : right_register };
+    }
+
+    int CodeGenerateVisitor::JmpCondition(SyntaxTree *exp, bool jmp_when,
+                                          int register_id, int line)
+    {
+        auto function = GetCurrentFunction();
+        auto bin_exp = dynamic_cast<BinaryExpression *>(exp);
+        auto token = bin_exp ? bin_exp->op_token_.token_ : 0;
+        if (token == '<' || token == '>' ||
+            token == Token_LessEqual || token == Token_GreaterEqual ||
+            token == Token_Equal || token == Token_NotEqual)
+        {
+            // Compare operands and jump directly, the jump diff is in
+            // the next OpType_Jmp instruction
+            int left_const = -1;
+            int right_const = -1;
+            auto operands = BinaryOperands(bin_exp, register_id, register_id + 1,
+                                           left_const, right_const);
+
+            auto choose = [=](OpType rr, OpType rk, OpType kr) {
+                return ChooseOpType(rr, rk, kr, left_const, right_const);
+            };
+
+            // Result of '~=' is the opposite of result of '=='
+            OpType op_type;
+            int jmp_result = jmp_when ? 1 : 0;
+            switch (token) {
+                case '<': op_type = choose(OpType_JmpLess, OpType_JmpLessRK, OpType_JmpLessKR); break;
+                case '>': op_type = choose(OpType_JmpGreater, OpType_JmpGreaterRK, OpType_JmpGreaterKR); break;
+                case Token_LessEqual: op_type = choose(OpType_JmpLessEqual, OpType_JmpLessEqualRK, OpType_JmpLessEqualKR); break;
+                case Token_GreaterEqual: op_type = choose(OpType_JmpGreaterEqual, OpType_JmpGreaterEqualRK, OpType_JmpGreaterEqualKR); break;
+                case Token_Equal: op_type = choose(OpType_JmpEqual, OpType_JmpEqualRK, OpType_JmpEqualRK); break;
+                case Token_NotEqual: op_type = choose(OpType_JmpEqual, OpType_JmpEqualRK, OpType_JmpEqualRK); jmp_result ^= 1; break;
+                default: assert(0); break;
+            }
+
+            auto instruction = Instruction::ABCCode(op_type, jmp_result,
+                                                    operands.first, operands.second);
+            function->AddInstruction(instruction, bin_exp->op_token_.line_);
+            instruction = Instruction::sAxCode(OpType_Jmp, 0);
+            return function->AddInstruction(instruction, line);
+        }
+
+        // Jump directly when value of the const is jmp_when
+        bool value = false;
+        if (GetConstCondition(exp, value) && value == jmp_when)
+        {
+            auto instruction = Instruction::sAxCode(OpType_Jmp, 0);
+            return function->AddInstruction(instruction, line);
+        }
+
+        ExpVarData exp_var_data{ register_id, register_id + 1 };
+        exp->Accept(this, &exp_var_data);
+
+        auto op_type = jmp_when ? OpType_JmpTrue : OpType_JmpFalse;
+        auto instruction = Instruction::AsBxCode(op_type, register_id, 0);
+        return AddConditionalJump(instruction, line);
+    }
+
     template<typename StatementType>
     void CodeGenerateVisitor::IfStatementGenerateCode(StatementType *if_stmt)
     {
@@ -584,11 +1271,7 @@ namespace luna
         {
             REGISTER_GENERATOR_GUARD();
             auto register_id = GenerateRegisterId();
-            ExpVarData exp_var_data{ register_id, register_id + 1 };
-            if_stmt->exp_->Accept(this, &exp_var_data);
-
-            auto instruction = Instruction::AsBxCode(OpType_JmpFalse, register_id, 0);
-            int jmp_index = function->AddInstruction(instruction, if_stmt->line_);
+            int jmp_index = JmpFalse(if_stmt->exp_.get(), register_id, if_stmt->line_);
 
             {
                 // True branch block generate code
@@ -597,42 +1280,49 @@ namespace luna
             }
 
             // Jmp to the end of if-elseif-else statement after excute block
-            instruction = Instruction::AsBxCode(OpType_Jmp, 0, 0);
+            auto instruction = Instruction::sAxCode(OpType_Jmp, 0);
             jmp_end_index = function->AddInstruction(instruction, if_stmt->block_end_line_);
 
-            // Refill OpType_JmpFalse instruction
-            int index = function->OpCodeSize();
-            function->GetMutableInstruction(jmp_index)->RefillsBx(index - jmp_index);
+            // Refill jump of false condition
+            RefillJump(jmp_index, function->OpCodeSize());
         }
 
         if (if_stmt->false_branch_)
             if_stmt->false_branch_->Accept(this, nullptr);
 
         // Refill OpType_Jmp instruction
-        int end_index = function->OpCodeSize();
-        function->GetMutableInstruction(jmp_end_index)->RefillsBx(end_index - jmp_end_index);
+        RefillJump(jmp_end_index, function->OpCodeSize());
     }
 
     template<typename TableFieldType>
     void CodeGenerateVisitor::SetTableFieldValue(TableFieldType *field,
                                                  int table_register,
-                                                 int key_register,
+                                                 int key, bool key_const,
                                                  int line)
     {
-        // Load value
-        auto value_register = GenerateRegisterId();
-        ExpVarData exp_var_data{ value_register, value_register + 1 };
-        field->value_->Accept(this, &exp_var_data);
+        // Load value when it is not a const operand
+        auto value = AddConstOperand(field->value_.get());
+        auto value_const = value >= 0;
+        if (!value_const)
+        {
+            value = GenerateRegisterId();
+            ExpVarData exp_var_data{ value, value + 1 };
+            field->value_->Accept(this, &exp_var_data);
+        }
 
         // Set table field
-        auto instruction = Instruction::ABCCode(OpType_SetTable, table_register,
-                                                key_register, value_register);
+        OpType op_type;
+        if (key_const)
+            op_type = value_const ? OpType_SetTableKK : OpType_SetTableKR;
+        else
+            op_type = value_const ? OpType_SetTableRK : OpType_SetTable;
+        auto instruction = Instruction::ABCCode(op_type, table_register, key, value);
         GetCurrentFunction()->AddInstruction(instruction, line);
     }
 
     template<typename TableAccessorType, typename LoadKey>
     void CodeGenerateVisitor::AccessTableField(TableAccessorType *accessor,
-                                               void *data, int line,
+                                               void *data, int line, int key_const,
                                                const LoadKey &load_key)
     {
         auto exp_var_data = static_cast<ExpVarData *>(data);
@@ -640,6 +1330,10 @@ namespace luna
         auto end_register = exp_var_data->end_register_;
         auto function = GetCurrentFunction();
 
+        // String const key uses field access instruction
+        auto field = key_const >= 0 &&
+            function->GetConstValue(key_const)->type_ == ValueT_String;
+
         int table_register = 0;
         int key_register = 0;
         int value_register = 0;
@@ -650,13 +1344,18 @@ namespace luna
             if (end_register != EXP_VALUE_COUNT_ANY && register_id >= end_register)
                 return ;
 
-            if (end_register != EXP_VALUE_COUNT_ANY && register_id + 1 < end_register)
+            if (key_const >= 0)
+                key_register = key_const;
+            else if (end_register != EXP_VALUE_COUNT_ANY && register_id + 1 < end_register)
                 key_register = register_id + 1;
             else
                 key_register = GenerateRegisterId();
             table_register = register_id;
             value_register = register_id;
-            op_type = OpType_GetTable;
+            if (field)
+                op_type = OpType_GetField;
+            else
+                op_type = key_const >= 0 ? OpType_GetTableKR : OpType_GetTable;
         }
         else
         {
@@ -664,17 +1363,21 @@ namespace luna
             assert(register_id + 1 == end_register);
 
             table_register = GenerateRegisterId();
-            key_register = GenerateRegisterId();
+            key_register = key_const >= 0 ? key_const : GenerateRegisterId();
             value_register = register_id;
-            op_type = OpType_SetTable;
+            if (field)
+                op_type = OpType_SetField;
+            else
+                op_type = key_const >= 0 ? OpType_SetTableKR : OpType_SetTable;
         }
 
         // Load table
         ExpVarData table_exp_var_data{ table_register, table_register + 1 };
         accessor->table_->Accept(this, &table_exp_var_data);
 
-        // Load key
-        load_key(key_register);
+        // Load key when key is not a const operand
+        if (key_const < 0)
+            load_key(key_register);
 
         // Set/Get table value by key
         auto instruction = Instruction::ABCCode(op_type, table_register,
@@ -721,13 +1424,44 @@ namespace luna
         auto results = end_register == EXP_VALUE_COUNT_ANY ?
             EXP_VALUE_COUNT_ANY : end_register - start_register;
 
-        // Generate call instruction
         auto function = GetCurrentFunction();
-        auto instruction = Instruction::ABCCode(OpType_Call,
-                                                caller_register,
-                                                total_args + 1,
-                                                results + 1);
-        function->AddInstruction(instruction, func_call->line_);
+
+        // Copy code of known local function instead of calling it when
+        // counts of args and results are fixed
+        bool inlined = false;
+        if (adjust_args == 0 && total_args != EXP_VALUE_COUNT_ANY &&
+            results != EXP_VALUE_COUNT_ANY)
+        {
+            auto callee = GetInlineFunction(func_call->caller_.get());
+            if (callee)
+                inlined = InlineCall(callee, caller_register + 1, total_args,
+                                     results, func_call->line_);
+        }
+
+        // Calculate call of math function with one result by intrinsic
+        // instruction, which skips the call instruction unless the
+        // function is reassigned
+        if (!inlined && adjust_args == 0 && results == 1)
+        {
+            auto intrinsic = GetIntrinsic(func_call->caller_.get(), total_args);
+            if (intrinsic >= 0)
+            {
+                auto instruction = Instruction::ABCCode(OpType_Intrinsic,
+                                                        caller_register,
+                                                        intrinsic, total_args);
+                function->AddInstruction(instruction, func_call->line_);
+            }
+        }
+
+        // Generate call instruction
+        if (!inlined)
+        {
+            auto instruction = Instruction::ABCCode(OpType_Call,
+                                                    caller_register,
+                                                    total_args + 1,
+                                                    results + 1);
+            function->AddInstruction(instruction, func_call->line_);
+        }
 
         // Copy results of function call to dst registers
         // if end_register == EXP_VALUE_COUNT_ANY, then do not
@@ -760,7 +1494,8 @@ namespace luna
             closure->SetPrototype(function);
 
             // Put closure on stack
-            auto top = state_->stack_.top_++;
+            auto top = state_->CheckStack(state_->stack_.top_, 1);
+            state_->stack_.top_ = top + 1;
             top->closure_ = closure;
             top->type_ = ValueT_Closure;
         }
@@ -785,6 +1520,17 @@ namespace luna
         }
 
         auto function = GetCurrentFunction();
+        if (IsTailCall(ret_stmt))
+        {
+            // Results of the call are returned directly, so change the
+            // last call instruction to tail call
+            auto call = function->GetMutableInstruction(function->OpCodeSize() - 1);
+            assert(Instruction::GetOpCode(*call) == OpType_Call &&
+                   Instruction::GetParamA(*call) == register_id);
+            *call = Instruction::ABCCode(OpType_TailCall, register_id,
+                                         Instruction::GetParamB(*call), 0);
+        }
+
         auto instruction = Instruction::AsBxCode(OpType_Ret, register_id,
                                                  ret_stmt->exp_value_count_);
         function->AddInstruction(instruction, ret_stmt->line_);
@@ -794,7 +1540,7 @@ namespace luna
     {
         assert(break_stmt->loop_);
         auto function = GetCurrentFunction();
-        auto instruction = Instruction::AsBxCode(OpType_Jmp, 0, 0);
+        auto instruction = Instruction::sAxCode(OpType_Jmp, 0);
         int index = function->AddInstruction(instruction, break_stmt->break_.line_);
         AddLoopJumpInfo(break_stmt->loop_, index, LoopJumpInfo::JumpTail);
     }
@@ -810,21 +1556,26 @@ namespace luna
         CODE_GENERATE_GUARD(EnterBlock, LeaveBlock);
         LOOP_GUARD(while_stmt);
 
-        auto register_id = GenerateRegisterId();
-        ExpVarData exp_var_data{ register_id, register_id + 1 };
-        while_stmt->exp_->Accept(this, &exp_var_data);
-
-        // Jump to loop tail when expression is false
-        auto function = GetCurrentFunction();
-        auto instruction = Instruction::AsBxCode(OpType_JmpFalse, register_id, 0);
-        int index = function->AddInstruction(instruction, while_stmt->first_line_);
-        AddLoopJumpInfo(while_stmt, index, LoopJumpInfo::JumpTail);
+        // Jump to loop tail when expression is false, loop runs until
+        // break when expression is always true
+        bool value = false;
+        if (!GetConstCondition(while_stmt->exp_.get(), value) || !value)
+        {
+            auto register_id = GenerateRegisterId();
+            int index = JmpFalse(while_stmt->exp_.get(), register_id, while_stmt->first_line_);
+            AddLoopJumpInfo(while_stmt, index, LoopJumpInfo::JumpTail);
+        }
 
-        while_stmt->block_->Accept(this, nullptr);
+        {
+            // Local names of the body are fresh in each iteration
+            CODE_GENERATE_GUARD(EnterBlock, LeaveBlock);
+            while_stmt->block_->Accept(this, nullptr);
+        }
 
         // Jump to loop head
-        instruction = Instruction::AsBxCode(OpType_Jmp, 0, 0);
-        index = function->AddInstruction(instruction, while_stmt->last_line_);
+        auto function = GetCurrentFunction();
+        auto instruction = Instruction::sAxCode(OpType_Jmp, 0);
+        int index = function->AddInstruction(instruction, while_stmt->last_line_);
         AddLoopJumpInfo(while_stmt, index, LoopJumpInfo::JumpHead);
     }
 
@@ -832,21 +1583,31 @@ namespace luna
     {
         CODE_GENERATE_GUARD(EnterBlock, LeaveBlock);
         LOOP_GUARD(repeat_stmt);
+        bool has_local = false;
         {
-            REGISTER_GENERATOR_GUARD();
+            // Local names of the body are fresh in each iteration, and
+            // they are visible in exp
+            CODE_GENERATE_GUARD(EnterBlock, LeaveBlock);
             repeat_stmt->block_->Accept(this, nullptr);
-        }
+            has_local = !current_function_->current_block_->names_.empty();
 
-        // Get exp value
-        auto register_id = GenerateRegisterId();
-        ExpVarData exp_var_data{ register_id, register_id + 1 };
-        repeat_stmt->exp_->Accept(this, &exp_var_data);
+            // Jump to head when exp value is false if there are no local
+            // names, otherwise jump to tail when exp value is true, and
+            // close the local names before jump to head
+            auto register_id = GenerateRegisterId();
+            int index = JmpCondition(repeat_stmt->exp_.get(), has_local,
+                                     register_id, repeat_stmt->line_);
+            AddLoopJumpInfo(repeat_stmt, index, has_local ?
+                            LoopJumpInfo::JumpTail : LoopJumpInfo::JumpHead);
+        }
 
-        // Jump to head when exp value is true
-        auto function = GetCurrentFunction();
-        auto instruction = Instruction::AsBxCode(OpType_JmpFalse, register_id, 0);
-        int index = function->AddInstruction(instruction, repeat_stmt->line_);
-        AddLoopJumpInfo(repeat_stmt, index, LoopJumpInfo::JumpHead);
+        if (has_local)
+        {
+            auto function = GetCurrentFunction();
+            auto instruction = Instruction::sAxCode(OpType_Jmp, 0);
+            int index = function->AddInstruction(instruction, repeat_stmt->line_);
+            AddLoopJumpInfo(repeat_stmt, index, LoopJumpInfo::JumpHead);
+        }
     }
 
     void CodeGenerateVisitor::Visit(IfStatement *if_stmt, void *data)
@@ -903,43 +1664,39 @@ namespace luna
             }
         }
 
-        // Init 'for' var, limit, step value
-        auto instruction = Instruction::ABCCode(OpType_ForInit, var_register,
-                                                limit_register, step_register);
-        function->AddInstruction(instruction, line);
+        // Init 'for' var, limit, step value, jump to the end of the loop
+        // when the loop does not run
+        auto instruction = Instruction::AsBxCode(OpType_ForInit, var_register, 0);
+        int init_index = AddConditionalJump(instruction, line);
 
         LOOP_GUARD(num_for);
+        int body_index = function->OpCodeSize();
         {
             CODE_GENERATE_GUARD(EnterBlock, LeaveBlock);
 
-            // Check 'for', continue loop or not
-            instruction = Instruction::ABCCode(OpType_ForStep, var_register,
-                limit_register, step_register);
-            function->AddInstruction(instruction, line);
-
-            // Break loop, prepare to jump to the end of the loop
-            instruction.opcode_ = 0;
-            int index = function->AddInstruction(instruction, line);
-            AddLoopJumpInfo(num_for, index, LoopJumpInfo::JumpTail);
-
+            // Name register is set by OpType_ForInit and OpType_ForLoop
             auto name_register = GenerateRegisterId();
+            assert(name_register == step_register + 1);
             InsertName(num_for->name_.str_, name_register);
 
-            // Prepare name value
-            instruction = Instruction::ABCode(OpType_Move, name_register, var_register);
-            function->AddInstruction(instruction, line);
-
             num_for->block_->Accept(this, nullptr);
-
-            // var = var + step
-            instruction = Instruction::ABCCode(OpType_Add, var_register,
-                var_register, step_register);
-            function->AddInstruction(instruction, line);
         }
-        // Jump to the begin of the loop
-        instruction = Instruction::AsBxCode(OpType_Jmp, 0, 0);
-        int index = function->AddInstruction(instruction, line);
-        AddLoopJumpInfo(num_for, index, LoopJumpInfo::JumpHead);
+
+        // Choose loop instruction by sign of step when the step is known
+        auto op_type = OpType_ForLoop;
+        double step = 0.0;
+        if (!num_for->exp3_)
+            op_type = OpType_ForLoopInc;
+        else if (GetConstNumber(num_for->exp3_.get(), step))
+            op_type = step > 0.0 ? OpType_ForLoopInc : OpType_ForLoopDec;
+
+        // var = var + step, jump to the begin of the loop body when
+        // the loop continues
+        instruction = Instruction::AsBxCode(op_type, var_register, 0);
+        RefillJump(AddConditionalJump(instruction, line), body_index);
+
+        // Refill jump of OpType_ForInit
+        RefillJump(init_index, function->OpCodeSize());
     }
 
     void CodeGenerateVisitor::Visit(GenericForStatement *gen_for, void *data)
@@ -989,9 +1746,12 @@ namespace luna
             for (auto name = name_start; name < name_end; ++name, ++temp_func)
                 move(name, temp_func);
 
+            // Names are valid after results are copied to them
+            SetNamesBeginPc(name_start, name_end, function->OpCodeSize());
+
             // Break the loop when the first name value is nil
             instruction = Instruction::AsBxCode(OpType_JmpNil, name_start, 0);
-            int index = function->AddInstruction(instruction, line);
+            int index = AddConditionalJump(instruction, line);
             AddLoopJumpInfo(gen_for, index, LoopJumpInfo::JumpTail);
 
             // Copy first name value to var_register
@@ -1002,7 +1762,7 @@ namespace luna
         
 
         // Jump to loop start
-        auto instruction = Instruction::AsBxCode(OpType_Jmp, 0, 0);
+        auto instruction = Instruction::sAxCode(OpType_Jmp, 0);
         int index = function->AddInstruction(instruction, line);
         AddLoopJumpInfo(gen_for, index, LoopJumpInfo::JumpHead);
     }
@@ -1033,54 +1793,54 @@ namespace luna
         if (!has_member)
         {
             assert(func_name->names_.size() == 1);
-            Instruction instruction;
             if (func_name->scoping_ == LexicalScoping_Global)
             {
                 // Define a global function
                 auto index = function->AddConstString(first_name);
-                instruction = Instruction::ABxCode(OpType_SetGlobal, func_register, index);
+                AddConstInstruction(OpType_SetGlobal, func_register, index, first_line);
             }
             else if (func_name->scoping_ == LexicalScoping_Upvalue)
             {
                 // Change a upvalue to a function
                 auto index = PrepareUpvalue(first_name);
-                instruction = Instruction::ABCode(OpType_SetUpvalue, func_register, index);
+                auto instruction = Instruction::ABCode(OpType_SetUpvalue, func_register, index);
+                function->AddInstruction(instruction, first_line);
             }
             else if (func_name->scoping_ == LexicalScoping_Local)
             {
                 // Change a local variable to a function
                 auto local_name = SearchLocalName(first_name);
-                instruction = Instruction::ABCode(OpType_Move, local_name->register_id_,
-                                                  func_register);
+                auto instruction = Instruction::ABCode(OpType_Move, local_name->register_id_,
+                                                       func_register);
+                function->AddInstruction(instruction, first_line);
             }
-            function->AddInstruction(instruction, first_line);
         }
         else
         {
-            Instruction instruction;
             auto table_register = GenerateRegisterId();
             if (func_name->scoping_ == LexicalScoping_Global)
             {
                 // Load global variable to table register
                 auto index = function->AddConstString(first_name);
-                instruction = Instruction::ABxCode(OpType_GetGlobal,
-                                                   table_register, index);
+                AddConstInstruction(OpType_GetGlobal, table_register, index, first_line);
             }
             else if (func_name->scoping_ == LexicalScoping_Upvalue)
             {
                 // Load upvalue to table register
                 auto index = PrepareUpvalue(first_name);
-                instruction = Instruction::ABCode(OpType_GetUpvalue, table_register, index);
+                auto instruction = Instruction::ABCode(OpType_GetUpvalue, table_register, index);
+                function->AddInstruction(instruction, first_line);
             }
             else if (func_name->scoping_ == LexicalScoping_Local)
             {
                 // Load local variable to table register
                 auto local_name = SearchLocalName(first_name);
-                instruction = Instruction::ABCode(OpType_Move, table_register,
-                                                  local_name->register_id_);
+                auto instruction = Instruction::ABCode(OpType_Move, table_register,
+                                                       local_name->register_id_);
+                function->AddInstruction(instruction, first_line);
             }
-            function->AddInstruction(instruction, first_line);
 
+            Instruction instruction;
             bool member = func_name->member_name_.token_ == Token_Id;
             auto size = func_name->names_.size();
             auto count = member ? size : size - 1;
@@ -1088,8 +1848,7 @@ namespace luna
 
             auto load_key = [=](String *name, int line) {
                 auto index = function->AddConstString(name);
-                auto instruction = Instruction::ABxCode(OpType_LoadConst, key_register, index);
-                function->AddInstruction(instruction, line);
+                AddConstInstruction(OpType_LoadConst, key_register, index, line);
             };
 
             for (std::size_t i = 1; i < count; ++i)
@@ -1097,17 +1856,35 @@ namespace luna
                 // Get value from table by key
                 auto name = func_name->names_[i].str_;
                 auto line = func_name->names_[i].line_;
-                load_key(name, line);
-                instruction = Instruction::ABCCode(OpType_GetTable, table_register,
-                                                   key_register, table_register);
+                auto key_index = AddConstOperand(name);
+                if (key_index >= 0)
+                {
+                    instruction = Instruction::ABCCode(OpType_GetField, table_register,
+                                                       key_index, table_register);
+                }
+                else
+                {
+                    load_key(name, line);
+                    instruction = Instruction::ABCCode(OpType_GetTable, table_register,
+                                                       key_register, table_register);
+                }
                 function->AddInstruction(instruction, line);
             }
 
             // Set function as value of table by key 'token'
             const auto &token = member ? func_name->member_name_ : func_name->names_.back();
-            load_key(token.str_, token.line_);
-            instruction = Instruction::ABCCode(OpType_SetTable, table_register,
-                                               key_register, func_register);
+            auto key_index = AddConstOperand(token.str_);
+            if (key_index >= 0)
+            {
+                instruction = Instruction::ABCCode(OpType_SetField, table_register,
+                                                   key_index, func_register);
+            }
+            else
+            {
+                load_key(token.str_, token.line_);
+                instruction = Instruction::ABCCode(OpType_SetTable, table_register,
+                                                   key_register, func_register);
+            }
             function->AddInstruction(instruction, token.line_);
         }
     }
@@ -1118,6 +1895,16 @@ namespace luna
         InsertName(l_func_stmt->name_.str_, register_id);
         ExpVarData exp_var_data{ register_id, register_id + 1 };
         l_func_stmt->func_body_->Accept(this, &exp_var_data);
+
+        // Calls of the function can be inlined when the name is never
+        // assigned again, the function is the last child function
+        auto function = GetCurrentFunction();
+        auto child = function->GetChildFunction(function->GetChildFunctionCount() - 1);
+        if (!l_func_stmt->reassigned_ && CanInline(child))
+        {
+            auto &names = current_function_->current_block_->names_;
+            names[l_func_stmt->name_.str_].inline_function_ = child;
+        }
     }
 
     void CodeGenerateVisitor::Visit(LocalNameListStatement *l_namelist_stmt, void *data)
@@ -1223,8 +2010,7 @@ namespace luna
             if (term->scoping_ == LexicalScoping_Global)
             {
                 auto index = function->AddConstString(term->token_.str_);
-                auto instruction = Instruction::ABxCode(OpType_SetGlobal, register_id, index);
-                function->AddInstruction(instruction, term->token_.line_);
+                AddConstInstruction(OpType_SetGlobal, register_id, index, term->token_.line_);
             }
             else if (term->scoping_ == LexicalScoping_Local)
             {
@@ -1248,16 +2034,19 @@ namespace luna
             end_register != EXP_VALUE_COUNT_ANY && register_id >= end_register)
             return ;
 
-        if (term->token_.token_ == Token_Number || term->token_.token_ == Token_String)
+        if (term->token_.token_ == Token_Number ||
+            term->token_.token_ == Token_Integer ||
+            term->token_.token_ == Token_String)
         {
             // Load const to register
             auto index = 0;
             if (term->token_.token_ == Token_Number)
                 index = function->AddConstNumber(term->token_.number_);
+            else if (term->token_.token_ == Token_Integer)
+                index = function->AddConstInteger(term->token_.integer_);
             else
                 index = function->AddConstString(term->token_.str_);
-            auto instruction = Instruction::ABxCode(OpType_LoadConst, register_id++, index);
-            function->AddInstruction(instruction, term->token_.line_);
+            AddConstInstruction(OpType_LoadConst, register_id++, index, term->token_.line_);
         }
         else if (term->token_.token_ == Token_Id)
         {
@@ -1265,8 +2054,7 @@ namespace luna
             {
                 // Get value from global table by key index
                 auto index = function->AddConstString(term->token_.str_);
-                auto instruction = Instruction::ABxCode(OpType_GetGlobal, register_id++, index);
-                function->AddInstruction(instruction, term->token_.line_);
+                AddConstInstruction(OpType_GetGlobal, register_id++, index, term->token_.line_);
             }
             else if (term->scoping_ == LexicalScoping_Local)
             {
@@ -1333,70 +2121,87 @@ namespace luna
             // satisfy semantics of operator
             auto op_type = token == Token_And ? OpType_JmpFalse : OpType_JmpTrue;
             auto instruction = Instruction::AsBxCode(op_type, register_id, 0);
-            int index = function->AddInstruction(instruction, line);
+            int index = AddConditionalJump(instruction, line);
 
             // Calculate right expression
             ExpVarData right_data{ register_id, register_id + 1 };
             bin_exp->right_->Accept(this, &right_data);
 
-            int dst_index = function->OpCodeSize();
-            function->GetMutableInstruction(index)->RefillsBx(dst_index - index);
+            RefillJump(index, function->OpCodeSize());
 
             return FillRemainRegisterNil(register_id + 1, end_register, line);
         }
 
-        int left_register = 0;
-        // Generate code to calculate left expression
+        if (token == Token_Concat)
         {
-            ExpVarData exp_var_data{ register_id, register_id + 1 };
-            bin_exp->left_->Accept(this, &exp_var_data);
-            left_register = register_id;
-        }
-
-        int right_register = 0;
-        // Generate code to calculate right expression
-        {
-            if (end_register != EXP_VALUE_COUNT_ANY && register_id + 1 < end_register)
-            {
-                // If parent AST provide more than one register, then use the second
-                // register as temp register of right expression
-                ExpVarData exp_var_data{ register_id + 1, register_id + 2 };
-                bin_exp->right_->Accept(this, &exp_var_data);
-                right_register = register_id + 1;
-            }
-            else
+            // Concat chain of more than two operands is calculated by
+            // groups of operands, operands of a group are placed into
+            // new registers and concatenated by one instruction, result
+            // of the group is the first operand of the next group, half
+            // of free registers are used by a group, then operands have
+            // registers to calculate, binary concat is used when there
+            // are not enough registers
+            auto operands = GetConcatOperands(bin_exp);
+            int group = (MAX_FUNCTION_REGISTER_COUNT - GetNextRegisterId()) / 2;
+            if (operands.size() > 2 && group > 2)
             {
-                // No more register, then generate a new register as temp register of
-                // right expression
                 REGISTER_GENERATOR_GUARD();
-                right_register = GenerateRegisterId();
-                ExpVarData exp_var_data{ right_register, right_register + 1 };
-                bin_exp->right_->Accept(this, &exp_var_data);
+                int first_register = GenerateRegisterId();
+                ExpVarData first_data{ first_register, first_register + 1 };
+                operands[0]->Accept(this, &first_data);
+
+                std::size_t index = 1;
+                while (index < operands.size())
+                {
+                    int count = 1;
+                    for (; index < operands.size() && count < group; ++index, ++count)
+                    {
+                        auto operand_register = GenerateRegisterId();
+                        ExpVarData operand_data{ operand_register, operand_register + 1 };
+                        operands[index]->Accept(this, &operand_data);
+                    }
+
+                    auto dst = index < operands.size() ? first_register : register_id;
+                    auto instruction = Instruction::ABCCode(OpType_ConcatRange, dst,
+                                                            first_register, count);
+                    function->AddInstruction(instruction, line);
+                    ResetRegisterIdGenerator(first_register + 1);
+                }
+                return FillRemainRegisterNil(register_id + 1, end_register, line);
             }
         }
 
-        // Choose OpType by operator
+        int left_const = -1;
+        int right_const = -1;
+        auto operands = BinaryOperands(bin_exp, register_id, end_register,
+                                       left_const, right_const);
+
+        // Choose OpType by operator and kinds of operands
+        auto choose = [=](OpType rr, OpType rk, OpType kr) {
+            return ChooseOpType(rr, rk, kr, left_const, right_const);
+        };
+
         OpType op_type;
         switch (token) {
-            case '+': op_type = OpType_Add; break;
-            case '-': op_type = OpType_Sub; break;
-            case '*': op_type = OpType_Mul; break;
-            case '/': op_type = OpType_Div; break;
-            case '^': op_type = OpType_Pow; break;
-            case '%': op_type = OpType_Mod; break;
-            case '<': op_type = OpType_Less; break;
-            case '>': op_type = OpType_Greater; break;
+            case '+': op_type = choose(OpType_Add, OpType_AddRK, OpType_AddKR); break;
+            case '-': op_type = choose(OpType_Sub, OpType_SubRK, OpType_SubKR); break;
+            case '*': op_type = choose(OpType_Mul, OpType_MulRK, OpType_MulKR); break;
+            case '/': op_type = choose(OpType_Div, OpType_DivRK, OpType_DivKR); break;
+            case '^': op_type = choose(OpType_Pow, OpType_PowRK, OpType_PowKR); break;
+            case '%': op_type = choose(OpType_Mod, OpType_ModRK, OpType_ModKR); break;
+            case '<': op_type = choose(OpType_Less, OpType_LessRK, OpType_LessKR); break;
+            case '>': op_type = choose(OpType_Greater, OpType_GreaterRK, OpType_GreaterKR); break;
             case Token_Concat: op_type = OpType_Concat; break;
-            case Token_Equal: op_type = OpType_Equal; break;
-            case Token_NotEqual: op_type = OpType_UnEqual; break;
-            case Token_LessEqual: op_type = OpType_LessEqual; break;
-            case Token_GreaterEqual: op_type = OpType_GreaterEqual; break;
+            case Token_Equal: op_type = choose(OpType_Equal, OpType_EqualRK, OpType_EqualRK); break;
+            case Token_NotEqual: op_type = choose(OpType_UnEqual, OpType_UnEqualRK, OpType_UnEqualRK); break;
+            case Token_LessEqual: op_type = choose(OpType_LessEqual, OpType_LessEqualRK, OpType_LessEqualKR); break;
+            case Token_GreaterEqual: op_type = choose(OpType_GreaterEqual, OpType_GreaterEqualRK, OpType_GreaterEqualKR); break;
             default: assert(0); break;
         }
 
         // Generate instruction to calculate
         auto instruction = Instruction::ABCCode(op_type, register_id++,
-                                                left_register, right_register);
+                                                operands.first, operands.second);
         function->AddInstruction(instruction, line);
 
         FillRemainRegisterNil(register_id, end_register, line);
@@ -1466,6 +2271,13 @@ namespace luna
         if (end_register == EXP_VALUE_COUNT_ANY || register_id < end_register)
         {
             auto function = GetCurrentFunction();
+            if (child_index > kMaxBx)
+            {
+                throw CodeGenerateException(
+                    function->GetModule()->GetCStr(), func_body->line_,
+                    "too many functions in function");
+            }
+
             auto i = Instruction::ABxCode(OpType_Closure,
                                           register_id++,
                                           child_index);
@@ -1542,12 +2354,17 @@ namespace luna
         auto field_data = static_cast<TableFieldData *>(data);
         auto table_register = field_data->table_register_;
 
-        // Load key
-        auto key_register = GenerateRegisterId();
-        ExpVarData exp_var_data{ key_register, key_register + 1 };
-        field->index_->Accept(this, &exp_var_data);
+        // Load key when it is not a const operand
+        auto key = AddConstOperand(field->index_.get());
+        auto key_const = key >= 0;
+        if (!key_const)
+        {
+            key = GenerateRegisterId();
+            ExpVarData exp_var_data{ key, key + 1 };
+            field->index_->Accept(this, &exp_var_data);
+        }
 
-        SetTableFieldValue(field, table_register, key_register, field->line_);
+        SetTableFieldValue(field, table_register, key, key_const, field->line_);
     }
 
     void CodeGenerateVisitor::Visit(TableNameField *field, void *data)
@@ -1555,14 +2372,18 @@ namespace luna
         auto field_data = static_cast<TableFieldData *>(data);
         auto table_register = field_data->table_register_;
 
-        // Load key
-        auto function = GetCurrentFunction();
-        auto key_index = function->AddConstString(field->name_.str_);
-        auto key_register = GenerateRegisterId();
-        auto instruction = Instruction::ABxCode(OpType_LoadConst, key_register, key_index);
-        function->AddInstruction(instruction, field->name_.line_);
+        // Load key when it is not a const operand
+        auto key = AddConstOperand(field->name_.str_);
+        auto key_const = key >= 0;
+        if (!key_const)
+        {
+            auto function = GetCurrentFunction();
+            auto key_index = function->AddConstString(field->name_.str_);
+            key = GenerateRegisterId();
+            AddConstInstruction(OpType_LoadConst, key, key_index, field->name_.line_);
+        }
 
-        SetTableFieldValue(field, table_register, key_register, field->name_.line_);
+        SetTableFieldValue(field, table_register, key, key_const, field->name_.line_);
     }
 
     void CodeGenerateVisitor::Visit(TableArrayField *field, void *data)
@@ -1578,12 +2399,13 @@ namespace luna
         instruction.opcode_ = field_data->array_index_++;
         function->AddInstruction(instruction, field->line_);
 
-        SetTableFieldValue(field, table_register, key_register, field->line_);
+        SetTableFieldValue(field, table_register, key_register, false, field->line_);
     }
 
     void CodeGenerateVisitor::Visit(IndexAccessor *accessor, void *data)
     {
         AccessTableField(accessor, data, accessor->line_,
+                         AddConstOperand(accessor->index_.get()),
                          [=](int key_register) {
                              ExpVarData data{ key_register, key_register + 1 };
                              accessor->index_->Accept(this, &data);
@@ -1593,14 +2415,13 @@ namespace luna
     void CodeGenerateVisitor::Visit(MemberAccessor *accessor, void *data)
     {
         AccessTableField(accessor, data, accessor->member_.line_,
+                         AddConstOperand(accessor->member_.str_),
                          [=](int key_register) {
                              auto function = GetCurrentFunction();
                              auto key_index = function->
                                 AddConstString(accessor->member_.str_);
-                             auto instruction = Instruction::
-                                ABxCode(OpType_LoadConst, key_register, key_index);
-                             function->AddInstruction(instruction,
-                                                      accessor->member_.line_);
+                             AddConstInstruction(OpType_LoadConst, key_register,
+                                                 key_index, accessor->member_.line_);
                          });
     }
 
@@ -1613,22 +2434,41 @@ namespace luna
     {
         FunctionCall(func_call, data, [=](int caller_register) {
             auto function = GetCurrentFunction();
-            // Copy table to arg_register as first argument
             auto arg_register = GenerateRegisterId();
+
+            // Get method and copy table as first argument by one instruction
+            auto key_index = AddConstOperand(func_call->member_.str_);
+            if (key_index >= 0 && arg_register == caller_register + 1)
+            {
+                auto instruction = Instruction::ABCode(OpType_Self, caller_register, key_index);
+                function->AddInstruction(instruction, func_call->member_.line_);
+                return 1;
+            }
+
+            // Copy table to arg_register as first argument
             auto instruction = Instruction::ABCode(OpType_Move, arg_register, caller_register);
             function->AddInstruction(instruction, func_call->member_.line_);
 
             {
                 REGISTER_GENERATOR_GUARD();
-                // Get key
-                auto index = function->AddConstString(func_call->member_.str_);
-                auto key_register = GenerateRegisterId();
-                instruction = Instruction::ABxCode(OpType_LoadConst, key_register, index);
-                function->AddInstruction(instruction, func_call->member_.line_);
-
-                // Get caller function from table
-                instruction = Instruction::ABCCode(OpType_GetTable, caller_register,
-                                                   key_register, caller_register);
+                // Get caller function from table by const key
+                if (key_index >= 0)
+                {
+                    instruction = Instruction::ABCCode(OpType_GetField, caller_register,
+                                                       key_index, caller_register);
+                }
+                else
+                {
+                    // Get key
+                    auto index = function->AddConstString(func_call->member_.str_);
+                    auto key_register = GenerateRegisterId();
+                    AddConstInstruction(OpType_LoadConst, key_register, index,
+                                        func_call->member_.line_);
+
+                    // Get caller function from table
+                    instruction = Instruction::ABCCode(OpType_GetTable, caller_register,
+                                                       key_register, caller_register);
+                }
                 function->AddInstruction(instruction, func_call->member_.line_);
             }
 
@@ -0,0 +1,647 @@
+#include "ConstantFold.h"
+#include "Visitor.h"
+#include "State.h"
+#include "String.h"
+#include "Value.h"
+#include "Arith.h"
+#include <string>
+#include <math.h>
+#include <assert.h>
+
+namespace luna
+{
+    // Folding result of an AST node
+    struct FoldData
+    {
+        // The node replaces the visited node when it is not null
+        std::unique_ptr<SyntaxTree> replace_;
+        // The visited node is removed
+        bool remove_;
+        // The visited statement never goes to the next statement,
+        // it returns or breaks
+        bool terminate_;
+
+        FoldData() : remove_(false), terminate_(false) { }
+    };
+
+    class ConstantFoldVisitor : public Visitor
+    {
+    public:
+        virtual void Visit(Chunk *, void *);
+        virtual void Visit(Block *, void *);
+        virtual void Visit(ReturnStatement *, void *);
+        virtual void Visit(BreakStatement *, void *);
+        virtual void Visit(DoStatement *, void *);
+        virtual void Visit(WhileStatement *, void *);
+        virtual void Visit(RepeatStatement *, void *);
+        virtual void Visit(IfStatement *, void *);
+        virtual void Visit(ElseIfStatement *, void *);
+        virtual void Visit(ElseStatement *, void *);
+        virtual void Visit(NumericForStatement *, void *);
+        virtual void Visit(GenericForStatement *, void *);
+        virtual void Visit(FunctionStatement *, void *);
+        virtual void Visit(FunctionName *, void *);
+        virtual void Visit(LocalFunctionStatement *, void *);
+        virtual void Visit(LocalNameListStatement *, void *);
+        virtual void Visit(AssignmentStatement *, void *);
+        virtual void Visit(VarList *, void *);
+        virtual void Visit(Terminator *, void *);
+        virtual void Visit(BinaryExpression *, void *);
+        virtual void Visit(UnaryExpression *, void *);
+        virtual void Visit(FunctionBody *, void *);
+        virtual void Visit(ParamList *, void *);
+        virtual void Visit(NameList *, void *);
+        virtual void Visit(TableDefine *, void *);
+        virtual void Visit(TableIndexField *, void *);
+        virtual void Visit(TableNameField *, void *);
+        virtual void Visit(TableArrayField *, void *);
+        virtual void Visit(IndexAccessor *, void *);
+        virtual void Visit(MemberAccessor *, void *);
+        virtual void Visit(NormalFuncCall *, void *);
+        virtual void Visit(MemberFuncCall *, void *);
+        virtual void Visit(FuncCallArgs *, void *);
+        virtual void Visit(ExpressionList *, void *);
+
+        explicit ConstantFoldVisitor(State *state) : state_(state) { }
+
+        // Fold the AST node, and replace or remove it by the folding
+        // result, return true when the node is a statement which never
+        // goes to the next statement
+        bool Fold(std::unique_ptr<SyntaxTree> &node)
+        {
+            FoldData fold_data;
+            node->Accept(this, &fold_data);
+            if (fold_data.remove_)
+                node.reset();
+            else if (fold_data.replace_)
+                node = std::move(fold_data.replace_);
+            return fold_data.terminate_;
+        }
+
+    private:
+        // Replace the visited node by the folded node, remove the
+        // visited node when the node is null
+        void ReplaceBy(std::unique_ptr<SyntaxTree> node, void *data)
+        {
+            auto fold_data = static_cast<FoldData *>(data);
+            if (node)
+                fold_data->terminate_ = Fold(node);
+            fold_data->remove_ = !node;
+            fold_data->replace_ = std::move(node);
+        }
+
+        // Replace the visited expression by a const terminator
+        static void ReplaceByConst(const TokenDetail &token, void *data)
+        {
+            auto term = new Terminator(token);
+            term->semantic_ = SemanticOp_Read;
+            static_cast<FoldData *>(data)->replace_.reset(term);
+        }
+
+        template<typename StatementType>
+        void IfStatementFold(StatementType *if_stmt, void *data);
+
+        // Branch which replaces the if statement when the condition is
+        // always true, if statement becomes a do statement and elseif
+        // statement becomes an else statement
+        static std::unique_ptr<SyntaxTree> TrueBranch(IfStatement *if_stmt)
+        {
+            return std::unique_ptr<SyntaxTree>(
+                new DoStatement(std::move(if_stmt->true_branch_)));
+        }
+
+        static std::unique_ptr<SyntaxTree> TrueBranch(ElseIfStatement *elseif_stmt)
+        {
+            return std::unique_ptr<SyntaxTree>(
+                new ElseStatement(std::move(elseif_stmt->true_branch_)));
+        }
+
+        // Branch which replaces the if statement when the condition is
+        // always false, elseif and else branch of if statement become
+        // if statement and do statement
+        static std::unique_ptr<SyntaxTree> FalseBranch(IfStatement *if_stmt)
+        {
+            auto branch = if_stmt->false_branch_.get();
+            if (auto elseif_stmt = dynamic_cast<ElseIfStatement *>(branch))
+            {
+                return std::unique_ptr<SyntaxTree>(
+                    new IfStatement(std::move(elseif_stmt->exp_),
+                                    std::move(elseif_stmt->true_branch_),
+                                    std::move(elseif_stmt->false_branch_),
+                                    elseif_stmt->line_,
+                                    elseif_stmt->block_end_line_));
+            }
+            if (auto else_stmt = dynamic_cast<ElseStatement *>(branch))
+            {
+                return std::unique_ptr<SyntaxTree>(
+                    new DoStatement(std::move(else_stmt->block_)));
+            }
+            return nullptr;
+        }
+
+        static std::unique_ptr<SyntaxTree> FalseBranch(ElseIfStatement *elseif_stmt)
+        {
+            return std::move(elseif_stmt->false_branch_);
+        }
+
+        bool FoldBinary(int op, const TokenDetail &left,
+                        const TokenDetail &right, TokenDetail &result);
+
+        State *state_;
+    };
+
+    // Get the terminator when the expression is a const
+    static const Terminator * GetConstTerm(const SyntaxTree *exp)
+    {
+        auto term = dynamic_cast<const Terminator *>(exp);
+        if (!term)
+            return nullptr;
+
+        switch (term->token_.token_)
+        {
+            case Token_Nil: case Token_True: case Token_False:
+            case Token_Number: case Token_Integer: case Token_String:
+                return term;
+            default:
+                return nullptr;
+        }
+    }
+
+    // Expression may have any count values
+    static bool IsMultiResults(const SyntaxTree *exp)
+    {
+        if (dynamic_cast<const NormalFuncCall *>(exp) ||
+            dynamic_cast<const MemberFuncCall *>(exp))
+            return true;
+        auto term = dynamic_cast<const Terminator *>(exp);
+        return term && term->token_.token_ == Token_VarArg;
+    }
+
+    static bool IsFalse(const TokenDetail &token)
+    {
+        return token.token_ == Token_Nil || token.token_ == Token_False;
+    }
+
+    static bool IsNumber(const TokenDetail &token)
+    {
+        return token.token_ == Token_Number || token.token_ == Token_Integer;
+    }
+
+    static double GetNumber(const TokenDetail &token)
+    {
+        return token.token_ == Token_Integer ?
+            static_cast<double>(token.integer_) : token.number_;
+    }
+
+    static void SetBool(TokenDetail &token, bool bvalue)
+    {
+        token.token_ = bvalue ? Token_True : Token_False;
+    }
+
+    // Integer which Value can not hold is not folded, arithmetic
+    // reports it at run time
+    static bool SetInteger(TokenDetail &token, long long integer)
+    {
+        if (!IntegerFitsValue(integer))
+            return false;
+        token.token_ = Token_Integer;
+        token.integer_ = integer;
+        return true;
+    }
+
+    // NaN and zero float are not folded, NaN is not equal to itself
+    // and zero may be -0.0, they are not safe in const table
+    static bool SetNumber(TokenDetail &token, double number)
+    {
+        if (isnan(number) || number == 0.0)
+            return false;
+        token.token_ = Token_Number;
+        token.number_ = number;
+        return true;
+    }
+
+    // Same as operator == of Value
+    static bool IsEqual(const TokenDetail &left, const TokenDetail &right)
+    {
+        if (IsNumber(left) && IsNumber(right))
+        {
+            if (left.token_ == Token_Integer && right.token_ == Token_Integer)
+                return left.integer_ == right.integer_;
+            if (left.token_ == Token_Number && right.token_ == Token_Number)
+                return left.number_ == right.number_;
+            if (left.token_ == Token_Number)
+                return EqualNumberInteger(left.number_, right.integer_);
+            return EqualNumberInteger(right.number_, left.integer_);
+        }
+
+        if (left.token_ != right.token_)
+            return false;
+        // Same strings are the same instance String
+        if (left.token_ == Token_String)
+            return left.str_ == right.str_;
+        return true;
+    }
+
+    // Fold binary operation of const operands, return false when the
+    // operation is not folded and it is left to run time, errors are
+    // always reported at run time
+    bool ConstantFoldVisitor::FoldBinary(int op, const TokenDetail &left,
+                                         const TokenDetail &right,
+                                         TokenDetail &result)
+    {
+        bool integer = left.token_ == Token_Integer &&
+                       right.token_ == Token_Integer;
+        switch (op)
+        {
+            case '+': case '-': case '*': case '/': case '^': case '%':
+                if (!IsNumber(left) || !IsNumber(right))
+                    return false;
+                break;
+            case '<': case '>': case Token_LessEqual: case Token_GreaterEqual:
+                if (left.token_ == Token_String && right.token_ == Token_String)
+                {
+                    switch (op)
+                    {
+                        case '<': SetBool(result, *left.str_ < *right.str_); break;
+                        case '>': SetBool(result, *left.str_ > *right.str_); break;
+                        case Token_LessEqual: SetBool(result, *left.str_ <= *right.str_); break;
+                        default: SetBool(result, *left.str_ >= *right.str_); break;
+                    }
+                    return true;
+                }
+                if (!IsNumber(left) || !IsNumber(right))
+                    return false;
+                break;
+            case Token_Equal:
+                SetBool(result, IsEqual(left, right));
+                return true;
+            case Token_NotEqual:
+                SetBool(result, !IsEqual(left, right));
+                return true;
+            case Token_Concat:
+            {
+                // Float operands are converted to string at run time
+                auto is_operand = [](const TokenDetail &t) {
+                    return t.token_ == Token_String || t.token_ == Token_Integer;
+                };
+                if (!is_operand(left) || !is_operand(right) ||
+                    (left.token_ != Token_String && right.token_ != Token_String))
+                    return false;
+
+                auto to_string = [](const TokenDetail &t) {
+                    return t.token_ == Token_String ?
+                        t.str_->GetStdString() : std::to_string(t.integer_);
+                };
+                result.token_ = Token_String;
+                result.str_ = state_->GetString(to_string(left) + to_string(right));
+                return true;
+            }
+            default:
+                return false;
+        }
+
+        double x = GetNumber(left);
+        double y = GetNumber(right);
+        switch (op)
+        {
+            case '+':
+                if (!integer) return SetNumber(result, x + y);
+                return SetInteger(result, IntegerAdd(left.integer_, right.integer_));
+            case '-':
+                if (!integer) return SetNumber(result, x - y);
+                return SetInteger(result, IntegerSub(left.integer_, right.integer_));
+            case '*':
+                if (!integer) return SetNumber(result, x * y);
+                return SetInteger(result, IntegerMul(left.integer_, right.integer_));
+            case '/':
+                return SetNumber(result, x / y);
+            case '^':
+                return SetNumber(result, pow(x, y));
+            case '%':
+                if (!integer) return SetNumber(result, fmod(x, y));
+                // Integer modulo by zero is an error at run time
+                if (right.integer_ == 0)
+                    return false;
+                return SetInteger(result, IntegerMod(left.integer_, right.integer_));
+            case '<':
+                SetBool(result, integer ? left.integer_ < right.integer_ : x < y);
+                return true;
+            case '>':
+                SetBool(result, integer ? left.integer_ > right.integer_ : x > y);
+                return true;
+            case Token_LessEqual:
+                SetBool(result, integer ? left.integer_ <= right.integer_ : x <= y);
+                return true;
+            default:
+                SetBool(result, integer ? left.integer_ >= right.integer_ : x >= y);
+                return true;
+        }
+    }
+
+    void ConstantFoldVisitor::Visit(Chunk *chunk, void *data)
+    {
+        Fold(chunk->block_);
+    }
+
+    void ConstantFoldVisitor::Visit(Block *block, void *data)
+    {
+        auto fold_data = static_cast<FoldData *>(data);
+        auto &statements = block->statements_;
+
+        // Remove folded away statements and statements after the
+        // statement which returns or breaks, they are unreachable
+        std::size_t count = 0;
+        for (std::size_t i = 0; i < statements.size() && !fold_data->terminate_; ++i)
+        {
+            fold_data->terminate_ = Fold(statements[i]);
+            if (statements[i])
+                statements[count++] = std::move(statements[i]);
+        }
+        statements.resize(count);
+
+        if (block->return_stmt_)
+        {
+            if (fold_data->terminate_)
+                block->return_stmt_.reset();
+            else
+                fold_data->terminate_ = Fold(block->return_stmt_);
+        }
+    }
+
+    void ConstantFoldVisitor::Visit(ReturnStatement *ret_stmt, void *data)
+    {
+        if (ret_stmt->exp_list_)
+            Fold(ret_stmt->exp_list_);
+        static_cast<FoldData *>(data)->terminate_ = true;
+    }
+
+    void ConstantFoldVisitor::Visit(BreakStatement *break_stmt, void *data)
+    {
+        static_cast<FoldData *>(data)->terminate_ = true;
+    }
+
+    void ConstantFoldVisitor::Visit(DoStatement *do_stmt, void *data)
+    {
+        static_cast<FoldData *>(data)->terminate_ = Fold(do_stmt->block_);
+    }
+
+    void ConstantFoldVisitor::Visit(WhileStatement *while_stmt, void *data)
+    {
+        Fold(while_stmt->exp_);
+
+        // Loop never runs when the condition is always false
+        auto term = GetConstTerm(while_stmt->exp_.get());
+        if (term && IsFalse(term->token_))
+        {
+            static_cast<FoldData *>(data)->remove_ = true;
+            return ;
+        }
+
+        Fold(while_stmt->block_);
+    }
+
+    void ConstantFoldVisitor::Visit(RepeatStatement *repeat_stmt, void *data)
+    {
+        Fold(repeat_stmt->block_);
+        Fold(repeat_stmt->exp_);
+    }
+
+    template<typename StatementType>
+    void ConstantFoldVisitor::IfStatementFold(StatementType *if_stmt, void *data)
+    {
+        Fold(if_stmt->exp_);
+
+        // Only the branch which always runs is kept when the condition
+        // is a const
+        if (auto term = GetConstTerm(if_stmt->exp_.get()))
+        {
+            if (IsFalse(term->token_))
+                ReplaceBy(FalseBranch(if_stmt), data);
+            else
+                ReplaceBy(TrueBranch(if_stmt), data);
+            return ;
+        }
+
+        bool true_terminate = Fold(if_stmt->true_branch_);
+        bool false_terminate = false;
+        if (if_stmt->false_branch_)
+            false_terminate = Fold(if_stmt->false_branch_);
+
+        // The statement never goes to the next statement when all
+        // branches return or break
+        static_cast<FoldData *>(data)->terminate_ =
+            true_terminate && false_terminate && if_stmt->false_branch_;
+    }
+
+    void ConstantFoldVisitor::Visit(IfStatement *if_stmt, void *data)
+    {
+        IfStatementFold(if_stmt, data);
+    }
+
+    void ConstantFoldVisitor::Visit(ElseIfStatement *elseif_stmt, void *data)
+    {
+        IfStatementFold(elseif_stmt, data);
+    }
+
+    void ConstantFoldVisitor::Visit(ElseStatement *else_stmt, void *data)
+    {
+        static_cast<FoldData *>(data)->terminate_ = Fold(else_stmt->block_);
+    }
+
+    void ConstantFoldVisitor::Visit(NumericForStatement *num_for, void *data)
+    {
+        Fold(num_for->exp1_);
+        Fold(num_for->exp2_);
+        if (num_for->exp3_)
+            Fold(num_for->exp3_);
+        Fold(num_for->block_);
+    }
+
+    void ConstantFoldVisitor::Visit(GenericForStatement *gen_for, void *data)
+    {
+        Fold(gen_for->exp_list_);
+        Fold(gen_for->block_);
+    }
+
+    void ConstantFoldVisitor::Visit(FunctionStatement *func_stmt, void *data)
+    {
+        Fold(func_stmt->func_body_);
+    }
+
+    void ConstantFoldVisitor::Visit(FunctionName *func_name, void *data)
+    {
+    }
+
+    void ConstantFoldVisitor::Visit(LocalFunctionStatement *l_func_stmt, void *data)
+    {
+        Fold(l_func_stmt->func_body_);
+    }
+
+    void ConstantFoldVisitor::Visit(LocalNameListStatement *l_namelist_stmt, void *data)
+    {
+        if (l_namelist_stmt->exp_list_)
+            Fold(l_namelist_stmt->exp_list_);
+    }
+
+    void ConstantFoldVisitor::Visit(AssignmentStatement *assign_stmt, void *data)
+    {
+        Fold(assign_stmt->var_list_);
+        Fold(assign_stmt->exp_list_);
+    }
+
+    void ConstantFoldVisitor::Visit(VarList *var_list, void *data)
+    {
+        for (auto &var : var_list->var_list_)
+            Fold(var);
+    }
+
+    void ConstantFoldVisitor::Visit(Terminator *term, void *data)
+    {
+    }
+
+    void ConstantFoldVisitor::Visit(BinaryExpression *binary_exp, void *data)
+    {
+        Fold(binary_exp->left_);
+        Fold(binary_exp->right_);
+
+        auto left = GetConstTerm(binary_exp->left_.get());
+        if (!left)
+            return ;
+
+        // Result of 'and' and 'or' is one of the operands, the right
+        // operand is kept when it may have any count values
+        auto op = binary_exp->op_token_.token_;
+        if (op == Token_And || op == Token_Or)
+        {
+            auto fold_data = static_cast<FoldData *>(data);
+            if (IsFalse(left->token_) == (op == Token_And))
+                fold_data->replace_ = std::move(binary_exp->left_);
+            else if (!IsMultiResults(binary_exp->right_.get()))
+                fold_data->replace_ = std::move(binary_exp->right_);
+            return ;
+        }
+
+        auto right = GetConstTerm(binary_exp->right_.get());
+        if (!right)
+            return ;
+
+        auto result = binary_exp->op_token_;
+        if (FoldBinary(op, left->token_, right->token_, result))
+            ReplaceByConst(result, data);
+    }
+
+    void ConstantFoldVisitor::Visit(UnaryExpression *unary_exp, void *data)
+    {
+        Fold(unary_exp->exp_);
+
+        auto term = GetConstTerm(unary_exp->exp_.get());
+        if (!term)
+            return ;
+
+        auto &operand = term->token_;
+        auto result = unary_exp->op_token_;
+        switch (unary_exp->op_token_.token_)
+        {
+            case '-':
+                if (operand.token_ == Token_Integer)
+                {
+                    if (!SetInteger(result, IntegerSub(0, operand.integer_)))
+                        return ;
+                }
+                else if (operand.token_ != Token_Number ||
+                         !SetNumber(result, -operand.number_))
+                    return ;
+                break;
+            case Token_Not:
+                SetBool(result, IsFalse(operand));
+                break;
+            case '#':
+                if (operand.token_ != Token_String)
+                    return ;
+                if (!SetInteger(result, operand.str_->GetLength()))
+                    return ;
+                break;
+            default:
+                return ;
+        }
+        ReplaceByConst(result, data);
+    }
+
+    void ConstantFoldVisitor::Visit(FunctionBody *func_body, void *data)
+    {
+        Fold(func_body->block_);
+    }
+
+    void ConstantFoldVisitor::Visit(ParamList *par_list, void *data)
+    {
+    }
+
+    void ConstantFoldVisitor::Visit(NameList *name_list, void *data)
+    {
+    }
+
+    void ConstantFoldVisitor::Visit(TableDefine *table_def, void *data)
+    {
+        for (auto &field : table_def->fields_)
+            Fold(field);
+    }
+
+    void ConstantFoldVisitor::Visit(TableIndexField *table_i_field, void *data)
+    {
+        Fold(table_i_field->index_);
+        Fold(table_i_field->value_);
+    }
+
+    void ConstantFoldVisitor::Visit(TableNameField *table_n_field, void *data)
+    {
+        Fold(table_n_field->value_);
+    }
+
+    void ConstantFoldVisitor::Visit(TableArrayField *table_a_field, void *data)
+    {
+        Fold(table_a_field->value_);
+    }
+
+    void ConstantFoldVisitor::Visit(IndexAccessor *i_accessor, void *data)
+    {
+        Fold(i_accessor->table_);
+        Fold(i_accessor->index_);
+    }
+
+    void ConstantFoldVisitor::Visit(MemberAccessor *m_accessor, void *data)
+    {
+        Fold(m_accessor->table_);
+    }
+
+    void ConstantFoldVisitor::Visit(NormalFuncCall *n_func_call, void *data)
+    {
+        Fold(n_func_call->caller_);
+        Fold(n_func_call->args_);
+    }
+
+    void ConstantFoldVisitor::Visit(MemberFuncCall *m_func_call, void *data)
+    {
+        Fold(m_func_call->caller_);
+        Fold(m_func_call->args_);
+    }
+
+    void ConstantFoldVisitor::Visit(FuncCallArgs *call_args, void *data)
+    {
+        if (call_args->arg_)
+            Fold(call_args->arg_);
+    }
+
+    void ConstantFoldVisitor::Visit(ExpressionList *exp_list, void *data)
+    {
+        for (auto &exp : exp_list->exp_list_)
+            Fold(exp);
+    }
+
+    void ConstantFold(SyntaxTree *root, State *state)
+    {
+        assert(root && state);
+        ConstantFoldVisitor constant_fold(state);
+        FoldData fold_data;
+        root->Accept(&constant_fold, &fold_data);
+    }
+} // namespace luna
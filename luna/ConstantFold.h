@@ -0,0 +1,16 @@
+#ifndef CONSTANT_FOLD_H
+#define CONSTANT_FOLD_H
+
+#include "SyntaxTree.h"
+
+namespace luna
+{
+    class State;
+
+    // Fold expressions of constant operands, prune branches of constant
+    // conditions and remove statements after return and break, the AST
+    // is analysed by SemanticAnalysis before folding
+    void ConstantFold(SyntaxTree *root, State *state);
+}
+
+#endif // CONSTANT_FOLD_H
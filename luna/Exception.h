@@ -50,6 +50,17 @@ namespace luna
         }
     };
 
+    // Native module can not be loaded, or it is not compiled by this
+    // luna, this exception will be throwed
+    class NativeModuleFail : public Exception
+    {
+    public:
+        NativeModuleFail(const std::string &module, const char *desc)
+        {
+            SetWhat(module, ": ", desc);
+        }
+    };
+
     // For lexer report error of token
     class LexException : public Exception
     {
@@ -109,6 +120,16 @@ namespace luna
         }
     };
 
+    // Report error of stack overflow
+    class StackOverflowException : public Exception
+    {
+    public:
+        StackOverflowException()
+        {
+            SetWhat("stack overflow");
+        }
+    };
+
     // For VM report runtime error
     class RuntimeException : public Exception
     {
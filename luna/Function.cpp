@@ -1,14 +1,30 @@
 #include "Function.h"
+#include "Jit.h"
+#include "NativeCode.h"
 #include <limits>
+#include <stdint.h>
+#include <string.h>
 
 namespace luna
 {
     Function::Function()
-        : module_(nullptr), line_(0), args_(0),
-          is_vararg_(false), superior_(nullptr)
+        : module_(nullptr), line_(0), args_(0), register_count_(0),
+          is_vararg_(false), superior_(nullptr), jit_(nullptr),
+          call_count_(0)
     {
     }
 
+    Function::~Function()
+    {
+        if (jit_)
+            jit_->ForgetFunction(this);
+    }
+
+    void Function::SetNativeCode(std::unique_ptr<NativeCode> native)
+    {
+        native_code_ = std::move(native);
+    }
+
     void Function::Accept(GCObjectVisitor *v)
     {
         if (v->Visit(this))
@@ -32,11 +48,6 @@ namespace luna
         }
     }
 
-    const Instruction * Function::GetOpCodes() const
-    {
-        return opcodes_.empty() ? nullptr : &opcodes_[0];
-    }
-
     std::size_t Function::OpCodeSize() const
     {
         return opcodes_.size();
@@ -51,9 +62,30 @@ namespace luna
     {
         opcodes_.push_back(i);
         opcode_lines_.push_back(line);
+        table_caches_.push_back(TableCache());
         return opcodes_.size() - 1;
     }
 
+    void Function::ReplaceInstructions(std::vector<Instruction> opcodes,
+                                       std::vector<int> lines,
+                                       const std::vector<int> &index_map)
+    {
+        opcodes_ = std::move(opcodes);
+        opcode_lines_ = std::move(lines);
+        table_caches_.assign(opcodes_.size(), TableCache());
+
+        for (auto &var : local_vars_)
+        {
+            var.begin_pc_ = index_map[var.begin_pc_];
+            var.end_pc_ = index_map[var.end_pc_];
+        }
+    }
+
+    void Function::SetRegisterCount(int count)
+    {
+        register_count_ = count;
+    }
+
     void Function::SetHasVararg()
     {
         is_vararg_ = true;
@@ -91,18 +123,40 @@ namespace luna
 
     int Function::AddConstNumber(double num)
     {
+        unsigned long long bits;
+        memcpy(&bits, &num, sizeof(bits));
         Value v;
         v.type_ = ValueT_Number;
         v.num_ = num;
-        return AddConstValue(v);
+        return AddConst(ConstKey(ValueT_Number, bits), v);
+    }
+
+    int Function::AddConstInteger(long long integer)
+    {
+        Value v;
+        v.type_ = ValueT_Integer;
+        v.integer_ = integer;
+        return AddConst(ConstKey(ValueT_Integer, integer), v);
     }
 
     int Function::AddConstString(String *str)
     {
+        // Same strings are the same instance String
         Value v;
         v.type_ = ValueT_String;
         v.str_ = str;
-        return AddConstValue(v);
+        return AddConst(ConstKey(ValueT_String, reinterpret_cast<uintptr_t>(str)), v);
+    }
+
+    int Function::AddConst(const ConstKey &key, const Value &v)
+    {
+        auto it = const_indexes_.find(key);
+        if (it != const_indexes_.end())
+            return it->second;
+
+        int index = AddConstValue(v);
+        const_indexes_.insert(std::make_pair(key, index));
+        return index;
     }
 
     int Function::AddConstValue(const Value &v)
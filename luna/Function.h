@@ -5,11 +5,18 @@
 #include "Value.h"
 #include "OpCode.h"
 #include "String.h"
+#include "Table.h"
 #include "Upvalue.h"
+#include <limits>
+#include <memory>
+#include <unordered_map>
 #include <vector>
 
 namespace luna
 {
+    class Jit;
+    class NativeCode;
+
     // Function prototype class, all runtime functions(closures) reference this
     // class object. This class contains some static information generated after
     // parse.
@@ -37,12 +44,32 @@ namespace luna
             register_index_(register_index) { }
         };
 
+        // Local variable debug info
+        struct LocalVarInfo
+        {
+            // Local variable name
+            String *name_;
+            // Register id in function
+            int register_id_;
+            // Begin instruction index of variable
+            int begin_pc_;
+            // The past-the-end instruction index
+            int end_pc_;
+
+            LocalVarInfo(String *name, int register_id,
+                         int begin_pc, int end_pc)
+                : name_(name), register_id_(register_id),
+                  begin_pc_(begin_pc), end_pc_(end_pc) { }
+        };
+
         Function();
+        ~Function();
 
         virtual void Accept(GCObjectVisitor *v);
 
         // Get function instructions and size
-        const Instruction * GetOpCodes() const;
+        const Instruction * GetOpCodes() const
+        { return opcodes_.empty() ? nullptr : &opcodes_[0]; }
         std::size_t OpCodeSize() const;
         // Get instruction pointer, then it can be changed
         Instruction * GetMutableInstruction(std::size_t index);
@@ -51,6 +78,13 @@ namespace luna
         // return index of the new instruction
         std::size_t AddInstruction(Instruction i, int line);
 
+        // Replace instructions and their lines by optimized ones,
+        // 'index_map' maps old instruction index to new index, then
+        // ranges of local variables are remapped
+        void ReplaceInstructions(std::vector<Instruction> opcodes,
+                                 std::vector<int> lines,
+                                 const std::vector<int> &index_map);
+
         // Set and get this function has vararg
         void SetHasVararg();
         bool HasVararg() const;
@@ -66,13 +100,17 @@ namespace luna
         // Set superior function
         void SetSuperior(Function *superior);
 
-        // Add const number and return index of the const value
+        // Add const number and return index of the const value, the
+        // same const number, integer or String is added only once
         int AddConstNumber(double num);
 
+        // Add const integer and return index of the const value
+        int AddConstInteger(long long integer);
+
         // Add const String and return index of the const value
         int AddConstString(String *str);
 
-        // Add const Value and return index of the const value
+        // Append const Value and return index of the const value
         int AddConstValue(const Value &v);
 
         // Add local variable debug info
@@ -91,12 +129,35 @@ namespace luna
         // Get child function by index
         Function * GetChildFunction(int index) const;
 
+        // Get child function count
+        std::size_t GetChildFunctionCount() const
+        { return child_funcs_.size(); }
+
         // Search local variable name from local variable list
         String * SearchLocalVar(int register_id, int pc) const;
 
+        // Get local variable debug info count and info by index
+        std::size_t GetLocalVarCount() const
+        { return local_vars_.size(); }
+        const LocalVarInfo * GetLocalVar(std::size_t index) const
+        { return &local_vars_[index]; }
+
         // Get const Value by index
         Value * GetConstValue(int i);
 
+        // Get const Values array
+        Value * GetConstValues()
+        { return const_values_.empty() ? nullptr : &const_values_[0]; }
+
+        // Get const Value count
+        std::size_t GetConstValueCount() const
+        { return const_values_.size(); }
+
+        // Get inline caches of table access instructions, indexed by
+        // instruction index
+        TableCache * GetTableCaches()
+        { return table_caches_.empty() ? nullptr : &table_caches_[0]; }
+
         // Get instruction line by instruction index
         int GetInstructionLine(int i) const;
 
@@ -112,35 +173,67 @@ namespace luna
         String * GetModule() const
         { return module_; }
 
+        // Set and get count of registers used by this function
+        void SetRegisterCount(int count);
+        int GetRegisterCount() const
+        { return register_count_; }
+
         // Get line of function define
         int GetLine() const
         { return line_; }
 
+        // Set the JIT which has loops of this function, the JIT
+        // forgets them when this function is freed
+        void SetJit(Jit *jit)
+        { jit_ = jit; }
+
+        // Count a call of this function for baseline JIT, return the
+        // count of calls
+        int CountCall()
+        { return call_count_ < std::numeric_limits<int>::max() ? ++call_count_ : call_count_; }
+        void ResetCallCount(int count)
+        { call_count_ = count; }
+
+        // Set and get machine code compiled by baseline JIT, it is
+        // nullptr when this function is not compiled
+        void SetNativeCode(std::unique_ptr<NativeCode> native);
+        NativeCode * GetNativeCode() const
+        { return native_code_.get(); }
+
     private:
-        // For debug
-        struct LocalVarInfo
+        // Key of const in const index map, number is keyed by its bits,
+        // so integer 1 and number 1.0, 0.0 and -0.0 are different consts
+        struct ConstKey
         {
-            // Local variable name
-            String *name_;
-            // Register id in function
-            int register_id_;
-            // Begin instruction index of variable
-            int begin_pc_;
-            // The past-the-end instruction index
-            int end_pc_;
+            int type_;
+            unsigned long long bits_;
 
-            LocalVarInfo(String *name, int register_id,
-                         int begin_pc, int end_pc)
-                : name_(name), register_id_(register_id),
-                  begin_pc_(begin_pc), end_pc_(end_pc) { }
+            ConstKey(int type, unsigned long long bits)
+                : type_(type), bits_(bits) { }
+
+            bool operator == (const ConstKey &k) const
+            { return type_ == k.type_ && bits_ == k.bits_; }
         };
 
+        struct ConstKeyHash
+        {
+            std::size_t operator () (const ConstKey &k) const
+            { return std::hash<unsigned long long>()(k.bits_) ^ k.type_; }
+        };
+
+        // Add const which is not added before, return index of the const
+        int AddConst(const ConstKey &key, const Value &v);
+
         // function instruction opcodes
         std::vector<Instruction> opcodes_;
         // opcodes' line number
         std::vector<int> opcode_lines_;
+        // opcodes' inline cache of table access
+        std::vector<TableCache> table_caches_;
         // const values in function
         std::vector<Value> const_values_;
+        // index of const values by ConstKey
+        std::unordered_map<ConstKey, int, ConstKeyHash> const_indexes_;
         // debug info
         std::vector<LocalVarInfo> local_vars_;
         // child functions
@@ -153,10 +246,17 @@ namespace luna
         int line_;
         // count of args
         int args_;
+        // count of registers
+        int register_count_;
         // has '...' param or not
         bool is_vararg_;
         // superior function pointer
         Function *superior_;
+        // JIT which has loops of this function
+        Jit *jit_;
+        // count of calls and machine code of baseline JIT
+        int call_count_;
+        std::unique_ptr<NativeCode> native_code_;
     };
 
     // All runtime function are closures, this class object pointer to a
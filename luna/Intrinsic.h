@@ -0,0 +1,203 @@
+#ifndef INTRINSIC_H
+#define INTRINSIC_H
+
+#include "Value.h"
+#include <string>
+#include <cmath>
+
+namespace luna
+{
+    // Math functions which are calculated by OpType_Intrinsic in place
+    // of calls of them, the math library registers the function of each
+    // intrinsic into State
+    enum IntrinsicType
+    {
+        Intrinsic_Abs,
+        Intrinsic_Acos,
+        Intrinsic_Asin,
+        Intrinsic_Atan,
+        Intrinsic_Ceil,
+        Intrinsic_Cos,
+        Intrinsic_Cosh,
+        Intrinsic_Deg,
+        Intrinsic_Exp,
+        Intrinsic_Floor,
+        Intrinsic_Rad,
+        Intrinsic_Sin,
+        Intrinsic_Sinh,
+        Intrinsic_Sqrt,
+        Intrinsic_Tan,
+        Intrinsic_Tanh,
+        Intrinsic_Atan2,
+        Intrinsic_Fmod,
+        Intrinsic_Ldexp,
+        Intrinsic_Pow,
+        Intrinsic_Log,
+        Intrinsic_Min,
+        Intrinsic_Max,
+        Intrinsic_Count,
+    };
+
+    // Get intrinsic of call math.'name' with 'arg_count' arguments,
+    // return -1 when the call has no intrinsic
+    inline int GetMathIntrinsic(const std::string &name, int arg_count)
+    {
+        static const struct
+        {
+            const char *name_;
+            int min_args_;
+            int max_args_;
+        } intrinsics[Intrinsic_Count] = {
+            { "abs", 1, 1 }, { "acos", 1, 1 }, { "asin", 1, 1 },
+            { "atan", 1, 1 }, { "ceil", 1, 1 }, { "cos", 1, 1 },
+            { "cosh", 1, 1 }, { "deg", 1, 1 }, { "exp", 1, 1 },
+            { "floor", 1, 1 }, { "rad", 1, 1 }, { "sin", 1, 1 },
+            { "sinh", 1, 1 }, { "sqrt", 1, 1 }, { "tan", 1, 1 },
+            { "tanh", 1, 1 }, { "atan2", 2, 2 }, { "fmod", 2, 2 },
+            { "ldexp", 2, 2 }, { "pow", 2, 2 }, { "log", 1, 2 },
+            // Count of arguments is encoded into 8 bits
+            { "min", 1, 255 }, { "max", 1, 255 },
+        };
+
+        for (int i = 0; i < Intrinsic_Count; ++i)
+        {
+            if (name == intrinsics[i].name_)
+            {
+                if (arg_count < intrinsics[i].min_args_ ||
+                    arg_count > intrinsics[i].max_args_)
+                    return -1;
+                return i;
+            }
+        }
+        return -1;
+    }
+
+    // Integral float 'x' is converted to integer when it is in range
+    // of integer, otherwise it is kept float
+    inline void SetIntegralNumber(Value *a, double x)
+    {
+        // Float of kValueIntegerMax + 1 is the power of 2 above the range
+        if (x >= static_cast<double>(kValueIntegerMin) &&
+            x < static_cast<double>(kValueIntegerMax) + 1.0)
+            a->SetInteger(static_cast<long long>(x));
+        else
+            a->SetNumber(x);
+    }
+
+    // Floor, ceil and abs of number 'x', integer is returned unchanged
+    // or exactly, floor and ceil of float are integers when they fit
+    inline void CalculateFloor(Value *a, const Value &x)
+    {
+        if (x.type_ == ValueT_Integer)
+            *a = x;
+        else
+            SetIntegralNumber(a, std::floor(x.num_));
+    }
+
+    inline void CalculateCeil(Value *a, const Value &x)
+    {
+        if (x.type_ == ValueT_Integer)
+            *a = x;
+        else
+            SetIntegralNumber(a, std::ceil(x.num_));
+    }
+
+    inline void CalculateAbs(Value *a, const Value &x)
+    {
+        if (x.type_ == ValueT_Integer)
+        {
+            // Wraps around like integer arithmetic, NaN-boxed Value
+            // holds abs of its minimum integer as float
+            auto u = static_cast<unsigned long long>(x.integer_);
+            auto abs = static_cast<long long>(x.integer_ < 0 ? 0 - u : u);
+            if (IntegerFitsValue(abs))
+                a->SetInteger(abs);
+            else
+                a->SetNumber(static_cast<double>(abs));
+        }
+        else
+            a->SetNumber(std::abs(x.num_));
+    }
+
+    // Number 'l' is less than number 'r', integers are compared exactly
+    inline bool NumberLess(const Value &l, const Value &r)
+    {
+        if (l.type_ == ValueT_Integer && r.type_ == ValueT_Integer)
+            return l.integer_ < r.integer_;
+        return l.GetNumber() < r.GetNumber();
+    }
+
+    // Min and max of 'count' numbers, the result is one of the numbers
+    inline void CalculateMin(Value *a, const Value *args, int count)
+    {
+        int min = 0;
+        for (int i = 1; i < count; ++i)
+            if (NumberLess(args[i], args[min])) min = i;
+        *a = args[min];
+    }
+
+    inline void CalculateMax(Value *a, const Value *args, int count)
+    {
+        int max = 0;
+        for (int i = 1; i < count; ++i)
+            if (NumberLess(args[max], args[i])) max = i;
+        *a = args[max];
+    }
+
+    // Calculate intrinsic with 'count' arguments from 'args' same as
+    // the math library, store the result into 'a', return false when
+    // any argument is not a number, then the function is called
+    inline bool CalculateIntrinsic(int type, Value *a, const Value *args, int count)
+    {
+        for (int i = 0; i < count; ++i)
+        {
+            if (!args[i].IsNumber())
+                return false;
+        }
+
+        // Results of these are integers when arguments are integers
+        switch (type) {
+            case Intrinsic_Abs: CalculateAbs(a, args[0]); return true;
+            case Intrinsic_Ceil: CalculateCeil(a, args[0]); return true;
+            case Intrinsic_Floor: CalculateFloor(a, args[0]); return true;
+            case Intrinsic_Min: CalculateMin(a, args, count); return true;
+            case Intrinsic_Max: CalculateMax(a, args, count); return true;
+            default: break;
+        }
+
+        const double pi = 3.14159265358979323846;
+        double x = args[0].GetNumber();
+        double result = 0.0;
+        switch (type) {
+            case Intrinsic_Acos: result = std::acos(x); break;
+            case Intrinsic_Asin: result = std::asin(x); break;
+            case Intrinsic_Atan: result = std::atan(x); break;
+            case Intrinsic_Cos: result = std::cos(x); break;
+            case Intrinsic_Cosh: result = std::cosh(x); break;
+            case Intrinsic_Deg: result = x / pi * 180; break;
+            case Intrinsic_Exp: result = std::exp(x); break;
+            case Intrinsic_Rad: result = x / 180 * pi; break;
+            case Intrinsic_Sin: result = std::sin(x); break;
+            case Intrinsic_Sinh: result = std::sinh(x); break;
+            case Intrinsic_Sqrt: result = std::sqrt(x); break;
+            case Intrinsic_Tan: result = std::tan(x); break;
+            case Intrinsic_Tanh: result = std::tanh(x); break;
+            case Intrinsic_Atan2: result = std::atan2(x, args[1].GetNumber()); break;
+            case Intrinsic_Fmod: result = std::fmod(x, args[1].GetNumber()); break;
+            case Intrinsic_Ldexp: result = std::ldexp(x, args[1].GetNumber()); break;
+            case Intrinsic_Pow: result = std::pow(x, args[1].GetNumber()); break;
+            case Intrinsic_Log:
+                result = std::log(x);
+                if (count > 1)
+                    result /= std::log(args[1].GetNumber());
+                break;
+            default:
+                return false;
+        }
+
+        a->SetNumber(result);
+        return true;
+    }
+} // namespace luna
+
+#endif // INTRINSIC_H
@@ -0,0 +1,1297 @@
+#include "Jit.h"
+#include "State.h"
+#include "Table.h"
+#include "String.h"
+#include "Function.h"
+#include "Upvalue.h"
+#include "Arith.h"
+#include "Assembler.h"
+#include <limits>
+#include <vector>
+#include <math.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+namespace luna
+{
+    // Machine code of a recorded loop
+    class Trace
+    {
+    public:
+        // Entry of machine code, return index of the exit
+        typedef int (*EntryType)(Value *base, Closure *cl);
+
+        Trace() : close_from_(-1), header_exits_(0) { }
+
+        int Run(Value *base, Closure *cl)
+        { return reinterpret_cast<EntryType>(code_.GetEntry())(base, cl); }
+
+        // Resume pc of each exit, exit 0 is the loop header
+        std::vector<const Instruction *> exits_;
+        // FillNil in trace does not close upvalues, so the trace can not
+        // run when any register from close_from_ is referred by an open
+        // upvalue, it is -1 when there is no FillNil
+        int close_from_;
+        // Count of exits at the loop header
+        int header_exits_;
+        ExecutableCode code_;
+    };
+
+    struct Jit::Loop
+    {
+        Function *proto_;
+        const Instruction *header_;
+        // Loop is recorded when it counts down to 0
+        int hot_count_;
+        // Times of recording failed
+        int aborts_;
+        std::unique_ptr<Trace> trace_;
+    };
+} // namespace luna
+
+namespace
+{
+    // Hot count of loop to record
+    const int kHotLoop = 56;
+    // Stop recording the loop after failed times
+    const int kMaxAborts = 4;
+    // Record the loop again when trace exits at header more than this
+    const int kMaxHeaderExits = 100;
+} // namespace
+
+#ifdef LUNA_JIT_SUPPORTED
+namespace
+{
+    using namespace luna;
+    using namespace luna::x64;
+
+    // Max instruction count of a trace
+    const int kMaxTraceLength = 500;
+    // Type of register which is unknown in trace
+    const int kUnknownType = -1;
+
+    static_assert(sizeof(Value) == 16 && offsetof(Value, type_) == 8,
+                  "trace assumes 8 bytes payload and then type of Value");
+
+    // Helpers called by trace, table and upvalue access are not inlined
+    void TraceGetTable(const Value *t, const Value *k, Value *v)
+    {
+        *v = t->table_->GetValue(*k);
+    }
+
+    void TraceSetTable(const Value *t, const Value *k, const Value *v)
+    {
+        t->table_->SetValue(*k, *v);
+    }
+
+    void TraceGetUpvalue(const Closure *cl, long index, Value *v)
+    {
+        *v = *cl->GetUpvalue(index)->GetValue();
+    }
+
+    void TraceSetUpvalue(const Closure *cl, long index, const Value *v)
+    {
+        *cl->GetUpvalue(index)->GetValue() = *v;
+    }
+
+    void TraceIntrinsic(Value *a, long type, long count)
+    {
+        CalculateIntrinsic(type, a, a + 1, count);
+    }
+
+    void TraceLen(Value *v)
+    {
+        if (v->type_ == ValueT_Table)
+            v->SetInteger(v->table_->ArraySize());
+        else
+            v->SetInteger(v->str_->GetLength());
+    }
+
+    uint64_t PayloadBits(const Value &v)
+    {
+        uint64_t bits;
+        memcpy(&bits, &v, sizeof(bits));
+        return bits;
+    }
+
+    // Kinds of comparison
+    enum CompareKind
+    {
+        Compare_Less,
+        Compare_LessEqual,
+        Compare_Greater,
+        Compare_GreaterEqual,
+        Compare_Equal,
+        Compare_UnEqual,
+    };
+
+    // Operand B or C of instruction, register or const
+    struct Operand
+    {
+        int reg_;
+        const Value *k_;
+
+        Operand(int reg) : reg_(reg), k_(nullptr) { }
+        Operand(const Value *k) : reg_(-1), k_(k) { }
+    };
+
+    // Record one iteration of the loop from header, registers are not
+    // changed while recording, the recorder evaluates instructions on a
+    // shadow copy of registers to choose the path and observe types,
+    // and emits machine code of the path at the same time.
+    class TraceRecorder
+    {
+    public:
+        TraceRecorder(State *state, Value *global, Closure *cl,
+                      Value *base, const Instruction *header)
+            : state_(state), global_(global), cl_(cl),
+              proto_(cl->GetPrototype()), consts_(proto_->GetConstValues()),
+              header_(header), closed_(false), close_from_(-1)
+        {
+            int count = proto_->GetRegisterCount();
+            shadow_.assign(base, base + count);
+            types_.assign(count, kUnknownType);
+            body_ = asm_.NewLabel();
+            guards_ = asm_.NewLabel();
+            epilogue_ = asm_.NewLabel();
+            // Exit 0 is the loop header
+            ExitLabel(header_);
+        }
+
+        // Record and compile the loop, return nullptr when the loop
+        // can not be compiled
+        std::unique_ptr<Trace> Record();
+
+    private:
+        struct Guard
+        {
+            int reg_;
+            ValueT type_;
+        };
+
+        // Record instruction at pc, return next pc or nullptr when abort
+        const Instruction * RecordInstruction(const Instruction *pc);
+
+        // Continue recording at 'next' after branch at 'pc', close the
+        // loop when 'next' is the header, return nullptr to abort at any
+        // other backward branch
+        const Instruction * Branch(const Instruction *pc, const Instruction *next);
+
+        // Get label of exit which resumes at pc
+        int ExitLabel(const Instruction *pc);
+
+        // Type of register, the first read of register before written
+        // adds a guard of the observed type at trace entry
+        ValueT ReadType(int reg);
+        ValueT ReadType(const Operand &o)
+        { return o.reg_ >= 0 ? ReadType(o.reg_) : o.k_->type_; }
+
+        const Value & Shadow(const Operand &o) const
+        { return o.reg_ >= 0 ? shadow_[o.reg_] : *o.k_; }
+
+        bool IsRegister(int reg) const
+        { return reg < static_cast<int>(shadow_.size()); }
+
+        static int Payload(int reg)
+        { return reg * sizeof(Value); }
+
+        static int TypeOf(int reg)
+        { return reg * sizeof(Value) + offsetof(Value, type_); }
+
+        // Store type of register when the type changes
+        void StoreType(int reg, ValueT type);
+        void StoreInteger(int reg, Reg r);
+        void StoreFloat(int reg, Xmm x);
+        void StoreImm(int reg, uint64_t payload, ValueT type);
+        void LoadInteger(Reg r, const Operand &o);
+        void LoadFloat(Xmm x, const Operand &o, ValueT type);
+        // Load address of operand
+        void LoadAddress(Reg r, const Operand &o);
+        void CallHelper(const void *helper);
+        // Exit at pc when type of register is not 'type'
+        void GuardType(int reg, ValueT type, const Instruction *pc);
+
+        // Emit comparison of numbers, return condition of result true
+        Condition EmitCompare(CompareKind kind, const Operand &b, ValueT tb,
+                              const Operand &c, ValueT tc);
+        void SetBoolByCondition(int reg, const Condition &cond);
+
+        // Record instructions by kind
+        bool RecordArith(Instruction i, const Operand &b, const Operand &c,
+                         const Instruction *pc);
+        bool RecordCompare(CompareKind kind, Instruction i,
+                           const Operand &b, const Operand &c);
+        const Instruction * RecordCompareJmp(CompareKind kind, Instruction i,
+                                             const Operand &b, const Operand &c,
+                                             const Instruction *pc);
+        const Instruction * RecordForLoop(Instruction i, const Instruction *pc);
+        const Instruction * RecordIntrinsic(Instruction i, const Instruction *pc);
+        bool RecordGetTable(int t, const Operand &k, int v, const Instruction *pc);
+        bool RecordSetTable(int t, const Operand &k, const Operand &v);
+
+        // Jump back to loop body, or to entry guards when types of
+        // guarded registers are changed by the iteration
+        void CloseLoop();
+
+        State *state_;
+        Value *global_;
+        Closure *cl_;
+        Function *proto_;
+        Value *consts_;
+        const Instruction *header_;
+        Assembler asm_;
+
+        // Shadow registers and known types of registers in trace
+        std::vector<Value> shadow_;
+        std::vector<int> types_;
+        // Type guards at trace entry
+        std::vector<Guard> guards_list_;
+        // Resume pc and label of exits
+        std::vector<const Instruction *> exits_;
+        std::vector<int> exit_labels_;
+
+        int body_;
+        int guards_;
+        int epilogue_;
+        bool closed_;
+        int close_from_;
+    };
+
+    std::unique_ptr<Trace> TraceRecorder::Record()
+    {
+        // Prologue, keep base in rbx and closure in r12, align stack
+        asm_.Push(RBX);
+        asm_.Push(R12);
+        asm_.SubRspImm8(8);
+        asm_.MovRegReg(RBX, RDI);
+        asm_.MovRegReg(R12, RSI);
+        asm_.Jmp(guards_);
+
+        asm_.Bind(body_);
+        const Instruction *pc = header_;
+        for (int count = 0; !closed_; ++count)
+        {
+            if (count >= kMaxTraceLength)
+                return std::unique_ptr<Trace>();
+            pc = RecordInstruction(pc);
+            if (!pc)
+                return std::unique_ptr<Trace>();
+        }
+
+        // Entry guards
+        asm_.Bind(guards_);
+        for (const auto &guard : guards_list_)
+        {
+            asm_.CmpMem32Imm(RBX, TypeOf(guard.reg_), guard.type_);
+            asm_.Jcc(CC_NE, exit_labels_[0]);
+        }
+        asm_.Jmp(body_);
+
+        // Exits return index of exit
+        for (std::size_t i = 0; i < exits_.size(); ++i)
+        {
+            asm_.Bind(exit_labels_[i]);
+            asm_.MovEaxImm(i);
+            asm_.Jmp(epilogue_);
+        }
+
+        asm_.Bind(epilogue_);
+        asm_.AddRspImm8(8);
+        asm_.Pop(R12);
+        asm_.Pop(RBX);
+        asm_.Ret();
+        asm_.ResolveLabels();
+
+        std::unique_ptr<Trace> trace(new Trace);
+        if (!trace->code_.Load(asm_.GetCode()))
+            return std::unique_ptr<Trace>();
+
+        trace->exits_ = exits_;
+        trace->close_from_ = close_from_;
+        return trace;
+    }
+
+    int TraceRecorder::ExitLabel(const Instruction *pc)
+    {
+        for (std::size_t i = 0; i < exits_.size(); ++i)
+        {
+            if (exits_[i] == pc)
+                return exit_labels_[i];
+        }
+
+        exits_.push_back(pc);
+        exit_labels_.push_back(asm_.NewLabel());
+        return exit_labels_.back();
+    }
+
+    ValueT TraceRecorder::ReadType(int reg)
+    {
+        if (types_[reg] == kUnknownType)
+        {
+            Guard guard = { reg, shadow_[reg].type_ };
+            guards_list_.push_back(guard);
+            types_[reg] = guard.type_;
+        }
+        return static_cast<ValueT>(types_[reg]);
+    }
+
+    void TraceRecorder::StoreType(int reg, ValueT type)
+    {
+        if (types_[reg] != type)
+        {
+            asm_.MovMem32Imm(RBX, TypeOf(reg), type);
+            types_[reg] = type;
+        }
+    }
+
+    void TraceRecorder::StoreInteger(int reg, Reg r)
+    {
+        asm_.MovMemReg(RBX, Payload(reg), r);
+        StoreType(reg, ValueT_Integer);
+    }
+
+    void TraceRecorder::StoreFloat(int reg, Xmm x)
+    {
+        asm_.MovsdMemXmm(RBX, Payload(reg), x);
+        StoreType(reg, ValueT_Number);
+    }
+
+    void TraceRecorder::StoreImm(int reg, uint64_t payload, ValueT type)
+    {
+        asm_.MovRegImm(RAX, payload);
+        asm_.MovMemReg(RBX, Payload(reg), RAX);
+        StoreType(reg, type);
+    }
+
+    void TraceRecorder::LoadInteger(Reg r, const Operand &o)
+    {
+        if (o.reg_ >= 0)
+            asm_.MovRegMem(r, RBX, Payload(o.reg_));
+        else
+            asm_.MovRegImm(r, o.k_->integer_);
+    }
+
+    void TraceRecorder::LoadFloat(Xmm x, const Operand &o, ValueT type)
+    {
+        if (type == ValueT_Integer)
+        {
+            LoadInteger(RAX, o);
+            asm_.Cvtsi2sdXmmReg(x, RAX);
+        }
+        else if (o.reg_ >= 0)
+        {
+            asm_.MovsdXmmMem(x, RBX, Payload(o.reg_));
+        }
+        else
+        {
+            asm_.MovRegImm(RAX, PayloadBits(*o.k_));
+            asm_.MovqXmmReg(x, RAX);
+        }
+    }
+
+    void TraceRecorder::LoadAddress(Reg r, const Operand &o)
+    {
+        if (o.reg_ >= 0)
+            asm_.LeaRegMem(r, RBX, Payload(o.reg_));
+        else
+            asm_.MovRegImm(r, reinterpret_cast<uint64_t>(o.k_));
+    }
+
+    void TraceRecorder::CallHelper(const void *helper)
+    {
+        asm_.MovRegImm(RAX, reinterpret_cast<uint64_t>(helper));
+        asm_.CallReg(RAX);
+    }
+
+    void TraceRecorder::GuardType(int reg, ValueT type, const Instruction *pc)
+    {
+        asm_.CmpMem32Imm(RBX, TypeOf(reg), type);
+        asm_.Jcc(CC_NE, ExitLabel(pc));
+        types_[reg] = type;
+    }
+
+    Condition TraceRecorder::EmitCompare(CompareKind kind,
+                                         const Operand &b, ValueT tb,
+                                         const Operand &c, ValueT tc)
+    {
+        if (tb == ValueT_Integer && tc == ValueT_Integer)
+        {
+            LoadInteger(RAX, b);
+            LoadInteger(RCX, c);
+            asm_.CmpRegReg(RAX, RCX);
+            switch (kind) {
+                case Compare_Less: return Condition(CC_L);
+                case Compare_LessEqual: return Condition(CC_LE);
+                case Compare_Greater: return Condition(CC_G);
+                case Compare_GreaterEqual: return Condition(CC_GE);
+                case Compare_Equal: return Condition(CC_E);
+                default: return Condition(CC_NE);
+            }
+        }
+
+        // Unordered comparison is false, except unequal
+        LoadFloat(XMM0, b, tb);
+        LoadFloat(XMM1, c, tc);
+        switch (kind) {
+            case Compare_Less:
+                asm_.UcomisdXmmXmm(XMM1, XMM0);
+                return Condition(CC_A);
+            case Compare_LessEqual:
+                asm_.UcomisdXmmXmm(XMM1, XMM0);
+                return Condition(CC_AE);
+            case Compare_Greater:
+                asm_.UcomisdXmmXmm(XMM0, XMM1);
+                return Condition(CC_A);
+            case Compare_GreaterEqual:
+                asm_.UcomisdXmmXmm(XMM0, XMM1);
+                return Condition(CC_AE);
+            case Compare_Equal:
+                asm_.UcomisdXmmXmm(XMM0, XMM1);
+                return Condition(CC_E, Condition::AndNotParity);
+            default:
+                asm_.UcomisdXmmXmm(XMM0, XMM1);
+                return Condition(CC_NE, Condition::OrParity);
+        }
+    }
+
+    void TraceRecorder::SetBoolByCondition(int reg, const Condition &cond)
+    {
+        asm_.Setcc(cond.cc_, RAX);
+        if (cond.parity_ == Condition::AndNotParity)
+        {
+            asm_.Setcc(CC_NP, RCX);
+            asm_.AndReg8Reg8(RAX, RCX);
+        }
+        else if (cond.parity_ == Condition::OrParity)
+        {
+            asm_.Setcc(CC_P, RCX);
+            asm_.OrReg8Reg8(RAX, RCX);
+        }
+        asm_.MovzxRegReg8(RAX, RAX);
+        asm_.MovMemReg(RBX, Payload(reg), RAX);
+        StoreType(reg, ValueT_Bool);
+    }
+
+    bool TraceRecorder::RecordArith(Instruction i, const Operand &b,
+                                    const Operand &c, const Instruction *pc)
+    {
+        int a = Instruction::GetParamA(i);
+        ValueT tb = ReadType(b);
+        ValueT tc = ReadType(c);
+        const Value &vb = Shadow(b);
+        const Value &vc = Shadow(c);
+        if (!vb.IsNumber() || !vc.IsNumber())
+            return false;
+
+        int op = Instruction::GetOpCode(i);
+        bool integer = tb == ValueT_Integer && tc == ValueT_Integer;
+        Value result;
+        switch (op) {
+            case OpType_Add: case OpType_AddRK: case OpType_AddKR:
+            case OpType_Sub: case OpType_SubRK: case OpType_SubKR:
+            case OpType_Mul: case OpType_MulRK: case OpType_MulKR:
+            {
+                bool add = op == OpType_Add || op == OpType_AddRK || op == OpType_AddKR;
+                bool sub = op == OpType_Sub || op == OpType_SubRK || op == OpType_SubKR;
+                if (integer)
+                {
+                    LoadInteger(RAX, b);
+                    LoadInteger(RCX, c);
+                    if (add)
+                    {
+                        asm_.AddRegReg(RAX, RCX);
+                        result.SetInteger(IntegerAdd(vb.integer_, vc.integer_));
+                    }
+                    else if (sub)
+                    {
+                        asm_.SubRegReg(RAX, RCX);
+                        result.SetInteger(IntegerSub(vb.integer_, vc.integer_));
+                    }
+                    else
+                    {
+                        asm_.ImulRegReg(RAX, RCX);
+                        result.SetInteger(IntegerMul(vb.integer_, vc.integer_));
+                    }
+                    StoreInteger(a, RAX);
+                }
+                else
+                {
+                    LoadFloat(XMM0, b, tb);
+                    LoadFloat(XMM1, c, tc);
+                    double x = vb.GetNumber();
+                    double y = vc.GetNumber();
+                    if (add)
+                    {
+                        asm_.AddsdXmmXmm(XMM0, XMM1);
+                        result.SetNumber(x + y);
+                    }
+                    else if (sub)
+                    {
+                        asm_.SubsdXmmXmm(XMM0, XMM1);
+                        result.SetNumber(x - y);
+                    }
+                    else
+                    {
+                        asm_.MulsdXmmXmm(XMM0, XMM1);
+                        result.SetNumber(x * y);
+                    }
+                    StoreFloat(a, XMM0);
+                }
+                break;
+            }
+            case OpType_Div: case OpType_DivRK: case OpType_DivKR:
+                LoadFloat(XMM0, b, tb);
+                LoadFloat(XMM1, c, tc);
+                asm_.DivsdXmmXmm(XMM0, XMM1);
+                StoreFloat(a, XMM0);
+                result.SetNumber(vb.GetNumber() / vc.GetNumber());
+                break;
+            case OpType_Pow: case OpType_PowRK: case OpType_PowKR:
+            {
+                double (*power)(double, double) = pow;
+                LoadFloat(XMM0, b, tb);
+                LoadFloat(XMM1, c, tc);
+                CallHelper(reinterpret_cast<const void *>(power));
+                StoreFloat(a, XMM0);
+                result.SetNumber(power(vb.GetNumber(), vc.GetNumber()));
+                break;
+            }
+            default:
+                if (integer)
+                {
+                    // Interpreter reports modulo by zero
+                    if (vc.integer_ == 0)
+                        return false;
+                    int div = asm_.NewLabel();
+                    int done = asm_.NewLabel();
+                    LoadInteger(RCX, c);
+                    LoadInteger(RAX, b);
+                    // Const divisor is known not 0 or -1
+                    if (c.reg_ >= 0)
+                    {
+                        asm_.TestRegReg(RCX, RCX);
+                        asm_.Jcc(CC_E, ExitLabel(pc));
+                    }
+                    if (c.reg_ >= 0 || vc.integer_ == -1)
+                    {
+                        asm_.CmpRegImm8(RCX, -1);
+                        asm_.Jcc(CC_NE, div);
+                        asm_.XorRegReg(RDX, RDX);
+                        asm_.Jmp(done);
+                    }
+                    asm_.Bind(div);
+                    asm_.CqoIdivReg(RCX);
+                    asm_.Bind(done);
+                    StoreInteger(a, RDX);
+                    result.SetInteger(vc.integer_ == -1 ? 0 : vb.integer_ % vc.integer_);
+                }
+                else
+                {
+                    double (*mod)(double, double) = fmod;
+                    LoadFloat(XMM0, b, tb);
+                    LoadFloat(XMM1, c, tc);
+                    CallHelper(reinterpret_cast<const void *>(mod));
+                    StoreFloat(a, XMM0);
+                    result.SetNumber(mod(vb.GetNumber(), vc.GetNumber()));
+                }
+                break;
+        }
+
+        shadow_[a] = result;
+        return true;
+    }
+
+    // Evaluate comparison of numbers same as VM
+    bool ShadowCompare(CompareKind kind, const Value &b, const Value &c)
+    {
+        if (b.type_ == ValueT_Integer && c.type_ == ValueT_Integer)
+        {
+            switch (kind) {
+                case Compare_Less: return b.integer_ < c.integer_;
+                case Compare_LessEqual: return b.integer_ <= c.integer_;
+                case Compare_Greater: return b.integer_ > c.integer_;
+                case Compare_GreaterEqual: return b.integer_ >= c.integer_;
+                case Compare_Equal: return b.integer_ == c.integer_;
+                default: return b.integer_ != c.integer_;
+            }
+        }
+
+        double x = b.GetNumber();
+        double y = c.GetNumber();
+        switch (kind) {
+            case Compare_Less: return x < y;
+            case Compare_LessEqual: return x <= y;
+            case Compare_Greater: return x > y;
+            case Compare_GreaterEqual: return x >= y;
+            case Compare_Equal: return x == y;
+            default: return x != y;
+        }
+    }
+
+    // Equality of integer and float is exact in VM, trace compares
+    // numbers of same type only
+    bool IsComparable(CompareKind kind, ValueT tb, ValueT tc)
+    {
+        bool number = (tb == ValueT_Integer || tb == ValueT_Number) &&
+                      (tc == ValueT_Integer || tc == ValueT_Number);
+        if (kind == Compare_Equal || kind == Compare_UnEqual)
+            return number && tb == tc;
+        return number;
+    }
+
+    bool TraceRecorder::RecordCompare(CompareKind kind, Instruction i,
+                                      const Operand &b, const Operand &c)
+    {
+        int a = Instruction::GetParamA(i);
+        ValueT tb = ReadType(b);
+        ValueT tc = ReadType(c);
+        if (!IsComparable(kind, tb, tc))
+            return false;
+
+        bool result = ShadowCompare(kind, Shadow(b), Shadow(c));
+        SetBoolByCondition(a, EmitCompare(kind, b, tb, c, tc));
+        shadow_[a].SetBool(result);
+        return true;
+    }
+
+    const Instruction * TraceRecorder::RecordCompareJmp(CompareKind kind, Instruction i,
+                                                        const Operand &b, const Operand &c,
+                                                        const Instruction *pc)
+    {
+        ValueT tb = ReadType(b);
+        ValueT tc = ReadType(c);
+        if (!IsComparable(kind, tb, tc))
+            return nullptr;
+
+        // Jump by the next instruction when result is A
+        bool expect = Instruction::GetParamA(i) != 0;
+        bool taken = ShadowCompare(kind, Shadow(b), Shadow(c)) == expect;
+        auto taken_pc = pc + 1 + Instruction::GetParamsAx(*(pc + 1));
+        auto skip_pc = pc + 2;
+
+        auto cond = EmitCompare(kind, b, tb, c, tc);
+        if (taken == expect)
+            asm_.JumpIf(cond.Negate(), ExitLabel(taken ? skip_pc : taken_pc));
+        else
+            asm_.JumpIf(cond, ExitLabel(taken ? skip_pc : taken_pc));
+        return Branch(pc + 1, taken ? taken_pc : skip_pc);
+    }
+
+    const Instruction * TraceRecorder::RecordForLoop(Instruction i, const Instruction *pc)
+    {
+        int a = Instruction::GetParamA(i);
+        if (!IsRegister(a + 3))
+            return nullptr;
+
+        ValueT type = ReadType(a);
+        if (ReadType(a + 1) != type || ReadType(a + 2) != type ||
+            (type != ValueT_Integer && type != ValueT_Number))
+            return nullptr;
+
+        auto body_pc = pc + Instruction::GetParamsBx(i);
+        auto exit = ExitLabel(pc + 1);
+        int op = Instruction::GetOpCode(i);
+        Value &var = shadow_[a];
+        const Value &limit = shadow_[a + 1];
+        const Value &step = shadow_[a + 2];
+
+        bool cond;
+        if (type == ValueT_Integer)
+        {
+            bool inc = op == OpType_ForLoopInc ||
+                       (op == OpType_ForLoop && step.integer_ > 0);
+            cond = inc ? IntegerForLoopInc(var.integer_, limit.integer_, step.integer_) :
+                         IntegerForLoopDec(var.integer_, limit.integer_, step.integer_);
+
+            // Continue when distance to limit is not below step
+            int ok = asm_.NewLabel();
+            int dec = asm_.NewLabel();
+            if (op == OpType_ForLoop)
+            {
+                asm_.MovRegMem(RCX, RBX, Payload(a + 2));
+                asm_.TestRegReg(RCX, RCX);
+                asm_.Jcc(CC_LE, dec);
+            }
+            if (op != OpType_ForLoopDec)
+            {
+                asm_.MovRegMem(RAX, RBX, Payload(a + 1));
+                asm_.MovRegMem(RCX, RBX, Payload(a));
+                asm_.SubRegReg(RAX, RCX);
+                asm_.MovRegMem(RCX, RBX, Payload(a + 2));
+                asm_.CmpRegReg(RAX, RCX);
+                asm_.Jcc(CC_B, exit);
+                asm_.Jmp(ok);
+            }
+            asm_.Bind(dec);
+            if (op != OpType_ForLoopInc)
+            {
+                asm_.MovRegMem(RAX, RBX, Payload(a));
+                asm_.MovRegMem(RCX, RBX, Payload(a + 1));
+                asm_.SubRegReg(RAX, RCX);
+                asm_.MovRegMem(RCX, RBX, Payload(a + 2));
+                asm_.NegReg(RCX);
+                asm_.CmpRegReg(RAX, RCX);
+                asm_.Jcc(CC_B, exit);
+            }
+            asm_.Bind(ok);
+            asm_.MovRegMem(RAX, RBX, Payload(a));
+            asm_.MovRegMem(RCX, RBX, Payload(a + 2));
+            asm_.AddRegReg(RAX, RCX);
+            StoreInteger(a, RAX);
+            StoreInteger(a + 3, RAX);
+
+            if (cond)
+            {
+                var.integer_ += step.integer_;
+                shadow_[a + 3].SetInteger(var.integer_);
+            }
+        }
+        else
+        {
+            // Var steps before the check, continue unless var passes
+            // limit, NaN never passes
+            bool inc = op == OpType_ForLoopInc ||
+                       (op == OpType_ForLoop && step.num_ > 0.0);
+            var.num_ += step.num_;
+            cond = inc ? !(var.num_ > limit.num_) : !(var.num_ < limit.num_);
+
+            int ok = asm_.NewLabel();
+            int dec = asm_.NewLabel();
+            asm_.MovsdXmmMem(XMM0, RBX, Payload(a));
+            asm_.MovsdXmmMem(XMM2, RBX, Payload(a + 2));
+            asm_.AddsdXmmXmm(XMM0, XMM2);
+            asm_.MovsdMemXmm(RBX, Payload(a), XMM0);
+            asm_.MovsdXmmMem(XMM1, RBX, Payload(a + 1));
+            if (op == OpType_ForLoop)
+            {
+                asm_.XorpdXmmXmm(XMM3, XMM3);
+                asm_.UcomisdXmmXmm(XMM2, XMM3);
+                asm_.Jcc(CC_A, ok);
+                asm_.Jmp(dec);
+            }
+            if (op != OpType_ForLoopDec)
+            {
+                asm_.Bind(ok);
+                asm_.UcomisdXmmXmm(XMM0, XMM1);
+                asm_.Jcc(CC_A, exit);
+                ok = asm_.NewLabel();
+                asm_.Jmp(ok);
+            }
+            asm_.Bind(dec);
+            if (op != OpType_ForLoopInc)
+            {
+                asm_.UcomisdXmmXmm(XMM1, XMM0);
+                asm_.Jcc(CC_A, exit);
+            }
+            asm_.Bind(ok);
+            StoreFloat(a + 3, XMM0);
+
+            if (cond)
+                shadow_[a + 3].SetNumber(var.num_);
+        }
+
+        // Trace of the loop which exits at the recorded iteration is useless
+        if (!cond || body_pc != header_)
+            return nullptr;
+        return Branch(pc, body_pc);
+    }
+
+    const Instruction * TraceRecorder::RecordIntrinsic(Instruction i,
+                                                       const Instruction *pc)
+    {
+        int a = Instruction::GetParamA(i);
+        int type = Instruction::GetParamB(i);
+        int count = Instruction::GetParamC(i);
+        if (!IsRegister(a + count))
+            return nullptr;
+
+        // Calls are not recorded, so the intrinsic must be calculated
+        // at the recorded iteration
+        if (ReadType(a) != ValueT_LeafFunction || !state_->IsIntrinsic(shadow_[a], type))
+            return nullptr;
+        for (int arg = a + 1; arg <= a + count; ++arg)
+        {
+            ValueT arg_type = ReadType(arg);
+            if (arg_type != ValueT_Number && arg_type != ValueT_Integer)
+                return nullptr;
+        }
+
+        // Exit to the interpreter when the function is reassigned
+        asm_.MovRegMem(RAX, RBX, Payload(a));
+        asm_.MovRegImm(RCX, PayloadBits(shadow_[a]));
+        asm_.CmpRegReg(RAX, RCX);
+        asm_.Jcc(CC_NE, ExitLabel(pc));
+
+        asm_.LeaRegMem(RDI, RBX, Payload(a));
+        asm_.MovRegImm(RSI, type);
+        asm_.MovRegImm(RDX, count);
+        CallHelper(reinterpret_cast<const void *>(TraceIntrinsic));
+        CalculateIntrinsic(type, &shadow_[a], &shadow_[a + 1], count);
+
+        // Type of result depends on types and values of arguments, exit
+        // after the skipped call when it changes
+        GuardType(a, shadow_[a].type_, pc + 2);
+
+        // Skip the call
+        return pc + 2;
+    }
+
+    bool TraceRecorder::RecordGetTable(int t, const Operand &k, int v,
+                                       const Instruction *pc)
+    {
+        if (ReadType(t) != ValueT_Table)
+            return false;
+
+        shadow_[v] = shadow_[t].table_->GetValue(Shadow(k));
+        asm_.LeaRegMem(RDI, RBX, Payload(t));
+        LoadAddress(RSI, k);
+        asm_.LeaRegMem(RDX, RBX, Payload(v));
+        CallHelper(reinterpret_cast<const void *>(TraceGetTable));
+        GuardType(v, shadow_[v].type_, pc + 1);
+        return true;
+    }
+
+    bool TraceRecorder::RecordSetTable(int t, const Operand &k, const Operand &v)
+    {
+        if (ReadType(t) != ValueT_Table)
+            return false;
+
+        asm_.LeaRegMem(RDI, RBX, Payload(t));
+        LoadAddress(RSI, k);
+        LoadAddress(RDX, v);
+        CallHelper(reinterpret_cast<const void *>(TraceSetTable));
+        return true;
+    }
+
+    const Instruction * TraceRecorder::Branch(const Instruction *pc,
+                                              const Instruction *next)
+    {
+        if (next == header_)
+        {
+            CloseLoop();
+            return next;
+        }
+
+        // Backward jump to other loop
+        if (next <= pc)
+            return nullptr;
+        return next;
+    }
+
+    void TraceRecorder::CloseLoop()
+    {
+        bool stable = true;
+        for (const auto &guard : guards_list_)
+        {
+            if (types_[guard.reg_] != guard.type_)
+                stable = false;
+        }
+
+        asm_.Jmp(stable ? body_ : guards_);
+        closed_ = true;
+    }
+
+#define REG_A(i)        Instruction::GetParamA(i)
+#define REG_B(i)        Operand(Instruction::GetParamB(i))
+#define REG_C(i)        Operand(Instruction::GetParamC(i))
+#define CONST_B(i)      Operand(consts_ + Instruction::GetParamB(i))
+#define CONST_C(i)      Operand(consts_ + Instruction::GetParamC(i))
+
+    const Instruction * TraceRecorder::RecordInstruction(const Instruction *pc)
+    {
+        Instruction i = ToCheckedInstruction(*pc);
+        int a = REG_A(i);
+        int op = Instruction::GetOpCode(i);
+
+        // Check registers of operands
+        switch (op) {
+            case OpType_FillNil:
+            case OpType_Move:
+            case OpType_SetTable:
+            case OpType_GetTable:
+            case OpType_SetTableRK:
+                if (!IsRegister(Instruction::GetParamB(i)))
+                    return nullptr;
+                break;
+            default:
+                break;
+        }
+        if (!IsRegister(a))
+            return nullptr;
+
+        switch (op) {
+            case OpType_LoadNil:
+                StoreImm(a, 0, ValueT_Nil);
+                shadow_[a].SetNil();
+                return pc + 1;
+            case OpType_FillNil:
+            {
+                if (close_from_ < 0 || a < close_from_)
+                    close_from_ = a;
+                for (int r = a; r < Instruction::GetParamB(i); ++r)
+                {
+                    StoreImm(r, 0, ValueT_Nil);
+                    shadow_[r].SetNil();
+                }
+                return pc + 1;
+            }
+            case OpType_LoadBool:
+            {
+                bool value = Instruction::GetParamB(i) ? true : false;
+                StoreImm(a, value ? 1 : 0, ValueT_Bool);
+                shadow_[a].SetBool(value);
+                return pc + 1;
+            }
+            case OpType_LoadInt:
+            {
+                long long value = (pc + 1)->opcode_;
+                StoreImm(a, value, ValueT_Integer);
+                shadow_[a].SetInteger(value);
+                return pc + 2;
+            }
+            case OpType_LoadConst:
+            case OpType_LoadConstX:
+            {
+                bool wide = op == OpType_LoadConstX;
+                auto k = consts_ + (wide ? (pc + 1)->opcode_ : Instruction::GetParamBx(i));
+                StoreImm(a, PayloadBits(*k), k->type_);
+                shadow_[a] = *k;
+                return pc + (wide ? 2 : 1);
+            }
+            case OpType_Move:
+            {
+                int b = Instruction::GetParamB(i);
+                // Copy payload and type separately, since 16 bytes load
+                // after smaller stores can not be forwarded
+                ValueT type = ReadType(b);
+                asm_.MovRegMem(RAX, RBX, Payload(b));
+                asm_.MovMemReg(RBX, Payload(a), RAX);
+                StoreType(a, type);
+                shadow_[a] = shadow_[b];
+                return pc + 1;
+            }
+            case OpType_GetUpvalue:
+            {
+                int b = Instruction::GetParamB(i);
+                shadow_[a] = *cl_->GetUpvalue(b)->GetValue();
+                asm_.MovRegReg(RDI, R12);
+                asm_.MovRegImm(RSI, b);
+                asm_.LeaRegMem(RDX, RBX, Payload(a));
+                CallHelper(reinterpret_cast<const void *>(TraceGetUpvalue));
+                GuardType(a, shadow_[a].type_, pc + 1);
+                return pc + 1;
+            }
+            case OpType_SetUpvalue:
+                asm_.MovRegReg(RDI, R12);
+                asm_.MovRegImm(RSI, Instruction::GetParamB(i));
+                asm_.LeaRegMem(RDX, RBX, Payload(a));
+                CallHelper(reinterpret_cast<const void *>(TraceSetUpvalue));
+                return pc + 1;
+            case OpType_GetGlobal:
+            case OpType_GetGlobalX:
+            {
+                bool wide = op == OpType_GetGlobalX;
+                auto key = consts_ + (wide ? (pc + 1)->opcode_ : Instruction::GetParamBx(i));
+                auto next = pc + (wide ? 2 : 1);
+                shadow_[a] = global_->table_->GetValue(*key);
+                asm_.MovRegImm(RDI, reinterpret_cast<uint64_t>(global_));
+                asm_.MovRegImm(RSI, reinterpret_cast<uint64_t>(key));
+                asm_.LeaRegMem(RDX, RBX, Payload(a));
+                CallHelper(reinterpret_cast<const void *>(TraceGetTable));
+                GuardType(a, shadow_[a].type_, next);
+                return next;
+            }
+            case OpType_SetGlobal:
+            case OpType_SetGlobalX:
+            {
+                bool wide = op == OpType_SetGlobalX;
+                auto key = consts_ + (wide ? (pc + 1)->opcode_ : Instruction::GetParamBx(i));
+                asm_.MovRegImm(RDI, reinterpret_cast<uint64_t>(global_));
+                asm_.MovRegImm(RSI, reinterpret_cast<uint64_t>(key));
+                asm_.LeaRegMem(RDX, RBX, Payload(a));
+                CallHelper(reinterpret_cast<const void *>(TraceSetTable));
+                return pc + (wide ? 2 : 1);
+            }
+            case OpType_JmpFalse:
+            case OpType_JmpTrue:
+            case OpType_JmpNil:
+            {
+                ValueT type = ReadType(a);
+                bool taken = op == OpType_JmpNil ? type == ValueT_Nil :
+                             shadow_[a].IsFalse() == (op == OpType_JmpFalse);
+                auto target = pc + Instruction::GetParamsBx(i);
+                // Only bool has runtime result
+                if (op != OpType_JmpNil && type == ValueT_Bool)
+                {
+                    asm_.CmpMem8Imm(RBX, Payload(a), 0);
+                    // ZF is set when the value is false
+                    bool jump_when_zero = op == OpType_JmpFalse;
+                    asm_.Jcc(taken == jump_when_zero ? CC_NE : CC_E,
+                             ExitLabel(taken ? pc + 1 : target));
+                }
+                return Branch(pc, taken ? target : pc + 1);
+            }
+            case OpType_Jmp:
+                return Branch(pc, pc + Instruction::GetParamsAx(i));
+            case OpType_JmpLess:
+                return RecordCompareJmp(Compare_Less, i, REG_B(i), REG_C(i), pc);
+            case OpType_JmpLessRK:
+                return RecordCompareJmp(Compare_Less, i, REG_B(i), CONST_C(i), pc);
+            case OpType_JmpLessKR:
+                return RecordCompareJmp(Compare_Less, i, CONST_B(i), REG_C(i), pc);
+            case OpType_JmpGreater:
+                return RecordCompareJmp(Compare_Greater, i, REG_B(i), REG_C(i), pc);
+            case OpType_JmpGreaterRK:
+                return RecordCompareJmp(Compare_Greater, i, REG_B(i), CONST_C(i), pc);
+            case OpType_JmpGreaterKR:
+                return RecordCompareJmp(Compare_Greater, i, CONST_B(i), REG_C(i), pc);
+            case OpType_JmpLessEqual:
+                return RecordCompareJmp(Compare_LessEqual, i, REG_B(i), REG_C(i), pc);
+            case OpType_JmpLessEqualRK:
+                return RecordCompareJmp(Compare_LessEqual, i, REG_B(i), CONST_C(i), pc);
+            case OpType_JmpLessEqualKR:
+                return RecordCompareJmp(Compare_LessEqual, i, CONST_B(i), REG_C(i), pc);
+            case OpType_JmpGreaterEqual:
+                return RecordCompareJmp(Compare_GreaterEqual, i, REG_B(i), REG_C(i), pc);
+            case OpType_JmpGreaterEqualRK:
+                return RecordCompareJmp(Compare_GreaterEqual, i, REG_B(i), CONST_C(i), pc);
+            case OpType_JmpGreaterEqualKR:
+                return RecordCompareJmp(Compare_GreaterEqual, i, CONST_B(i), REG_C(i), pc);
+            case OpType_JmpEqual:
+                return RecordCompareJmp(Compare_Equal, i, REG_B(i), REG_C(i), pc);
+            case OpType_JmpEqualRK:
+                return RecordCompareJmp(Compare_Equal, i, REG_B(i), CONST_C(i), pc);
+            case OpType_Neg:
+            {
+                ValueT type = ReadType(a);
+                asm_.MovRegMem(RAX, RBX, Payload(a));
+                if (type == ValueT_Integer)
+                {
+                    asm_.NegReg(RAX);
+                    shadow_[a].integer_ = IntegerSub(0, shadow_[a].integer_);
+                }
+                else if (type == ValueT_Number)
+                {
+                    asm_.BtcRegImm8(RAX, 63);
+                    shadow_[a].num_ = -shadow_[a].num_;
+                }
+                else
+                    return nullptr;
+                asm_.MovMemReg(RBX, Payload(a), RAX);
+                return pc + 1;
+            }
+            case OpType_Not:
+            {
+                ValueT type = ReadType(a);
+                bool result = shadow_[a].IsFalse();
+                if (type == ValueT_Bool)
+                {
+                    asm_.CmpMem8Imm(RBX, Payload(a), 0);
+                    SetBoolByCondition(a, Condition(CC_E));
+                }
+                else
+                    StoreImm(a, result ? 1 : 0, ValueT_Bool);
+                shadow_[a].SetBool(result);
+                return pc + 1;
+            }
+            case OpType_Len:
+            {
+                ValueT type = ReadType(a);
+                if (type != ValueT_Table && type != ValueT_String)
+                    return nullptr;
+                asm_.LeaRegMem(RDI, RBX, Payload(a));
+                CallHelper(reinterpret_cast<const void *>(TraceLen));
+                types_[a] = ValueT_Integer;
+                TraceLen(&shadow_[a]);
+                return pc + 1;
+            }
+            case OpType_Add: case OpType_Sub: case OpType_Mul:
+            case OpType_Div: case OpType_Pow: case OpType_Mod:
+                return RecordArith(i, REG_B(i), REG_C(i), pc) ? pc + 1 : nullptr;
+            case OpType_AddRK: case OpType_SubRK: case OpType_MulRK:
+            case OpType_DivRK: case OpType_PowRK: case OpType_ModRK:
+                return RecordArith(i, REG_B(i), CONST_C(i), pc) ? pc + 1 : nullptr;
+            case OpType_AddKR: case OpType_SubKR: case OpType_MulKR:
+            case OpType_DivKR: case OpType_PowKR: case OpType_ModKR:
+                return RecordArith(i, CONST_B(i), REG_C(i), pc) ? pc + 1 : nullptr;
+            case OpType_Less:
+                return RecordCompare(Compare_Less, i, REG_B(i), REG_C(i)) ? pc + 1 : nullptr;
+            case OpType_Greater:
+                return RecordCompare(Compare_Greater, i, REG_B(i), REG_C(i)) ? pc + 1 : nullptr;
+            case OpType_Equal:
+                return RecordCompare(Compare_Equal, i, REG_B(i), REG_C(i)) ? pc + 1 : nullptr;
+            case OpType_UnEqual:
+                return RecordCompare(Compare_UnEqual, i, REG_B(i), REG_C(i)) ? pc + 1 : nullptr;
+            case OpType_LessEqual:
+                return RecordCompare(Compare_LessEqual, i, REG_B(i), REG_C(i)) ? pc + 1 : nullptr;
+            case OpType_GreaterEqual:
+                return RecordCompare(Compare_GreaterEqual, i, REG_B(i), REG_C(i)) ? pc + 1 : nullptr;
+            case OpType_LessRK:
+                return RecordCompare(Compare_Less, i, REG_B(i), CONST_C(i)) ? pc + 1 : nullptr;
+            case OpType_LessKR:
+                return RecordCompare(Compare_Less, i, CONST_B(i), REG_C(i)) ? pc + 1 : nullptr;
+            case OpType_GreaterRK:
+                return RecordCompare(Compare_Greater, i, REG_B(i), CONST_C(i)) ? pc + 1 : nullptr;
+            case OpType_GreaterKR:
+                return RecordCompare(Compare_Greater, i, CONST_B(i), REG_C(i)) ? pc + 1 : nullptr;
+            case OpType_EqualRK:
+                return RecordCompare(Compare_Equal, i, REG_B(i), CONST_C(i)) ? pc + 1 : nullptr;
+            case OpType_UnEqualRK:
+                return RecordCompare(Compare_UnEqual, i, REG_B(i), CONST_C(i)) ? pc + 1 : nullptr;
+            case OpType_LessEqualRK:
+                return RecordCompare(Compare_LessEqual, i, REG_B(i), CONST_C(i)) ? pc + 1 : nullptr;
+            case OpType_LessEqualKR:
+                return RecordCompare(Compare_LessEqual, i, CONST_B(i), REG_C(i)) ? pc + 1 : nullptr;
+            case OpType_GreaterEqualRK:
+                return RecordCompare(Compare_GreaterEqual, i, REG_B(i), CONST_C(i)) ? pc + 1 : nullptr;
+            case OpType_GreaterEqualKR:
+                return RecordCompare(Compare_GreaterEqual, i, CONST_B(i), REG_C(i)) ? pc + 1 : nullptr;
+            case OpType_SetTable:
+                return RecordSetTable(a, REG_B(i), REG_C(i)) ? pc + 1 : nullptr;
+            case OpType_GetTable:
+                return RecordGetTable(a, REG_B(i), Instruction::GetParamC(i), pc) ? pc + 1 : nullptr;
+            case OpType_SetTableRK:
+                return RecordSetTable(a, REG_B(i), CONST_C(i)) ? pc + 1 : nullptr;
+            case OpType_SetTableKR:
+                return RecordSetTable(a, CONST_B(i), REG_C(i)) ? pc + 1 : nullptr;
+            case OpType_SetTableKK:
+                return RecordSetTable(a, CONST_B(i), CONST_C(i)) ? pc + 1 : nullptr;
+            case OpType_GetTableKR:
+                return RecordGetTable(a, CONST_B(i), Instruction::GetParamC(i), pc) ? pc + 1 : nullptr;
+            case OpType_GetField:
+                return RecordGetTable(a, CONST_B(i), Instruction::GetParamC(i), pc) ? pc + 1 : nullptr;
+            case OpType_SetField:
+                return RecordSetTable(a, CONST_B(i), REG_C(i)) ? pc + 1 : nullptr;
+            case OpType_ForLoop:
+            case OpType_ForLoopInc:
+            case OpType_ForLoopDec:
+                return RecordForLoop(i, pc);
+            case OpType_Intrinsic:
+                return RecordIntrinsic(i, pc);
+            default:
+                // Calls, closures, concat, new table and others which
+                // may allocate objects or leave the frame
+                return nullptr;
+        }
+    }
+
+#undef REG_A
+#undef REG_B
+#undef REG_C
+#undef CONST_B
+#undef CONST_C
+} // namespace
+#endif // LUNA_JIT_SUPPORTED
+
+namespace luna
+{
+    Jit::Jit(State *state) : state_(state)
+    {
+        for (auto &loop : loop_cache_)
+            loop = nullptr;
+    }
+
+    Jit::~Jit()
+    {
+    }
+
+    const Instruction * Jit::ExecuteLoop(Closure *cl, Value *base,
+                                         const Instruction *pc)
+    {
+        auto index = reinterpret_cast<std::size_t>(pc) / sizeof(Instruction);
+        auto &cached = loop_cache_[index & (kLoopCacheSize - 1)];
+        if (!cached || cached->header_ != pc)
+            cached = GetLoop(cl->GetPrototype(), pc);
+
+        auto loop = cached;
+        if (loop->trace_)
+            return RunTrace(loop, cl, base);
+
+        if (--loop->hot_count_ > 0)
+            return pc;
+
+        if (CompileLoop(loop, cl, base))
+            return RunTrace(loop, cl, base);
+        return pc;
+    }
+
+    void Jit::ForgetFunction(const Function *proto)
+    {
+        for (auto &cached : loop_cache_)
+        {
+            if (cached && cached->proto_ == proto)
+                cached = nullptr;
+        }
+
+        for (auto it = loops_.begin(); it != loops_.end(); )
+        {
+            if (it->second->proto_ == proto)
+                it = loops_.erase(it);
+            else
+                ++it;
+        }
+    }
+
+    Jit::Loop * Jit::GetLoop(Function *proto, const Instruction *pc)
+    {
+        auto &loop = loops_[pc];
+        if (!loop)
+        {
+            loop.reset(new Loop);
+            loop->proto_ = proto;
+            loop->header_ = pc;
+            loop->hot_count_ = kHotLoop;
+            loop->aborts_ = 0;
+            proto->SetJit(this);
+        }
+        return loop.get();
+    }
+
+    bool Jit::CompileLoop(Loop *loop, Closure *cl, Value *base)
+    {
+#ifdef LUNA_JIT_SUPPORTED
+        TraceRecorder recorder(state_, &state_->global_, cl, base, loop->header_);
+        loop->trace_ = recorder.Record();
+        if (loop->trace_)
+            return true;
+#else
+        (void)cl;
+        (void)base;
+#endif
+
+        AbortLoop(loop);
+        return false;
+    }
+
+    void Jit::AbortLoop(Loop *loop)
+    {
+        // Back off, and never record the loop after too many aborts
+        if (++loop->aborts_ < kMaxAborts)
+            loop->hot_count_ = kHotLoop << loop->aborts_;
+        else
+            loop->hot_count_ = std::numeric_limits<int>::max();
+    }
+
+    const Instruction * Jit::RunTrace(Loop *loop, Closure *cl, Value *base)
+    {
+        auto trace = loop->trace_.get();
+        if (trace->close_from_ >= 0)
+        {
+            auto open = state_->open_upvalues_;
+            if (open && open->GetValue() >= base + trace->close_from_)
+                return loop->header_;
+        }
+
+        int exit = trace->Run(base, cl);
+        auto pc = trace->exits_[exit];
+
+        // Types at loop header are changed, record again
+        if (exit == 0 && ++trace->header_exits_ > kMaxHeaderExits)
+        {
+            loop->trace_.reset();
+            AbortLoop(loop);
+        }
+        return pc;
+    }
+} // namespace luna
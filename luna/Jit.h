@@ -0,0 +1,68 @@
+#ifndef JIT_H
+#define JIT_H
+
+#include "Value.h"
+#include "OpCode.h"
+#include <memory>
+#include <unordered_map>
+
+namespace luna
+{
+    class State;
+    class Function;
+    class Closure;
+    class Trace;
+
+    // Tracing JIT of hot loops. Target of every backward jump is a loop
+    // header, when a header gets hot, the JIT records one iteration of
+    // the loop from the header, specializes the recorded path on the
+    // observed ValueT of registers and compiles it into machine code.
+    // Types and branch directions are checked by guards in the trace,
+    // the trace exits to the interpreter at the pc where a guard fails.
+    class Jit
+    {
+    public:
+        explicit Jit(State *state);
+        ~Jit();
+
+        Jit(const Jit&) = delete;
+        void operator = (const Jit&) = delete;
+
+        // Run the trace of loop header 'pc' of closure 'cl', registers
+        // of the frame start from 'base'. Count the loop and compile the
+        // trace when the loop gets hot. Return the pc where interpreter
+        // resumes, it is 'pc' when no trace runs.
+        const Instruction * ExecuteLoop(Closure *cl, Value *base,
+                                        const Instruction *pc);
+
+        // Discard all loops of the function, when the function is freed
+        void ForgetFunction(const Function *proto);
+
+    private:
+        struct Loop;
+
+        // Size of direct mapped cache of loops, power of 2
+        static const std::size_t kLoopCacheSize = 256;
+
+        // Find or create the loop of header 'pc'
+        Loop * GetLoop(Function *proto, const Instruction *pc);
+
+        // Record and compile trace of the hot loop, return true
+        // when the trace is ready
+        bool CompileLoop(Loop *loop, Closure *cl, Value *base);
+
+        // Count a failed recording of the loop and record it later
+        void AbortLoop(Loop *loop);
+
+        // Run the trace of the loop, return the resume pc
+        const Instruction * RunTrace(Loop *loop, Closure *cl, Value *base);
+
+        State *state_;
+        // All loops by header pc
+        std::unordered_map<const Instruction *, std::unique_ptr<Loop>> loops_;
+        // Cache of loops by header pc
+        Loop *loop_cache_[kLoopCacheSize];
+    };
+} // namespace luna
+
+#endif // JIT_H
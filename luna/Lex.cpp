@@ -30,6 +30,36 @@ namespace
         return true;
     }
 
+    // Convert integer numeral 'str' to integer, hexadecimal numeral wraps
+    // around on overflow, decimal numeral returns false on overflow
+    bool StrToInteger(const std::string &str, long long *integer)
+    {
+        unsigned long long value = 0;
+        if (str.size() > 2 && str[0] == '0' && (str[1] == 'x' || str[1] == 'X'))
+        {
+            for (std::size_t i = 2; i < str.size(); ++i)
+            {
+                int c = str[i];
+                int digit = isdigit(c) ? c - '0' : tolower(c) - 'a' + 10;
+                value = value * 16 + digit;
+            }
+        }
+        else
+        {
+            const unsigned long long max = 9223372036854775807ULL;
+            for (auto c : str)
+            {
+                unsigned long long digit = c - '0';
+                if (value > (max - digit) / 10)
+                    return false;
+                value = value * 10 + digit;
+            }
+        }
+
+        *integer = static_cast<long long>(value);
+        return true;
+    }
+
     inline bool IsHexChar(int c)
     {
         return (c >= '0' && c <= '9') ||
@@ -55,6 +85,12 @@ namespace luna
         RETURN_NORMAL_TOKEN_DETAIL(detail, Token_Number);       \
     } while (0)
 
+#define RETURN_INTEGER_TOKEN_DETAIL(detail, integer)            \
+    do {                                                        \
+        detail->integer_ = integer;                             \
+        RETURN_NORMAL_TOKEN_DETAIL(detail, Token_Integer);      \
+    } while (0)
+
 #define RETURN_TOKEN_DETAIL(detail, string, token)              \
     do {                                                        \
         detail->str_ = state_->GetString(string);               \
@@ -323,8 +359,10 @@ namespace luna
             throw LexException(module_->GetCStr(), line_, column_,
                     "unexpect incomplete number '", token_buffer_, "'");
 
+        bool exponent = false;
         if (is_exponent(current_))
         {
+            exponent = true;
             token_buffer_.push_back(current_);
             current_ = Next();
             if (current_ == '-' || current_ == '+')
@@ -344,6 +382,15 @@ namespace luna
             }
         }
 
+        long long integer = 0;
+        if (!point && !exponent && StrToInteger(token_buffer_, &integer))
+        {
+            if (!IntegerFitsValue(integer))
+                throw LexException(module_->GetCStr(), line_, column_,
+                        "integer '", token_buffer_, "' is out of range of value");
+            RETURN_INTEGER_TOKEN_DETAIL(detail, integer);
+        }
+
         double number = strtod(token_buffer_.c_str(), nullptr);
         RETURN_NUMBER_TOKEN_DETAIL(detail, number);
     }
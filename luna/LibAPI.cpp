@@ -30,11 +30,22 @@ namespace luna
     {
         Value *v = GetValue(index);
         if (v)
-            return v->num_;
+            return v->GetNumber();
         else
             return 0.0;
     }
 
+    long long StackAPI::GetInteger(int index)
+    {
+        Value *v = GetValue(index);
+        if (!v)
+            return 0;
+        else if (v->type_ == ValueT_Integer)
+            return v->integer_;
+        else
+            return static_cast<long long>(v->num_);
+    }
+
     const char * StackAPI::GetCString(int index)
     {
         Value *v = GetValue(index);
@@ -98,6 +109,15 @@ namespace luna
             return nullptr;
     }
 
+    LeafFunctionType StackAPI::GetLeafFunction(int index)
+    {
+        Value *v = GetValue(index);
+        if (v)
+            return v->leaf_;
+        else
+            return nullptr;
+    }
+
     Value * StackAPI::GetValue(int index)
     {
         assert(!state_->calls_.empty());
@@ -125,6 +145,13 @@ namespace luna
         v->num_ = num;
     }
 
+    void StackAPI::PushInteger(long long integer)
+    {
+        Value *v = PushValue();
+        v->type_ = ValueT_Integer;
+        v->integer_ = integer;
+    }
+
     void StackAPI::PushString(const char *string)
     {
         Value *v = PushValue();
@@ -176,27 +203,41 @@ namespace luna
 
     void StackAPI::PushValue(const Value &value)
     {
-        *PushValue() = value;
+        // Copy value first, it may be a stack value
+        Value v = value;
+        *PushValue() = v;
     }
 
     void StackAPI::ArgCountError(int expect_count)
     {
-        auto cfunc_error = state_->GetCFunctionErrorData();
-        cfunc_error->type_ = CFuntionErrorType_ArgCount;
-        cfunc_error->expect_arg_count_ = expect_count;
+        LeafAPI::ArgCountError(state_, expect_count);
     }
 
     void StackAPI::ArgTypeError(int arg_index, ValueT expect_type)
     {
-        auto cfunc_error = state_->GetCFunctionErrorData();
-        cfunc_error->type_ = CFuntionErrorType_ArgType;
-        cfunc_error->arg_index_ = arg_index;
-        cfunc_error->expect_type_ = expect_type;
+        LeafAPI::ArgTypeError(state_, arg_index, expect_type);
     }
 
     Value * StackAPI::PushValue()
     {
-        return stack_->top_++;
+        auto top = state_->CheckStack(stack_->top_, 1);
+        stack_->top_ = top + 1;
+        return top;
+    }
+
+    void LeafAPI::ArgCountError(State *state, int expect_count)
+    {
+        auto cfunc_error = state->GetCFunctionErrorData();
+        cfunc_error->type_ = CFuntionErrorType_ArgCount;
+        cfunc_error->expect_arg_count_ = expect_count;
+    }
+
+    void LeafAPI::ArgTypeError(State *state, int arg_index, ValueT expect_type)
+    {
+        auto cfunc_error = state->GetCFunctionErrorData();
+        cfunc_error->type_ = CFuntionErrorType_ArgType;
+        cfunc_error->arg_index_ = arg_index;
+        cfunc_error->expect_type_ = expect_type;
     }
 
     Library::Library(State *state)
@@ -210,6 +251,11 @@ namespace luna
         RegisterFunc(global_, name, func);
     }
 
+    void Library::RegisterFunc(const char *name, LeafFunctionType func)
+    {
+        RegisterFunc(global_, name, func);
+    }
+
     void Library::RegisterTableFunction(const char *name, const TableMemberReg *table,
                                         std::size_t size)
     {
@@ -243,6 +289,9 @@ namespace luna
                 case ValueT_CFunction:
                     RegisterFunc(table, table_reg[i].name_, table_reg[i].func_);
                     break;
+                case ValueT_LeafFunction:
+                    RegisterFunc(table, table_reg[i].name_, table_reg[i].leaf_);
+                    break;
                 case ValueT_Number:
                     RegisterNumber(table, table_reg[i].name_, table_reg[i].number_);
                     break;
@@ -266,6 +315,18 @@ namespace luna
         table->SetValue(k, v);
     }
 
+    void Library::RegisterFunc(Table *table, const char *name, LeafFunctionType func)
+    {
+        Value k;
+        k.type_ = ValueT_String;
+        k.str_ = state_->GetString(name);
+
+        Value v;
+        v.type_ = ValueT_LeafFunction;
+        v.leaf_ = func;
+        table->SetValue(k, v);
+    }
+
     void Library::RegisterNumber(Table *table, const char *name, double number)
     {
         Value k;
@@ -44,7 +44,11 @@ namespace luna
                 return true;
 
             // Check type of the index + 1 argument
-            if (GetValueType(index) != type)
+            // Integer is a number argument
+            auto arg_type = GetValueType(index);
+            if (arg_type == ValueT_Integer)
+                arg_type = ValueT_Number;
+            if (arg_type != type)
             {
                 ArgTypeError(index, type);
                 return false;
@@ -75,16 +79,23 @@ namespace luna
         ValueT GetValueType(int index);
 
         // Check value type by index of stack
-        bool IsNumber(int index) { return GetValueType(index) == ValueT_Number; }
+        bool IsNumber(int index)
+        {
+            auto type = GetValueType(index);
+            return type == ValueT_Number || type == ValueT_Integer;
+        }
+        bool IsInteger(int index) { return GetValueType(index) == ValueT_Integer; }
         bool IsString(int index) { return GetValueType(index) == ValueT_String; }
         bool IsBool(int index) { return GetValueType(index) == ValueT_Bool; }
         bool IsClosure(int index) { return GetValueType(index) == ValueT_Closure; }
         bool IsTable(int index) { return GetValueType(index) == ValueT_Table; }
         bool IsUserData(int index) { return GetValueType(index) == ValueT_UserData; }
         bool IsCFunction(int index) { return GetValueType(index) == ValueT_CFunction; }
+        bool IsLeafFunction(int index) { return GetValueType(index) == ValueT_LeafFunction; }
 
         // Get value from stack by index
         double GetNumber(int index);
+        long long GetInteger(int index);
         const char * GetCString(int index);
         const String * GetString(int index);
         bool GetBool(int index);
@@ -92,11 +103,13 @@ namespace luna
         Table * GetTable(int index);
         UserData * GetUserData(int index);
         CFunctionType GetCFunction(int index);
+        LeafFunctionType GetLeafFunction(int index);
         Value * GetValue(int index);
 
         // Push value to stack
         void PushNil();
         void PushNumber(double num);
+        void PushInteger(long long integer);
         void PushString(const char *string);
         void PushString(const char *str, std::size_t len);
         void PushString(const std::string &str);
@@ -118,6 +131,63 @@ namespace luna
         Stack *stack_;
     };
 
+    // Helper functions for leaf function to check arguments, leaf
+    // function returns -1 when it reports an argument error, e.g.
+    //   int Floor(State *state, Value *args, int count)
+    //   {
+    //       if (!LeafAPI::CheckArgs(state, args, count, 1, ValueT_Number))
+    //           return -1;
+    //       args[0].SetNumber(std::floor(args[0].GetNumber()));
+    //       return 1;
+    //   }
+    class LeafAPI
+    {
+    public:
+        // Same as StackAPI::CheckArgs
+        template<typename... ValueTypes>
+        static bool CheckArgs(State *state, const Value *args, int count,
+                              int minCount, ValueTypes... types)
+        {
+            if (count < minCount)
+            {
+                ArgCountError(state, minCount);
+                return false;
+            }
+
+            return CheckArgTypes(state, args, 0, count, types...);
+        }
+
+        // For report argument error
+        static void ArgCountError(State *state, int expect_count);
+        static void ArgTypeError(State *state, int arg_index, ValueT expect_type);
+
+    private:
+        static bool CheckArgTypes(State *state, const Value *args, int index, int params)
+        {
+            return true;
+        }
+
+        template<typename... ValueTypes>
+        static bool CheckArgTypes(State *state, const Value *args, int index, int params,
+                                  ValueT type, ValueTypes... types)
+        {
+            if (index == params)
+                return true;
+
+            // Integer is a number argument
+            ValueT arg_type = args[index].type_;
+            if (arg_type == ValueT_Integer)
+                arg_type = ValueT_Number;
+            if (arg_type != type)
+            {
+                ArgTypeError(state, index, type);
+                return false;
+            }
+
+            return CheckArgTypes(state, args, ++index, params, types...);
+        }
+    };
+
     // For register table member
     struct TableMemberReg
     {
@@ -128,6 +198,7 @@ namespace luna
         union
         {
             CFunctionType func_;
+            LeafFunctionType leaf_;
             double number_;
             const char *str_;
         };
@@ -140,6 +211,11 @@ namespace luna
         {
         }
 
+        TableMemberReg(const char *name, LeafFunctionType leaf)
+            : name_(name), leaf_(leaf), type_(ValueT_LeafFunction)
+        {
+        }
+
         TableMemberReg(const char *name, double number)
             : name_(name), number_(number), type_(ValueT_Number)
         {
@@ -163,6 +239,9 @@ namespace luna
         // Register global function 'func' as 'name'
         void RegisterFunc(const char *name, CFunctionType func);
 
+        // Register global leaf function 'func' as 'name'
+        void RegisterFunc(const char *name, LeafFunctionType func);
+
         // Register a table of functions
         void RegisterTableFunction(const char *name, const TableMemberReg *table,
                                    std::size_t size);
@@ -186,6 +265,7 @@ namespace luna
     private:
         void RegisterToTable(Table *table, const TableMemberReg *table_reg, std::size_t size);
         void RegisterFunc(Table *table, const char *name, CFunctionType func);
+        void RegisterFunc(Table *table, const char *name, LeafFunctionType func);
         void RegisterNumber(Table *table, const char *name, double number);
         void RegisterString(Table *table, const char *name, const char *str);
 
@@ -1,6 +1,5 @@
 #include "LibBase.h"
 #include "Table.h"
-#include "Upvalue.h"
 #include "State.h"
 #include "String.h"
 #include <string>
@@ -30,6 +29,9 @@ namespace base {
                 case luna::ValueT_Number:
                     printf("%.14g", api.GetNumber(i));
                     break;
+                case luna::ValueT_Integer:
+                    printf("%lld", api.GetInteger(i));
+                    break;
                 case luna::ValueT_String:
                     printf("%s", api.GetCString(i));
                     break;
@@ -45,6 +47,9 @@ namespace base {
                 case luna::ValueT_CFunction:
                     printf("function:\t%p", api.GetCFunction(i));
                     break;
+                case luna::ValueT_LeafFunction:
+                    printf("function:\t%p", api.GetLeafFunction(i));
+                    break;
                 default:
                     break;
             }
@@ -74,10 +79,7 @@ namespace base {
             return 0;
 
         const luna::Value *v = api.GetValue(0);
-        luna::ValueT type = v->type_ == luna::ValueT_Upvalue ?
-            v->upvalue_->GetValue()->type_ : v->type_;
-
-        switch (type) {
+        switch (v->type_) {
             case luna::ValueT_Nil:
                 api.PushString("nil");
                 break;
@@ -85,6 +87,7 @@ namespace base {
                 api.PushString("boolean");
                 break;
             case luna::ValueT_Number:
+            case luna::ValueT_Integer:
                 api.PushString("number");
                 break;
             case luna::ValueT_String:
@@ -98,6 +101,7 @@ namespace base {
                 break;
             case luna::ValueT_Closure:
             case luna::ValueT_CFunction:
+            case luna::ValueT_LeafFunction:
                 api.PushString("function");
                 break;
             default:
@@ -114,11 +118,8 @@ namespace base {
             return 0;
 
         luna::Table *t = api.GetTable(0);
-        double num = api.GetNumber(1) + 1;
-
         luna::Value k;
-        k.type_ = luna::ValueT_Number;
-        k.num_ = num;
+        k.SetInteger(api.GetInteger(1) + 1);
         luna::Value v = t->GetValue(k);
 
         if (v.type_ == luna::ValueT_Nil)
@@ -138,7 +139,7 @@ namespace base {
         luna::Table *t = api.GetTable(0);
         api.PushCFunction(DoIPairs);
         api.PushTable(t);
-        api.PushNumber(0);
+        api.PushInteger(0);
         return 3;
     }
 
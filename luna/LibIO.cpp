@@ -154,7 +154,7 @@ namespace io {
         for (int i = 1; i < params; ++i)
         {
             auto type = api.GetValueType(i);
-            if (type == luna::ValueT_Number)
+            if (type == luna::ValueT_Number || type == luna::ValueT_Integer)
             {
                 auto bytes = static_cast<int>(api.GetNumber(i));
                 ReadBytes(api, file, bytes);
@@ -205,7 +205,7 @@ namespace io {
         if (pos < 0)
             return PushError(api);
 
-        api.PushNumber(pos);
+        api.PushInteger(pos);
         return 1;
     }
 
@@ -259,6 +259,11 @@ namespace io {
                 if (std::fprintf(file, "%.14g", api.GetNumber(i)) < 0)
                     return PushError(api);
             }
+            else if (type == luna::ValueT_Integer)
+            {
+                if (std::fprintf(file, "%lld", api.GetInteger(i)) < 0)
+                    return PushError(api);
+            }
             else
             {
                 api.ArgTypeError(i, luna::ValueT_String);
@@ -1,4 +1,6 @@
 #include "LibMath.h"
+#include "State.h"
+#include "Intrinsic.h"
 #include <random>
 #include <cmath>
 #include <cstdlib>
@@ -10,158 +12,158 @@
 namespace lib {
 namespace math {
 
+// Math functions are leaf functions, they are called without CallInfo
+
 // Define one parameter one return value math function
-#define MATH_FUNCTION(name, std_name)                       \
-    int name(luna::State *state)                            \
-    {                                                       \
-        luna::StackAPI api(state);                          \
-        if (!api.CheckArgs(1, luna::ValueT_Number))         \
-            return 0;                                       \
-        api.PushNumber(std::std_name(api.GetNumber(0)));    \
-        return 1;                                           \
+#define MATH_FUNCTION(name, std_name)                                   \
+    int name(luna::State *state, luna::Value *args, int count)          \
+    {                                                                   \
+        if (!luna::LeafAPI::CheckArgs(state, args, count, 1,            \
+                                      luna::ValueT_Number))             \
+            return -1;                                                  \
+        args[0].SetNumber(std::std_name(args[0].GetNumber()));          \
+        return 1;                                                       \
     }
 
 // Define two parameters one return value math function
-#define MATH_FUNCTION2(name, std_name)                      \
-    int name(luna::State *state)                            \
-    {                                                       \
-        luna::StackAPI api(state);                          \
-        if (!api.CheckArgs(2, luna::ValueT_Number,          \
-                           luna::ValueT_Number))            \
-            return 0;                                       \
-        api.PushNumber(std::std_name(api.GetNumber(0),      \
-                                     api.GetNumber(1)));    \
-        return 1;                                           \
+#define MATH_FUNCTION2(name, std_name)                                  \
+    int name(luna::State *state, luna::Value *args, int count)          \
+    {                                                                   \
+        if (!luna::LeafAPI::CheckArgs(state, args, count, 2,            \
+                                      luna::ValueT_Number,              \
+                                      luna::ValueT_Number))             \
+            return -1;                                                  \
+        args[0].SetNumber(std::std_name(args[0].GetNumber(),            \
+                                        args[1].GetNumber()));          \
+        return 1;                                                       \
+    }
+
+// Define one parameter one return value math function, which returns
+// integer argument unchanged
+#define MATH_INTEGER_FUNCTION(name, calculate)                          \
+    int name(luna::State *state, luna::Value *args, int count)          \
+    {                                                                   \
+        if (!luna::LeafAPI::CheckArgs(state, args, count, 1,            \
+                                      luna::ValueT_Number))             \
+            return -1;                                                  \
+        luna::Value x = args[0];                                        \
+        luna::calculate(&args[0], x);                                   \
+        return 1;                                                       \
     }
 
-    MATH_FUNCTION(Abs, abs)
     MATH_FUNCTION(Acos, acos)
     MATH_FUNCTION(Asin, asin)
     MATH_FUNCTION(Atan, atan)
-    MATH_FUNCTION(Ceil, ceil)
     MATH_FUNCTION(Cos, cos)
     MATH_FUNCTION(Cosh, cosh)
     MATH_FUNCTION(Exp, exp)
-    MATH_FUNCTION(Floor, floor)
     MATH_FUNCTION(Sin, sin)
     MATH_FUNCTION(Sinh, sinh)
     MATH_FUNCTION(Sqrt, sqrt)
     MATH_FUNCTION(Tan, tan)
     MATH_FUNCTION(Tanh, tanh)
 
+    MATH_INTEGER_FUNCTION(Abs, CalculateAbs)
+    MATH_INTEGER_FUNCTION(Ceil, CalculateCeil)
+    MATH_INTEGER_FUNCTION(Floor, CalculateFloor)
+
     MATH_FUNCTION2(Atan2, atan2)
     MATH_FUNCTION2(Fmod, fmod)
     MATH_FUNCTION2(Ldexp, ldexp)
     MATH_FUNCTION2(Pow, pow)
 
-    int Deg(luna::State *state)
+    int Deg(luna::State *state, luna::Value *args, int count)
     {
-        luna::StackAPI api(state);
-        if (!api.CheckArgs(1, luna::ValueT_Number))
-            return 0;
+        if (!luna::LeafAPI::CheckArgs(state, args, count, 1, luna::ValueT_Number))
+            return -1;
 
-        api.PushNumber(api.GetNumber(0) / M_PI * 180);
+        args[0].SetNumber(args[0].GetNumber() / M_PI * 180);
         return 1;
     }
 
-    int Rad(luna::State *state)
+    int Rad(luna::State *state, luna::Value *args, int count)
     {
-        luna::StackAPI api(state);
-        if (!api.CheckArgs(1, luna::ValueT_Number))
-            return 0;
+        if (!luna::LeafAPI::CheckArgs(state, args, count, 1, luna::ValueT_Number))
+            return -1;
 
-        api.PushNumber(api.GetNumber(0) / 180 * M_PI);
+        args[0].SetNumber(args[0].GetNumber() / 180 * M_PI);
         return 1;
     }
 
-    int Log(luna::State *state)
+    int Log(luna::State *state, luna::Value *args, int count)
     {
-        luna::StackAPI api(state);
-        if (!api.CheckArgs(1, luna::ValueT_Number, luna::ValueT_Number))
-            return 0;
+        if (!luna::LeafAPI::CheckArgs(state, args, count, 1,
+                                      luna::ValueT_Number, luna::ValueT_Number))
+            return -1;
 
-        auto l = std::log(api.GetNumber(0));
-        if (api.GetStackSize() > 1)
+        auto l = std::log(args[0].GetNumber());
+        if (count > 1)
         {
-            auto b = std::log(api.GetNumber(1));
+            auto b = std::log(args[1].GetNumber());
             l /= b;
         }
 
-        api.PushNumber(l);
+        args[0].SetNumber(l);
         return 1;
     }
 
-    int Min(luna::State *state)
+    int Min(luna::State *state, luna::Value *args, int count)
     {
-        luna::StackAPI api(state);
-        if (!api.CheckArgs(1, luna::ValueT_Number))
-            return 0;
+        if (!luna::LeafAPI::CheckArgs(state, args, count, 1, luna::ValueT_Number))
+            return -1;
 
-        auto min = api.GetNumber(0);
-        auto params = api.GetStackSize();
-        for (int i = 1; i < params; ++i)
+        for (int i = 1; i < count; ++i)
         {
-            if (!api.IsNumber(i))
+            if (!args[i].IsNumber())
             {
-                api.ArgTypeError(i, luna::ValueT_Number);
-                return 0;
+                luna::LeafAPI::ArgTypeError(state, i, luna::ValueT_Number);
+                return -1;
             }
-
-            auto n = api.GetNumber(i);
-            if (n < min) min = n;
         }
 
-        api.PushNumber(min);
+        luna::CalculateMin(&args[0], args, count);
         return 1;
     }
 
-    int Max(luna::State *state)
+    int Max(luna::State *state, luna::Value *args, int count)
     {
-        luna::StackAPI api(state);
-        if (!api.CheckArgs(1, luna::ValueT_Number))
-            return 0;
+        if (!luna::LeafAPI::CheckArgs(state, args, count, 1, luna::ValueT_Number))
+            return -1;
 
-        auto max = api.GetNumber(0);
-        auto params = api.GetStackSize();
-        for (int i = 1; i < params; ++i)
+        for (int i = 1; i < count; ++i)
         {
-            if (!api.IsNumber(i))
+            if (!args[i].IsNumber())
             {
-                api.ArgTypeError(i, luna::ValueT_Number);
-                return 0;
+                luna::LeafAPI::ArgTypeError(state, i, luna::ValueT_Number);
+                return -1;
             }
-
-            auto n = api.GetNumber(i);
-            if (n > max) max = n;
         }
 
-        api.PushNumber(max);
+        luna::CalculateMax(&args[0], args, count);
         return 1;
     }
 
-    int Frexp(luna::State *state)
+    int Frexp(luna::State *state, luna::Value *args, int count)
     {
-        luna::StackAPI api(state);
-        if (!api.CheckArgs(1, luna::ValueT_Number))
-            return 0;
+        if (!luna::LeafAPI::CheckArgs(state, args, count, 1, luna::ValueT_Number))
+            return -1;
 
         int exp = 0;
-        auto m = std::frexp(api.GetNumber(0), &exp);
-        api.PushNumber(m);
-        api.PushNumber(exp);
+        auto m = std::frexp(args[0].GetNumber(), &exp);
+        args[0].SetNumber(m);
+        args[1].SetNumber(exp);
         return 2;
     }
 
-    int Modf(luna::State *state)
+    int Modf(luna::State *state, luna::Value *args, int count)
     {
-        luna::StackAPI api(state);
-        if (!api.CheckArgs(1, luna::ValueT_Number))
-            return 0;
+        if (!luna::LeafAPI::CheckArgs(state, args, count, 1, luna::ValueT_Number))
+            return -1;
 
         double ipart = 0.0;
-        auto fpart = std::modf(api.GetNumber(0), &ipart);
-        api.PushNumber(ipart);
-        api.PushNumber(fpart);
+        auto fpart = std::modf(args[0].GetNumber(), &ipart);
+        args[0].SetNumber(ipart);
+        args[1].SetNumber(fpart);
         return 2;
     }
 
@@ -203,7 +205,7 @@ namespace math {
 
             RandEngine engine;
             std::uniform_int_distribution<unsigned long long> dis(1, max);
-            api.PushNumber(static_cast<double>(dis(engine)));
+            api.PushInteger(static_cast<long long>(dis(engine)));
         }
         else if (params >= 2)
         {
@@ -212,7 +214,7 @@ namespace math {
 
             RandEngine engine;
             std::uniform_int_distribution<long long> dis(min, max);
-            api.PushNumber(static_cast<double>(dis(engine)));
+            api.PushInteger(dis(engine));
         }
 
         return 1;
@@ -264,6 +266,41 @@ namespace math {
         };
 
         lib.RegisterTableFunction("math", math);
+
+        // Calls of these functions by math.xxx(...) are calculated by
+        // intrinsic instructions while they are not reassigned
+        const struct
+        {
+            luna::IntrinsicType type_;
+            luna::LeafFunctionType func_;
+        } intrinsics[] = {
+            { luna::Intrinsic_Abs, Abs },
+            { luna::Intrinsic_Acos, Acos },
+            { luna::Intrinsic_Asin, Asin },
+            { luna::Intrinsic_Atan, Atan },
+            { luna::Intrinsic_Ceil, Ceil },
+            { luna::Intrinsic_Cos, Cos },
+            { luna::Intrinsic_Cosh, Cosh },
+            { luna::Intrinsic_Deg, Deg },
+            { luna::Intrinsic_Exp, Exp },
+            { luna::Intrinsic_Floor, Floor },
+            { luna::Intrinsic_Rad, Rad },
+            { luna::Intrinsic_Sin, Sin },
+            { luna::Intrinsic_Sinh, Sinh },
+            { luna::Intrinsic_Sqrt, Sqrt },
+            { luna::Intrinsic_Tan, Tan },
+            { luna::Intrinsic_Tanh, Tanh },
+            { luna::Intrinsic_Atan2, Atan2 },
+            { luna::Intrinsic_Fmod, Fmod },
+            { luna::Intrinsic_Ldexp, Ldexp },
+            { luna::Intrinsic_Pow, Pow },
+            { luna::Intrinsic_Log, Log },
+            { luna::Intrinsic_Min, Min },
+            { luna::Intrinsic_Max, Max },
+        };
+
+        for (const auto &intrinsic : intrinsics)
+            state->SetIntrinsic(intrinsic.type_, intrinsic.func_);
     }
 
 } // namespace math
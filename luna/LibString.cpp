@@ -37,7 +37,7 @@ namespace string {
         {
             if (index >= 0 && index < len)
             {
-                api.PushNumber(s[index]);
+                api.PushInteger(s[index]);
                 ++count;
             }
         }
@@ -67,13 +67,13 @@ namespace string {
         return 1;
     }
 
-    int Len(luna::State *state)
+    // Leaf function
+    int Len(luna::State *state, luna::Value *args, int count)
     {
-        luna::StackAPI api(state);
-        if (!api.CheckArgs(1, luna::ValueT_String))
-            return 0;
+        if (!luna::LeafAPI::CheckArgs(state, args, count, 1, luna::ValueT_String))
+            return -1;
 
-        api.PushNumber(api.GetString(0)->GetLength());
+        args[0].SetInteger(args[0].str_->GetLength());
         return 1;
     }
 
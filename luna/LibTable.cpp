@@ -59,17 +59,18 @@ namespace table {
         }
 
         luna::Value key;
-        key.type_ = luna::ValueT_Number;
 
         // Concat values(number or string) of the range [i, j]
         std::ostringstream oss;
         for (; i <= j; ++i)
         {
-            key.num_ = i;
+            key.SetInteger(i);
             auto value = table->GetValue(key);
 
             if (value.type_ == luna::ValueT_Number)
                 oss << value.num_;
+            else if (value.type_ == luna::ValueT_Integer)
+                oss << value.integer_;
             else if (value.type_ == luna::ValueT_String)
                 oss << value.str_->GetCStr();
 
@@ -159,10 +160,9 @@ namespace table {
 
         int count = 0;
         luna::Value key;
-        key.type_ = luna::ValueT_Number;
         for (int i = begin; i <= end; ++i)
         {
-            key.num_ = i;
+            key.SetInteger(i);
             api.PushValue(table->GetValue(key));
             ++count;
         }
@@ -1,11 +1,15 @@
 #include "State.h"
+#include "Function.h"
 #include "Exception.h"
+#include "AotCompile.h"
 #include "LibBase.h"
 #include "LibIO.h"
 #include "LibMath.h"
 #include "LibString.h"
 #include "LibTable.h"
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 
 void Repl(luna::State &state)
 {
@@ -30,15 +34,15 @@ void Repl(luna::State &state)
     }
 }
 
-void ExecuteFile(const char **argv, luna::State &state)
+void ExecuteFile(const char *program, const char *file, luna::State &state)
 {
     try
     {
-        state.DoModule(argv[1]);
+        state.DoModule(file);
     }
     catch (const luna::OpenFileFail &exp)
     {
-        printf("%s: can not open file %s\n", argv[0], exp.What().c_str());
+        printf("%s: can not open file %s\n", program, exp.What().c_str());
     }
     catch (const luna::Exception &exp)
     {
@@ -46,6 +50,27 @@ void ExecuteFile(const char **argv, luna::State &state)
     }
 }
 
+int EmitCpp(const char *program, const char *file, luna::State &state)
+{
+    try
+    {
+        state.LoadModule(file);
+        auto closure = state.GetModuleClosure(file);
+        auto cpp = luna::AotCompile(closure.closure_->GetPrototype());
+        fwrite(cpp.data(), 1, cpp.size(), stdout);
+        return 0;
+    }
+    catch (const luna::OpenFileFail &exp)
+    {
+        printf("%s: can not open file %s\n", program, exp.What().c_str());
+    }
+    catch (const luna::Exception &exp)
+    {
+        printf("%s\n", exp.What().c_str());
+    }
+    return 1;
+}
+
 int main(int argc, const char **argv)
 {
     luna::State state;
@@ -56,14 +81,62 @@ int main(int argc, const char **argv)
     lib::string::RegisterLibString(&state);
     lib::table::RegisterLibTable(&state);
 
-    if (argc < 2)
+    // Option -j enables JIT of hot loops, -b enables baseline JIT of
+    // functions, -bN also compiles a function after N calls, -s prints
+    // count of compiled functions at exit, --emit-cpp prints the module
+    // compiled into C++ instead of executing it
+    int arg = 1;
+    bool stats = false;
+    bool emit_cpp = false;
+    for (; arg < argc && argv[arg][0] == '-'; ++arg)
+    {
+        if (strcmp(argv[arg], "-j") == 0)
+        {
+            state.SetJitEnabled(true);
+        }
+        else if (strncmp(argv[arg], "-b", 2) == 0)
+        {
+            state.SetBaselineJitEnabled(true);
+            if (argv[arg][2])
+                state.SetBaselineJitThreshold(atoi(argv[arg] + 2));
+        }
+        else if (strcmp(argv[arg], "-s") == 0)
+        {
+            stats = true;
+        }
+        else if (strcmp(argv[arg], "--emit-cpp") == 0)
+        {
+            emit_cpp = true;
+        }
+        else
+        {
+            printf("%s: unknown option %s\n", argv[0], argv[arg]);
+            return 1;
+        }
+    }
+
+    if (emit_cpp)
+    {
+        if (arg >= argc)
+        {
+            printf("%s: --emit-cpp needs a module file\n", argv[0]);
+            return 1;
+        }
+        return EmitCpp(argv[0], argv[arg], state);
+    }
+
+    if (arg >= argc)
     {
         Repl(state);
     }
     else
     {
-        ExecuteFile(argv, state);
+        ExecuteFile(argv[0], argv[arg], state);
     }
 
+    if (stats)
+        fprintf(stderr, "baseline JIT compiled %zu functions\n",
+                state.GetBaselineJitCompiledCount());
+
     return 0;
 }
@@ -5,9 +5,19 @@
 #include "Table.h"
 #include "Exception.h"
 #include "SemanticAnalysis.h"
+#include "ConstantFold.h"
 #include "CodeGenerate.h"
 #include "TextInStream.h"
+#include "Function.h"
+#include "AotModule.h"
 #include <functional>
+#include <memory>
+#include <string.h>
+
+#if !defined(_WIN32)
+#define LUNA_NATIVE_MODULE_SUPPORTED
+#include <dlfcn.h>
+#endif
 
 namespace luna
 {
@@ -16,6 +26,14 @@ namespace luna
     {
     }
 
+    ModuleManager::~ModuleManager()
+    {
+#ifdef LUNA_NATIVE_MODULE_SUPPORTED
+        for (auto handle : native_modules_)
+            dlclose(handle);
+#endif
+    }
+
     bool ModuleManager::IsLoaded(const std::string &module_name) const
     {
         auto value = GetModuleClosure(module_name);
@@ -34,9 +52,18 @@ namespace luna
         if (!is.IsOpen())
             throw OpenFileFail(module_name);
 
-        Lexer lexer(state_, state_->GetString(module_name),
-                    [&is] () { return is.GetChar(); });
-        Load(lexer);
+        auto suffix = module_name.size() > 3 ?
+            module_name.substr(module_name.size() - 3) : std::string();
+        if (suffix == ".so")
+        {
+            LoadNativeModule(module_name);
+        }
+        else
+        {
+            Lexer lexer(state_, state_->GetString(module_name),
+                        [&is] () { return is.GetChar(); });
+            Load(lexer);
+        }
 
         // Add to modules' table
         Value key(state_->GetString(module_name));
@@ -60,7 +87,119 @@ namespace luna
         // Semantic analysis
         SemanticAnalysis(ast.get(), state_);
 
+        // Fold constants and remove dead code
+        ConstantFold(ast.get(), state_);
+
         // Generate code
         CodeGenerate(ast.get(), state_);
     }
+
+    void ModuleManager::LoadNativeModule(const std::string &module_name)
+    {
+#ifdef LUNA_NATIVE_MODULE_SUPPORTED
+        // dlopen searches library paths for name without '/'
+        auto path = module_name.find('/') == std::string::npos ?
+            "./" + module_name : module_name;
+        auto handle = dlopen(path.c_str(), RTLD_NOW | RTLD_LOCAL);
+        if (!handle)
+            throw NativeModuleFail(module_name, dlerror());
+        native_modules_.push_back(handle);
+
+        auto module = static_cast<const aot::Module *>(
+            dlsym(handle, LUNA_AOT_MODULE_SYMBOL));
+        if (!module)
+            throw NativeModuleFail(module_name, "not a native module");
+        if (module->version_ != aot::kVersion ||
+            module->value_size_ != sizeof(Value))
+            throw NativeModuleFail(module_name, "native module does not match this luna");
+
+        auto function = NewNativeFunction(module, 0, state_->GetString(module->name_));
+
+        // New one closure and put it on stack
+        auto closure = state_->NewClosure();
+        closure->SetPrototype(function);
+
+        auto top = state_->CheckStack(state_->stack_.top_, 1);
+        state_->stack_.top_ = top + 1;
+        top->closure_ = closure;
+        top->type_ = ValueT_Closure;
+#else
+        throw NativeModuleFail(module_name, "native module is not supported");
+#endif
+    }
+
+    Function * ModuleManager::NewNativeFunction(const aot::Module *module, int index,
+                                                String *module_name)
+    {
+        const auto &proto = module->prototypes_[index];
+
+        // New function is default on GCGen2, so barrier it
+        auto function = state_->NewFunction();
+        CHECK_BARRIER(state_->GetGC(), function);
+        function->SetModuleName(module_name);
+        function->SetLine(proto.line_);
+        function->AddFixedArgCount(proto.args_);
+        if (proto.vararg_)
+            function->SetHasVararg();
+        function->SetRegisterCount(proto.register_count_);
+
+        for (int i = 0; i < proto.code_size_; ++i)
+        {
+            Instruction instruction;
+            instruction.opcode_ = proto.code_[i];
+            function->AddInstruction(instruction, proto.lines_[i]);
+        }
+
+        // Consts are appended without merging, so indexes of them are
+        // same with the module
+        for (int i = 0; i < proto.const_count_; ++i)
+        {
+            const auto &k = proto.consts_[i];
+            switch (k.type_) {
+                case ValueT_Number:
+                {
+                    double num;
+                    memcpy(&num, &k.bits_, sizeof(num));
+                    function->AddConstValue(Value(num));
+                    break;
+                }
+                case ValueT_Integer:
+                    function->AddConstValue(Value(k.integer_));
+                    break;
+                case ValueT_String:
+                    function->AddConstValue(Value(state_->GetString(k.str_, k.len_)));
+                    break;
+                case ValueT_Bool:
+                    function->AddConstValue(Value(k.integer_ != 0));
+                    break;
+                default:
+                    function->AddConstValue(Value());
+                    break;
+            }
+        }
+
+        for (int i = 0; i < proto.local_var_count_; ++i)
+        {
+            const auto &var = proto.local_vars_[i];
+            function->AddLocalVar(state_->GetString(var.name_), var.register_id_,
+                                  var.begin_pc_, var.end_pc_);
+        }
+
+        for (int i = 0; i < proto.upvalue_count_; ++i)
+        {
+            const auto &upvalue = proto.upvalues_[i];
+            function->AddUpvalue(state_->GetString(upvalue.name_),
+                                 upvalue.parent_local_, upvalue.register_index_);
+        }
+
+        for (int i = 0; i < proto.child_count_; ++i)
+        {
+            auto child = NewNativeFunction(module, proto.children_[i], module_name);
+            child->SetSuperior(function);
+            function->AddChildFunction(child);
+        }
+
+        function->SetNativeCode(std::unique_ptr<NativeCode>(new NativeCode(proto.entry_)));
+        return function;
+    }
 } // namespace luna
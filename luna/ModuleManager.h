@@ -3,17 +3,25 @@
 
 #include "Value.h"
 #include <string>
+#include <vector>
 
 namespace luna
 {
     class State;
     class Lexer;
+    class Function;
+
+    namespace aot
+    {
+        struct Module;
+    } // namespace aot
 
     // Load and manage all modules or load string
     class ModuleManager
     {
     public:
         ModuleManager(State *state, Table *modules);
+        ~ModuleManager();
 
         ModuleManager(const ModuleManager&) = delete;
         void operator = (const ModuleManager&) = delete;
@@ -26,7 +34,8 @@ namespace luna
         Value GetModuleClosure(const std::string &module_name) const;
 
         // Load module, when loaded success, push the closure of the module
-        // onto stack
+        // onto stack, module which name ends with ".so" is loaded as a
+        // native module
         void LoadModule(const std::string &module_name);
 
         // Load string, when loaded success, push the closure of the string
@@ -37,8 +46,19 @@ namespace luna
         // Load and push the closure onto stack
         void Load(Lexer &lexer);
 
+        // Load native module and push the closure onto stack
+        void LoadNativeModule(const std::string &module_name);
+
+        // New function of prototype 'index' of native module and all
+        // functions in it
+        Function * NewNativeFunction(const aot::Module *module, int index,
+                                     String *module_name);
+
         State *state_;
         Table *modules_;
+        // Handles of native modules, native code of functions is in them,
+        // they are closed after GC frees all functions
+        std::vector<void *> native_modules_;
     };
 } // namespace luna
 
@@ -0,0 +1,297 @@
+#include "NativeCode.h"
+#include "State.h"
+#include "VM.h"
+#include "Table.h"
+#include "String.h"
+#include "Function.h"
+#include "Upvalue.h"
+#include "UserData.h"
+#include "Arith.h"
+#include <math.h>
+
+namespace luna
+{
+    // Integer result which Value can not hold returns 0, then the
+    // interpreter executes the instruction again and reports it
+    static int SetIntegerResult(Value *a, long long integer)
+    {
+        if (!IntegerFitsValue(integer))
+            return 0;
+        a->SetInteger(integer);
+        return 1;
+    }
+
+    NativeCode::NativeCode(EntryType entry)
+        : entry_(entry)
+    {
+    }
+
+    NativeCode::~NativeCode()
+    {
+    }
+
+    bool NativeCode::Load(const std::vector<unsigned char> &code)
+    {
+        if (!code_.Load(code))
+            return false;
+        entry_ = reinterpret_cast<EntryType>(code_.GetEntry());
+        return true;
+    }
+
+    void NativeHelper::CloseUpvalue(VM *vm, Value *a)
+    {
+        vm->CloseUpvalue(a);
+    }
+
+    void NativeHelper::GetUpvalue(const Closure *cl, long index, Value *a)
+    {
+        *a = *cl->GetUpvalue(index)->GetValue();
+    }
+
+    void NativeHelper::SetUpvalue(const Closure *cl, long index, const Value *a)
+    {
+        *cl->GetUpvalue(index)->GetValue() = *a;
+    }
+
+    void NativeHelper::GetGlobal(VM *vm, Value *a, const Value *key,
+                                 TableCache *cache)
+    {
+        if (cache->version_ == vm->state_->global_.table_->GetVersion())
+            *a = *cache->value_;
+        else
+            vm->GetGlobal(a, key, cache);
+    }
+
+    void NativeHelper::SetGlobal(VM *vm, const Value *a, const Value *key,
+                                 TableCache *cache)
+    {
+        // Assign nil erases the key, so it is not cached
+        if (cache->version_ == vm->state_->global_.table_->GetVersion() &&
+            a->type_ != ValueT_Nil)
+            *cache->value_ = *a;
+        else
+            vm->SetGlobal(a, key, cache);
+    }
+
+    int NativeHelper::Arith(long kind, Value *a, const Value *b, const Value *c)
+    {
+        if (!b->IsNumber() || !c->IsNumber())
+            return 0;
+
+        bool integer = b->type_ == ValueT_Integer && c->type_ == ValueT_Integer;
+        double x = b->GetNumber();
+        double y = c->GetNumber();
+        switch (kind) {
+            case Arith_Add:
+                if (integer)
+                    return SetIntegerResult(a, IntegerAdd(b->integer_, c->integer_));
+                a->SetNumber(x + y);
+                break;
+            case Arith_Sub:
+                if (integer)
+                    return SetIntegerResult(a, IntegerSub(b->integer_, c->integer_));
+                a->SetNumber(x - y);
+                break;
+            case Arith_Mul:
+                if (integer)
+                    return SetIntegerResult(a, IntegerMul(b->integer_, c->integer_));
+                a->SetNumber(x * y);
+                break;
+            case Arith_Div:
+                a->SetNumber(x / y);
+                break;
+            case Arith_Pow:
+                a->SetNumber(pow(x, y));
+                break;
+            default:
+                if (integer)
+                {
+                    if (c->integer_ == 0)
+                        return 0;
+                    a->SetInteger(IntegerMod(b->integer_, c->integer_));
+                }
+                else
+                    a->SetNumber(fmod(x, y));
+                break;
+        }
+        return 1;
+    }
+
+    int NativeHelper::Compare(long kind, const Value *b, const Value *c)
+    {
+        if (kind == Compare_Equal)
+            return *b == *c;
+        if (kind == Compare_UnEqual)
+            return *b != *c;
+
+        if (b->type_ == ValueT_Integer && c->type_ == ValueT_Integer)
+        {
+            switch (kind) {
+                case Compare_Less: return b->integer_ < c->integer_;
+                case Compare_LessEqual: return b->integer_ <= c->integer_;
+                case Compare_Greater: return b->integer_ > c->integer_;
+                default: return b->integer_ >= c->integer_;
+            }
+        }
+
+        if (b->IsNumber() && c->IsNumber())
+        {
+            double x = b->GetNumber();
+            double y = c->GetNumber();
+            switch (kind) {
+                case Compare_Less: return x < y;
+                case Compare_LessEqual: return x <= y;
+                case Compare_Greater: return x > y;
+                default: return x >= y;
+            }
+        }
+
+        if (b->type_ == ValueT_String && c->type_ == ValueT_String)
+        {
+            switch (kind) {
+                case Compare_Less: return *b->str_ < *c->str_;
+                case Compare_LessEqual: return *b->str_ <= *c->str_;
+                case Compare_Greater: return *b->str_ > *c->str_;
+                default: return *b->str_ >= *c->str_;
+            }
+        }
+        return -1;
+    }
+
+    int NativeHelper::SetCompare(long kind, Value *a, const Value *b, const Value *c)
+    {
+        int result = Compare(kind, b, c);
+        if (result < 0)
+            return 0;
+        a->SetBool(result != 0);
+        return 1;
+    }
+
+    int NativeHelper::Len(Value *a)
+    {
+        if (a->type_ == ValueT_Table)
+            a->SetInteger(a->table_->ArraySize());
+        else if (a->type_ == ValueT_String)
+            a->SetInteger(a->str_->GetLength());
+        else
+            return 0;
+        return 1;
+    }
+
+    int NativeHelper::Concat(VM *vm, Value *a, Value *b, Value *c)
+    {
+        if ((b->type_ != ValueT_String && !b->IsNumber()) ||
+            (c->type_ != ValueT_String && !c->IsNumber()) ||
+            (b->type_ != ValueT_String && c->type_ != ValueT_String))
+            return 0;
+
+        vm->Concat(a, b, c);
+        vm->state_->CheckRunGC();
+        return 1;
+    }
+
+    int NativeHelper::ConcatRange(VM *vm, Value *a, Value *b, long count)
+    {
+        if (b->type_ != ValueT_String && (b + 1)->type_ != ValueT_String)
+            return 0;
+        for (long i = 0; i < count; ++i)
+        {
+            if (b[i].type_ != ValueT_String && !b[i].IsNumber())
+                return 0;
+        }
+
+        vm->ConcatRange(a, b, count);
+        vm->state_->CheckRunGC();
+        return 1;
+    }
+
+    void NativeHelper::NewTable(VM *vm, Value *a)
+    {
+        a->table_ = vm->state_->NewTable();
+        a->type_ = ValueT_Table;
+        vm->state_->CheckRunGC();
+    }
+
+    int NativeHelper::GetTable(const Value *t, const Value *k, Value *v)
+    {
+        if (t->type_ == ValueT_Table)
+            *v = t->table_->GetValue(*k);
+        else if (t->type_ == ValueT_UserData && t->user_data_->GetMetatable())
+            *v = t->user_data_->GetMetatable()->GetValue(*k);
+        else
+            return 0;
+        return 1;
+    }
+
+    int NativeHelper::SetTable(const Value *t, const Value *k, const Value *v)
+    {
+        if (t->type_ == ValueT_Table)
+            t->table_->SetValue(*k, *v);
+        else if (t->type_ == ValueT_UserData && t->user_data_->GetMetatable())
+            t->user_data_->GetMetatable()->SetValue(*k, *v);
+        else
+            return 0;
+        return 1;
+    }
+
+    int NativeHelper::GetField(VM *vm, Value *t, const Value *key,
+                               Value *v, TableCache *cache)
+    {
+        if (t->type_ == ValueT_Table)
+        {
+            if (cache->version_ == t->table_->GetVersion())
+            {
+                *v = *cache->value_;
+                return 1;
+            }
+        }
+        else if (t->type_ != ValueT_UserData || !t->user_data_->GetMetatable())
+            return 0;
+
+        vm->GetField(t, key, v, cache);
+        return 1;
+    }
+
+    int NativeHelper::SetField(VM *vm, Value *t, const Value *key,
+                               const Value *v, TableCache *cache)
+    {
+        if (t->type_ == ValueT_Table)
+        {
+            // Assign nil erases the key, so it is not cached
+            if (cache->version_ == t->table_->GetVersion() &&
+                v->type_ != ValueT_Nil)
+            {
+                *cache->value_ = *v;
+                return 1;
+            }
+        }
+        else if (t->type_ != ValueT_UserData || !t->user_data_->GetMetatable())
+            return 0;
+
+        vm->SetField(t, key, v, cache);
+        return 1;
+    }
+
+    int NativeHelper::Self(VM *vm, Value *a, const Value *key, TableCache *cache)
+    {
+        *(a + 1) = *a;
+        return GetField(vm, a, key, a, cache);
+    }
+
+    int NativeHelper::ForInit(VM *vm, Value *a)
+    {
+        if (!a->IsNumber() || !(a + 1)->IsNumber() || !(a + 2)->IsNumber())
+            return -1;
+
+        if (!vm->ForInit(a, a + 1, a + 2))
+            return 0;
+        *(a + 3) = *a;
+        return 1;
+    }
+
+    int NativeHelper::Intrinsic(VM *vm, Value *a, long type, long count)
+    {
+        return vm->state_->IsIntrinsic(*a, type) &&
+               CalculateIntrinsic(type, a, a + 1, count);
+    }
+} // namespace luna
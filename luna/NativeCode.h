@@ -0,0 +1,88 @@
+#ifndef NATIVE_CODE_H
+#define NATIVE_CODE_H
+
+#include "Value.h"
+#include "Assembler.h"
+#include <vector>
+
+namespace luna
+{
+    class VM;
+    struct TableCache;
+
+    // Machine code of a function, compiled by baseline JIT or compiled
+    // ahead of time into a native module
+    class NativeCode
+    {
+    public:
+        // Entry of machine code, run from instruction 'index' of the
+        // function, return index of the instruction where interpreter
+        // resumes
+        typedef int (*EntryType)(Value *base, Closure *cl, VM *vm, long index);
+
+        // Code is loaded later, or 'entry' is a function compiled ahead
+        // of time
+        explicit NativeCode(EntryType entry = nullptr);
+        ~NativeCode();
+
+        NativeCode(const NativeCode&) = delete;
+        void operator = (const NativeCode&) = delete;
+
+        // Copy machine code into executable memory, return false when
+        // the memory is not available
+        bool Load(const std::vector<unsigned char> &code);
+
+        int Run(Value *base, Closure *cl, VM *vm, long index)
+        { return entry_(base, cl, vm, index); }
+
+    private:
+        EntryType entry_;
+        ExecutableCode code_;
+    };
+
+    // Kinds of arithmetic and comparison of helpers
+    enum ArithKind { Arith_Add, Arith_Sub, Arith_Mul, Arith_Div, Arith_Pow, Arith_Mod };
+
+    enum CompareKind
+    {
+        Compare_Less,
+        Compare_LessEqual,
+        Compare_Greater,
+        Compare_GreaterEqual,
+        Compare_Equal,
+        Compare_UnEqual,
+    };
+
+    // Helpers called by native code for instructions which are not
+    // executed inline. Helpers never throw, helpers which return int
+    // return 0 when the instruction reports an error, then native code
+    // exits to the interpreter to report the error
+    class NativeHelper
+    {
+    public:
+        static void CloseUpvalue(VM *vm, Value *a);
+        static void GetUpvalue(const Closure *cl, long index, Value *a);
+        static void SetUpvalue(const Closure *cl, long index, const Value *a);
+        static void GetGlobal(VM *vm, Value *a, const Value *key, TableCache *cache);
+        static void SetGlobal(VM *vm, const Value *a, const Value *key, TableCache *cache);
+        static int Arith(long kind, Value *a, const Value *b, const Value *c);
+        // Return result of comparison, or -1 when it is an error
+        static int Compare(long kind, const Value *b, const Value *c);
+        static int SetCompare(long kind, Value *a, const Value *b, const Value *c);
+        static int Len(Value *a);
+        static int Concat(VM *vm, Value *a, Value *b, Value *c);
+        static int ConcatRange(VM *vm, Value *a, Value *b, long count);
+        static void NewTable(VM *vm, Value *a);
+        static int GetTable(const Value *t, const Value *k, Value *v);
+        static int SetTable(const Value *t, const Value *k, const Value *v);
+        static int GetField(VM *vm, Value *t, const Value *key, Value *v, TableCache *cache);
+        static int SetField(VM *vm, Value *t, const Value *key, const Value *v, TableCache *cache);
+        static int Self(VM *vm, Value *a, const Value *key, TableCache *cache);
+        // Return -1 when it is an error, 0 when loop body does not run
+        static int ForInit(VM *vm, Value *a);
+        // Return 0 when the next call instruction is not skipped
+        static int Intrinsic(VM *vm, Value *a, long type, long count);
+    };
+} // namespace luna
+
+#endif // NATIVE_CODE_H
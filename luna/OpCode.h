@@ -17,12 +17,27 @@ namespace luna
         OpType_SetGlobal,               // ABx  A: value register Bx: const index
         OpType_Closure,                 // ABx  A: register Bx: proto index
         OpType_Call,                    // ABC  A: register B: arg value count + 1 C: expected result count + 1
+        OpType_TailCall,                // ABC  A: register B: arg value count + 1, return all results of the call
         OpType_VarArg,                  // AsBx A: register sBx: expected result count
         OpType_Ret,                     // AsBx A: return value start register sBx: return value count
         OpType_JmpFalse,                // AsBx A: register sBx: diff of instruction index
         OpType_JmpTrue,                 // AsBx A: register sBx: diff of instruction index
         OpType_JmpNil,                  // AsBx A: register sBx: diff of instruction index
-        OpType_Jmp,                     // sBx  sBx: diff of instruction index
+        OpType_Jmp,                     // sAx  sAx: diff of instruction index
+        OpType_JmpLess,                 // ABC  A: jump when result is A B: operand1 register C: operand2 register, next instruction sAx: diff of instruction index
+        OpType_JmpLessRK,               // ABC  A: jump when result is A B: operand1 register C: operand2 const index, next instruction sAx: diff of instruction index
+        OpType_JmpLessKR,               // ABC  A: jump when result is A B: operand1 const index C: operand2 register, next instruction sAx: diff of instruction index
+        OpType_JmpGreater,              // ABC  A: jump when result is A B: operand1 register C: operand2 register, next instruction sAx: diff of instruction index
+        OpType_JmpGreaterRK,            // ABC  A: jump when result is A B: operand1 register C: operand2 const index, next instruction sAx: diff of instruction index
+        OpType_JmpGreaterKR,            // ABC  A: jump when result is A B: operand1 const index C: operand2 register, next instruction sAx: diff of instruction index
+        OpType_JmpLessEqual,            // ABC  A: jump when result is A B: operand1 register C: operand2 register, next instruction sAx: diff of instruction index
+        OpType_JmpLessEqualRK,          // ABC  A: jump when result is A B: operand1 register C: operand2 const index, next instruction sAx: diff of instruction index
+        OpType_JmpLessEqualKR,          // ABC  A: jump when result is A B: operand1 const index C: operand2 register, next instruction sAx: diff of instruction index
+        OpType_JmpGreaterEqual,         // ABC  A: jump when result is A B: operand1 register C: operand2 register, next instruction sAx: diff of instruction index
+        OpType_JmpGreaterEqualRK,       // ABC  A: jump when result is A B: operand1 register C: operand2 const index, next instruction sAx: diff of instruction index
+        OpType_JmpGreaterEqualKR,       // ABC  A: jump when result is A B: operand1 const index C: operand2 register, next instruction sAx: diff of instruction index
+        OpType_JmpEqual,                // ABC  A: jump when result is A B: operand1 register C: operand2 register, next instruction sAx: diff of instruction index
+        OpType_JmpEqualRK,              // ABC  A: jump when result is A B: operand1 register C: operand2 const index, next instruction sAx: diff of instruction index
         OpType_Neg,                     // A    A: operand register and dst register
         OpType_Not,                     // A    A: operand register and dst register
         OpType_Len,                     // A    A: operand register and dst register
@@ -32,6 +47,18 @@ namespace luna
         OpType_Div,                     // ABC  A: dst register B: operand1 register C: operand2 register
         OpType_Pow,                     // ABC  A: dst register B: operand1 register C: operand2 register
         OpType_Mod,                     // ABC  A: dst register B: operand1 register C: operand2 register
+        OpType_AddRK,                   // ABC  A: dst register B: operand1 register C: operand2 const index
+        OpType_AddKR,                   // ABC  A: dst register B: operand1 const index C: operand2 register
+        OpType_SubRK,                   // ABC  A: dst register B: operand1 register C: operand2 const index
+        OpType_SubKR,                   // ABC  A: dst register B: operand1 const index C: operand2 register
+        OpType_MulRK,                   // ABC  A: dst register B: operand1 register C: operand2 const index
+        OpType_MulKR,                   // ABC  A: dst register B: operand1 const index C: operand2 register
+        OpType_DivRK,                   // ABC  A: dst register B: operand1 register C: operand2 const index
+        OpType_DivKR,                   // ABC  A: dst register B: operand1 const index C: operand2 register
+        OpType_PowRK,                   // ABC  A: dst register B: operand1 register C: operand2 const index
+        OpType_PowKR,                   // ABC  A: dst register B: operand1 const index C: operand2 register
+        OpType_ModRK,                   // ABC  A: dst register B: operand1 register C: operand2 const index
+        OpType_ModKR,                   // ABC  A: dst register B: operand1 const index C: operand2 register
         OpType_Concat,                  // ABC  A: dst register B: operand1 register C: operand2 register
         OpType_Less,                    // ABC  A: dst register B: operand1 register C: operand2 register
         OpType_Greater,                 // ABC  A: dst register B: operand1 register C: operand2 register
@@ -39,13 +66,68 @@ namespace luna
         OpType_UnEqual,                 // ABC  A: dst register B: operand1 register C: operand2 register
         OpType_LessEqual,               // ABC  A: dst register B: operand1 register C: operand2 register
         OpType_GreaterEqual,            // ABC  A: dst register B: operand1 register C: operand2 register
+        OpType_LessRK,                  // ABC  A: dst register B: operand1 register C: operand2 const index
+        OpType_LessKR,                  // ABC  A: dst register B: operand1 const index C: operand2 register
+        OpType_GreaterRK,               // ABC  A: dst register B: operand1 register C: operand2 const index
+        OpType_GreaterKR,               // ABC  A: dst register B: operand1 const index C: operand2 register
+        OpType_EqualRK,                 // ABC  A: dst register B: operand1 register C: operand2 const index
+        OpType_UnEqualRK,               // ABC  A: dst register B: operand1 register C: operand2 const index
+        OpType_LessEqualRK,             // ABC  A: dst register B: operand1 register C: operand2 const index
+        OpType_LessEqualKR,             // ABC  A: dst register B: operand1 const index C: operand2 register
+        OpType_GreaterEqualRK,          // ABC  A: dst register B: operand1 register C: operand2 const index
+        OpType_GreaterEqualKR,          // ABC  A: dst register B: operand1 const index C: operand2 register
         OpType_NewTable,                // A    A: register of table
         OpType_SetTable,                // ABC  A: register of table B: key register C: value register
         OpType_GetTable,                // ABC  A: register of table B: key register C: value register
-        OpType_ForInit,                 // ABC  A: var register B: limit register    C: step register
-        OpType_ForStep,                 // ABC  ABC same with OpType_ForInit, next instruction sBx: diff of instruction index
+        OpType_SetTableRK,              // ABC  A: register of table B: key register C: value const index
+        OpType_SetTableKR,              // ABC  A: register of table B: key const index C: value register
+        OpType_SetTableKK,              // ABC  A: register of table B: key const index C: value const index
+        OpType_GetTableKR,              // ABC  A: register of table B: key const index C: value register
+        OpType_GetField,                // ABC  A: register of table B: string key const index C: value register
+        OpType_SetField,                // ABC  A: register of table B: string key const index C: value register
+        OpType_Self,                    // AB   A: register of table and method B: string key const index, table is copied to A + 1
+        OpType_ForInit,                 // AsBx A: var register, A + 1: limit A + 2: step A + 3: name sBx: diff of instruction index to loop end
+        OpType_ForLoop,                 // AsBx A: var register same with OpType_ForInit sBx: diff of instruction index to loop body
+        OpType_ForLoopInc,              // AsBx Same with OpType_ForLoop, step is known greater than 0
+        OpType_ForLoopDec,              // AsBx Same with OpType_ForLoop, step is known less than or equal to 0
+        OpType_Intrinsic,               // ABC  A: register of function and result B: IntrinsicType C: arg count, calculate and skip next call instruction when function in A is the intrinsic
+        OpType_ConcatRange,             // ABC  A: dst register B: first operand register C: operand count, concat operands from left to right
+        OpType_LoadConstX,              // A    A: register Next instruction opcode is const index
+        OpType_GetGlobalX,              // A    A: value register Next instruction opcode is const index
+        OpType_SetGlobalX,              // A    A: value register Next instruction opcode is const index
+        OpType_AddNN,                   // ABC  Same with OpType_Add, operands are known numbers
+        OpType_AddNK,                   // ABC  Same with OpType_AddRK, operands are known numbers
+        OpType_SubNN,                   // ABC  Same with OpType_Sub, operands are known numbers
+        OpType_SubNK,                   // ABC  Same with OpType_SubRK, operands are known numbers
+        OpType_MulNN,                   // ABC  Same with OpType_Mul, operands are known numbers
+        OpType_MulNK,                   // ABC  Same with OpType_MulRK, operands are known numbers
+        OpType_DivNN,                   // ABC  Same with OpType_Div, operands are known numbers
+        OpType_DivNK,                   // ABC  Same with OpType_DivRK, operands are known numbers
+        OpType_JmpLessNN,               // ABC  Same with OpType_JmpLess, operands are known numbers
+        OpType_JmpLessNK,               // ABC  Same with OpType_JmpLessRK, operands are known numbers
+        OpType_JmpGreaterNN,            // ABC  Same with OpType_JmpGreater, operands are known numbers
+        OpType_JmpGreaterNK,            // ABC  Same with OpType_JmpGreaterRK, operands are known numbers
+        OpType_JmpLessEqualNN,          // ABC  Same with OpType_JmpLessEqual, operands are known numbers
+        OpType_JmpLessEqualNK,          // ABC  Same with OpType_JmpLessEqualRK, operands are known numbers
+        OpType_JmpGreaterEqualNN,       // ABC  Same with OpType_JmpGreaterEqual, operands are known numbers
+        OpType_JmpGreaterEqualNK,       // ABC  Same with OpType_JmpGreaterEqualRK, operands are known numbers
     };
 
+    // Max const index in Bx, instructions which const index is greater
+    // than it use the wide form with index in the next instruction
+    const int kMaxBx = 0xFFFF;
+
+    // Range of jump diff in sBx and sAx
+    const int kMaxsBx = 0x7FFF;
+    const int kMaxsAx = 0x7FFFFF;
+
+    // Next instruction opcode of these instructions is data of them
+    inline bool HasDataWord(int op)
+    {
+        return op == OpType_LoadInt || op == OpType_LoadConstX ||
+               op == OpType_GetGlobalX || op == OpType_SetGlobalX;
+    }
+
     struct Instruction
     {
         unsigned int opcode_;
@@ -72,6 +154,20 @@ namespace luna
             opcode_ = (opcode_ & 0xFFFF0000) | (static_cast<int>(b) & 0xFFFF);
         }
 
+        void RefillsAx(int ax)
+        {
+            opcode_ = (opcode_ & 0xFF000000) | (static_cast<unsigned int>(ax) & 0xFFFFFF);
+        }
+
+        // Refill jump diff, sAx of OpType_Jmp and sBx of others
+        void RefillJumpDiff(int diff)
+        {
+            if (GetOpCode(*this) == OpType_Jmp)
+                RefillsAx(diff);
+            else
+                RefillsBx(diff);
+        }
+
         static int GetOpCode(Instruction i)
         {
             return (i.opcode_ >> 24) & 0xFF;
@@ -102,6 +198,18 @@ namespace luna
             return static_cast<unsigned short>(i.opcode_ & 0xFFFF);
         }
 
+        // sAx is 24 bits of A and Bx
+        static int GetParamsAx(Instruction i)
+        {
+            return static_cast<int>(i.opcode_ << 8) >> 8;
+        }
+
+        // Get jump diff, sAx of OpType_Jmp and sBx of others
+        static int GetJumpDiff(Instruction i)
+        {
+            return GetOpCode(i) == OpType_Jmp ? GetParamsAx(i) : GetParamsBx(i);
+        }
+
         static Instruction ABCCode(OpType op, int a, int b, int c)
         {
             return Instruction(op, a, b, c);
@@ -126,7 +234,40 @@ namespace luna
         {
             return Instruction(op, a, static_cast<unsigned short>(b));
         }
+
+        static Instruction sAxCode(OpType op, int ax)
+        {
+            Instruction i(op, 0, 0, 0);
+            i.RefillsAx(ax);
+            return i;
+        }
     };
+
+    // Unchecked numeric instructions run same with the checked ones
+    // when operands are numbers, compilers which do not specialize
+    // them compile the checked instructions instead
+    inline Instruction ToCheckedInstruction(Instruction i)
+    {
+        static const OpType checked[] = {
+            OpType_Add, OpType_AddRK, OpType_Sub, OpType_SubRK,
+            OpType_Mul, OpType_MulRK, OpType_Div, OpType_DivRK,
+            OpType_JmpLess, OpType_JmpLessRK,
+            OpType_JmpGreater, OpType_JmpGreaterRK,
+            OpType_JmpLessEqual, OpType_JmpLessEqualRK,
+            OpType_JmpGreaterEqual, OpType_JmpGreaterEqualRK,
+        };
+        static_assert(sizeof(checked) / sizeof(checked[0]) ==
+                      OpType_JmpGreaterEqualNK - OpType_AddNN + 1,
+                      "checked instructions mismatch with OpType");
+
+        int op = Instruction::GetOpCode(i);
+        if (op >= OpType_AddNN && op <= OpType_JmpGreaterEqualNK)
+        {
+            unsigned int checked_op = checked[op - OpType_AddNN];
+            i.opcode_ = (i.opcode_ & 0xFFFFFF) | (checked_op << 24);
+        }
+        return i;
+    }
 } // namespace luna
 
 #endif // OP_CODE_H
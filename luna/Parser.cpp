@@ -95,6 +95,7 @@ namespace
                 case Token_False:
                 case Token_True:
                 case Token_Number:
+                case Token_Integer:
                 case Token_String:
                 case Token_VarArg:
                     exp.reset(new Terminator(NextToken()));
@@ -862,6 +863,7 @@ namespace
                 token == Token_False ||
                 token == Token_True ||
                 token == Token_Number ||
+                token == Token_Integer ||
                 token == Token_String ||
                 token == Token_VarArg ||
                 token == Token_Function ||
@@ -0,0 +1,928 @@
+#include "Peephole.h"
+#include "Function.h"
+#include "OpCode.h"
+#include <bitset>
+#include <limits>
+#include <vector>
+#include <algorithm>
+
+namespace luna
+{
+    namespace
+    {
+        // Register fields of instruction
+        enum RegisterField
+        {
+            Field_A = 1,
+            Field_B = 2,
+            Field_C = 4,
+        };
+    } // namespace
+
+    class PeepholeOptimizer
+    {
+    public:
+        explicit PeepholeOptimizer(Function *function);
+
+        void Optimize();
+
+    private:
+        typedef std::bitset<256> RegisterSet;
+
+        int Size() const
+        { return static_cast<int>(code_.size()); }
+
+        bool IsKept(int i) const
+        { return !removed_[i] && !data_[i]; }
+
+        // Get index of next and previous kept instruction of index 'i',
+        // data words of instructions are skipped
+        int Next(int i) const;
+        int Prev(int i) const;
+
+        // Get the first kept instruction from index 'i'
+        int Resolve(int i) const;
+
+        // Get jump target of instruction at index 'i'
+        int Target(int i) const
+        { return i + Instruction::GetJumpDiff(code_[i]); }
+
+        // Get kept successors of instruction at index 'i', return
+        // count of successors
+        int Successors(int i, int *succ) const;
+
+        // Get registers used, always defined and maybe written by
+        // instruction
+        void GetEffect(Instruction i, RegisterSet &use, RegisterSet &def,
+                       RegisterSet &clobber) const;
+
+        // Instruction 'i' reads 'reg' by register fields only
+        bool IsReplaceable(Instruction i, int reg) const;
+
+        // Remove instruction at index 'i'
+        void Remove(int i);
+
+        // Thread jumps to jumps, remove jumps to the next instruction
+        // and unreachable instructions, return true when changed
+        bool SimplifyJumps();
+
+        void ComputeTargets();
+        void ComputeLiveness();
+
+        // Optimizations of instruction at index 'i', return true when
+        // the instruction is optimized
+        bool RemoveDeadStore(int i);
+        bool PropagateCopy(int i);
+        bool ForwardResult(int i);
+        bool RetargetCall(int i);
+        bool CoalesceNil(int i);
+
+        // Replace instructions of function by kept instructions
+        void Compact();
+
+        Function *function_;
+        std::vector<Instruction> code_;
+        // Removed instructions and data words of instructions
+        std::vector<bool> removed_;
+        std::vector<bool> data_;
+        // Instructions which start basic blocks
+        std::vector<bool> targets_;
+        // Instructions changed after liveness is computed, liveness of
+        // them is stale
+        std::vector<bool> touched_;
+        std::vector<RegisterSet> live_in_;
+        std::vector<RegisterSet> live_out_;
+        // Registers captured by closures of child functions, they are
+        // always live and never optimized
+        RegisterSet captured_;
+    };
+
+    namespace
+    {
+        bool IsCompareJump(int op)
+        {
+            return op >= OpType_JmpLess && op <= OpType_JmpEqualRK;
+        }
+
+        bool HasJumpTarget(int op)
+        {
+            return (op >= OpType_JmpFalse && op <= OpType_Jmp) ||
+                   (op >= OpType_ForInit && op <= OpType_ForLoopDec);
+        }
+
+        // Arithmetic, concat and compare instructions read operands
+        // before write dst register
+        bool IsBinaryOperation(int op)
+        {
+            return op >= OpType_Add && op <= OpType_GreaterEqualKR;
+        }
+
+        // Get register fields read and written by instruction which
+        // accesses registers by fields only, return false for others
+        bool GetRegisterFields(int op, int &read, int &write)
+        {
+            read = 0;
+            write = 0;
+            switch (op) {
+                case OpType_LoadNil: case OpType_LoadBool:
+                case OpType_LoadInt: case OpType_LoadConst:
+                case OpType_LoadConstX: case OpType_GetUpvalue:
+                case OpType_GetGlobal: case OpType_GetGlobalX:
+                case OpType_Closure: case OpType_NewTable:
+                    write = Field_A;
+                    return true;
+                case OpType_Move:
+                    read = Field_B;
+                    write = Field_A;
+                    return true;
+                case OpType_SetUpvalue: case OpType_SetGlobal:
+                case OpType_SetGlobalX:
+                case OpType_JmpFalse: case OpType_JmpTrue:
+                case OpType_JmpNil: case OpType_SetTableKK:
+                case OpType_GetTableKR: case OpType_GetField:
+                    read = Field_A;
+                    write = (op == OpType_GetTableKR ||
+                             op == OpType_GetField) ? Field_C : 0;
+                    return true;
+                case OpType_Jmp:
+                    return true;
+                case OpType_JmpLess: case OpType_JmpGreater:
+                case OpType_JmpLessEqual: case OpType_JmpGreaterEqual:
+                case OpType_JmpEqual:
+                    read = Field_B | Field_C;
+                    return true;
+                case OpType_JmpLessRK: case OpType_JmpGreaterRK:
+                case OpType_JmpLessEqualRK: case OpType_JmpGreaterEqualRK:
+                case OpType_JmpEqualRK:
+                    read = Field_B;
+                    return true;
+                case OpType_JmpLessKR: case OpType_JmpGreaterKR:
+                case OpType_JmpLessEqualKR: case OpType_JmpGreaterEqualKR:
+                    read = Field_C;
+                    return true;
+                case OpType_Neg: case OpType_Not: case OpType_Len:
+                    read = Field_A;
+                    write = Field_A;
+                    return true;
+                case OpType_Add: case OpType_Sub: case OpType_Mul:
+                case OpType_Div: case OpType_Pow: case OpType_Mod:
+                case OpType_Concat: case OpType_Less: case OpType_Greater:
+                case OpType_Equal: case OpType_UnEqual:
+                case OpType_LessEqual: case OpType_GreaterEqual:
+                    read = Field_B | Field_C;
+                    write = Field_A;
+                    return true;
+                case OpType_AddRK: case OpType_SubRK: case OpType_MulRK:
+                case OpType_DivRK: case OpType_PowRK: case OpType_ModRK:
+                case OpType_LessRK: case OpType_GreaterRK:
+                case OpType_EqualRK: case OpType_UnEqualRK:
+                case OpType_LessEqualRK: case OpType_GreaterEqualRK:
+                    read = Field_B;
+                    write = Field_A;
+                    return true;
+                case OpType_AddKR: case OpType_SubKR: case OpType_MulKR:
+                case OpType_DivKR: case OpType_PowKR: case OpType_ModKR:
+                case OpType_LessKR: case OpType_GreaterKR:
+                case OpType_LessEqualKR: case OpType_GreaterEqualKR:
+                    read = Field_C;
+                    write = Field_A;
+                    return true;
+                case OpType_SetTable:
+                    read = Field_A | Field_B | Field_C;
+                    return true;
+                case OpType_GetTable:
+                    read = Field_A | Field_B;
+                    write = Field_C;
+                    return true;
+                case OpType_SetTableRK:
+                    read = Field_A | Field_B;
+                    return true;
+                case OpType_SetTableKR: case OpType_SetField:
+                    read = Field_A | Field_C;
+                    return true;
+                default:
+                    return false;
+            }
+        }
+
+        int GetField(Instruction i, int field)
+        {
+            if (field == Field_A)
+                return Instruction::GetParamA(i);
+            else if (field == Field_B)
+                return Instruction::GetParamB(i);
+            else
+                return Instruction::GetParamC(i);
+        }
+
+        Instruction SetField(Instruction i, int field, int reg)
+        {
+            int a = Instruction::GetParamA(i);
+            int b = Instruction::GetParamB(i);
+            int c = Instruction::GetParamC(i);
+            if (field == Field_A)
+                a = reg;
+            else if (field == Field_B)
+                b = reg;
+            else
+                c = reg;
+            // Bx and sBx are in fields B and C, so they are kept
+            auto op = static_cast<OpType>(Instruction::GetOpCode(i));
+            return Instruction::ABCCode(op, a, b, c);
+        }
+
+        // Set registers [begin, end) of set
+        template<typename Set>
+        void SetRange(Set &set, int begin, int end)
+        {
+            for (int r = std::max(begin, 0);
+                 r < end && r < static_cast<int>(set.size()); ++r)
+                set.set(r);
+        }
+    } // namespace
+
+    PeepholeOptimizer::PeepholeOptimizer(Function *function)
+        : function_(function)
+    {
+        auto size = function->OpCodeSize();
+        auto code = function->GetOpCodes();
+        code_.assign(code, code + size);
+        removed_.assign(size, false);
+        data_.assign(size, false);
+
+        for (std::size_t i = 0; i < size; ++i)
+        {
+            if (HasDataWord(Instruction::GetOpCode(code_[i])))
+                data_[++i] = true;
+        }
+
+        for (std::size_t i = 0; i < function->GetChildFunctionCount(); ++i)
+        {
+            auto child = function->GetChildFunction(i);
+            for (std::size_t j = 0; j < child->GetUpvalueCount(); ++j)
+            {
+                auto upvalue = child->GetUpvalue(j);
+                if (upvalue->parent_local_)
+                    captured_.set(upvalue->register_index_);
+            }
+        }
+    }
+
+    int PeepholeOptimizer::Next(int i) const
+    {
+        ++i;
+        while (i < Size() && !IsKept(i))
+            ++i;
+        return i;
+    }
+
+    int PeepholeOptimizer::Prev(int i) const
+    {
+        --i;
+        while (i >= 0 && !IsKept(i))
+            --i;
+        return i;
+    }
+
+    int PeepholeOptimizer::Resolve(int i) const
+    {
+        while (i < Size() && !IsKept(i))
+            ++i;
+        return i;
+    }
+
+    int PeepholeOptimizer::Successors(int i, int *succ) const
+    {
+        int count = 0;
+        int op = Instruction::GetOpCode(code_[i]);
+        switch (op) {
+            case OpType_Ret:
+                break;
+            case OpType_Jmp:
+                succ[count++] = Resolve(Target(i));
+                break;
+            case OpType_JmpFalse: case OpType_JmpTrue: case OpType_JmpNil:
+            case OpType_ForInit: case OpType_ForLoop:
+            case OpType_ForLoopInc: case OpType_ForLoopDec:
+                succ[count++] = Next(i);
+                succ[count++] = Resolve(Target(i));
+                break;
+            case OpType_Intrinsic:
+                // Intrinsic skips the next call instruction
+                succ[count++] = Next(i);
+                succ[count++] = Next(Next(i));
+                break;
+            default:
+                // Compare jump executes the next jump instruction or
+                // skips it
+                succ[count++] = Next(i);
+                if (IsCompareJump(op))
+                    succ[count++] = Next(Next(i));
+                break;
+        }
+
+        // Remove successors past the end
+        int kept = 0;
+        for (int k = 0; k < count; ++k)
+        {
+            if (succ[k] < Size())
+                succ[kept++] = succ[k];
+        }
+        return kept;
+    }
+
+    void PeepholeOptimizer::GetEffect(Instruction i, RegisterSet &use,
+                                      RegisterSet &def, RegisterSet &clobber) const
+    {
+        use.reset();
+        def.reset();
+        clobber.reset();
+
+        int op = Instruction::GetOpCode(i);
+        int a = Instruction::GetParamA(i);
+        int b = Instruction::GetParamB(i);
+        int c = Instruction::GetParamC(i);
+        int read = 0;
+        int write = 0;
+        if (GetRegisterFields(op, read, write))
+        {
+            for (auto field : { Field_A, Field_B, Field_C })
+            {
+                if (read & field)
+                    use.set(GetField(i, field));
+                if (write & field)
+                    def.set(GetField(i, field));
+            }
+            clobber = def;
+            return ;
+        }
+
+        // Registers which are not always written by the instruction are
+        // clobbered, they are not defined for liveness
+        int any = static_cast<int>(use.size());
+        int count = Instruction::GetParamsBx(i);
+        switch (op) {
+            case OpType_FillNil:
+                SetRange(def, a, b);
+                SetRange(clobber, a, b);
+                break;
+            case OpType_Call:
+                // Callee frame starts from the register after function
+                SetRange(use, a, b > 0 ? a + b : any);
+                if (c > 0)
+                    SetRange(def, a, a + c - 1);
+                SetRange(clobber, a, any);
+                break;
+            case OpType_TailCall:
+                SetRange(use, a, b > 0 ? a + b : any);
+                SetRange(clobber, a, any);
+                break;
+            case OpType_VarArg:
+                if (count >= 0)
+                    SetRange(def, a, a + count);
+                SetRange(clobber, a, any);
+                break;
+            case OpType_Ret:
+                SetRange(use, a, count >= 0 ? a + count : any);
+                break;
+            case OpType_Self:
+                use.set(a);
+                SetRange(def, a, a + 2);
+                SetRange(clobber, a, a + 2);
+                break;
+            case OpType_ForInit: case OpType_ForLoop:
+            case OpType_ForLoopInc: case OpType_ForLoopDec:
+                SetRange(use, a, a + 4);
+                SetRange(clobber, a, a + 4);
+                break;
+            case OpType_Intrinsic:
+                SetRange(use, a, a + c + 1);
+                clobber.set(a);
+                break;
+            case OpType_ConcatRange:
+                SetRange(use, b, b + c);
+                def.set(a);
+                clobber.set(a);
+                break;
+            default:
+                use.set();
+                clobber.set();
+                break;
+        }
+    }
+
+    bool PeepholeOptimizer::IsReplaceable(Instruction i, int reg) const
+    {
+        int read = 0;
+        int write = 0;
+        if (!GetRegisterFields(Instruction::GetOpCode(i), read, write))
+            return false;
+
+        // Register read and written by the same field is not replaceable
+        for (auto field : { Field_A, Field_B, Field_C })
+        {
+            if ((read & field) && (write & field) && GetField(i, field) == reg)
+                return false;
+        }
+        return true;
+    }
+
+    void PeepholeOptimizer::Remove(int i)
+    {
+        removed_[i] = true;
+        if (HasDataWord(Instruction::GetOpCode(code_[i])))
+            removed_[i + 1] = true;
+
+        // Jumps to the removed instruction go to the next instruction
+        if (!targets_.empty() && targets_[i])
+        {
+            auto next = Next(i);
+            if (next < Size())
+                targets_[next] = true;
+        }
+        if (!touched_.empty())
+            touched_[i] = true;
+    }
+
+    bool PeepholeOptimizer::SimplifyJumps()
+    {
+        bool changed = false;
+
+        // Remove unreachable instructions except the last return first,
+        // then jumps over them are jumps to the next instruction
+        std::vector<bool> reachable(Size(), false);
+        std::vector<int> work;
+        if (Resolve(0) < Size())
+        {
+            reachable[Resolve(0)] = true;
+            work.push_back(Resolve(0));
+        }
+        while (!work.empty())
+        {
+            int i = work.back();
+            work.pop_back();
+
+            int succ[2];
+            int count = Successors(i, succ);
+            for (int k = 0; k < count; ++k)
+            {
+                if (!reachable[succ[k]])
+                {
+                    reachable[succ[k]] = true;
+                    work.push_back(succ[k]);
+                }
+            }
+        }
+
+        for (int i = Resolve(0); i < Size() - 1; i = Next(i))
+        {
+            if (!reachable[i])
+            {
+                Remove(i);
+                changed = true;
+            }
+        }
+
+        for (int i = Resolve(0); i < Size(); i = Next(i))
+        {
+            int op = Instruction::GetOpCode(code_[i]);
+            if (op < OpType_JmpFalse || op > OpType_Jmp)
+                continue;
+
+            // Jump of compare jump is a part of the compare
+            auto prev = Prev(i);
+            bool compare = prev >= 0 &&
+                IsCompareJump(Instruction::GetOpCode(code_[prev]));
+
+            // Thread jumps to unconditional jumps, keep direction of
+            // jump, since backward jumps are loops of JIT
+            int target = Resolve(Target(i));
+            for (int hops = 0; hops < 8 && target < Size(); ++hops)
+            {
+                if (Instruction::GetOpCode(code_[target]) != OpType_Jmp)
+                    break;
+                auto before = Prev(target);
+                if (before >= 0 && IsCompareJump(Instruction::GetOpCode(code_[before])))
+                    break;
+                auto next = Resolve(Target(target));
+                if ((next > i) != (Target(i) > i) || next == target)
+                    break;
+                target = next;
+            }
+
+            // Conditional jumps have sBx only
+            int diff = target - i;
+            int max_diff = op == OpType_Jmp ? kMaxsAx : kMaxsBx;
+            if (target != Resolve(Target(i)) &&
+                diff >= -max_diff && diff <= max_diff)
+            {
+                code_[i].RefillJumpDiff(diff);
+                changed = true;
+            }
+
+            // Remove unconditional jump to the next instruction
+            if (op == OpType_Jmp && !compare && Target(i) > i &&
+                Resolve(Target(i)) == Next(i))
+            {
+                Remove(i);
+                changed = true;
+            }
+        }
+
+        return changed;
+    }
+
+    void PeepholeOptimizer::ComputeTargets()
+    {
+        targets_.assign(Size(), false);
+        for (int i = Resolve(0); i < Size(); i = Next(i))
+        {
+            int succ[2];
+            int count = Successors(i, succ);
+            int op = Instruction::GetOpCode(code_[i]);
+            for (int k = 0; k < count; ++k)
+            {
+                if (succ[k] != Next(i) || IsCompareJump(op) ||
+                    op == OpType_Jmp)
+                    targets_[succ[k]] = true;
+            }
+        }
+    }
+
+    void PeepholeOptimizer::ComputeLiveness()
+    {
+        std::vector<RegisterSet> use(Size());
+        std::vector<RegisterSet> def(Size());
+        RegisterSet clobber;
+        for (int i = Resolve(0); i < Size(); i = Next(i))
+            GetEffect(code_[i], use[i], def[i], clobber);
+
+        live_in_.assign(Size(), RegisterSet());
+        live_out_.assign(Size(), RegisterSet());
+        bool changed = true;
+        while (changed)
+        {
+            changed = false;
+            for (int i = Prev(Size()); i >= 0; i = Prev(i))
+            {
+                int succ[2];
+                int count = Successors(i, succ);
+                RegisterSet out;
+                for (int k = 0; k < count; ++k)
+                    out |= live_in_[succ[k]];
+
+                auto in = use[i] | (out & ~def[i]) | captured_;
+                if (in != live_in_[i] || out != live_out_[i])
+                {
+                    live_in_[i] = in;
+                    live_out_[i] = out;
+                    changed = true;
+                }
+            }
+        }
+    }
+
+    bool PeepholeOptimizer::RemoveDeadStore(int i)
+    {
+        auto ins = code_[i];
+        int op = Instruction::GetOpCode(ins);
+        int a = Instruction::GetParamA(ins);
+        if (touched_[i])
+            return false;
+
+        if (op == OpType_FillNil)
+        {
+            // FillNil closes upvalues from register A
+            int b = Instruction::GetParamB(ins);
+            for (int r = a; r < static_cast<int>(captured_.size()); ++r)
+            {
+                if (captured_[r] || (r < b && live_out_[i][r]))
+                    return false;
+            }
+        }
+        else if (op == OpType_Move || op == OpType_LoadNil ||
+                 op == OpType_LoadBool || op == OpType_LoadInt ||
+                 op == OpType_LoadConst || op == OpType_LoadConstX ||
+                 op == OpType_GetUpvalue)
+        {
+            bool self_move = op == OpType_Move && a == Instruction::GetParamB(ins);
+            if (!self_move && (captured_[a] || live_out_[i][a]))
+                return false;
+        }
+        else
+            return false;
+
+        Remove(i);
+        return true;
+    }
+
+    bool PeepholeOptimizer::PropagateCopy(int i)
+    {
+        auto ins = code_[i];
+        if (Instruction::GetOpCode(ins) != OpType_Move)
+            return false;
+
+        // Moves to local variables are kept for debug
+        int t = Instruction::GetParamA(ins);
+        int s = Instruction::GetParamB(ins);
+        if (t == s || captured_[t] || captured_[s] ||
+            function_->SearchLocalVar(t, i + 1))
+            return false;
+
+        // Find uses of t in the basic block until t is redefined, then
+        // t must be dead after the last instruction
+        std::vector<int> uses;
+        int j = i;
+        RegisterSet use, def, clobber;
+        for (;;)
+        {
+            j = Next(j);
+            if (j >= Size() || touched_[j])
+                return false;
+            if (targets_[j])
+            {
+                if (live_in_[j][t])
+                    return false;
+                j = Prev(j);
+                break;
+            }
+
+            GetEffect(code_[j], use, def, clobber);
+            if (use[t])
+            {
+                if (!IsReplaceable(code_[j], t))
+                    return false;
+                uses.push_back(j);
+            }
+
+            if (def[t])
+                break;
+
+            int succ[2];
+            int count = Successors(j, succ);
+            if (clobber[t] || clobber[s] || count != 1 || succ[0] != Next(j))
+            {
+                if (live_out_[j][t])
+                    return false;
+                break;
+            }
+        }
+
+        if (uses.empty())
+            return false;
+
+        int read = 0;
+        int write = 0;
+        for (auto u : uses)
+        {
+            GetRegisterFields(Instruction::GetOpCode(code_[u]), read, write);
+            for (auto field : { Field_A, Field_B, Field_C })
+            {
+                if ((read & field) && GetField(code_[u], field) == t)
+                    code_[u] = SetField(code_[u], field, s);
+            }
+        }
+
+        for (int k = i; k <= j && k < Size(); ++k)
+            touched_[k] = true;
+        Remove(i);
+        return true;
+    }
+
+    bool PeepholeOptimizer::ForwardResult(int i)
+    {
+        auto ins = code_[i];
+        int op = Instruction::GetOpCode(ins);
+        int read = 0;
+        int write = 0;
+        if (!GetRegisterFields(op, read, write) ||
+            (write != Field_A && write != Field_C) || (read & write))
+            return false;
+
+        // Instruction writes t, then the next instruction moves t to x
+        int t = GetField(ins, write);
+        int m = Next(i);
+        if (m >= Size() || targets_[m] || touched_[i] || touched_[m])
+            return false;
+
+        auto move = code_[m];
+        int x = Instruction::GetParamA(move);
+        if (Instruction::GetOpCode(move) != OpType_Move ||
+            Instruction::GetParamB(move) != t || x == t ||
+            captured_[t] || captured_[x] || live_out_[m][t] ||
+            function_->SearchLocalVar(t, m))
+            return false;
+
+        // Instruction which reads x is forwarded only when it reads
+        // x as the first operand of binary operation
+        for (auto field : { Field_A, Field_B, Field_C })
+        {
+            if ((read & field) && GetField(ins, field) == x &&
+                !(field == Field_B && IsBinaryOperation(op)))
+                return false;
+        }
+
+        code_[i] = SetField(ins, write, x);
+        touched_[i] = true;
+        Remove(m);
+        return true;
+    }
+
+    bool PeepholeOptimizer::RetargetCall(int i)
+    {
+        // Function and args are written into [T, T + B) by instructions
+        // before the call, and results are moved from [T, T + R) to
+        // [N, N + R) after the call, then place the call at N
+        auto call = code_[i];
+        if (Instruction::GetOpCode(call) != OpType_Call || touched_[i] ||
+            targets_[i])
+            return false;
+
+        int t = Instruction::GetParamA(call);
+        int b = Instruction::GetParamB(call);
+        int r = Instruction::GetParamC(call) - 1;
+        if (b <= 0 || r <= 0)
+            return false;
+
+        std::vector<int> setups(b);
+        std::vector<int> fields(b);
+        int j = i;
+        for (int k = b - 1; k >= 0; --k)
+        {
+            j = Prev(j);
+            if (j < 0 || touched_[j] || (k > 0 && targets_[j]))
+                return false;
+
+            int read = 0;
+            int write = 0;
+            if (!GetRegisterFields(Instruction::GetOpCode(code_[j]), read, write) ||
+                (write != Field_A && write != Field_C) || (read & write) ||
+                GetField(code_[j], write) != t + k)
+                return false;
+            setups[k] = j;
+            fields[k] = write;
+        }
+
+        std::vector<int> moves(r);
+        int n = 0;
+        j = i;
+        for (int k = 0; k < r; ++k)
+        {
+            j = Next(j);
+            if (j >= Size() || touched_[j] || targets_[j])
+                return false;
+
+            auto move = code_[j];
+            if (k == 0)
+                n = Instruction::GetParamA(move);
+            if (Instruction::GetOpCode(move) != OpType_Move ||
+                Instruction::GetParamA(move) != n + k ||
+                Instruction::GetParamB(move) != t + k)
+                return false;
+            moves[k] = j;
+        }
+
+        // Registers [N + R, end) are clobbered by the new call, they
+        // must be dead, setup instructions must not read the registers
+        int end = t + std::max(b, r);
+        if (n + r > t || function_->SearchLocalVar(n, i))
+            return false;
+        for (int reg = n; reg < end; ++reg)
+        {
+            if (captured_[reg] || (reg >= n + r && live_out_[moves.back()][reg]))
+                return false;
+        }
+        RegisterSet use, def, clobber;
+        for (auto setup : setups)
+        {
+            GetEffect(code_[setup], use, def, clobber);
+            for (int reg = n; reg < end; ++reg)
+            {
+                if (use[reg])
+                    return false;
+            }
+        }
+
+        for (int k = 0; k < b; ++k)
+            code_[setups[k]] = SetField(code_[setups[k]], fields[k], n + k);
+        code_[i] = Instruction::ABCCode(OpType_Call, n, b, r + 1);
+        for (int k = setups[0]; k <= moves.back(); ++k)
+            touched_[k] = true;
+        for (auto move : moves)
+            Remove(move);
+        return true;
+    }
+
+    bool PeepholeOptimizer::CoalesceNil(int i)
+    {
+        // Get nil range [begin, end) of instruction, and the register
+        // from which it closes upvalues
+        auto get_range = [this](int index, int &begin, int &end, int &close) {
+            auto ins = code_[index];
+            int op = Instruction::GetOpCode(ins);
+            begin = Instruction::GetParamA(ins);
+            end = op == OpType_LoadNil ? begin + 1 : Instruction::GetParamB(ins);
+            close = op == OpType_FillNil ? begin : static_cast<int>(captured_.size());
+            return (op == OpType_LoadNil || op == OpType_FillNil) && begin < end;
+        };
+
+        int m = Next(i);
+        int begin1 = 0, end1 = 0, close1 = 0;
+        int begin2 = 0, end2 = 0, close2 = 0;
+        if (m >= Size() || targets_[m] || touched_[i] || touched_[m] ||
+            !get_range(i, begin1, end1, close1) ||
+            !get_range(m, begin2, end2, close2) ||
+            begin2 > end1 || begin1 > end2)
+            return false;
+
+        // The coalesced FillNil closes upvalues from its begin register
+        int begin = std::min(begin1, begin2);
+        int end = std::max(end1, end2);
+        int close = std::min(close1, close2);
+        if (end > 0xFF)
+            return false;
+        for (int reg = begin; reg < close; ++reg)
+        {
+            if (captured_[reg])
+                return false;
+        }
+
+        code_[i] = Instruction::ABCode(OpType_FillNil, begin, end);
+        touched_[i] = true;
+        Remove(m);
+        return true;
+    }
+
+    void PeepholeOptimizer::Optimize()
+    {
+        const int max_rounds = 8;
+        for (int round = 0; round < max_rounds; ++round)
+        {
+            targets_.clear();
+            touched_.clear();
+            bool changed = SimplifyJumps();
+
+            ComputeTargets();
+            ComputeLiveness();
+            touched_.assign(Size(), false);
+            for (int i = Resolve(0); i < Size(); i = Next(i))
+            {
+                if (RemoveDeadStore(i) || PropagateCopy(i) ||
+                    ForwardResult(i) || RetargetCall(i) || CoalesceNil(i))
+                    changed = true;
+            }
+
+            if (!changed)
+                break;
+        }
+
+        Compact();
+    }
+
+    void PeepholeOptimizer::Compact()
+    {
+        // Map index of instruction to new index, removed instruction
+        // is mapped to the next kept instruction
+        std::vector<int> index_map(Size() + 1);
+        int count = 0;
+        for (int i = 0; i < Size(); ++i)
+        {
+            index_map[i] = count;
+            if (!removed_[i])
+                ++count;
+        }
+        index_map[Size()] = count;
+
+        if (count == Size())
+        {
+            // Jumps may be threaded
+            for (int i = 0; i < Size(); ++i)
+                function_->GetMutableInstruction(i)->opcode_ = code_[i].opcode_;
+            return ;
+        }
+
+        std::vector<Instruction> code;
+        std::vector<int> lines;
+        code.reserve(count);
+        lines.reserve(count);
+        for (int i = 0; i < Size(); ++i)
+        {
+            if (removed_[i])
+                continue;
+
+            auto ins = code_[i];
+            if (!data_[i] && HasJumpTarget(Instruction::GetOpCode(ins)))
+                ins.RefillJumpDiff(index_map[Target(i)] - index_map[i]);
+            code.push_back(ins);
+            lines.push_back(function_->GetInstructionLine(i));
+        }
+
+        function_->ReplaceInstructions(std::move(code), std::move(lines), index_map);
+    }
+
+    void PeepholeOptimize(Function *function)
+    {
+        PeepholeOptimizer optimizer(function);
+        optimizer.Optimize();
+    }
+} // namespace luna
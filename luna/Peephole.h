@@ -0,0 +1,15 @@
+#ifndef PEEPHOLE_H
+#define PEEPHOLE_H
+
+namespace luna
+{
+    class Function;
+
+    // Optimize instructions of function after code generation, the
+    // optimizer propagates copies, threads jumps, removes redundant
+    // moves and dead code, and coalesces nil fills, line numbers and
+    // local variable ranges are kept consistent with instructions
+    void PeepholeOptimize(Function *function);
+} // namespace luna
+
+#endif // PEEPHOLE_H
@@ -10,9 +10,12 @@ namespace luna
     struct Instruction;
 
     // Runtime stack, registers of each function is one part of stack.
+    // The stack starts small and grows on demand, State relocates all
+    // pointers to stack values when it grows.
     struct Stack
     {
-        static const int kBaseStackSize = 10000;
+        static const int kBaseStackSize = 64;
+        static const int kMaxStackSize = 1000000;
 
         std::vector<Value> stack_;
         Value *top_;
@@ -21,8 +24,9 @@ namespace luna
         Stack(const Stack&) = delete;
         void operator = (const Stack&) = delete;
 
-        // Set new top pointer, and [new top, old top) will be set nil
-        void SetNewTop(Value *top);
+        // Get the past-the-end pointer of stack values
+        Value * End()
+        { return &stack_[0] + stack_.size(); }
     };
 
     // Function call stack info
@@ -4,7 +4,7 @@
 #include "State.h"
 #include "String.h"
 #include "Guard.h"
-#include <unordered_set>
+#include <unordered_map>
 #include <assert.h>
 
 namespace luna
@@ -13,10 +13,11 @@ namespace luna
     struct LexicalBlock
     {
         LexicalBlock *parent_;
-        // Local names
+        // Local names and their local function statements, the
+        // statement is nullptr when the name is not a local function
         // Same names are the same instance String, so using String
         // pointer as key is fine
-        std::unordered_set<const String *> names_;
+        std::unordered_map<const String *, LocalFunctionStatement *> names_;
 
         LexicalBlock() : parent_(nullptr) { }
     };
@@ -116,10 +117,36 @@ namespace luna
         }
 
         // Insert a name into current block, replace its info when existed
-        void InsertName(const String *name)
+        void InsertName(const String *name,
+                        LocalFunctionStatement *l_func_stmt = nullptr)
         {
             assert(current_function_ && current_function_->current_block_);
-            current_function_->current_block_->names_.insert(name);
+            current_function_->current_block_->names_[name] = l_func_stmt;
+        }
+
+        // Mark the local function of name reassigned when the name
+        // is a local function
+        void MarkNameWritten(const String *str)
+        {
+            auto function = current_function_;
+            while (function)
+            {
+                auto block = function->current_block_;
+                while (block)
+                {
+                    auto it = block->names_.find(str);
+                    if (it != block->names_.end())
+                    {
+                        if (it->second)
+                            it->second->reassigned_ = true;
+                        return ;
+                    }
+
+                    block = block->parent_;
+                }
+
+                function = function->parent_;
+            }
         }
 
         // Search LexicalScoping of a name
@@ -411,6 +438,9 @@ namespace luna
         assert(!func_name->names_.empty());
         // Get the scoping of first token of FunctionName
         func_name->scoping_ = SearchName(func_name->names_[0].str_);
+        if (func_name->names_.size() == 1 &&
+            func_name->member_name_.token_ != Token_Id)
+            MarkNameWritten(func_name->names_[0].str_);
 
         // Set FunctionNameData
         static_cast<FunctionNameData *>(data)->has_member_token_ =
@@ -419,7 +449,7 @@ namespace luna
 
     void SemanticAnalysisVisitor::Visit(LocalFunctionStatement *l_func_stmt, void *data)
     {
-        InsertName(l_func_stmt->name_.str_);
+        InsertName(l_func_stmt->name_.str_, l_func_stmt);
         l_func_stmt->func_body_->Accept(this, nullptr);
     }
 
@@ -467,6 +497,7 @@ namespace luna
             case Token_Nil: exp_var_data->exp_type_ = ExpType_Nil; break;
             case Token_Id: exp_var_data->exp_type_ = ExpType_Unknown; break;
             case Token_Number: exp_var_data->exp_type_ = ExpType_Number; break;
+            case Token_Integer: exp_var_data->exp_type_ = ExpType_Number; break;
             case Token_String: exp_var_data->exp_type_ = ExpType_String; break;
             case Token_VarArg: exp_var_data->exp_type_ = ExpType_VarArg; break;
             case Token_True: case Token_False: exp_var_data->exp_type_ = ExpType_Bool; break;
@@ -476,6 +507,9 @@ namespace luna
         if (term->token_.token_ == Token_Id)
             term->scoping_ = SearchName(term->token_.str_);
 
+        if (term->semantic_ == SemanticOp_Write)
+            MarkNameWritten(term->token_.str_);
+
         // Check function has vararg
         if (term->token_.token_ == Token_VarArg && !HasVararg())
             throw SemanticException("function has no '...' param", term->token_);
@@ -7,6 +7,9 @@
 #include "Table.h"
 #include "TextInStream.h"
 #include "Exception.h"
+#include "Jit.h"
+#include "BaselineJit.h"
+#include <algorithm>
 #include <cassert>
 
 namespace luna
@@ -15,7 +18,14 @@ namespace luna
 #define MODULES_TABLE "__modules"
 
     State::State()
+        : jit_enabled_(false), baseline_jit_enabled_(false),
+          open_upvalues_(nullptr)
     {
+        calls_.reserve(kBaseCallInfoSize);
+
+        for (auto &intrinsic : intrinsics_)
+            intrinsic = nullptr;
+
         string_pool_.reset(new StringPool);
 
         // Init GC
@@ -58,18 +68,52 @@ namespace luna
         gc_->ResetDeleter();
     }
 
+    void State::SetJitEnabled(bool enabled)
+    {
+        if (enabled && !jit_)
+            jit_.reset(new Jit(this));
+        jit_enabled_ = enabled;
+    }
+
+    void State::SetBaselineJitEnabled(bool enabled)
+    {
+        if (enabled && !baseline_jit_)
+            baseline_jit_.reset(new BaselineJit(this));
+        baseline_jit_enabled_ = enabled;
+    }
+
+    void State::SetBaselineJitThreshold(int calls)
+    {
+        if (!baseline_jit_)
+            baseline_jit_.reset(new BaselineJit(this));
+        baseline_jit_->SetThreshold(calls);
+    }
+
+    std::size_t State::GetBaselineJitCompiledCount() const
+    {
+        return baseline_jit_ ? baseline_jit_->GetCompiledCount() : 0;
+    }
+
     bool State::IsModuleLoaded(const std::string &module_name) const
     {
         return module_manager_->IsLoaded(module_name);
     }
 
+    Value State::GetModuleClosure(const std::string &module_name) const
+    {
+        return module_manager_->GetModuleClosure(module_name);
+    }
+
     void State::LoadModule(const std::string &module_name)
     {
         auto value = module_manager_->GetModuleClosure(module_name);
         if (value.IsNil())
             module_manager_->LoadModule(module_name);
         else
+        {
+            stack_.top_ = CheckStack(stack_.top_, 1);
             *stack_.top_++ = value;
+        }
     }
 
     void State::DoModule(const std::string &module_name)
@@ -94,7 +138,8 @@ namespace luna
 
     bool State::CallFunction(Value *f, int arg_count, int expect_result)
     {
-        assert(f->type_ == ValueT_Closure || f->type_ == ValueT_CFunction);
+        assert(f->type_ == ValueT_Closure || f->type_ == ValueT_CFunction ||
+               f->type_ == ValueT_LeafFunction);
 
         // Set stack top when arg_count is fixed
         if (arg_count != EXP_VALUE_COUNT_ANY)
@@ -106,6 +151,11 @@ namespace luna
             CallClosure(f, expect_result);
             return true;
         }
+        else if (f->type_ == ValueT_LeafFunction)
+        {
+            CallLeafFunction(f, expect_result);
+            return false;
+        }
         else
         {
             CallCFunction(f, expect_result);
@@ -223,21 +273,33 @@ namespace luna
         // Visit global table
         global_.Accept(v);
 
-        // Visit stack values
-        for (const auto &value : stack_.stack_)
-        {
-            value.Accept(v);
-        }
-
-        // Visit call info
+        // Visit live stack values, which are below the stack top and
+        // registers of all frames
+        Value *live_top = stack_.top_;
         for (const auto &call : calls_)
         {
-            call.register_->Accept(v);
-            if (call.func_)
+            if (call.func_ && call.func_->type_ == ValueT_Closure)
             {
-                call.func_->Accept(v);
+                auto proto = call.func_->closure_->GetPrototype();
+                live_top = std::max(live_top, call.register_ + proto->GetRegisterCount());
             }
         }
+
+        Value *value = &stack_.stack_[0];
+        for (; value < live_top; ++value)
+            value->Accept(v);
+
+        // Dead stack values are not cleared when the stack top goes
+        // down, clear them here since they may refer to objects freed
+        // by this GC and become live when frames grow
+        for (auto end = stack_.End(); value < end; ++value)
+            value->SetNil();
+
+        // Visit open upvalues
+        for (auto upvalue = open_upvalues_; upvalue; upvalue = upvalue->GetNext())
+        {
+            upvalue->Accept(v);
+        }
     }
 
     Table * State::GetMetatables()
@@ -251,11 +313,42 @@ namespace luna
         return v.table_;
     }
 
+    Value * State::GrowStack(Value *v, int count)
+    {
+        auto old_base = &stack_.stack_[0];
+        std::size_t max_size = Stack::kMaxStackSize;
+        std::size_t need = v - old_base + count;
+        if (need > max_size)
+            throw StackOverflowException();
+
+        auto size = std::min(std::max(stack_.stack_.size() * 2, need), max_size);
+        stack_.stack_.resize(size);
+
+        // Relocate all pointers to stack values
+        auto new_base = &stack_.stack_[0];
+        auto relocate = [=](Value *p) { return new_base + (p - old_base); };
+
+        stack_.top_ = relocate(stack_.top_);
+        for (auto &call : calls_)
+        {
+            call.register_ = relocate(call.register_);
+            call.func_ = relocate(call.func_);
+        }
+
+        for (auto upvalue = open_upvalues_; upvalue; upvalue = upvalue->GetNext())
+            upvalue->Open(relocate(upvalue->GetValue()));
+
+        return relocate(v);
+    }
+
     void State::CallClosure(Value *f, int expect_result)
     {
         CallInfo callee;
         Function *callee_proto = f->closure_->GetPrototype();
 
+        // Args and registers of callee are above f
+        f = CheckStack(f, stack_.top_ - f + callee_proto->GetRegisterCount());
+
         callee.func_ = f;
         callee.instruction_ = callee_proto->GetOpCodes();
         callee.end_ = callee.instruction_ + callee_proto->OpCodeSize();
@@ -284,12 +377,16 @@ namespace luna
             }
         }
 
-        stack_.SetNewTop(callee.register_ + fixed_args);
+        stack_.top_ = callee.register_ + fixed_args;
         calls_.push_back(callee);
     }
 
     void State::CallCFunction(Value *f, int expect_result)
     {
+        // Make sure c function can push some values without growing
+        // the stack
+        f = CheckStack(f, stack_.top_ - f + kCFunctionMinStack);
+
         // Push the c function CallInfo
         CallInfo callee;
         callee.register_ = f + 1;
@@ -301,14 +398,45 @@ namespace luna
         CFunctionType cfunc = f->cfunc_;
         ClearCFunctionError();
         int res_count = cfunc(this);
-        CheckCFunctionError();
+        if (cfunc_error_.type_ != CFuntionErrorType_NoError)
+        {
+            // Pop the c function CallInfo
+            auto args = calls_.back().register_;
+            calls_.pop_back();
+            ThrowCFunctionError(args);
+        }
 
         Value *src = nullptr;
         if (res_count > 0)
             src = stack_.top_ - res_count;
 
-        // Copy c function result to caller stack
-        Value *dst = f;
+        // Copy c function result to caller stack, the stack may grow
+        // when the c function pushes values
+        SetCFunctionResult(calls_.back().func_, src, res_count, expect_result);
+
+        // Pop the c function CallInfo
+        calls_.pop_back();
+    }
+
+    void State::CallLeafFunction(Value *f, int expect_result)
+    {
+        // Leaf function could write as many results beyond its
+        // arguments as c function could push
+        f = CheckStack(f, stack_.top_ - f + kCFunctionMinStack);
+
+        // Call leaf function without CallInfo, results are written
+        // over the arguments
+        auto args = f + 1;
+        int res_count = f->leaf_(this, args, static_cast<int>(stack_.top_ - args));
+        if (res_count < 0)
+            ThrowCFunctionError(args);
+
+        SetCFunctionResult(f, args, res_count, expect_result);
+    }
+
+    void State::SetCFunctionResult(Value *dst, const Value *src,
+                                   int res_count, int expect_result)
+    {
         if (expect_result == EXP_VALUE_COUNT_ANY)
         {
             for (int i = 0; i < res_count; ++i)
@@ -325,37 +453,25 @@ namespace luna
                 dst->SetNil();
         }
 
-        // Set registers which after dst to nil
-        // and set new stack top pointer
-        stack_.SetNewTop(dst);
-
-        // Pop the c function CallInfo
-        calls_.pop_back();
+        // Set new stack top pointer
+        stack_.top_ = dst;
     }
 
-    void State::CheckCFunctionError()
+    void State::ThrowCFunctionError(const Value *args)
     {
         auto error = GetCFunctionErrorData();
-        if (error->type_ == CFuntionErrorType_NoError)
-            return ;
-
-        CallCFuncException exp;
         if (error->type_ == CFuntionErrorType_ArgCount)
         {
-            exp = CallCFuncException("expect ",
+            throw CallCFuncException("expect ",
                     error->expect_arg_count_, " arguments");
         }
-        else if (error->type_ == CFuntionErrorType_ArgType)
+        else
         {
-            auto &call = calls_.back();
-            auto arg = call.register_ + error->arg_index_;
-            exp = CallCFuncException("argument #", error->arg_index_ + 1,
+            assert(error->type_ == CFuntionErrorType_ArgType);
+            auto arg = args + error->arg_index_;
+            throw CallCFuncException("argument #", error->arg_index_ + 1,
                     " is a ", arg->TypeName(), " value, expect a ",
                     Value::TypeName(error->expect_type_), " value");
         }
-
-        // Pop the c function CallInfo
-        calls_.pop_back();
-        throw exp;
     }
 } // namespace luna
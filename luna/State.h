@@ -5,14 +5,16 @@
 #include "Runtime.h"
 #include "ModuleManager.h"
 #include "StringPool.h"
+#include "Intrinsic.h"
 #include <string>
 #include <memory>
 #include <vector>
-#include <list>
 
 namespace luna
 {
     class VM;
+    class Jit;
+    class BaselineJit;
 
     // Error type reported by called c function
     enum CFuntionErrorType
@@ -42,6 +44,9 @@ namespace luna
     class State
     {
         friend class VM;
+        friend class Jit;
+        friend class BaselineJit;
+        friend class NativeHelper;
         friend class StackAPI;
         friend class Library;
         friend class ModuleManager;
@@ -56,8 +61,12 @@ namespace luna
         // Check module loaded or not
         bool IsModuleLoaded(const std::string &module_name) const;
 
+        // Get module closure when module loaded, otherwise return nil
+        Value GetModuleClosure(const std::string &module_name) const;
+
         // Load module, if load success, then push a module closure on stack,
-        // otherwise throw Exception
+        // otherwise throw Exception. Module which name ends with ".so" is
+        // a native module compiled by luna --emit-cpp
         void LoadModule(const std::string &module_name);
 
         // Load module and call the module function when the module
@@ -110,14 +119,61 @@ namespace luna
         // Check and run GC
         void CheckRunGC() { gc_->CheckGC(); }
 
+        // Enable or disable JIT of hot loops, traces are only
+        // compiled on x86-64 Linux
+        void SetJitEnabled(bool enabled);
+        bool IsJitEnabled() const
+        { return jit_enabled_; }
+
+        // Enable or disable baseline JIT of functions, set count of
+        // calls to compile a function, and get count of functions
+        // compiled, functions are only compiled on x86-64 Linux
+        void SetBaselineJitEnabled(bool enabled);
+        bool IsBaselineJitEnabled() const
+        { return baseline_jit_enabled_; }
+        void SetBaselineJitThreshold(int calls);
+        std::size_t GetBaselineJitCompiledCount() const;
+
+        // Set function of intrinsic, OpType_Intrinsic calculates in
+        // place of calling the function
+        void SetIntrinsic(IntrinsicType type, LeafFunctionType func)
+        { intrinsics_[type] = func; }
+
+        // Function 'f' is the function of intrinsic 'type' or not
+        bool IsIntrinsic(const Value &f, int type) const
+        { return f.type_ == ValueT_LeafFunction && f.leaf_ == intrinsics_[type]; }
+
+        // Make sure there are 'count' values from stack value 'v', when
+        // the stack grows, all pointers to stack values are relocated
+        // and return the relocated 'v', throw StackOverflowException
+        // when the stack can not grow
+        Value * CheckStack(Value *v, int count)
+        { return v + count <= stack_.End() ? v : GrowStack(v, count); }
+
     private:
+        // Preallocated count of stack frames
+        static const std::size_t kBaseCallInfoSize = 64;
+        // Count of stack values could be pushed by c function, or be
+        // written beyond arguments by leaf function, without growing
+        // the stack
+        static const int kCFunctionMinStack = 20;
+
         // Full GC root
         void FullGCRoot(GCObjectVisitor *v);
 
+        // Grow the stack for CheckStack
+        Value * GrowStack(Value *v, int count);
+
         // For CallFunction
         void CallClosure(Value *f, int expect_result);
         void CallCFunction(Value *f, int expect_result);
-        void CheckCFunctionError();
+        void CallLeafFunction(Value *f, int expect_result);
+        // Copy results of c function to 'dst' and set new stack top
+        void SetCFunctionResult(Value *dst, const Value *src,
+                                int res_count, int expect_result);
+        // Throw the error reported by c function, 'args' are arguments
+        // of the c function
+        void ThrowCFunctionError(const Value *args);
 
         // Get the table which stores all metatables
         Table * GetMetatables();
@@ -126,6 +182,12 @@ namespace luna
         std::unique_ptr<ModuleManager> module_manager_;
         // All strings in the pool
         std::unique_ptr<StringPool> string_pool_;
+        // JIT of hot loops, it is destroyed after GC frees all functions
+        std::unique_ptr<Jit> jit_;
+        bool jit_enabled_;
+        // Baseline JIT of functions
+        std::unique_ptr<BaselineJit> baseline_jit_;
+        bool baseline_jit_enabled_;
         // The GC
         std::unique_ptr<GC> gc_;
 
@@ -134,10 +196,15 @@ namespace luna
 
         // Stack data
         Stack stack_;
-        // Stack frames
-        std::list<CallInfo> calls_;
+        // Stack frames, preallocated and grows when it is full
+        std::vector<CallInfo> calls_;
+        // Open upvalues list, sorted by referred stack value from high
+        // address to low address
+        Upvalue *open_upvalues_;
         // Global table
         Value global_;
+        // Functions of intrinsics
+        LeafFunctionType intrinsics_[Intrinsic_Count];
     };
 } // namespace luna
 
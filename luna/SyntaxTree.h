@@ -297,9 +297,14 @@ namespace luna
         TokenDetail name_;
         std::unique_ptr<SyntaxTree> func_body_;
 
+        // For code generate, the local name is assigned again or not,
+        // calls of the function can be inlined when it is not
+        bool reassigned_;
+
         LocalFunctionStatement(const TokenDetail &name,
                                std::unique_ptr<SyntaxTree> func_body)
-            : name_(name), func_body_(std::move(func_body))
+            : name_(name), func_body_(std::move(func_body)),
+              reassigned_(false)
         {
         }
 
@@ -3,15 +3,29 @@
 
 namespace
 {
-    inline bool IsInt(double d)
+    // Float key which has an exact integer value is converted to
+    // integer key, so 1.0 and 1 are the same key of table
+    inline luna::Value NormalizeKey(const luna::Value &key)
     {
-        return floor(d) == d;
+        if (key.type_ == luna::ValueT_Number &&
+            key.num_ >= -9223372036854775808.0 &&
+            key.num_ < 9223372036854775808.0 &&
+            floor(key.num_) == key.num_)
+            return luna::Value(static_cast<long long>(key.num_));
+        return key;
     }
 } // namespace
 
 namespace luna
 {
-    Table::Table()
+    std::atomic<std::size_t> Table::version_counter_(0);
+
+    std::size_t Table::NewVersion()
+    {
+        return version_counter_.fetch_add(1, std::memory_order_relaxed) + 1;
+    }
+
+    Table::Table() : version_(NewVersion())
     {
     }
 
@@ -90,12 +104,14 @@ namespace luna
         return true;
     }
 
-    void Table::SetValue(const Value &key, const Value &value)
+    void Table::SetValue(const Value &k, const Value &value)
     {
+        auto key = NormalizeKey(k);
+
         // Try array part
-        if (key.type_ == ValueT_Number && IsInt(key.num_))
+        if (key.type_ == ValueT_Integer)
         {
-            if (SetArrayValue(static_cast<std::size_t>(key.num_), value))
+            if (SetArrayValue(static_cast<std::size_t>(key.integer_), value))
                 return ;
         }
 
@@ -113,7 +129,7 @@ namespace luna
         {
             // If value is nil, then just erase the element
             if (value.IsNil())
-                hash_->erase(it);
+                EraseHashValue(it);
             else
                 it->second = value;
         }
@@ -125,12 +141,14 @@ namespace luna
         }
     }
 
-    Value Table::GetValue(const Value &key) const
+    Value Table::GetValue(const Value &k) const
     {
+        auto key = NormalizeKey(k);
+
         // Get from array first
-        if (key.type_ == ValueT_Number && IsInt(key.num_))
+        if (key.type_ == ValueT_Integer)
         {
-            std::size_t index = static_cast<std::size_t>(key.num_);
+            std::size_t index = static_cast<std::size_t>(key.integer_);
             if (index >= 1 && index <= ArraySize())
                 return (*array_)[index - 1];
         }
@@ -152,8 +170,7 @@ namespace luna
         // array part
         if (ArraySize() > 0)
         {
-            key.num_ = 1;           // first element index
-            key.type_ = ValueT_Number;
+            key.SetInteger(1);      // first element index
             value = (*array_)[0];
             return true;
         }
@@ -170,16 +187,17 @@ namespace luna
         return false;
     }
 
-    bool Table::NextKeyValue(const Value &key, Value &next_key, Value &next_value)
+    bool Table::NextKeyValue(const Value &k, Value &next_key, Value &next_value)
     {
+        auto key = NormalizeKey(k);
+
         // array part
-        if (key.type_ == ValueT_Number && IsInt(key.num_))
+        if (key.type_ == ValueT_Integer)
         {
-            std::size_t index = static_cast<std::size_t>(key.num_) + 1;
+            std::size_t index = static_cast<std::size_t>(key.integer_) + 1;
             if (index >= 1 && index <= ArraySize())
             {
-                next_key.num_ = index;
-                next_key.type_ = ValueT_Number;
+                next_key.SetInteger(index);
                 next_value = (*array_)[index - 1];
                 return true;
             }
@@ -213,6 +231,15 @@ namespace luna
         return array_ ? array_->size() : 0;
     }
 
+    Value * Table::GetHashValue(const Value &key)
+    {
+        if (!hash_)
+            return nullptr;
+
+        auto it = hash_->find(NormalizeKey(key));
+        return it != hash_->end() ? &it->second : nullptr;
+    }
+
     void Table::AppendAndMergeFromHashToArray(const Value &value)
     {
         AppendToArray(value);
@@ -230,11 +257,10 @@ namespace luna
     {
         auto index = ArraySize();
         Value key;
-        key.num_ = ++index;
-        key.type_ = ValueT_Number;
+        key.SetInteger(++index);
 
         while (MoveHashToArray(key))
-            key.num_ = ++index;
+            key.SetInteger(++index);
     }
 
     bool Table::MoveHashToArray(const Value &key)
@@ -247,7 +273,13 @@ namespace luna
             return false;
 
         AppendToArray(it->second);
-        hash_->erase(it);
+        EraseHashValue(it);
         return true;
     }
+
+    void Table::EraseHashValue(Hash::iterator it)
+    {
+        hash_->erase(it);
+        version_ = NewVersion();
+    }
 } // namespace luna
@@ -3,12 +3,23 @@
 
 #include "GC.h"
 #include "Value.h"
+#include <atomic>
 #include <memory>
 #include <vector>
 #include <unordered_map>
 
 namespace luna
 {
+    // Inline cache of table access instruction, 'value_' is the value
+    // pointer in hash table of the table which version is 'version_'
+    struct TableCache
+    {
+        std::size_t version_;
+        Value *value_;
+
+        TableCache() : version_(0), value_(nullptr) { }
+    };
+
     // Table has array part and hash table part.
     class Table : public GCObject
     {
@@ -54,6 +65,16 @@ namespace luna
         // Return the number of array part elements.
         std::size_t ArraySize() const;
 
+        // Get value pointer of 'key' in hash table, return nullptr if
+        // 'key' is not existed in hash table. The pointer keeps valid
+        // until the version of table changed.
+        Value * GetHashValue(const Value &key);
+
+        // Version of hash table, it changes when any key is erased from
+        // hash table, and it is unique among all tables.
+        std::size_t GetVersion() const
+        { return version_; }
+
     private:
         typedef std::vector<Value> Array;
         typedef std::unordered_map<Value, Value> Hash;
@@ -72,8 +93,17 @@ namespace luna
         // fit with array, return true if move success.
         bool MoveHashToArray(const Value &key);
 
+        // Erase key-value pair from hash table and change version
+        void EraseHashValue(Hash::iterator it);
+
         std::unique_ptr<Array> array_;              // array part of table
         std::unique_ptr<Hash> hash_;                // hash table part of table
+        std::size_t version_;                       // version of hash table
+
+        // Get a new version which is unique in the process, tables of
+        // States in different threads share the counter
+        static std::size_t NewVersion();
+        static std::atomic<std::size_t> version_counter_;
     };
 } // namespace luna
 
@@ -9,7 +9,7 @@ namespace luna
         "false", "for", "function", "if", "in",
         "local", "nil", "not", "or", "repeat",
         "return", "then", "true", "until", "while",
-        "<id>", "<string>", "<number>",
+        "<id>", "<string>", "<number>", "<integer>",
         "==", "~=", "<=", ">=", "..", "...", "<EOF>"
     };
 
@@ -24,6 +24,12 @@ namespace luna
             oss << t.number_;
             str = oss.str();
         }
+        else if (token == Token_Integer)
+        {
+            std::ostringstream oss;
+            oss << t.integer_;
+            str = oss.str();
+        }
         else if (token == Token_Id || token == Token_String)
         {
             str = t.str_->GetStdString();
@@ -13,7 +13,7 @@ namespace luna
         Token_False, Token_For, Token_Function, Token_If, Token_In,
         Token_Local, Token_Nil, Token_Not, Token_Or, Token_Repeat,
         Token_Return, Token_Then, Token_True, Token_Until, Token_While,
-        Token_Id, Token_String, Token_Number,
+        Token_Id, Token_String, Token_Number, Token_Integer,
         Token_Equal, Token_NotEqual, Token_LessEqual, Token_GreaterEqual,
         Token_Concat, Token_VarArg, Token_EOF,
     };
@@ -23,6 +23,7 @@ namespace luna
         union
         {
             double number_;         // number for Token_Number
+            long long integer_;     // integer for Token_Integer
             String *str_;           // string for Token_Id, Token_KeyWord and Token_String
         };
 
@@ -0,0 +1,347 @@
+#include "TypeInference.h"
+#include "Function.h"
+#include "OpCode.h"
+#include <bitset>
+#include <vector>
+
+namespace luna
+{
+    class NumberTypeInference
+    {
+    public:
+        explicit NumberTypeInference(Function *function);
+
+        void Infer();
+
+    private:
+        typedef std::bitset<256> RegisterSet;
+
+        int Size() const
+        { return static_cast<int>(code_.size()); }
+
+        // Get index of the next instruction, data words are skipped
+        int Next(int i) const
+        { return i + (HasDataWord(Instruction::GetOpCode(code_[i])) ? 2 : 1); }
+
+        // Get successors of instruction at index 'i', return count of
+        // successors
+        int Successors(int i, int *succ) const;
+
+        // Update number registers 's' by instruction at index 'i', then
+        // 's' is number registers of successor 'succ'
+        void Transfer(int i, int succ, RegisterSet &s) const;
+
+        // Const index is a number
+        bool IsNumberConst(int index) const
+        { return function_->GetConstValue(index)->IsNumber(); }
+
+        // Replace instruction at index 'i' by unchecked instruction when
+        // its operands are numbers
+        void Specialize(int i);
+
+        Function *function_;
+        std::vector<Instruction> code_;
+        // Number registers before each instruction
+        std::vector<RegisterSet> in_;
+        // Registers captured by closures of child functions, they may
+        // be changed by calls through upvalues, so never proved
+        RegisterSet captured_;
+    };
+
+    namespace
+    {
+        bool IsCompareJump(int op)
+        {
+            return (op >= OpType_JmpLess && op <= OpType_JmpEqualRK) ||
+                   (op >= OpType_JmpLessNN && op <= OpType_JmpGreaterEqualNK);
+        }
+
+        template<typename Set>
+        void ResetRange(Set &set, int begin, int end)
+        {
+            for (int r = begin; r < end && r < static_cast<int>(set.size()); ++r)
+                set.reset(r);
+        }
+
+        template<typename Set>
+        void SetRange(Set &set, int begin, int end)
+        {
+            for (int r = begin; r < end && r < static_cast<int>(set.size()); ++r)
+                set.set(r);
+        }
+
+        Instruction ReplaceOpCode(Instruction i, OpType op, int b, int c)
+        {
+            return Instruction::ABCCode(op, Instruction::GetParamA(i), b, c);
+        }
+    } // namespace
+
+    NumberTypeInference::NumberTypeInference(Function *function)
+        : function_(function)
+    {
+        auto size = function->OpCodeSize();
+        auto code = function->GetOpCodes();
+        code_.assign(code, code + size);
+
+        for (std::size_t i = 0; i < function->GetChildFunctionCount(); ++i)
+        {
+            auto child = function->GetChildFunction(i);
+            for (std::size_t j = 0; j < child->GetUpvalueCount(); ++j)
+            {
+                auto upvalue = child->GetUpvalue(j);
+                if (upvalue->parent_local_)
+                    captured_.set(upvalue->register_index_);
+            }
+        }
+    }
+
+    int NumberTypeInference::Successors(int i, int *succ) const
+    {
+        int count = 0;
+        int op = Instruction::GetOpCode(code_[i]);
+        switch (op) {
+            case OpType_Ret:
+                break;
+            case OpType_Jmp:
+                succ[count++] = i + Instruction::GetJumpDiff(code_[i]);
+                break;
+            case OpType_JmpFalse: case OpType_JmpTrue: case OpType_JmpNil:
+            case OpType_ForInit: case OpType_ForLoop:
+            case OpType_ForLoopInc: case OpType_ForLoopDec:
+                succ[count++] = Next(i);
+                succ[count++] = i + Instruction::GetJumpDiff(code_[i]);
+                break;
+            case OpType_Intrinsic:
+                // Intrinsic skips the next call instruction
+                succ[count++] = Next(i);
+                succ[count++] = Next(Next(i));
+                break;
+            default:
+                // Compare jump executes the next jump instruction or
+                // skips it
+                succ[count++] = Next(i);
+                if (IsCompareJump(op))
+                    succ[count++] = Next(Next(i));
+                break;
+        }
+
+        int kept = 0;
+        for (int k = 0; k < count; ++k)
+        {
+            if (succ[k] < Size())
+                succ[kept++] = succ[k];
+        }
+        return kept;
+    }
+
+    void NumberTypeInference::Transfer(int i, int succ, RegisterSet &s) const
+    {
+        auto ins = code_[i];
+        int op = Instruction::GetOpCode(ins);
+        int a = Instruction::GetParamA(ins);
+        int b = Instruction::GetParamB(ins);
+        int c = Instruction::GetParamC(ins);
+        int any = static_cast<int>(s.size());
+
+        switch (op) {
+            case OpType_LoadInt:
+                s.set(a);
+                break;
+            case OpType_LoadConst:
+                s[a] = IsNumberConst(Instruction::GetParamBx(ins));
+                break;
+            case OpType_LoadConstX:
+                s[a] = IsNumberConst(code_[i + 1].opcode_);
+                break;
+            case OpType_Move:
+                s[a] = s[b];
+                break;
+            case OpType_Neg:
+                s.set(a);
+                break;
+            case OpType_Len:
+                // Length is an integer
+                s.set(a);
+                break;
+            case OpType_Add: case OpType_Sub: case OpType_Mul:
+            case OpType_Div: case OpType_Pow: case OpType_Mod:
+            case OpType_AddNN: case OpType_SubNN:
+            case OpType_MulNN: case OpType_DivNN:
+                // Operands are numbers when the instruction returns
+                s.set(b);
+                s.set(c);
+                s.set(a);
+                break;
+            case OpType_AddRK: case OpType_SubRK: case OpType_MulRK:
+            case OpType_DivRK: case OpType_PowRK: case OpType_ModRK:
+            case OpType_AddNK: case OpType_SubNK:
+            case OpType_MulNK: case OpType_DivNK:
+                s.set(b);
+                s.set(a);
+                break;
+            case OpType_AddKR: case OpType_SubKR: case OpType_MulKR:
+            case OpType_DivKR: case OpType_PowKR: case OpType_ModKR:
+                s.set(c);
+                s.set(a);
+                break;
+            case OpType_ForInit:
+                // Var, limit and step are numbers after the check, name
+                // is set when the loop runs
+                SetRange(s, a, a + 3);
+                if (succ == Next(i))
+                    SetRange(s, a + 3, a + 4);
+                break;
+            case OpType_ForLoop: case OpType_ForLoopInc: case OpType_ForLoopDec:
+                SetRange(s, a, a + 3);
+                if (succ != Next(i))
+                    SetRange(s, a + 3, a + 4);
+                break;
+            case OpType_LoadNil: case OpType_LoadBool:
+            case OpType_GetUpvalue: case OpType_GetGlobal:
+            case OpType_GetGlobalX: case OpType_Closure:
+            case OpType_NewTable: case OpType_Not:
+            case OpType_Concat: case OpType_ConcatRange:
+            case OpType_Intrinsic:
+                s.reset(a);
+                break;
+            case OpType_Less: case OpType_Greater:
+            case OpType_Equal: case OpType_UnEqual:
+            case OpType_LessEqual: case OpType_GreaterEqual:
+            case OpType_LessRK: case OpType_LessKR:
+            case OpType_GreaterRK: case OpType_GreaterKR:
+            case OpType_EqualRK: case OpType_UnEqualRK:
+            case OpType_LessEqualRK: case OpType_LessEqualKR:
+            case OpType_GreaterEqualRK: case OpType_GreaterEqualKR:
+                s.reset(a);
+                break;
+            case OpType_GetTable: case OpType_GetTableKR: case OpType_GetField:
+                s.reset(c);
+                break;
+            case OpType_Self:
+                ResetRange(s, a, a + 2);
+                break;
+            case OpType_FillNil:
+                ResetRange(s, a, b);
+                break;
+            case OpType_Call: case OpType_VarArg:
+                ResetRange(s, a, any);
+                break;
+            case OpType_SetUpvalue: case OpType_SetGlobal: case OpType_SetGlobalX:
+            case OpType_SetTable: case OpType_SetTableRK: case OpType_SetTableKR:
+            case OpType_SetTableKK: case OpType_SetField:
+            case OpType_JmpFalse: case OpType_JmpTrue: case OpType_JmpNil:
+            case OpType_Jmp: case OpType_Ret:
+                break;
+            default:
+                if (!IsCompareJump(op))
+                    s.reset();
+                break;
+        }
+
+        s &= ~captured_;
+    }
+
+    void NumberTypeInference::Specialize(int i)
+    {
+        auto ins = code_[i];
+        int op = Instruction::GetOpCode(ins);
+        int b = Instruction::GetParamB(ins);
+        int c = Instruction::GetParamC(ins);
+        const RegisterSet &s = in_[i];
+
+        // Operands of register and register form, register and const
+        // form, const and register form which is swapped to register
+        // and const form by commutative or reversed operator
+        auto rr = [&]() { return s[b] && s[c]; };
+        auto rk = [&]() { return s[b] && IsNumberConst(c); };
+        auto kr = [&]() { return s[c] && IsNumberConst(b); };
+
+        switch (op) {
+#define SPECIALIZE(checked, unchecked, ok, b, c)                        \
+            case checked:                                               \
+                if (ok())                                               \
+                    code_[i] = ReplaceOpCode(ins, unchecked, b, c);     \
+                break
+
+            SPECIALIZE(OpType_Add, OpType_AddNN, rr, b, c);
+            SPECIALIZE(OpType_AddRK, OpType_AddNK, rk, b, c);
+            SPECIALIZE(OpType_AddKR, OpType_AddNK, kr, c, b);
+            SPECIALIZE(OpType_Sub, OpType_SubNN, rr, b, c);
+            SPECIALIZE(OpType_SubRK, OpType_SubNK, rk, b, c);
+            SPECIALIZE(OpType_Mul, OpType_MulNN, rr, b, c);
+            SPECIALIZE(OpType_MulRK, OpType_MulNK, rk, b, c);
+            SPECIALIZE(OpType_MulKR, OpType_MulNK, kr, c, b);
+            SPECIALIZE(OpType_Div, OpType_DivNN, rr, b, c);
+            SPECIALIZE(OpType_DivRK, OpType_DivNK, rk, b, c);
+            SPECIALIZE(OpType_JmpLess, OpType_JmpLessNN, rr, b, c);
+            SPECIALIZE(OpType_JmpLessRK, OpType_JmpLessNK, rk, b, c);
+            SPECIALIZE(OpType_JmpLessKR, OpType_JmpGreaterNK, kr, c, b);
+            SPECIALIZE(OpType_JmpGreater, OpType_JmpGreaterNN, rr, b, c);
+            SPECIALIZE(OpType_JmpGreaterRK, OpType_JmpGreaterNK, rk, b, c);
+            SPECIALIZE(OpType_JmpGreaterKR, OpType_JmpLessNK, kr, c, b);
+            SPECIALIZE(OpType_JmpLessEqual, OpType_JmpLessEqualNN, rr, b, c);
+            SPECIALIZE(OpType_JmpLessEqualRK, OpType_JmpLessEqualNK, rk, b, c);
+            SPECIALIZE(OpType_JmpLessEqualKR, OpType_JmpGreaterEqualNK, kr, c, b);
+            SPECIALIZE(OpType_JmpGreaterEqual, OpType_JmpGreaterEqualNN, rr, b, c);
+            SPECIALIZE(OpType_JmpGreaterEqualRK, OpType_JmpGreaterEqualNK, rk, b, c);
+            SPECIALIZE(OpType_JmpGreaterEqualKR, OpType_JmpLessEqualNK, kr, c, b);
+#undef SPECIALIZE
+            default:
+                break;
+        }
+    }
+
+    void NumberTypeInference::Infer()
+    {
+        if (code_.empty())
+            return ;
+
+        // Registers are not numbers at the function start, instructions
+        // not reached yet assume all registers are numbers, the sets
+        // shrink until they are stable
+        RegisterSet all;
+        all.set();
+        in_.assign(Size(), all);
+        in_[0].reset();
+
+        std::vector<bool> queued(Size(), false);
+        std::vector<int> work(1, 0);
+        queued[0] = true;
+        while (!work.empty())
+        {
+            int i = work.back();
+            work.pop_back();
+            queued[i] = false;
+
+            int succ[2];
+            int count = Successors(i, succ);
+            for (int k = 0; k < count; ++k)
+            {
+                RegisterSet s = in_[i];
+                Transfer(i, succ[k], s);
+                s &= in_[succ[k]];
+                if (s != in_[succ[k]])
+                {
+                    in_[succ[k]] = s;
+                    if (!queued[succ[k]])
+                    {
+                        queued[succ[k]] = true;
+                        work.push_back(succ[k]);
+                    }
+                }
+            }
+        }
+
+        for (int i = 0; i < Size(); i = Next(i))
+        {
+            Specialize(i);
+            function_->GetMutableInstruction(i)->opcode_ = code_[i].opcode_;
+        }
+    }
+
+    void InferNumberTypes(Function *function)
+    {
+        NumberTypeInference inference(function);
+        inference.Infer();
+    }
+} // namespace luna
@@ -0,0 +1,15 @@
+#ifndef TYPE_INFERENCE_H
+#define TYPE_INFERENCE_H
+
+namespace luna
+{
+    class Function;
+
+    // Infer registers which are always numbers at each instruction of
+    // function, arithmetic and compare jump instructions which
+    // operands are proved numbers are replaced by unchecked numeric
+    // instructions, others are kept checked
+    void InferNumberTypes(Function *function);
+} // namespace luna
+
+#endif // TYPE_INFERENCE_H
@@ -6,7 +6,7 @@ namespace luna
     {
         if (v->Visit(this))
         {
-            value_.Accept(v);
+            value_->Accept(v);
         }
     }
 } // namespace luna
@@ -6,19 +6,42 @@
 
 namespace luna
 {
+    // Upvalue is open when it refers to a register of a living stack
+    // frame, and it is closed when the frame dies, then the value is
+    // copied into the upvalue itself.
     class Upvalue : public GCObject
     {
     public:
+        Upvalue() : value_(&closed_value_), next_(nullptr) { }
+
         virtual void Accept(GCObjectVisitor *v);
 
         void SetValue(const Value &value)
-        { value_ = value; }
+        { *value_ = value; }
 
         Value * GetValue()
-        { return &value_; }
+        { return value_; }
+
+        // Refer to stack value
+        void Open(Value *value)
+        { value_ = value; }
+
+        // Copy the referred stack value into upvalue
+        void Close()
+        { closed_value_ = *value_; value_ = &closed_value_; next_ = nullptr; }
+
+        void SetNext(Upvalue *next)
+        { next_ = next; }
+
+        Upvalue * GetNext() const
+        { return next_; }
 
     private:
-        Value value_;
+        // Points to stack value when opened, otherwise to closed_value_
+        Value *value_;
+        Value closed_value_;
+        // Next open upvalue which refers to a lower stack value
+        Upvalue *next_;
     };
 } // namespace luna
 
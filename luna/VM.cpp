@@ -4,8 +4,12 @@
 #include "UserData.h"
 #include "Function.h"
 #include "Exception.h"
+#include "Jit.h"
+#include "BaselineJit.h"
+#include "Arith.h"
 #include <assert.h>
 #include <math.h>
+#include <limits>
 
 #ifdef _MSC_VER
 #define snprintf _snprintf
@@ -13,26 +17,51 @@
 
 namespace
 {
-    std::string NumberToStr(luna::Value *num)
+    // Append number or string operand of concat to 'buffer'
+    void AppendConcatOperand(std::string &buffer, const luna::Value *v)
     {
-        assert(num->type_ == luna::ValueT_Number);
+        if (v->type_ == luna::ValueT_String)
+        {
+            buffer.append(v->str_->GetCStr(), v->str_->GetLength());
+            return ;
+        }
+
+        assert(v->IsNumber());
         char temp[64];
-        if (floor(num->num_) == num->num_)
-            snprintf(temp, sizeof(temp), "%lld", static_cast<long long>(num->num_));
+        int len = 0;
+        if (v->type_ == luna::ValueT_Integer)
+        {
+            long long integer = v->integer_;
+            len = snprintf(temp, sizeof(temp), "%lld", integer);
+        }
         else
-            snprintf(temp, sizeof(temp), "%g", num->num_);
-        return temp;
+        {
+            double d = v->num_;
+            if (floor(d) == d)
+                len = snprintf(temp, sizeof(temp), "%lld", static_cast<long long>(d));
+            else
+                len = snprintf(temp, sizeof(temp), "%g", d);
+        }
+        buffer.append(temp, len);
+    }
+
+    inline bool IsConcatOperand(const luna::Value *v)
+    {
+        return v->type_ == luna::ValueT_String || v->IsNumber();
     }
 } // namespace
 
 namespace luna
 {
-#define GET_CONST_VALUE(i)      (proto->GetConstValue(Instruction::GetParamBx(i)))
-#define GET_REGISTER_A(i)       (call->register_ + Instruction::GetParamA(i))
-#define GET_REGISTER_B(i)       (call->register_ + Instruction::GetParamB(i))
-#define GET_REGISTER_C(i)       (call->register_ + Instruction::GetParamC(i))
+#define GET_CONST_VALUE(i)      (consts + Instruction::GetParamBx(i))
+#define GET_CONST_VALUE_X()     (consts + pc->opcode_)
+#define GET_REGISTER_A(i)       (base + Instruction::GetParamA(i))
+#define GET_REGISTER_B(i)       (base + Instruction::GetParamB(i))
+#define GET_REGISTER_C(i)       (base + Instruction::GetParamC(i))
+#define GET_CONST_B(i)          (consts + Instruction::GetParamB(i))
+#define GET_CONST_C(i)          (consts + Instruction::GetParamC(i))
 #define GET_UPVALUE_B(i)        (cl->GetUpvalue(Instruction::GetParamB(i)))
-#define GET_REAL_VALUE(a)       (a->type_ == ValueT_Upvalue ? a->upvalue_->GetValue() : a)
+#define GET_TABLE_CACHE()       (caches + (pc - 1 - code))
 
 #define GET_REGISTER_ABC(i)                                 \
     a = GET_REGISTER_A(i);                                  \
@@ -45,6 +74,379 @@ namespace luna
     assert(call->func_ && call->func_->closure_);           \
     auto proto = call->func_->closure_->GetPrototype()
 
+// Write the cached pc back to CallInfo, every out of line function
+// which may throw or leave current frame needs it
+#define SAVE_PC()               (call->instruction_ = pc)
+
+// Load frame state of the CallInfo on the top into locals of
+// ExecuteFrame
+#define LOAD_FRAME()                                        \
+    do                                                      \
+    {                                                       \
+        call = &state_->calls_.back();                      \
+        cl = call->func_->closure_;                         \
+        proto = cl->GetPrototype();                         \
+        base = call->register_;                             \
+        consts = proto->GetConstValues();                   \
+        caches = proto->GetTableCaches();                   \
+        code = proto->GetOpCodes();                         \
+        pc = call->instruction_;                            \
+    } while (0)
+
+// GC safepoint, objects are only allocated by NewTable, Concat, Closure
+// and called c functions, so GC is checked after these instructions,
+// at backward jumps and when a frame starts or resumes executing
+#define CHECK_GC()              state_->CheckRunGC()
+
+#define VM_FETCH()              (i = *pc++)
+
+// Target of backward jump is a loop header, run the trace of
+// the loop when JIT is enabled
+#define JIT_LOOP()                                          \
+    if (state_->jit_enabled_)                               \
+        pc = state_->jit_->ExecuteLoop(cl, base, pc)
+
+// Run native code of the frame from pc when the function has native
+// code or baseline JIT is enabled, when a frame starts or resumes, and
+// after instructions which native code exits to interpreter for
+#define NATIVE_ENTER()                                      \
+    if (state_->baseline_jit_enabled_ ||                    \
+        proto->GetNativeCode())                             \
+        pc = ExecuteNative(proto, cl, base, code, pc)
+
+// Jump by diff of instruction index, backward jump is a GC safepoint
+#define VM_JUMP_DIFF(jump_diff)                             \
+    do                                                      \
+    {                                                       \
+        int diff = (jump_diff);                             \
+        pc += -1 + diff;                                    \
+        if (diff < 0)                                       \
+        {                                                   \
+            CHECK_GC();                                     \
+            JIT_LOOP();                                     \
+        }                                                   \
+    } while (0)
+
+// Jump by sBx of instruction
+#define VM_JUMP(i)              VM_JUMP_DIFF(Instruction::GetParamsBx(i))
+
+// Jump by sAx of OpType_Jmp
+#define VM_JUMP_AX(i)           VM_JUMP_DIFF(Instruction::GetParamsAx(i))
+
+// Dispatch instructions by computed goto when compiler supports
+// labels as values, otherwise by switch
+#if defined(__GNUC__) && !defined(LUNA_NO_COMPUTED_GOTO)
+#define VM_DISPATCH_BEGIN                                   \
+    VM_FETCH();                                             \
+    goto *dispatch_table[Instruction::GetOpCode(i)];
+#define VM_DISPATCH_END
+#define VM_CASE(op)             L_##op
+#define VM_DEFAULT              L_Default
+#define VM_NEXT()                                           \
+    do                                                      \
+    {                                                       \
+        VM_FETCH();                                         \
+        goto *dispatch_table[Instruction::GetOpCode(i)];    \
+    } while (0)
+#else
+#define VM_DISPATCH_BEGIN                                   \
+    for (;;)                                                \
+    {                                                       \
+        VM_FETCH();                                         \
+        switch (Instruction::GetOpCode(i)) {
+#define VM_DISPATCH_END         } }
+#define VM_CASE(op)             case op
+#define VM_DEFAULT              default
+#define VM_NEXT()               continue
+#endif
+
+// Current frame is finished, resume the caller frame in this loop,
+// return when the caller is not a Lua function
+#define VM_RETURN()                                                 \
+    if (state_->calls_.empty() ||                                   \
+        state_->calls_.back().func_->type_ != ValueT_Closure)       \
+        return ;                                                    \
+    LOAD_FRAME();                                                   \
+    CHECK_GC();                                                     \
+    NATIVE_ENTER();                                                 \
+    VM_NEXT()
+
+#define CHECK_TYPE(v, type, op)                             \
+    if (v->type_ != type)                                   \
+    {                                                       \
+        SAVE_PC();                                          \
+        ReportTypeError(v, op);                             \
+    }
+
+#define CHECK_ARITH_TYPE(v1, v2, op)                        \
+    if (!v1->IsNumber() || !v2->IsNumber())                 \
+    {                                                       \
+        SAVE_PC();                                          \
+        CheckArithType(v1, v2, op);                         \
+    }
+
+#define CHECK_INEQUALITY_TYPE(v1, v2, op)                   \
+    if ((!v1->IsNumber() || !v2->IsNumber()) &&             \
+        (v1->type_ != ValueT_String ||                      \
+         v2->type_ != ValueT_String))                       \
+    {                                                       \
+        SAVE_PC();                                          \
+        CheckInequalityType(v1, v2, op);                    \
+    }
+
+#define CHECK_TABLE_TYPE(t, k, op, desc)                    \
+    if (t->type_ != ValueT_Table)                           \
+    {                                                       \
+        SAVE_PC();                                          \
+        CheckTableType(t, k, op, desc);                     \
+    }
+
+// Integer result which Value can not hold is an error, it happens
+// only when Value is NaN-boxed
+#define SET_INTEGER_RESULT(v, integer)                      \
+    do                                                      \
+    {                                                       \
+        long long int_result = integer;                     \
+        if (!IntegerFitsValue(int_result))                  \
+        {                                                   \
+            SAVE_PC();                                      \
+            ReportIntegerOverflow();                        \
+        }                                                   \
+        (v)->SetInteger(int_result);                        \
+    } while (0)
+
+// Operand B and C of arithmetic, comparison and table instructions
+// are registers or consts, get_b and get_c choose one of
+// GET_REGISTER_B/GET_CONST_B and GET_REGISTER_C/GET_CONST_C.
+// Result is integer when both operands are integers, otherwise
+// operands are converted to float
+#define ARITH_OP(get_b, get_c, op, int_calc, num_calc)      \
+    a = GET_REGISTER_A(i);                                  \
+    b = get_b(i);                                           \
+    c = get_c(i);                                           \
+    if (b->type_ == ValueT_Number &&                        \
+        c->type_ == ValueT_Number)                          \
+        a->SetNumber(num_calc(b->num_, c->num_));           \
+    else if (b->type_ == ValueT_Integer &&                  \
+             c->type_ == ValueT_Integer)                    \
+        SET_INTEGER_RESULT(a, int_calc(b->integer_,         \
+                                       c->integer_));       \
+    else if (b->IsNumber() && c->IsNumber())                \
+        a->SetNumber(num_calc(b->GetNumber(),               \
+                              c->GetNumber()));             \
+    else                                                    \
+    {                                                       \
+        SAVE_PC();                                          \
+        CheckArithType(b, c, op);                           \
+    }                                                       \
+    VM_NEXT()
+
+// Arithmetic which result is always float, div and power
+#define FLOAT_ARITH_OP(get_b, get_c, op, num_calc)          \
+    a = GET_REGISTER_A(i);                                  \
+    b = get_b(i);                                           \
+    c = get_c(i);                                           \
+    if (b->type_ == ValueT_Number &&                        \
+        c->type_ == ValueT_Number)                          \
+        a->SetNumber(num_calc(b->num_, c->num_));           \
+    else                                                    \
+    {                                                       \
+        CHECK_ARITH_TYPE(b, c, op);                         \
+        a->SetNumber(num_calc(b->GetNumber(),               \
+                              c->GetNumber()));             \
+    }                                                       \
+    VM_NEXT()
+
+// Integer modulo by zero is an error
+#define MOD_OP(get_b, get_c)                                \
+    a = GET_REGISTER_A(i);                                  \
+    b = get_b(i);                                           \
+    c = get_c(i);                                           \
+    if (b->type_ == ValueT_Integer &&                       \
+        c->type_ == ValueT_Integer)                         \
+    {                                                       \
+        if (c->integer_ == 0)                               \
+        {                                                   \
+            SAVE_PC();                                      \
+            ReportModByZero();                              \
+        }                                                   \
+        a->SetInteger(IntegerMod(b->integer_, c->integer_));\
+    }                                                       \
+    else                                                    \
+    {                                                       \
+        CHECK_ARITH_TYPE(b, c, "mod");                      \
+        a->SetNumber(fmod(b->GetNumber(), c->GetNumber())); \
+    }                                                       \
+    VM_NEXT()
+
+// Arithmetic of operands which are known numbers, no type check
+#define NUM_ARITH_OP(get_b, get_c, int_calc, num_calc)      \
+    a = GET_REGISTER_A(i);                                  \
+    b = get_b(i);                                           \
+    c = get_c(i);                                           \
+    if (b->type_ == ValueT_Integer &&                       \
+        c->type_ == ValueT_Integer)                         \
+        SET_INTEGER_RESULT(a, int_calc(b->integer_,         \
+                                       c->integer_));       \
+    else                                                    \
+        a->SetNumber(num_calc(b->GetNumber(),               \
+                              c->GetNumber()));             \
+    VM_NEXT()
+
+#define NUM_ADD(x, y)           ((x) + (y))
+#define NUM_SUB(x, y)           ((x) - (y))
+#define NUM_MUL(x, y)           ((x) * (y))
+#define NUM_DIV(x, y)           ((x) / (y))
+
+// Integers compare directly, integer and float compare as floats
+#define INEQUALITY_OP(get_b, get_c, cmp)                    \
+    a = GET_REGISTER_A(i);                                  \
+    b = get_b(i);                                           \
+    c = get_c(i);                                           \
+    if (b->type_ == ValueT_Integer &&                       \
+        c->type_ == ValueT_Integer)                         \
+        a->SetBool(b->integer_ cmp c->integer_);            \
+    else                                                    \
+    {                                                       \
+        CHECK_INEQUALITY_TYPE(b, c, "compare(" #cmp ")");   \
+        if (b->IsNumber())                                  \
+            a->SetBool(b->GetNumber() cmp c->GetNumber());  \
+        else                                                \
+            a->SetBool(*b->str_ cmp *c->str_);              \
+    }                                                       \
+    VM_NEXT()
+
+#define EQUALITY_OP(get_b, get_c, cmp)                      \
+    a = GET_REGISTER_A(i);                                  \
+    b = get_b(i);                                           \
+    c = get_c(i);                                           \
+    a->SetBool(*b cmp *c);                                  \
+    VM_NEXT()
+
+// Jump by the next instruction when result of comparison is A,
+// otherwise skip the next instruction
+#define COMPARE_JMP(result)                                 \
+    if ((result) == (Instruction::GetParamA(i) != 0))       \
+    {                                                       \
+        i = *pc++;                                          \
+        VM_JUMP_AX(i);                                      \
+    }                                                       \
+    else                                                    \
+        ++pc;                                               \
+    VM_NEXT()
+
+#define JMP_INEQUALITY_OP(get_b, get_c, cmp)                \
+    b = get_b(i);                                           \
+    c = get_c(i);                                           \
+    if (b->type_ == ValueT_Integer &&                       \
+        c->type_ == ValueT_Integer)                         \
+    {                                                       \
+        COMPARE_JMP(b->integer_ cmp c->integer_);           \
+    }                                                       \
+    if (b->type_ == ValueT_Number &&                        \
+        c->type_ == ValueT_Number)                          \
+    {                                                       \
+        COMPARE_JMP(b->num_ cmp c->num_);                   \
+    }                                                       \
+    if (b->IsNumber() && c->IsNumber())                     \
+    {                                                       \
+        COMPARE_JMP(b->GetNumber() cmp c->GetNumber());     \
+    }                                                       \
+    CHECK_INEQUALITY_TYPE(b, c, "compare(" #cmp ")");       \
+    COMPARE_JMP(*b->str_ cmp *c->str_)
+
+// Compare operands which are known numbers, no type check
+#define JMP_NUM_INEQUALITY_OP(get_b, get_c, cmp)            \
+    b = get_b(i);                                           \
+    c = get_c(i);                                           \
+    if (b->type_ == ValueT_Integer &&                       \
+        c->type_ == ValueT_Integer)                         \
+    {                                                       \
+        COMPARE_JMP(b->integer_ cmp c->integer_);           \
+    }                                                       \
+    COMPARE_JMP(b->GetNumber() cmp c->GetNumber())
+
+#define JMP_EQUALITY_OP(get_b, get_c)                       \
+    b = get_b(i);                                           \
+    c = get_c(i);                                           \
+    if (b->type_ == ValueT_Integer &&                       \
+        c->type_ == ValueT_Integer)                         \
+    {                                                       \
+        COMPARE_JMP(b->integer_ == c->integer_);            \
+    }                                                       \
+    if (b->type_ == ValueT_Number &&                        \
+        c->type_ == ValueT_Number)                          \
+    {                                                       \
+        COMPARE_JMP(b->num_ == c->num_);                    \
+    }                                                       \
+    COMPARE_JMP(*b == *c)
+
+// Get field of table by string const key B, hit inline cache first
+#define GET_FIELD_OP(table, value)                          \
+    a = table;                                              \
+    c = value;                                              \
+    if (a->type_ == ValueT_Table &&                         \
+        GET_TABLE_CACHE()->version_ ==                      \
+        a->table_->GetVersion())                            \
+        *c = *GET_TABLE_CACHE()->value_;                    \
+    else                                                    \
+    {                                                       \
+        SAVE_PC();                                          \
+        GetField(a, GET_CONST_B(i), c, GET_TABLE_CACHE());  \
+    }                                                       \
+    VM_NEXT()
+
+// Numeric 'for' loop, A: var A + 1: limit A + 2: step A + 3: name,
+// integer loop steps var and jumps to loop body when int_cond is
+// true, float loop steps var and jumps when num_cond is true
+#define FOR_LOOP(int_cond, num_cond)                        \
+    a = GET_REGISTER_A(i);                                  \
+    if (a->type_ == ValueT_Integer)                         \
+    {                                                       \
+        if (int_cond)                                       \
+        {                                                   \
+            a->integer_ += (a + 2)->integer_;               \
+            (a + 3)->SetInteger(a->integer_);               \
+            VM_JUMP(i);                                     \
+        }                                                   \
+    }                                                       \
+    else                                                    \
+    {                                                       \
+        a->num_ += (a + 2)->num_;                           \
+        if (num_cond)                                       \
+        {                                                   \
+            (a + 3)->SetNumber(a->num_);                    \
+            VM_JUMP(i);                                     \
+        }                                                   \
+    }                                                       \
+    VM_NEXT()
+
+#define SET_TABLE_OP(get_b, get_c)                          \
+    a = GET_REGISTER_A(i);                                  \
+    b = get_b(i);                                           \
+    c = get_c(i);                                           \
+    CHECK_TABLE_TYPE(a, b, "set", "to");                    \
+    if (a->type_ == ValueT_Table)                           \
+        a->table_->SetValue(*b, *c);                        \
+    else if (a->type_ == ValueT_UserData)                   \
+        a->user_data_->GetMetatable()->SetValue(*b, *c);    \
+    else                                                    \
+        assert(0);                                          \
+    VM_NEXT()
+
+#define GET_TABLE_OP(get_b)                                 \
+    a = GET_REGISTER_A(i);                                  \
+    b = get_b(i);                                           \
+    c = GET_REGISTER_C(i);                                  \
+    CHECK_TABLE_TYPE(a, b, "get", "from");                  \
+    if (a->type_ == ValueT_Table)                           \
+        *c = a->table_->GetValue(*b);                       \
+    else if (a->type_ == ValueT_UserData)                   \
+        *c = a->user_data_->GetMetatable()->GetValue(*b);   \
+    else                                                    \
+        assert(0);                                          \
+    VM_NEXT()
+
     VM::VM(State *state) : state_(state)
     {
     }
@@ -63,262 +465,539 @@ namespace luna
         }
     }
 
+    inline const Instruction * VM::ExecuteNative(Function *proto, Closure *cl, Value *base,
+                                                 const Instruction *code,
+                                                 const Instruction *pc)
+    {
+        auto native = proto->GetNativeCode();
+        if (!native)
+        {
+            // Baseline JIT is enabled
+            if (pc != code)
+                return pc;
+            native = state_->baseline_jit_->CountCall(proto);
+            if (!native)
+                return pc;
+        }
+        return code + native->Run(base, cl, this, pc - code);
+    }
+
     void VM::ExecuteFrame()
     {
-        CallInfo *call = &state_->calls_.back();
-        Closure *cl = call->func_->closure_;
-        Function *proto = cl->GetPrototype();
+        // Keep frame state in locals, the last instruction of each
+        // function is OpType_Ret, so there is no end check
+        CallInfo *call = nullptr;
+        Closure *cl = nullptr;
+        Function *proto = nullptr;
+        Value *base = nullptr;
+        Value *consts = nullptr;
+        Table *global = state_->global_.table_;
+        TableCache *caches = nullptr;
+        const Instruction *code = nullptr;
+        const Instruction *pc = nullptr;
+        LOAD_FRAME();
+        Instruction i;
         Value *a = nullptr;
         Value *b = nullptr;
         Value *c = nullptr;
 
-        while (call->instruction_ < call->end_)
-        {
-            state_->CheckRunGC();
-            Instruction i = *call->instruction_++;
+        CHECK_GC();
+        NATIVE_ENTER();
 
-            switch (Instruction::GetOpCode(i)) {
-                case OpType_LoadNil:
-                    a = GET_REGISTER_A(i);
-                    GET_REAL_VALUE(a)->SetNil();
-                    break;
-                case OpType_FillNil:
-                    a = GET_REGISTER_A(i);
-                    b = GET_REGISTER_B(i);
-                    while (a < b)
-                    {
-                        a->SetNil();
-                        ++a;
-                    }
-                    break;
-                case OpType_LoadBool:
-                    a = GET_REGISTER_A(i);
-                    GET_REAL_VALUE(a)->SetBool(Instruction::GetParamB(i) ? true : false);
-                    break;
-                case OpType_LoadInt:
-                    a = GET_REGISTER_A(i);
-                    assert(call->instruction_ < call->end_);
-                    a->num_ = (*call->instruction_++).opcode_;
-                    a->type_ = ValueT_Number;
-                    break;
-                case OpType_LoadConst:
-                    a = GET_REGISTER_A(i);
-                    b = GET_CONST_VALUE(i);
-                    *GET_REAL_VALUE(a) = *b;
-                    break;
-                case OpType_Move:
-                    a = GET_REGISTER_A(i);
-                    b = GET_REGISTER_B(i);
-                    *GET_REAL_VALUE(a) = *GET_REAL_VALUE(b);
-                    break;
-                case OpType_Call:
-                    a = GET_REGISTER_A(i);
-                    if (Call(a, i)) return ;
-                    break;
-                case OpType_GetUpvalue:
-                    a = GET_REGISTER_A(i);
-                    b = GET_UPVALUE_B(i)->GetValue();
-                    *GET_REAL_VALUE(a) = *b;
-                    break;
-                case OpType_SetUpvalue:
-                    a = GET_REGISTER_A(i);
-                    b = GET_UPVALUE_B(i)->GetValue();
-                    *b = *a;
-                    break;
-                case OpType_GetGlobal:
-                    a = GET_REGISTER_A(i);
-                    b = GET_CONST_VALUE(i);
-                    *GET_REAL_VALUE(a) = state_->global_.table_->GetValue(*b);
-                    break;
-                case OpType_SetGlobal:
-                    a = GET_REGISTER_A(i);
-                    b = GET_CONST_VALUE(i);
-                    state_->global_.table_->SetValue(*b, *a);
-                    break;
-                case OpType_Closure:
-                    a = GET_REGISTER_A(i);
-                    GenerateClosure(a, i);
-                    break;
-                case OpType_VarArg:
-                    a = GET_REGISTER_A(i);
-                    CopyVarArg(a, i);
-                    break;
-                case OpType_Ret:
-                    a = GET_REGISTER_A(i);
-                    return Return(a, i);
-                case OpType_JmpFalse:
-                    a = GET_REGISTER_A(i);
-                    if (GET_REAL_VALUE(a)->IsFalse())
-                        call->instruction_ += -1 + Instruction::GetParamsBx(i);
-                    break;
-                case OpType_JmpTrue:
-                    a = GET_REGISTER_A(i);
-                    if (!GET_REAL_VALUE(a)->IsFalse())
-                        call->instruction_ += -1 + Instruction::GetParamsBx(i);
-                    break;
-                case OpType_JmpNil:
-                    a = GET_REGISTER_A(i);
-                    if (a->type_ == ValueT_Nil)
-                        call->instruction_ += -1 + Instruction::GetParamsBx(i);
-                    break;
-                case OpType_Jmp:
-                    call->instruction_ += -1 + Instruction::GetParamsBx(i);
-                    break;
-                case OpType_Neg:
-                    a = GET_REGISTER_A(i);
-                    CheckType(a, ValueT_Number, "neg");
-                    a->num_ = -a->num_;
-                    break;
-                case OpType_Not:
-                    a = GET_REGISTER_A(i);
-                    a->SetBool(a->IsFalse() ? true : false);
-                    break;
-                case OpType_Len:
-                    a = GET_REGISTER_A(i);
-                    if (a->type_ == ValueT_Table)
-                        a->num_ = a->table_->ArraySize();
-                    else if (a->type_ == ValueT_String)
-                        a->num_ = a->str_->GetLength();
-                    else
-                        ReportTypeError(a, "length of");
-                    a->type_ = ValueT_Number;
-                    break;
-                case OpType_Add:
-                    GET_REGISTER_ABC(i);
-                    CheckArithType(b, c, "add");
-                    a->num_ = b->num_ + c->num_;
-                    a->type_ = ValueT_Number;
-                    break;
-                case OpType_Sub:
-                    GET_REGISTER_ABC(i);
-                    CheckArithType(b, c, "sub");
-                    a->num_ = b->num_ - c->num_;
-                    a->type_ = ValueT_Number;
-                    break;
-                case OpType_Mul:
-                    GET_REGISTER_ABC(i);
-                    CheckArithType(b, c, "multiply");
-                    a->num_ = b->num_ * c->num_;
-                    a->type_ = ValueT_Number;
-                    break;
-                case OpType_Div:
-                    GET_REGISTER_ABC(i);
-                    CheckArithType(b, c, "div");
-                    a->num_ = b->num_ / c->num_;
-                    a->type_ = ValueT_Number;
-                    break;
-                case OpType_Pow:
-                    GET_REGISTER_ABC(i);
-                    CheckArithType(b, c, "power");
-                    a->num_ = pow(b->num_, c->num_);
-                    a->type_ = ValueT_Number;
-                    break;
-                case OpType_Mod:
-                    GET_REGISTER_ABC(i);
-                    CheckArithType(b, c, "mod");
-                    a->num_ = fmod(b->num_, c->num_);
-                    a->type_ = ValueT_Number;
-                    break;
-                case OpType_Concat:
-                    GET_REGISTER_ABC(i);
-                    Concat(a, b, c);
-                    break;
-                case OpType_Less:
-                    GET_REGISTER_ABC(i);
-                    CheckInequalityType(b, c, "compare(<)");
-                    if (b->type_ == ValueT_Number)
-                        a->SetBool(b->num_ < c->num_);
-                    else
-                        a->SetBool(*b->str_ < *c->str_);
-                    break;
-                case OpType_Greater:
-                    GET_REGISTER_ABC(i);
-                    CheckInequalityType(b, c, "compare(>)");
-                    if (b->type_ == ValueT_Number)
-                        a->SetBool(b->num_ > c->num_);
-                    else
-                        a->SetBool(*b->str_ > *c->str_);
-                    break;
-                case OpType_Equal:
-                    GET_REGISTER_ABC(i);
-                    a->SetBool(*b == *c);
-                    break;
-                case OpType_UnEqual:
-                    GET_REGISTER_ABC(i);
-                    a->SetBool(*b != *c);
-                    break;
-                case OpType_LessEqual:
-                    GET_REGISTER_ABC(i);
-                    CheckInequalityType(b, c, "compare(<=)");
-                    if (b->type_ == ValueT_Number)
-                        a->SetBool(b->num_ <= c->num_);
-                    else
-                        a->SetBool(*b->str_ <= *c->str_);
-                    break;
-                case OpType_GreaterEqual:
-                    GET_REGISTER_ABC(i);
-                    CheckInequalityType(b, c, "compare(>=)");
-                    if (b->type_ == ValueT_Number)
-                        a->SetBool(b->num_ >= c->num_);
-                    else
-                        a->SetBool(*b->str_ >= *c->str_);
-                    break;
-                case OpType_NewTable:
-                    a = GET_REGISTER_A(i);
-                    a->table_ = state_->NewTable();
-                    a->type_ = ValueT_Table;
-                    break;
-                case OpType_SetTable:
-                    GET_REGISTER_ABC(i);
-                    CheckTableType(a, b, "set", "to");
-                    if (a->type_ == ValueT_Table)
-                        a->table_->SetValue(*b, *c);
-                    else if (a->type_ == ValueT_UserData)
-                        a->user_data_->GetMetatable()->SetValue(*b, *c);
-                    else
-                        assert(0);
-                    break;
-                case OpType_GetTable:
-                    GET_REGISTER_ABC(i);
-                    CheckTableType(a, b, "get", "from");
-                    if (a->type_ == ValueT_Table)
-                        *c = a->table_->GetValue(*b);
-                    else if (a->type_ == ValueT_UserData)
-                        *c = a->user_data_->GetMetatable()->GetValue(*b);
-                    else
-                        assert(0);
-                    break;
-                case OpType_ForInit:
-                    GET_REGISTER_ABC(i);
-                    ForInit(a, b, c);
-                    break;
-                case OpType_ForStep:
-                    GET_REGISTER_ABC(i);
-                    i = *call->instruction_++;
-                    if ((c->num_ > 0.0 && a->num_ > b->num_) ||
-                        (c->num_ <= 0.0 && a->num_ < b->num_))
-                        call->instruction_ += -1 + Instruction::GetParamsBx(i);
-                    break;
-                default:
-                    break;
-            }
-        }
-
-        Value *new_top = call->func_;
-        // Reset top value
-        state_->stack_.SetNewTop(new_top);
-        // Set expect results
-        if (call->expect_result_ != EXP_VALUE_COUNT_ANY)
-            state_->stack_.SetNewTop(new_top + call->expect_result_);
+#if defined(__GNUC__) && !defined(LUNA_NO_COMPUTED_GOTO)
+        // Same order as OpType
+        static void *dispatch_table[] = {
+            &&L_Default,
+            &&L_OpType_LoadNil,
+            &&L_OpType_FillNil,
+            &&L_OpType_LoadBool,
+            &&L_OpType_LoadInt,
+            &&L_OpType_LoadConst,
+            &&L_OpType_Move,
+            &&L_OpType_GetUpvalue,
+            &&L_OpType_SetUpvalue,
+            &&L_OpType_GetGlobal,
+            &&L_OpType_SetGlobal,
+            &&L_OpType_Closure,
+            &&L_OpType_Call,
+            &&L_OpType_TailCall,
+            &&L_OpType_VarArg,
+            &&L_OpType_Ret,
+            &&L_OpType_JmpFalse,
+            &&L_OpType_JmpTrue,
+            &&L_OpType_JmpNil,
+            &&L_OpType_Jmp,
+            &&L_OpType_JmpLess,
+            &&L_OpType_JmpLessRK,
+            &&L_OpType_JmpLessKR,
+            &&L_OpType_JmpGreater,
+            &&L_OpType_JmpGreaterRK,
+            &&L_OpType_JmpGreaterKR,
+            &&L_OpType_JmpLessEqual,
+            &&L_OpType_JmpLessEqualRK,
+            &&L_OpType_JmpLessEqualKR,
+            &&L_OpType_JmpGreaterEqual,
+            &&L_OpType_JmpGreaterEqualRK,
+            &&L_OpType_JmpGreaterEqualKR,
+            &&L_OpType_JmpEqual,
+            &&L_OpType_JmpEqualRK,
+            &&L_OpType_Neg,
+            &&L_OpType_Not,
+            &&L_OpType_Len,
+            &&L_OpType_Add,
+            &&L_OpType_Sub,
+            &&L_OpType_Mul,
+            &&L_OpType_Div,
+            &&L_OpType_Pow,
+            &&L_OpType_Mod,
+            &&L_OpType_AddRK,
+            &&L_OpType_AddKR,
+            &&L_OpType_SubRK,
+            &&L_OpType_SubKR,
+            &&L_OpType_MulRK,
+            &&L_OpType_MulKR,
+            &&L_OpType_DivRK,
+            &&L_OpType_DivKR,
+            &&L_OpType_PowRK,
+            &&L_OpType_PowKR,
+            &&L_OpType_ModRK,
+            &&L_OpType_ModKR,
+            &&L_OpType_Concat,
+            &&L_OpType_Less,
+            &&L_OpType_Greater,
+            &&L_OpType_Equal,
+            &&L_OpType_UnEqual,
+            &&L_OpType_LessEqual,
+            &&L_OpType_GreaterEqual,
+            &&L_OpType_LessRK,
+            &&L_OpType_LessKR,
+            &&L_OpType_GreaterRK,
+            &&L_OpType_GreaterKR,
+            &&L_OpType_EqualRK,
+            &&L_OpType_UnEqualRK,
+            &&L_OpType_LessEqualRK,
+            &&L_OpType_LessEqualKR,
+            &&L_OpType_GreaterEqualRK,
+            &&L_OpType_GreaterEqualKR,
+            &&L_OpType_NewTable,
+            &&L_OpType_SetTable,
+            &&L_OpType_GetTable,
+            &&L_OpType_SetTableRK,
+            &&L_OpType_SetTableKR,
+            &&L_OpType_SetTableKK,
+            &&L_OpType_GetTableKR,
+            &&L_OpType_GetField,
+            &&L_OpType_SetField,
+            &&L_OpType_Self,
+            &&L_OpType_ForInit,
+            &&L_OpType_ForLoop,
+            &&L_OpType_ForLoopInc,
+            &&L_OpType_ForLoopDec,
+            &&L_OpType_Intrinsic,
+            &&L_OpType_ConcatRange,
+            &&L_OpType_LoadConstX,
+            &&L_OpType_GetGlobalX,
+            &&L_OpType_SetGlobalX,
+            &&L_OpType_AddNN,
+            &&L_OpType_AddNK,
+            &&L_OpType_SubNN,
+            &&L_OpType_SubNK,
+            &&L_OpType_MulNN,
+            &&L_OpType_MulNK,
+            &&L_OpType_DivNN,
+            &&L_OpType_DivNK,
+            &&L_OpType_JmpLessNN,
+            &&L_OpType_JmpLessNK,
+            &&L_OpType_JmpGreaterNN,
+            &&L_OpType_JmpGreaterNK,
+            &&L_OpType_JmpLessEqualNN,
+            &&L_OpType_JmpLessEqualNK,
+            &&L_OpType_JmpGreaterEqualNN,
+            &&L_OpType_JmpGreaterEqualNK,
+        };
+        static_assert(sizeof(dispatch_table) / sizeof(dispatch_table[0]) ==
+                      OpType_JmpGreaterEqualNK + 1, "dispatch table mismatch with OpType");
+#endif
 
-        // Pop current CallInfo, and return to last CallInfo
-        state_->calls_.pop_back();
+        VM_DISPATCH_BEGIN
+            VM_CASE(OpType_LoadNil):
+                a = GET_REGISTER_A(i);
+                a->SetNil();
+                VM_NEXT();
+            VM_CASE(OpType_FillNil):
+                a = GET_REGISTER_A(i);
+                b = GET_REGISTER_B(i);
+                CloseUpvalue(a);
+                while (a < b)
+                {
+                    a->SetNil();
+                    ++a;
+                }
+                VM_NEXT();
+            VM_CASE(OpType_LoadBool):
+                a = GET_REGISTER_A(i);
+                a->SetBool(Instruction::GetParamB(i) ? true : false);
+                VM_NEXT();
+            VM_CASE(OpType_LoadInt):
+                a = GET_REGISTER_A(i);
+                a->SetInteger((*pc++).opcode_);
+                VM_NEXT();
+            VM_CASE(OpType_LoadConst):
+                a = GET_REGISTER_A(i);
+                *a = *GET_CONST_VALUE(i);
+                VM_NEXT();
+            VM_CASE(OpType_Move):
+                a = GET_REGISTER_A(i);
+                b = GET_REGISTER_B(i);
+                *a = *b;
+                VM_NEXT();
+            VM_CASE(OpType_Call):
+                a = GET_REGISTER_A(i);
+                SAVE_PC();
+                // Execute the callee frame in this loop when callee is
+                // a closure, otherwise reload current frame, since the
+                // c function may grow calls_ and the stack
+                Call(a, i);
+                LOAD_FRAME();
+                CHECK_GC();
+                NATIVE_ENTER();
+                VM_NEXT();
+            VM_CASE(OpType_TailCall):
+                a = GET_REGISTER_A(i);
+                SAVE_PC();
+                TailCall(a, i);
+                VM_RETURN();
+            VM_CASE(OpType_GetUpvalue):
+                a = GET_REGISTER_A(i);
+                b = GET_UPVALUE_B(i)->GetValue();
+                *a = *b;
+                VM_NEXT();
+            VM_CASE(OpType_SetUpvalue):
+                a = GET_REGISTER_A(i);
+                b = GET_UPVALUE_B(i)->GetValue();
+                *b = *a;
+                VM_NEXT();
+            VM_CASE(OpType_GetGlobal):
+                a = GET_REGISTER_A(i);
+                if (GET_TABLE_CACHE()->version_ == global->GetVersion())
+                    *a = *GET_TABLE_CACHE()->value_;
+                else
+                    GetGlobal(a, GET_CONST_VALUE(i), GET_TABLE_CACHE());
+                VM_NEXT();
+            VM_CASE(OpType_SetGlobal):
+                a = GET_REGISTER_A(i);
+                // Assign nil erases the key, so it is not cached
+                if (GET_TABLE_CACHE()->version_ == global->GetVersion() &&
+                    a->type_ != ValueT_Nil)
+                    *GET_TABLE_CACHE()->value_ = *a;
+                else
+                    SetGlobal(a, GET_CONST_VALUE(i), GET_TABLE_CACHE());
+                VM_NEXT();
+            VM_CASE(OpType_Closure):
+                a = GET_REGISTER_A(i);
+                GenerateClosure(a, i);
+                CHECK_GC();
+                NATIVE_ENTER();
+                VM_NEXT();
+            VM_CASE(OpType_VarArg):
+                a = GET_REGISTER_A(i);
+                SAVE_PC();
+                CopyVarArg(a, i);
+                // The stack may grow
+                base = call->register_;
+                NATIVE_ENTER();
+                VM_NEXT();
+            VM_CASE(OpType_Ret):
+                a = GET_REGISTER_A(i);
+                SAVE_PC();
+                Return(a, i);
+                VM_RETURN();
+            VM_CASE(OpType_JmpFalse):
+                a = GET_REGISTER_A(i);
+                if (a->IsFalse())
+                    VM_JUMP(i);
+                VM_NEXT();
+            VM_CASE(OpType_JmpTrue):
+                a = GET_REGISTER_A(i);
+                if (!a->IsFalse())
+                    VM_JUMP(i);
+                VM_NEXT();
+            VM_CASE(OpType_JmpNil):
+                a = GET_REGISTER_A(i);
+                if (a->type_ == ValueT_Nil)
+                    VM_JUMP(i);
+                VM_NEXT();
+            VM_CASE(OpType_Jmp):
+                VM_JUMP_AX(i);
+                VM_NEXT();
+            VM_CASE(OpType_JmpLess):
+                JMP_INEQUALITY_OP(GET_REGISTER_B, GET_REGISTER_C, <);
+            VM_CASE(OpType_JmpLessRK):
+                JMP_INEQUALITY_OP(GET_REGISTER_B, GET_CONST_C, <);
+            VM_CASE(OpType_JmpLessKR):
+                JMP_INEQUALITY_OP(GET_CONST_B, GET_REGISTER_C, <);
+            VM_CASE(OpType_JmpGreater):
+                JMP_INEQUALITY_OP(GET_REGISTER_B, GET_REGISTER_C, >);
+            VM_CASE(OpType_JmpGreaterRK):
+                JMP_INEQUALITY_OP(GET_REGISTER_B, GET_CONST_C, >);
+            VM_CASE(OpType_JmpGreaterKR):
+                JMP_INEQUALITY_OP(GET_CONST_B, GET_REGISTER_C, >);
+            VM_CASE(OpType_JmpLessEqual):
+                JMP_INEQUALITY_OP(GET_REGISTER_B, GET_REGISTER_C, <=);
+            VM_CASE(OpType_JmpLessEqualRK):
+                JMP_INEQUALITY_OP(GET_REGISTER_B, GET_CONST_C, <=);
+            VM_CASE(OpType_JmpLessEqualKR):
+                JMP_INEQUALITY_OP(GET_CONST_B, GET_REGISTER_C, <=);
+            VM_CASE(OpType_JmpGreaterEqual):
+                JMP_INEQUALITY_OP(GET_REGISTER_B, GET_REGISTER_C, >=);
+            VM_CASE(OpType_JmpGreaterEqualRK):
+                JMP_INEQUALITY_OP(GET_REGISTER_B, GET_CONST_C, >=);
+            VM_CASE(OpType_JmpGreaterEqualKR):
+                JMP_INEQUALITY_OP(GET_CONST_B, GET_REGISTER_C, >=);
+            VM_CASE(OpType_JmpEqual):
+                JMP_EQUALITY_OP(GET_REGISTER_B, GET_REGISTER_C);
+            VM_CASE(OpType_JmpEqualRK):
+                JMP_EQUALITY_OP(GET_REGISTER_B, GET_CONST_C);
+            VM_CASE(OpType_Neg):
+                a = GET_REGISTER_A(i);
+                if (a->type_ == ValueT_Integer)
+                    SET_INTEGER_RESULT(a, IntegerSub(0, a->integer_));
+                else
+                {
+                    CHECK_TYPE(a, ValueT_Number, "neg");
+                    a->num_ = -a->num_;
+                }
+                VM_NEXT();
+            VM_CASE(OpType_Not):
+                a = GET_REGISTER_A(i);
+                a->SetBool(a->IsFalse() ? true : false);
+                VM_NEXT();
+            VM_CASE(OpType_Len):
+                a = GET_REGISTER_A(i);
+                if (a->type_ == ValueT_Table)
+                    a->SetInteger(a->table_->ArraySize());
+                else if (a->type_ == ValueT_String)
+                    a->SetInteger(a->str_->GetLength());
+                else
+                {
+                    SAVE_PC();
+                    ReportTypeError(a, "length of");
+                }
+                VM_NEXT();
+            VM_CASE(OpType_Add):
+                ARITH_OP(GET_REGISTER_B, GET_REGISTER_C, "add", IntegerAdd, NUM_ADD);
+            VM_CASE(OpType_Sub):
+                ARITH_OP(GET_REGISTER_B, GET_REGISTER_C, "sub", IntegerSub, NUM_SUB);
+            VM_CASE(OpType_Mul):
+                ARITH_OP(GET_REGISTER_B, GET_REGISTER_C, "multiply", IntegerMul, NUM_MUL);
+            VM_CASE(OpType_Div):
+                FLOAT_ARITH_OP(GET_REGISTER_B, GET_REGISTER_C, "div", NUM_DIV);
+            VM_CASE(OpType_Pow):
+                FLOAT_ARITH_OP(GET_REGISTER_B, GET_REGISTER_C, "power", pow);
+            VM_CASE(OpType_Mod):
+                MOD_OP(GET_REGISTER_B, GET_REGISTER_C);
+            VM_CASE(OpType_AddRK):
+                ARITH_OP(GET_REGISTER_B, GET_CONST_C, "add", IntegerAdd, NUM_ADD);
+            VM_CASE(OpType_AddKR):
+                ARITH_OP(GET_CONST_B, GET_REGISTER_C, "add", IntegerAdd, NUM_ADD);
+            VM_CASE(OpType_SubRK):
+                ARITH_OP(GET_REGISTER_B, GET_CONST_C, "sub", IntegerSub, NUM_SUB);
+            VM_CASE(OpType_SubKR):
+                ARITH_OP(GET_CONST_B, GET_REGISTER_C, "sub", IntegerSub, NUM_SUB);
+            VM_CASE(OpType_MulRK):
+                ARITH_OP(GET_REGISTER_B, GET_CONST_C, "multiply", IntegerMul, NUM_MUL);
+            VM_CASE(OpType_MulKR):
+                ARITH_OP(GET_CONST_B, GET_REGISTER_C, "multiply", IntegerMul, NUM_MUL);
+            VM_CASE(OpType_DivRK):
+                FLOAT_ARITH_OP(GET_REGISTER_B, GET_CONST_C, "div", NUM_DIV);
+            VM_CASE(OpType_DivKR):
+                FLOAT_ARITH_OP(GET_CONST_B, GET_REGISTER_C, "div", NUM_DIV);
+            VM_CASE(OpType_PowRK):
+                FLOAT_ARITH_OP(GET_REGISTER_B, GET_CONST_C, "power", pow);
+            VM_CASE(OpType_PowKR):
+                FLOAT_ARITH_OP(GET_CONST_B, GET_REGISTER_C, "power", pow);
+            VM_CASE(OpType_ModRK):
+                MOD_OP(GET_REGISTER_B, GET_CONST_C);
+            VM_CASE(OpType_ModKR):
+                MOD_OP(GET_CONST_B, GET_REGISTER_C);
+            VM_CASE(OpType_Concat):
+                GET_REGISTER_ABC(i);
+                SAVE_PC();
+                Concat(a, b, c);
+                CHECK_GC();
+                VM_NEXT();
+            VM_CASE(OpType_Less):
+                INEQUALITY_OP(GET_REGISTER_B, GET_REGISTER_C, <);
+            VM_CASE(OpType_Greater):
+                INEQUALITY_OP(GET_REGISTER_B, GET_REGISTER_C, >);
+            VM_CASE(OpType_Equal):
+                EQUALITY_OP(GET_REGISTER_B, GET_REGISTER_C, ==);
+            VM_CASE(OpType_UnEqual):
+                EQUALITY_OP(GET_REGISTER_B, GET_REGISTER_C, !=);
+            VM_CASE(OpType_LessEqual):
+                INEQUALITY_OP(GET_REGISTER_B, GET_REGISTER_C, <=);
+            VM_CASE(OpType_GreaterEqual):
+                INEQUALITY_OP(GET_REGISTER_B, GET_REGISTER_C, >=);
+            VM_CASE(OpType_LessRK):
+                INEQUALITY_OP(GET_REGISTER_B, GET_CONST_C, <);
+            VM_CASE(OpType_LessKR):
+                INEQUALITY_OP(GET_CONST_B, GET_REGISTER_C, <);
+            VM_CASE(OpType_GreaterRK):
+                INEQUALITY_OP(GET_REGISTER_B, GET_CONST_C, >);
+            VM_CASE(OpType_GreaterKR):
+                INEQUALITY_OP(GET_CONST_B, GET_REGISTER_C, >);
+            VM_CASE(OpType_EqualRK):
+                EQUALITY_OP(GET_REGISTER_B, GET_CONST_C, ==);
+            VM_CASE(OpType_UnEqualRK):
+                EQUALITY_OP(GET_REGISTER_B, GET_CONST_C, !=);
+            VM_CASE(OpType_LessEqualRK):
+                INEQUALITY_OP(GET_REGISTER_B, GET_CONST_C, <=);
+            VM_CASE(OpType_LessEqualKR):
+                INEQUALITY_OP(GET_CONST_B, GET_REGISTER_C, <=);
+            VM_CASE(OpType_GreaterEqualRK):
+                INEQUALITY_OP(GET_REGISTER_B, GET_CONST_C, >=);
+            VM_CASE(OpType_GreaterEqualKR):
+                INEQUALITY_OP(GET_CONST_B, GET_REGISTER_C, >=);
+            VM_CASE(OpType_NewTable):
+                a = GET_REGISTER_A(i);
+                a->table_ = state_->NewTable();
+                a->type_ = ValueT_Table;
+                CHECK_GC();
+                VM_NEXT();
+            VM_CASE(OpType_SetTable):
+                SET_TABLE_OP(GET_REGISTER_B, GET_REGISTER_C);
+            VM_CASE(OpType_GetTable):
+                GET_TABLE_OP(GET_REGISTER_B);
+            VM_CASE(OpType_SetTableRK):
+                SET_TABLE_OP(GET_REGISTER_B, GET_CONST_C);
+            VM_CASE(OpType_SetTableKR):
+                SET_TABLE_OP(GET_CONST_B, GET_REGISTER_C);
+            VM_CASE(OpType_SetTableKK):
+                SET_TABLE_OP(GET_CONST_B, GET_CONST_C);
+            VM_CASE(OpType_GetTableKR):
+                GET_TABLE_OP(GET_CONST_B);
+            VM_CASE(OpType_GetField):
+                GET_FIELD_OP(GET_REGISTER_A(i), GET_REGISTER_C(i));
+            VM_CASE(OpType_SetField):
+                a = GET_REGISTER_A(i);
+                c = GET_REGISTER_C(i);
+                // Assign nil erases the key, so it is not cached
+                if (a->type_ == ValueT_Table &&
+                    GET_TABLE_CACHE()->version_ == a->table_->GetVersion() &&
+                    c->type_ != ValueT_Nil)
+                    *GET_TABLE_CACHE()->value_ = *c;
+                else
+                {
+                    SAVE_PC();
+                    SetField(a, GET_CONST_B(i), c, GET_TABLE_CACHE());
+                }
+                VM_NEXT();
+            VM_CASE(OpType_Self):
+                a = GET_REGISTER_A(i);
+                *(a + 1) = *a;
+                GET_FIELD_OP(a, a);
+            VM_CASE(OpType_ForInit):
+                a = GET_REGISTER_A(i);
+                SAVE_PC();
+                if (!ForInit(a, a + 1, a + 2))
+                    VM_JUMP(i);
+                else
+                    *(a + 3) = *a;
+                VM_NEXT();
+            VM_CASE(OpType_ForLoop):
+                FOR_LOOP((a + 2)->integer_ > 0 ?
+                         IntegerForLoopInc(a->integer_, (a + 1)->integer_, (a + 2)->integer_) :
+                         IntegerForLoopDec(a->integer_, (a + 1)->integer_, (a + 2)->integer_),
+                         (a + 2)->num_ > 0.0 ? !(a->num_ > (a + 1)->num_) :
+                                               !(a->num_ < (a + 1)->num_));
+            VM_CASE(OpType_ForLoopInc):
+                FOR_LOOP(IntegerForLoopInc(a->integer_, (a + 1)->integer_, (a + 2)->integer_),
+                         !(a->num_ > (a + 1)->num_));
+            VM_CASE(OpType_ForLoopDec):
+                FOR_LOOP(IntegerForLoopDec(a->integer_, (a + 1)->integer_, (a + 2)->integer_),
+                         !(a->num_ < (a + 1)->num_));
+            VM_CASE(OpType_Intrinsic):
+                a = GET_REGISTER_A(i);
+                // Skip the call when the function is not reassigned
+                if (state_->IsIntrinsic(*a, Instruction::GetParamB(i)) &&
+                    CalculateIntrinsic(Instruction::GetParamB(i), a, a + 1,
+                                       Instruction::GetParamC(i)))
+                    ++pc;
+                VM_NEXT();
+            VM_CASE(OpType_ConcatRange):
+                a = GET_REGISTER_A(i);
+                SAVE_PC();
+                ConcatRange(a, GET_REGISTER_B(i), Instruction::GetParamC(i));
+                CHECK_GC();
+                VM_NEXT();
+            VM_CASE(OpType_LoadConstX):
+                a = GET_REGISTER_A(i);
+                *a = *GET_CONST_VALUE_X();
+                ++pc;
+                VM_NEXT();
+            VM_CASE(OpType_GetGlobalX):
+                a = GET_REGISTER_A(i);
+                if (GET_TABLE_CACHE()->version_ == global->GetVersion())
+                    *a = *GET_TABLE_CACHE()->value_;
+                else
+                    GetGlobal(a, GET_CONST_VALUE_X(), GET_TABLE_CACHE());
+                ++pc;
+                VM_NEXT();
+            VM_CASE(OpType_SetGlobalX):
+                a = GET_REGISTER_A(i);
+                if (GET_TABLE_CACHE()->version_ == global->GetVersion() &&
+                    a->type_ != ValueT_Nil)
+                    *GET_TABLE_CACHE()->value_ = *a;
+                else
+                    SetGlobal(a, GET_CONST_VALUE_X(), GET_TABLE_CACHE());
+                ++pc;
+                VM_NEXT();
+            VM_CASE(OpType_AddNN):
+                NUM_ARITH_OP(GET_REGISTER_B, GET_REGISTER_C, IntegerAdd, NUM_ADD);
+            VM_CASE(OpType_AddNK):
+                NUM_ARITH_OP(GET_REGISTER_B, GET_CONST_C, IntegerAdd, NUM_ADD);
+            VM_CASE(OpType_SubNN):
+                NUM_ARITH_OP(GET_REGISTER_B, GET_REGISTER_C, IntegerSub, NUM_SUB);
+            VM_CASE(OpType_SubNK):
+                NUM_ARITH_OP(GET_REGISTER_B, GET_CONST_C, IntegerSub, NUM_SUB);
+            VM_CASE(OpType_MulNN):
+                NUM_ARITH_OP(GET_REGISTER_B, GET_REGISTER_C, IntegerMul, NUM_MUL);
+            VM_CASE(OpType_MulNK):
+                NUM_ARITH_OP(GET_REGISTER_B, GET_CONST_C, IntegerMul, NUM_MUL);
+            VM_CASE(OpType_DivNN):
+                a = GET_REGISTER_A(i);
+                a->SetNumber(GET_REGISTER_B(i)->GetNumber() / GET_REGISTER_C(i)->GetNumber());
+                VM_NEXT();
+            VM_CASE(OpType_DivNK):
+                a = GET_REGISTER_A(i);
+                a->SetNumber(GET_REGISTER_B(i)->GetNumber() / GET_CONST_C(i)->GetNumber());
+                VM_NEXT();
+            VM_CASE(OpType_JmpLessNN):
+                JMP_NUM_INEQUALITY_OP(GET_REGISTER_B, GET_REGISTER_C, <);
+            VM_CASE(OpType_JmpLessNK):
+                JMP_NUM_INEQUALITY_OP(GET_REGISTER_B, GET_CONST_C, <);
+            VM_CASE(OpType_JmpGreaterNN):
+                JMP_NUM_INEQUALITY_OP(GET_REGISTER_B, GET_REGISTER_C, >);
+            VM_CASE(OpType_JmpGreaterNK):
+                JMP_NUM_INEQUALITY_OP(GET_REGISTER_B, GET_CONST_C, >);
+            VM_CASE(OpType_JmpLessEqualNN):
+                JMP_NUM_INEQUALITY_OP(GET_REGISTER_B, GET_REGISTER_C, <=);
+            VM_CASE(OpType_JmpLessEqualNK):
+                JMP_NUM_INEQUALITY_OP(GET_REGISTER_B, GET_CONST_C, <=);
+            VM_CASE(OpType_JmpGreaterEqualNN):
+                JMP_NUM_INEQUALITY_OP(GET_REGISTER_B, GET_REGISTER_C, >=);
+            VM_CASE(OpType_JmpGreaterEqualNK):
+                JMP_NUM_INEQUALITY_OP(GET_REGISTER_B, GET_CONST_C, >=);
+            VM_DEFAULT:
+                VM_NEXT();
+        VM_DISPATCH_END
     }
 
     bool VM::Call(Value *a, Instruction i)
     {
         if (a->type_ != ValueT_Closure &&
-            a->type_ != ValueT_CFunction)
+            a->type_ != ValueT_CFunction &&
+            a->type_ != ValueT_LeafFunction)
         {
             ReportTypeError(a, "call");
             return true;
@@ -334,9 +1013,71 @@ namespace luna
             // Calculate line number of the call
             auto pos = GetCurrentInstructionPos();
             throw RuntimeException(pos.first, pos.second, e.What().c_str());
+        } catch (const StackOverflowException &e)
+        {
+            auto pos = GetCurrentInstructionPos();
+            throw RuntimeException(pos.first, pos.second, e.What().c_str());
         }
     }
 
+    void VM::TailCall(Value *a, Instruction i)
+    {
+        if (a->type_ != ValueT_Closure &&
+            a->type_ != ValueT_CFunction &&
+            a->type_ != ValueT_LeafFunction)
+            ReportTypeError(a, "call");
+
+        assert(!state_->calls_.empty());
+        auto call = &state_->calls_.back();
+
+        // Current frame is dying, close upvalues which refer to it
+        CloseUpvalue(call->register_);
+
+        int arg_count = Instruction::GetParamB(i) - 1;
+        int expect_result = call->expect_result_;
+        if (a->type_ != ValueT_Closure)
+        {
+            // Call c function in place and keep current frame until it
+            // returns, then errors are reported at the position of
+            // current function, results are moved to the place of
+            // current function after the call, the stack may grow
+            auto offset = a - call->func_;
+            try
+            {
+                state_->CallFunction(a, arg_count, expect_result);
+            } catch (const CallCFuncException &e)
+            {
+                auto pos = GetCurrentInstructionPos();
+                throw RuntimeException(pos.first, pos.second, e.What().c_str());
+            } catch (const StackOverflowException &e)
+            {
+                auto pos = GetCurrentInstructionPos();
+                throw RuntimeException(pos.first, pos.second, e.What().c_str());
+            }
+
+            auto dst = state_->calls_.back().func_;
+            auto src = dst + offset;
+            while (src < state_->stack_.top_)
+                *dst++ = *src++;
+            state_->stack_.top_ = dst;
+            state_->calls_.pop_back();
+            return ;
+        }
+
+        // Move callee and args to the place of current function, then
+        // callee frame takes the place of current frame
+        auto top = arg_count == EXP_VALUE_COUNT_ANY ?
+            state_->stack_.top_ : a + 1 + arg_count;
+        auto func = call->func_;
+        auto dst = func;
+        while (a < top)
+            *dst++ = *a++;
+        state_->stack_.top_ = dst;
+
+        state_->calls_.pop_back();
+        state_->CallFunction(func, EXP_VALUE_COUNT_ANY, expect_result);
+    }
+
     void VM::GenerateClosure(Value *a, Instruction i)
     {
         GET_CALLINFO_AND_PROTO();
@@ -354,20 +1095,9 @@ namespace luna
             auto upvalue_info = a_proto->GetUpvalue(i);
             if (upvalue_info->parent_local_)
             {
-                // Transform local variable to upvalue
+                // Refer to the local variable of current frame
                 auto reg = call->register_ + upvalue_info->register_index_;
-                if (reg->type_ != ValueT_Upvalue)
-                {
-                    auto upvalue = state_->NewUpvalue();
-                    upvalue->SetValue(*reg);
-                    reg->type_ = ValueT_Upvalue;
-                    reg->upvalue_ = upvalue;
-                    new_closure->AddUpvalue(upvalue);
-                }
-                else
-                {
-                    new_closure->AddUpvalue(reg->upvalue_);
-                }
+                new_closure->AddUpvalue(FindOpenUpvalue(reg));
             }
             else
             {
@@ -378,20 +1108,57 @@ namespace luna
         }
     }
 
+    Upvalue * VM::FindOpenUpvalue(Value *a)
+    {
+        Upvalue *prev = nullptr;
+        auto upvalue = state_->open_upvalues_;
+        while (upvalue && upvalue->GetValue() > a)
+        {
+            prev = upvalue;
+            upvalue = upvalue->GetNext();
+        }
+
+        if (upvalue && upvalue->GetValue() == a)
+            return upvalue;
+
+        // Insert new open upvalue before the upvalue refers to lower address
+        auto new_upvalue = state_->NewUpvalue();
+        new_upvalue->Open(a);
+        new_upvalue->SetNext(upvalue);
+        if (prev)
+            prev->SetNext(new_upvalue);
+        else
+            state_->open_upvalues_ = new_upvalue;
+        return new_upvalue;
+    }
+
+    void VM::CloseUpvalue(Value *a)
+    {
+        auto &open = state_->open_upvalues_;
+        while (open && open->GetValue() >= a)
+        {
+            auto upvalue = open;
+            open = upvalue->GetNext();
+            upvalue->Close();
+        }
+    }
+
     void VM::CopyVarArg(Value *a, Instruction i)
     {
         GET_CALLINFO_AND_PROTO();
-        auto arg = call->func_ + 1;
-        int total_args = call->register_ - arg;
+        int total_args = call->register_ - (call->func_ + 1);
         int vararg_count = total_args - proto->FixedArgCount();
 
-        arg += proto->FixedArgCount();
         int expect_count = Instruction::GetParamsBx(i);
+        if (expect_count == EXP_VALUE_COUNT_ANY)
+            a = state_->CheckStack(a, vararg_count);
+
+        auto arg = call->func_ + 1 + proto->FixedArgCount();
         if (expect_count == EXP_VALUE_COUNT_ANY)
         {
             for (int i = 0; i < vararg_count; ++i)
                 *a++ = *arg++;
-            state_->stack_.SetNewTop(a);
+            state_->stack_.top_ = a;
         }
         else
         {
@@ -413,6 +1180,9 @@ namespace luna
         assert(!state_->calls_.empty());
         auto call = &state_->calls_.back();
 
+        // Frame is dying, close upvalues which refer to it
+        CloseUpvalue(call->register_);
+
         auto src = a;
         auto dst = call->func_;
 
@@ -435,58 +1205,180 @@ namespace luna
         }
 
         // Set new top and pop current CallInfo
-        state_->stack_.SetNewTop(dst);
+        state_->stack_.top_ = dst;
         state_->calls_.pop_back();
     }
 
-    void VM::Concat(Value *dst, Value *op1, Value *op2)
+    void VM::GetGlobal(Value *a, const Value *key, TableCache *cache)
+    {
+        auto global = state_->global_.table_;
+        auto value = global->GetHashValue(*key);
+        if (value)
+        {
+            cache->version_ = global->GetVersion();
+            cache->value_ = value;
+            *a = *value;
+        }
+        else
+        {
+            *a = global->GetValue(*key);
+        }
+    }
+
+    void VM::SetGlobal(const Value *a, const Value *key, TableCache *cache)
+    {
+        auto global = state_->global_.table_;
+        global->SetValue(*key, *a);
+
+        auto value = global->GetHashValue(*key);
+        if (value)
+        {
+            cache->version_ = global->GetVersion();
+            cache->value_ = value;
+        }
+    }
+
+    void VM::GetField(Value *t, const Value *key, Value *value, TableCache *cache)
     {
-        if (op1->type_ == ValueT_String && op2->type_ == ValueT_String)
+        CheckTableType(t, key, "get", "from");
+        if (t->type_ == ValueT_Table)
         {
-            dst->str_ = state_->GetString(op1->str_->GetStdString() +
-                                          op2->str_->GetCStr());
+            auto v = t->table_->GetHashValue(*key);
+            if (v)
+            {
+                cache->version_ = t->table_->GetVersion();
+                cache->value_ = v;
+                *value = *v;
+            }
+            else
+            {
+                value->SetNil();
+            }
         }
-        else if (op1->type_ == ValueT_String && op2->type_ == ValueT_Number)
+        else
         {
-            dst->str_ = state_->GetString(op1->str_->GetCStr() +
-                                          NumberToStr(op2));
+            *value = t->user_data_->GetMetatable()->GetValue(*key);
         }
-        else if (op1->type_ == ValueT_Number && op2->type_ == ValueT_String)
+    }
+
+    void VM::SetField(Value *t, const Value *key, const Value *value, TableCache *cache)
+    {
+        CheckTableType(t, key, "set", "to");
+        if (t->type_ == ValueT_Table)
         {
-            dst->str_ = state_->GetString(NumberToStr(op1) +
-                                          op2->str_->GetCStr());
+            t->table_->SetValue(*key, *value);
+            auto v = t->table_->GetHashValue(*key);
+            if (v)
+            {
+                cache->version_ = t->table_->GetVersion();
+                cache->value_ = v;
+            }
         }
         else
+        {
+            t->user_data_->GetMetatable()->SetValue(*key, *value);
+        }
+    }
+
+    void VM::Concat(Value *dst, Value *op1, Value *op2)
+    {
+        if (!IsConcatOperand(op1) || !IsConcatOperand(op2) ||
+            (op1->type_ != ValueT_String && op2->type_ != ValueT_String))
         {
             auto pos = GetCurrentInstructionPos();
             throw RuntimeException(pos.first, pos.second, op1, op2, "concat");
         }
 
+        concat_buffer_.clear();
+        AppendConcatOperand(concat_buffer_, op1);
+        AppendConcatOperand(concat_buffer_, op2);
+        dst->str_ = state_->GetString(concat_buffer_.data(), concat_buffer_.size());
         dst->type_ = ValueT_String;
     }
 
-    void VM::ForInit(Value *var, Value *limit, Value *step)
+    void VM::ConcatRange(Value *dst, Value *ops, int count)
     {
-        if (var->type_ != ValueT_Number)
+        assert(count >= 2);
+        // Operands are concatenated from left to right, the first
+        // concat needs a string operand, then results are strings
+        if (!IsConcatOperand(ops) || !IsConcatOperand(ops + 1) ||
+            (ops[0].type_ != ValueT_String && ops[1].type_ != ValueT_String))
+        {
+            auto pos = GetCurrentInstructionPos();
+            throw RuntimeException(pos.first, pos.second, ops, ops + 1, "concat");
+        }
+
+        std::size_t length = 0;
+        for (int i = 0; i < count; ++i)
+        {
+            if (ops[i].type_ == ValueT_String)
+                length += ops[i].str_->GetLength();
+            else if (ops[i].IsNumber())
+                length += 24;
+            else
+                ReportConcatError(ops, i);
+        }
+
+        concat_buffer_.clear();
+        concat_buffer_.reserve(length);
+        for (int i = 0; i < count; ++i)
+            AppendConcatOperand(concat_buffer_, ops + i);
+
+        // Only the result is interned into string pool
+        dst->str_ = state_->GetString(concat_buffer_.data(), concat_buffer_.size());
+        dst->type_ = ValueT_String;
+    }
+
+    bool VM::ForInit(Value *var, Value *limit, Value *step)
+    {
+        if (!var->IsNumber())
         {
             auto pos = GetCurrentInstructionPos();
             throw RuntimeException(pos.first, pos.second,
                                    var, "'for' init", "number");
         }
 
-        if (limit->type_ != ValueT_Number)
+        if (!limit->IsNumber())
         {
             auto pos = GetCurrentInstructionPos();
             throw RuntimeException(pos.first, pos.second,
                                    limit, "'for' limit", "number");
         }
 
-        if (step->type_ != ValueT_Number)
+        if (!step->IsNumber())
         {
             auto pos = GetCurrentInstructionPos();
             throw RuntimeException(pos.first, pos.second,
                                    step, "'for' step", "number");
         }
+
+        // Integer loop when init and step are integers, float limit
+        // is converted to the integer limit which loop can reach
+        if (var->type_ == ValueT_Integer && step->type_ == ValueT_Integer &&
+            (limit->type_ == ValueT_Integer || !isnan(limit->num_)))
+        {
+            if (limit->type_ == ValueT_Number)
+            {
+                double l = step->integer_ > 0 ? floor(limit->num_) : ceil(limit->num_);
+                if (l >= 9223372036854775808.0)
+                    limit->SetInteger(std::numeric_limits<long long>::max());
+                else if (l < -9223372036854775808.0)
+                    limit->SetInteger(std::numeric_limits<long long>::min());
+                else
+                    limit->SetInteger(static_cast<long long>(l));
+            }
+
+            // NaN-boxed integer may not hold the limit, then use float loop
+            if (limit->type_ == ValueT_Integer)
+                return step->integer_ > 0 ? var->integer_ <= limit->integer_ :
+                                            var->integer_ >= limit->integer_;
+        }
+
+        var->SetNumber(var->GetNumber());
+        limit->SetNumber(limit->GetNumber());
+        step->SetNumber(step->GetNumber());
+        return step->num_ > 0.0 ? var->num_ <= limit->num_ :
+                                  var->num_ >= limit->num_;
     }
 
     std::pair<const char *, const char *> VM::GetOperandNameAndScope(const Value *a) const
@@ -504,16 +1396,22 @@ namespace luna
         const char *scope_table = "table member";
         const char *scope_null = "";
 
+        // Operand is the local variable when reg is a local variable
+        auto local_name = proto->SearchLocalVar(reg, pc);
+        if (local_name)
+            return { local_name->GetCStr(), scope_local };
+
         // Search last instruction which dst register is reg,
         // and get the name base on the instruction
         while (instruction > base)
         {
             --instruction;
             switch (Instruction::GetOpCode(*instruction)) {
-                case OpType_GetGlobal:
+                case OpType_GetGlobal: case OpType_GetGlobalX:
                     if (reg == Instruction::GetParamA(*instruction))
                     {
-                        auto index = Instruction::GetParamBx(*instruction);
+                        auto index = Instruction::GetOpCode(*instruction) == OpType_GetGlobal ?
+                            Instruction::GetParamBx(*instruction) : (instruction + 1)->opcode_;
                         auto key = proto->GetConstValue(index);
                         if (key->type_ == ValueT_String)
                             return { key->str_->GetCStr(), scope_global };
@@ -551,6 +1449,26 @@ namespace luna
                             return { unknown_name, scope_table };
                     }
                     break;
+                case OpType_Self:
+                    if (reg == Instruction::GetParamA(*instruction))
+                    {
+                        auto index = Instruction::GetParamB(*instruction);
+                        auto key = proto->GetConstValue(index);
+                        return { key->str_->GetCStr(), scope_table };
+                    }
+                    break;
+                case OpType_GetTableKR:
+                case OpType_GetField:
+                    if (reg == Instruction::GetParamC(*instruction))
+                    {
+                        auto index = Instruction::GetParamB(*instruction);
+                        auto key = proto->GetConstValue(index);
+                        if (key->type_ == ValueT_String)
+                            return { key->str_->GetCStr(), scope_table };
+                        else
+                            return { unknown_name, scope_table };
+                    }
+                    break;
             }
         }
 
@@ -573,7 +1491,7 @@ namespace luna
 
     void VM::CheckArithType(const Value *v1, const Value *v2, const char *op) const
     {
-        if (v1->type_ != ValueT_Number || v2->type_ != ValueT_Number)
+        if (!v1->IsNumber() || !v2->IsNumber())
         {
             auto pos = GetCurrentInstructionPos();
             throw RuntimeException(pos.first, pos.second, v1, v2, op);
@@ -583,14 +1501,44 @@ namespace luna
     void VM::CheckInequalityType(const Value *v1, const Value *v2,
                                  const char *op) const
     {
-        if (v1->type_ != v2->type_ ||
-            (v1->type_ != ValueT_Number && v1->type_ != ValueT_String))
+        if ((!v1->IsNumber() || !v2->IsNumber()) &&
+            (v1->type_ != ValueT_String || v2->type_ != ValueT_String))
         {
             auto pos = GetCurrentInstructionPos();
             throw RuntimeException(pos.first, pos.second, v1, v2, op);
         }
     }
 
+    void VM::ReportConcatError(const Value *ops, int index)
+    {
+        // Report the error same as concat operands one by one, the left
+        // operand is the result of concat operands before 'index'
+        concat_buffer_.clear();
+        for (int i = 0; i < index; ++i)
+            AppendConcatOperand(concat_buffer_, ops + i);
+
+        Value result;
+        result.str_ = state_->GetString(concat_buffer_.data(), concat_buffer_.size());
+        result.type_ = ValueT_String;
+
+        auto pos = GetCurrentInstructionPos();
+        throw RuntimeException(pos.first, pos.second, &result, ops + index, "concat");
+    }
+
+    void VM::ReportModByZero() const
+    {
+        auto pos = GetCurrentInstructionPos();
+        throw RuntimeException(pos.first, pos.second,
+                               "attempt to perform 'n%0'");
+    }
+
+    void VM::ReportIntegerOverflow() const
+    {
+        auto pos = GetCurrentInstructionPos();
+        throw RuntimeException(pos.first, pos.second,
+                               "integer overflows range of value");
+    }
+
     void VM::CheckTableType(const Value *t, const Value *k,
                             const char *op, const char *desc) const
     {
@@ -4,30 +4,64 @@
 #include "Value.h"
 #include "OpCode.h"
 #include <utility>
+#include <string>
 
 namespace luna
 {
     class State;
+    class Function;
+    struct TableCache;
 
     class VM
     {
+        friend class BaselineJit;
+        friend class NativeHelper;
     public:
         explicit VM(State *state);
 
         void Execute();
 
     private:
+        // Execute frames of Lua functions, calls and returns between
+        // Lua functions are executed in this function
         void ExecuteFrame();
 
+        // Run native code of the frame from 'pc', the function is
+        // compiled by baseline JIT when its frame starts and it is
+        // called enough times, return the pc where interpreter resumes
+        const Instruction * ExecuteNative(Function *proto, Closure *cl, Value *base,
+                                          const Instruction *code,
+                                          const Instruction *pc);
+
         // Execute next frame if return true
         bool Call(Value *a, Instruction i);
 
+        // Replace current frame by the callee frame
+        void TailCall(Value *a, Instruction i);
+
         void GenerateClosure(Value *a, Instruction i);
         void CopyVarArg(Value *a, Instruction i);
         void Return(Value *a, Instruction i);
 
+        // Find or create the open upvalue which refers to register a
+        Upvalue * FindOpenUpvalue(Value *a);
+        // Close all open upvalues which refer to registers from a
+        void CloseUpvalue(Value *a);
+
+        // Access global table and fill inline cache
+        void GetGlobal(Value *a, const Value *key, TableCache *cache);
+        void SetGlobal(const Value *a, const Value *key, TableCache *cache);
+
+        // Access table field by string key and fill inline cache
+        void GetField(Value *t, const Value *key, Value *value, TableCache *cache);
+        void SetField(Value *t, const Value *key, const Value *value, TableCache *cache);
+
         void Concat(Value *dst, Value *op1, Value *op2);
-        void ForInit(Value *var, Value *limit, Value *step);
+        // Concat 'count' operands from 'ops' into one string
+        void ConcatRange(Value *dst, Value *ops, int count);
+        // Check and convert 'for' loop values to all integers or all
+        // floats, return whether loop body runs at the first time
+        bool ForInit(Value *var, Value *limit, Value *step);
 
         // Debug help functions
         std::pair<const char *, const char *>
@@ -48,7 +82,15 @@ namespace luna
 
         void ReportTypeError(const Value *v, const char *op) const;
 
+        void ReportConcatError(const Value *ops, int index);
+
+        void ReportModByZero() const;
+
+        void ReportIntegerOverflow() const;
+
         State *state_;
+        // Buffer of concat result which is interned into string pool
+        std::string concat_buffer_;
     };
 } // namespace luna
 
@@ -14,7 +14,9 @@ namespace luna
             case ValueT_Nil:
             case ValueT_Bool:
             case ValueT_Number:
+            case ValueT_Integer:
             case ValueT_CFunction:
+            case ValueT_LeafFunction:
                 break;
             case ValueT_Obj:
                 obj_->Accept(v);
@@ -49,7 +51,9 @@ namespace luna
             case ValueT_Nil: return "nil";
             case ValueT_Bool: return "bool";
             case ValueT_Number: return "number";
+            case ValueT_Integer: return "number";
             case ValueT_CFunction: return "C-Function";
+            case ValueT_LeafFunction: return "C-Function";
             case ValueT_String: return "string";
             case ValueT_Closure: return "function";
             case ValueT_Upvalue: return "upvalue";
@@ -3,6 +3,11 @@
 
 #include "GC.h"
 #include <functional>
+#ifdef LUNA_NAN_BOXING
+#include <assert.h>
+#include <stdint.h>
+#include <string.h>
+#endif
 
 namespace luna
 {
@@ -14,14 +19,22 @@ namespace luna
     class Table;
     class UserData;
     class State;
+    struct Value;
 
     typedef int (*CFunctionType)(State *);
 
+    // Leaf function is a c function which does not call functions and
+    // does not use StackAPI, it gets 'count' arguments from 'args',
+    // writes results over the arguments from 'args' and returns count
+    // of results, it is called without CallInfo, see LibAPI.h
+    typedef int (*LeafFunctionType)(State *state, Value *args, int count);
+
     enum ValueT
     {
         ValueT_Nil,
         ValueT_Bool,
         ValueT_Number,
+        ValueT_Integer,
         ValueT_Obj,
         ValueT_String,
         ValueT_Closure,
@@ -29,8 +42,10 @@ namespace luna
         ValueT_Table,
         ValueT_UserData,
         ValueT_CFunction,
+        ValueT_LeafFunction,
     };
 
+#ifndef LUNA_NAN_BOXING
     // Value type of luna
     struct Value
     {
@@ -43,7 +58,9 @@ namespace luna
             Table *table_;
             UserData *user_data_;
             CFunctionType cfunc_;
+            LeafFunctionType leaf_;
             double num_;
+            long long integer_;
             bool bvalue_;
         };
 
@@ -52,12 +69,14 @@ namespace luna
         Value() : obj_(nullptr), type_(ValueT_Nil) { }
         explicit Value(bool bvalue) : bvalue_(bvalue), type_(ValueT_Bool) { }
         explicit Value(double num) : num_(num), type_(ValueT_Number) { }
+        explicit Value(long long integer) : integer_(integer), type_(ValueT_Integer) { }
         explicit Value(String *str) : str_(str), type_(ValueT_String) { }
         explicit Value(Closure *closure) : closure_(closure), type_(ValueT_Closure) { }
         explicit Value(Upvalue *upvalue) : upvalue_(upvalue), type_(ValueT_Upvalue) { }
         explicit Value(Table *table) : table_(table), type_(ValueT_Table) { }
         explicit Value(UserData *user_data) : user_data_(user_data), type_(ValueT_UserData) { }
         explicit Value(CFunctionType cfunc) : cfunc_(cfunc), type_(ValueT_CFunction) { }
+        explicit Value(LeafFunctionType leaf) : leaf_(leaf), type_(ValueT_LeafFunction) { }
 
         void SetNil()
         { obj_ = nullptr; type_ = ValueT_Nil; }
@@ -65,6 +84,20 @@ namespace luna
         void SetBool(bool bvalue)
         { bvalue_ = bvalue; type_ = ValueT_Bool; }
 
+        void SetNumber(double num)
+        { num_ = num; type_ = ValueT_Number; }
+
+        void SetInteger(long long integer)
+        { integer_ = integer; type_ = ValueT_Integer; }
+
+        // Number is float or integer
+        bool IsNumber() const
+        { return type_ == ValueT_Number || type_ == ValueT_Integer; }
+
+        // Get float value of number
+        double GetNumber() const
+        { return type_ == ValueT_Integer ? static_cast<double>(integer_) : num_; }
+
         bool IsNil() const
         { return type_ == ValueT_Nil; }
 
@@ -76,17 +109,268 @@ namespace luna
 
         static const char * TypeName(ValueT type);
     };
+#else
+    // NaN-boxed Value packs type and payload into 64 bits:
+    //   float:   any double, NaN is canonicalized to 0x7FF8000000000000
+    //   integer: bits 63..49 are all 1, bits 48..0 are the integer, an
+    //            integer out of [-2^48, 2^48) is stored as float, so
+    //            code generator and arithmetic report it as an error
+    //            before storing it, see IntegerFitsValue
+    //   others:  bits 63..51 are all 1, bits 50..47 are ValueT, bits
+    //            46..0 are payload of pointer or bool
+    namespace nan_boxing
+    {
+        const uint64_t kBoxed = 0xFFF8000000000000ULL;
+        const uint64_t kInteger = 0xFFFE000000000000ULL;
+        const uint64_t kIntegerMask = 0x0001FFFFFFFFFFFFULL;
+        const uint64_t kPayloadMask = 0x00007FFFFFFFFFFFULL;
+        const uint64_t kCanonicalNaN = 0x7FF8000000000000ULL;
+        const long long kIntegerMin = -(1LL << 48);
+        const long long kIntegerMax = (1LL << 48) - 1;
+
+        inline uint64_t Tag(ValueT type)
+        { return kBoxed | (static_cast<uint64_t>(type) << 47); }
+
+        inline uint64_t FromNumber(double num)
+        {
+            uint64_t bits = kCanonicalNaN;
+            if (num == num)
+                memcpy(&bits, &num, sizeof(bits));
+            return bits;
+        }
+
+        inline double ToNumber(uint64_t bits)
+        {
+            double num;
+            memcpy(&num, &bits, sizeof(num));
+            return num;
+        }
+
+        inline uint64_t FromInteger(long long integer)
+        {
+            if (integer < kIntegerMin || integer > kIntegerMax)
+                return FromNumber(static_cast<double>(integer));
+            return kInteger | (static_cast<uint64_t>(integer) & kIntegerMask);
+        }
+
+        inline long long ToInteger(uint64_t bits)
+        { return static_cast<long long>(bits << 15) >> 15; }
+
+        inline ValueT GetType(uint64_t bits)
+        {
+            if (bits < kBoxed)
+                return ValueT_Number;
+            if (bits >= kInteger)
+                return ValueT_Integer;
+            return static_cast<ValueT>((bits >> 47) & 0xF);
+        }
+
+        inline bool IsType(uint64_t bits, ValueT type)
+        {
+            if (type == ValueT_Number)
+                return bits < kBoxed;
+            if (type == ValueT_Integer)
+                return bits >= kInteger;
+            return (bits & ~kPayloadMask) == Tag(type);
+        }
+
+        // Change type and keep payload, the payload is filled by field
+        // assignment before or after changing type
+        inline uint64_t SetType(uint64_t bits, ValueT type)
+        {
+            if (type == ValueT_Number)
+                return bits < kBoxed ? bits : 0;
+            if (type == ValueT_Integer)
+                return bits < kBoxed || bits >= kInteger ? bits : kInteger;
+            if (type == ValueT_Nil)
+                return Tag(type);
+            return Tag(type) | (bits & kPayloadMask);
+        }
+
+        inline uint64_t SetPayload(uint64_t bits, uint64_t payload)
+        {
+            assert((payload & ~kPayloadMask) == 0);
+            return (bits & ~kPayloadMask) | payload;
+        }
+
+        // Fields of Value, all fields share the same 64 bits, and keep
+        // the usage of fields same as the non NaN-boxed Value
+        struct TypeField
+        {
+            uint64_t bits_;
+
+            operator ValueT () const { return GetType(bits_); }
+            bool operator == (ValueT type) const { return IsType(bits_, type); }
+            bool operator != (ValueT type) const { return !IsType(bits_, type); }
+            TypeField & operator = (ValueT type)
+            { bits_ = SetType(bits_, type); return *this; }
+        };
+
+        struct NumberField
+        {
+            uint64_t bits_;
+
+            operator double () const { return ToNumber(bits_); }
+            NumberField & operator = (double num)
+            { bits_ = FromNumber(num); return *this; }
+            NumberField & operator += (double num)
+            { bits_ = FromNumber(ToNumber(bits_) + num); return *this; }
+        };
+
+        struct IntegerField
+        {
+            uint64_t bits_;
+
+            operator long long () const { return ToInteger(bits_); }
+            IntegerField & operator = (long long integer)
+            { bits_ = FromInteger(integer); return *this; }
+            IntegerField & operator += (long long integer)
+            {
+                bits_ = FromInteger(static_cast<long long>(
+                        static_cast<uint64_t>(ToInteger(bits_)) + integer));
+                return *this;
+            }
+        };
+
+        struct BoolField
+        {
+            uint64_t bits_;
+
+            operator bool () const { return (bits_ & kPayloadMask) != 0; }
+            BoolField & operator = (bool bvalue)
+            { bits_ = SetPayload(bits_, bvalue ? 1 : 0); return *this; }
+        };
+
+        // Pointer field, 'PointerType' is pointer of object or function
+        template<typename PointerType>
+        struct PointerField
+        {
+            uint64_t bits_;
+
+            operator PointerType () const { return Get(); }
+            PointerType operator -> () const { return Get(); }
+            auto operator * () const -> decltype(*PointerType()) { return *Get(); }
+            PointerField & operator = (PointerType p)
+            {
+                bits_ = SetPayload(bits_, reinterpret_cast<uintptr_t>(p));
+                return *this;
+            }
+
+            PointerType Get() const
+            { return reinterpret_cast<PointerType>(bits_ & kPayloadMask); }
+        };
+    } // namespace nan_boxing
+
+    // Value type of luna
+    struct Value
+    {
+        union
+        {
+            uint64_t bits_;
+            nan_boxing::TypeField type_;
+            nan_boxing::PointerField<GCObject *> obj_;
+            nan_boxing::PointerField<String *> str_;
+            nan_boxing::PointerField<Closure *> closure_;
+            nan_boxing::PointerField<Upvalue *> upvalue_;
+            nan_boxing::PointerField<Table *> table_;
+            nan_boxing::PointerField<UserData *> user_data_;
+            nan_boxing::PointerField<CFunctionType> cfunc_;
+            nan_boxing::PointerField<LeafFunctionType> leaf_;
+            nan_boxing::NumberField num_;
+            nan_boxing::IntegerField integer_;
+            nan_boxing::BoolField bvalue_;
+        };
+
+        Value() : bits_(nan_boxing::Tag(ValueT_Nil)) { }
+        explicit Value(bool bvalue) : bits_(nan_boxing::Tag(ValueT_Bool) | bvalue) { }
+        explicit Value(double num) : bits_(nan_boxing::FromNumber(num)) { }
+        explicit Value(long long integer) : bits_(nan_boxing::FromInteger(integer)) { }
+        explicit Value(String *str) : bits_(nan_boxing::Tag(ValueT_String)) { str_ = str; }
+        explicit Value(Closure *closure) : bits_(nan_boxing::Tag(ValueT_Closure)) { closure_ = closure; }
+        explicit Value(Upvalue *upvalue) : bits_(nan_boxing::Tag(ValueT_Upvalue)) { upvalue_ = upvalue; }
+        explicit Value(Table *table) : bits_(nan_boxing::Tag(ValueT_Table)) { table_ = table; }
+        explicit Value(UserData *user_data) : bits_(nan_boxing::Tag(ValueT_UserData)) { user_data_ = user_data; }
+        explicit Value(CFunctionType cfunc) : bits_(nan_boxing::Tag(ValueT_CFunction)) { cfunc_ = cfunc; }
+        explicit Value(LeafFunctionType leaf) : bits_(nan_boxing::Tag(ValueT_LeafFunction)) { leaf_ = leaf; }
+
+        void SetNil()
+        { bits_ = nan_boxing::Tag(ValueT_Nil); }
+
+        void SetBool(bool bvalue)
+        { bits_ = nan_boxing::Tag(ValueT_Bool) | bvalue; }
+
+        void SetNumber(double num)
+        { bits_ = nan_boxing::FromNumber(num); }
+
+        void SetInteger(long long integer)
+        { bits_ = nan_boxing::FromInteger(integer); }
+
+        // Number is float or integer
+        bool IsNumber() const
+        { return bits_ < nan_boxing::kBoxed || bits_ >= nan_boxing::kInteger; }
+
+        // Get float value of number
+        double GetNumber() const
+        {
+            return bits_ >= nan_boxing::kInteger ?
+                static_cast<double>(nan_boxing::ToInteger(bits_)) :
+                nan_boxing::ToNumber(bits_);
+        }
+
+        bool IsNil() const
+        { return bits_ == nan_boxing::Tag(ValueT_Nil); }
+
+        bool IsFalse() const
+        { return IsNil() || bits_ == nan_boxing::Tag(ValueT_Bool); }
+
+        void Accept(GCObjectVisitor *v) const;
+        const char * TypeName() const;
+
+        static const char * TypeName(ValueT type);
+    };
+
+    static_assert(sizeof(Value) == sizeof(uint64_t), "NaN-boxed Value is not 64 bits");
+#endif // LUNA_NAN_BOXING
+
+    // Range of integer which Value holds exactly
+#ifdef LUNA_NAN_BOXING
+    const long long kValueIntegerMin = nan_boxing::kIntegerMin;
+    const long long kValueIntegerMax = nan_boxing::kIntegerMax;
+#else
+    const long long kValueIntegerMin = -9223372036854775807LL - 1;
+    const long long kValueIntegerMax = 9223372036854775807LL;
+#endif // LUNA_NAN_BOXING
+
+    inline bool IntegerFitsValue(long long integer)
+    { return integer >= kValueIntegerMin && integer <= kValueIntegerMax; }
+
+    // Float 'num' equals to integer 'integer' when 'num' has exactly
+    // the same integer value
+    inline bool EqualNumberInteger(double num, long long integer)
+    {
+        // [-2^63, 2^63) is the range of integer in float
+        return num >= -9223372036854775808.0 && num < 9223372036854775808.0 &&
+               static_cast<long long>(num) == integer &&
+               static_cast<double>(static_cast<long long>(num)) == num;
+    }
 
     inline bool operator == (const Value &left, const Value &right)
     {
         if (left.type_ != right.type_)
+        {
+            if (left.type_ == ValueT_Number && right.type_ == ValueT_Integer)
+                return EqualNumberInteger(left.num_, right.integer_);
+            if (left.type_ == ValueT_Integer && right.type_ == ValueT_Number)
+                return EqualNumberInteger(right.num_, left.integer_);
             return false;
+        }
 
         switch (left.type_)
         {
             case ValueT_Nil: return true;
             case ValueT_Bool: return left.bvalue_ == right.bvalue_;
             case ValueT_Number: return left.num_ == right.num_;
+            case ValueT_Integer: return left.integer_ == right.integer_;
             case ValueT_Obj: return left.obj_ == right.obj_;
             case ValueT_String: return left.str_ == right.str_;
             case ValueT_Closure: return left.closure_ == right.closure_;
@@ -94,6 +378,7 @@ namespace luna
             case ValueT_Table: return left.table_ == right.table_;
             case ValueT_UserData: return left.user_data_ == right.user_data_;
             case ValueT_CFunction: return left.cfunc_ == right.cfunc_;
+            case ValueT_LeafFunction: return left.leaf_ == right.leaf_;
         }
 
         return false;
@@ -112,6 +397,7 @@ namespace std
     {
         size_t operator () (const luna::Value &t) const
         {
+#ifndef LUNA_NAN_BOXING
             switch (t.type_)
             {
                 case luna::ValueT_Nil:
@@ -120,6 +406,8 @@ namespace std
                     return hash<bool>()(t.bvalue_);
                 case luna::ValueT_Number:
                     return hash<double>()(t.num_);
+                case luna::ValueT_Integer:
+                    return hash<long long>()(t.integer_);
                 case luna::ValueT_String:
                     return hash<void *>()(t.str_);
                 case luna::ValueT_Closure:
@@ -132,9 +420,19 @@ namespace std
                     return hash<void *>()(t.user_data_);
                 case luna::ValueT_CFunction:
                     return hash<void *>()(reinterpret_cast<void *>(t.cfunc_));
+                case luna::ValueT_LeafFunction:
+                    return hash<void *>()(reinterpret_cast<void *>(t.leaf_));
                 default:
                     return hash<void *>()(t.obj_);
             }
+#else
+            // Type and payload identify the value except numbers
+            if (t.type_ == luna::ValueT_Number)
+                return hash<double>()(t.num_);
+            if (t.type_ == luna::ValueT_Integer)
+                return hash<long long>()(t.integer_);
+            return hash<uint64_t>()(t.bits_);
+#endif
         }
     };
 } // namespace std
@@ -0,0 +1,179 @@
+#include "UnitTest.h"
+#include "TestCommon.h"
+#include "luna/AotCompile.h"
+#include "luna/Assembler.h"
+#include "luna/LibBase.h"
+#include "luna/LibMath.h"
+#include "luna/LibString.h"
+#include "luna/LibTable.h"
+#include <fstream>
+#include <functional>
+#include <stdio.h>
+#include <stdlib.h>
+
+namespace
+{
+    // Scripts put their results into global array 'r', loops run
+    // enough iterations to get hot for the JITs
+    const char *kScripts[] = {
+        "local s, f = 0, 0.5 "
+        "for i = 1, 300 do s = s + i * 3 - i % 7 f = f * 1.01 + i / 3 end "
+        "local d = 0 for x = 1, 2, 0.25 do d = d + x end "
+        "for i = 10, 1, -2 do d = d + i end "
+        "r = { s, f, d, -s, 2 ^ 10 }",
+
+        "local function lp(n) local k = 0 while k < n do k = k + 1 end return k end "
+        "local function h(a) local w = 0 while w < 1 do w = w + 1 end return a end "
+        "local function m(x, y, z) return x, y, z end "
+        "local t = 0 for i = 1, 100 do t = t + lp(i) + h(i) end "
+        "local a, b, c = m(1) "
+        "r = { t, lp(3), 10 + h(3), a, b == nil, c == nil, m(4, 5, 6, 7) }",
+
+        "local t = { x = 1, y = 2 } g = 0 "
+        "for i = 1, 200 do t.x = t.x + t.y t[i] = i * 2 g = g + t[i] "
+        "if i % 50 == 0 then t.y = nil t.y = i end end "
+        "r = { t.x, t.y, g, #t }",
+
+        "local s = \"\" for i = 1, 100 do "
+        "s = s .. string.sub(\"abcdef\", i % 6 + 1, i % 6 + 1) end "
+        "r = { s, #s, \"a\" .. \"b\" .. s .. \"c\" }",
+
+        "local function fib(n) if n < 2 then return n end "
+        "return fib(n - 1) + fib(n - 2) end "
+        "local function counter() local c = 0 "
+        "return function() c = c + 1 return c end end "
+        "local f = counter() for i = 1, 100 do f() end "
+        "r = { fib(20), f() }",
+
+        "local a = 0 for i = 1, 200 do "
+        "a = a + math.floor(i / 3) + math.max(i, 50) + math.abs(-i) end "
+        "r = { a, math.sqrt(16.0), math.min(3, 1.5), math.ceil(2.5) }",
+    };
+
+    const int kScriptCount = sizeof(kScripts) / sizeof(kScripts[0]);
+
+    void RegisterLibs(luna::State &state)
+    {
+        lib::base::RegisterLibBase(&state);
+        lib::math::RegisterLibMath(&state);
+        lib::string::RegisterLibString(&state);
+        lib::table::RegisterLibTable(&state);
+    }
+
+    std::string ToString(const luna::Value &v)
+    {
+        char buffer[64];
+        switch (v.type_)
+        {
+            case luna::ValueT_Nil:
+                return "nil";
+            case luna::ValueT_Bool:
+                return v.bvalue_ ? "true" : "false";
+            case luna::ValueT_Integer:
+                return "integer " + std::to_string(v.integer_);
+            case luna::ValueT_Number:
+                snprintf(buffer, sizeof(buffer), "number %.17g", v.GetNumber());
+                return buffer;
+            case luna::ValueT_String:
+                return "string " + v.str_->GetStdString();
+            default:
+                return v.TypeName();
+        }
+    }
+
+    // Get results in global array 'r' of script
+    std::vector<std::string> GetResults(luna::State &state)
+    {
+        std::vector<std::string> results;
+        auto r = GetGlobal(state, "r");
+        if (r.type_ != luna::ValueT_Table)
+            return results;
+
+        for (std::size_t i = 1; i <= r.table_->ArraySize(); ++i)
+            results.push_back(ToString(r.table_->GetValue(luna::Value(static_cast<long long>(i)))));
+        return results;
+    }
+
+    // Run script in a new State set up by 'setup', return results,
+    // count of functions compiled by baseline JIT is added to 'compiled'
+    std::vector<std::string> RunScript(const char *script,
+                                       const std::function<void (luna::State &)> &setup,
+                                       std::size_t *compiled = nullptr)
+    {
+        luna::State state;
+        RegisterLibs(state);
+        setup(state);
+        state.DoString(script);
+        if (compiled)
+            *compiled += state.GetBaselineJitCompiledCount();
+        return GetResults(state);
+    }
+
+    std::vector<std::string> Interpret(const char *script)
+    {
+        return RunScript(script, [](luna::State &) { });
+    }
+} // namespace
+
+TEST_CASE(backend1)
+{
+    // Tracing JIT gives the same results as the interpreter
+    for (int i = 0; i < kScriptCount; ++i)
+    {
+        auto expect = Interpret(kScripts[i]);
+        EXPECT_TRUE(!expect.empty());
+        EXPECT_TRUE(RunScript(kScripts[i], [](luna::State &state) {
+            state.SetJitEnabled(true);
+        }) == expect);
+    }
+}
+
+TEST_CASE(backend2)
+{
+    // Baseline JIT gives the same results as the interpreter, both
+    // after the default count of calls and after the first call
+    std::size_t compiled = 0;
+    for (int i = 0; i < kScriptCount; ++i)
+    {
+        auto expect = Interpret(kScripts[i]);
+        EXPECT_TRUE(RunScript(kScripts[i], [](luna::State &state) {
+            state.SetBaselineJitEnabled(true);
+        }) == expect);
+        EXPECT_TRUE(RunScript(kScripts[i], [](luna::State &state) {
+            state.SetBaselineJitEnabled(true);
+            state.SetBaselineJitThreshold(1);
+        }, &compiled) == expect);
+    }
+#ifdef LUNA_JIT_SUPPORTED
+    EXPECT_TRUE(compiled > 0);
+#endif
+}
+
+TEST_CASE(backend3)
+{
+    // Module compiled ahead of time gives the same results as the
+    // interpreter
+    for (int i = 0; i < kScriptCount; ++i)
+    {
+        auto name = std::string(LUNA_BINARY_DIR) + "/backend" + std::to_string(i);
+        std::ofstream(name + ".lua") << kScripts[i];
+
+        luna::State state;
+        state.LoadModule(name + ".lua");
+        auto closure = state.GetModuleClosure(name + ".lua");
+        std::ofstream(name + ".cpp") << luna::AotCompile(closure.closure_->GetPrototype());
+
+        std::string command = std::string(LUNA_CXX_COMPILER) +
+            " -std=c++11 -w -shared -fPIC -I" LUNA_SOURCE_DIR " -I" LUNA_SOURCE_DIR "/luna"
+#ifdef LUNA_NAN_BOXING
+            " -DLUNA_NAN_BOXING"
+#endif
+            " -o " + name + ".so " + name + ".cpp";
+        EXPECT_TRUE(system(command.c_str()) == 0);
+
+        luna::State aot_state;
+        RegisterLibs(aot_state);
+        aot_state.DoModule(name + ".so");
+        EXPECT_TRUE(GetResults(aot_state) == Interpret(kScripts[i]));
+    }
+}
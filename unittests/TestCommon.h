@@ -8,6 +8,9 @@
 #include "luna/TextInStream.h"
 #include "luna/Exception.h"
 #include "luna/Visitor.h"
+#include "luna/Table.h"
+#include "luna/Function.h"
+#include "luna/OpCode.h"
 #include <functional>
 #include <type_traits>
 
@@ -384,4 +387,33 @@ struct AcceptAST
     { return true; }
 };
 
+// Get prototype of function which body is 's', the function is
+// generated by 'state' as global function 't'
+inline luna::Function * GenerateFunction(luna::State &state, const std::string &s)
+{
+    state.DoString("function t() " + s + " end");
+    luna::Value key(state.GetString("t"));
+    return state.GetGlobal()->table_->GetValue(key).closure_->GetPrototype();
+}
+
+// Get global value of 'name'
+inline luna::Value GetGlobal(luna::State &state, const char *name)
+{
+    luna::Value key(state.GetString(name));
+    return state.GetGlobal()->table_->GetValue(key);
+}
+
+// Count instructions of 'op' in function
+inline int CountOpCode(const luna::Function *f, luna::OpType op)
+{
+    int count = 0;
+    auto code = f->GetOpCodes();
+    for (std::size_t i = 0; i < f->OpCodeSize(); ++i)
+    {
+        if (luna::Instruction::GetOpCode(code[i]) == op)
+            ++count;
+    }
+    return count;
+}
+
 #endif // TEST_COMMON_H
@@ -0,0 +1,99 @@
+#include "UnitTest.h"
+#include "TestCommon.h"
+#include "luna/SemanticAnalysis.h"
+#include "luna/ConstantFold.h"
+
+namespace
+{
+    ParserWrapper g_parser;
+    std::unique_ptr<luna::SyntaxTree> Fold(const std::string &s)
+    {
+        g_parser.SetInput(s);
+        auto ast = g_parser.Parse();
+        luna::SemanticAnalysis(ast.get(), g_parser.GetState());
+        luna::ConstantFold(ast.get(), g_parser.GetState());
+        return ast;
+    }
+
+    struct FindToken
+    {
+        FindToken(int token) : token_(token) { }
+
+        bool operator () (const luna::Terminator *term) const
+        { return term->token_.token_ == token_; }
+
+        int token_;
+    };
+} // namespace
+
+TEST_CASE(fold1)
+{
+    auto ast = Fold("a = 60 * 60 * 24");
+    auto exp = ASTFind<luna::BinaryExpression>(ast, AcceptAST());
+    auto term = ASTFind<luna::Terminator>(ast, FindToken(luna::Token_Integer));
+    EXPECT_TRUE(!exp);
+    EXPECT_TRUE(term && term->token_.integer_ == 86400);
+    EXPECT_TRUE(term->semantic_ == luna::SemanticOp_Read);
+}
+
+TEST_CASE(fold2)
+{
+    auto ast = Fold("a = \"a\" .. \"b\" .. 1 b = -1.5 c = not nil d = #\"abc\"");
+    auto exp = ASTFind<luna::BinaryExpression>(ast, AcceptAST());
+    auto unexp = ASTFind<luna::UnaryExpression>(ast, AcceptAST());
+    auto s = ASTFind<luna::Terminator>(ast, FindToken(luna::Token_String));
+    auto n = ASTFind<luna::Terminator>(ast, FindToken(luna::Token_Number));
+    auto t = ASTFind<luna::Terminator>(ast, FindToken(luna::Token_True));
+    auto i = ASTFind<luna::Terminator>(ast, FindToken(luna::Token_Integer));
+    EXPECT_TRUE(!exp && !unexp);
+    EXPECT_TRUE(s && s->token_.str_->GetStdString() == "ab1");
+    EXPECT_TRUE(n && n->token_.number_ == -1.5);
+    EXPECT_TRUE(t);
+    EXPECT_TRUE(i && i->token_.integer_ == 3);
+}
+
+TEST_CASE(fold3)
+{
+    // Errors and unsafe float results are left to run time
+    EXPECT_TRUE(ASTFind<luna::BinaryExpression>(Fold("a = 1 % 0"), AcceptAST()));
+    EXPECT_TRUE(ASTFind<luna::BinaryExpression>(Fold("a = 0 / 0"), AcceptAST()));
+    EXPECT_TRUE(ASTFind<luna::BinaryExpression>(Fold("a = 0 * -1.5"), AcceptAST()));
+    EXPECT_TRUE(ASTFind<luna::BinaryExpression>(Fold("a = 1.5 .. \"a\""), AcceptAST()));
+}
+
+TEST_CASE(fold4)
+{
+    auto ast = Fold("a = false or b c = 1 and d");
+    EXPECT_TRUE(!ASTFind<luna::BinaryExpression>(ast, AcceptAST()));
+    EXPECT_TRUE(ASTFind<luna::Terminator>(ast, FindName("b")));
+
+    // The right operand which has any count values is kept
+    ast = Fold("return true and f()");
+    EXPECT_TRUE(ASTFind<luna::BinaryExpression>(ast, AcceptAST()));
+}
+
+TEST_CASE(fold5)
+{
+    auto ast = Fold("if false then f() elseif 1 > 0 then g() else h() end");
+    EXPECT_TRUE(!ASTFind<luna::IfStatement>(ast, AcceptAST()));
+    EXPECT_TRUE(!ASTFind<luna::Terminator>(ast, FindName("f")));
+    EXPECT_TRUE(ASTFind<luna::Terminator>(ast, FindName("g")));
+    EXPECT_TRUE(!ASTFind<luna::Terminator>(ast, FindName("h")));
+
+    ast = Fold("if a then f() elseif nil then g() end while false do h() end");
+    EXPECT_TRUE(ASTFind<luna::IfStatement>(ast, AcceptAST()));
+    EXPECT_TRUE(!ASTFind<luna::ElseIfStatement>(ast, AcceptAST()));
+    EXPECT_TRUE(!ASTFind<luna::Terminator>(ast, FindName("g")));
+    EXPECT_TRUE(!ASTFind<luna::WhileStatement>(ast, AcceptAST()));
+}
+
+TEST_CASE(fold6)
+{
+    // Statements after return or break are unreachable
+    auto ast = Fold("while a do if b then break else return end f() end g()");
+    EXPECT_TRUE(!ASTFind<luna::Terminator>(ast, FindName("f")));
+    EXPECT_TRUE(ASTFind<luna::Terminator>(ast, FindName("g")));
+
+    ast = Fold("do return end f()");
+    EXPECT_TRUE(!ASTFind<luna::Terminator>(ast, FindName("f")));
+}
@@ -0,0 +1,118 @@
+#include "UnitTest.h"
+#include "TestCommon.h"
+
+TEST_CASE(inline1)
+{
+    luna::State state;
+
+    // Small local function is inlined
+    auto f = GenerateFunction(state, "local function clamp(x, lo, hi) "
+                                     "if x < lo then return lo end "
+                                     "if x > hi then return hi end return x end "
+                                     "local s = 0 for i = 1, 10 do s = s + clamp(i, 3, 7) end return s");
+    EXPECT_TRUE(CountOpCode(f, luna::OpType_Call) == 0);
+
+    f = GenerateFunction(state, "local function g(a) return a end g(1) local x, y = g(2)");
+    EXPECT_TRUE(CountOpCode(f, luna::OpType_Call) == 0);
+}
+
+TEST_CASE(inline2)
+{
+    luna::State state;
+
+    // Local function is assigned again
+    auto f = GenerateFunction(state, "local function g(a) return a end g = nil return g(1)");
+    EXPECT_TRUE(CountOpCode(f, luna::OpType_TailCall) == 1);
+
+    f = GenerateFunction(state, "local function g(a) return a end function g() end local x = g(1)");
+    EXPECT_TRUE(CountOpCode(f, luna::OpType_Call) == 1);
+
+    f = GenerateFunction(state, "local function g(a) return a end "
+                                "local function s() g = nil end local x = g(1)");
+    EXPECT_TRUE(CountOpCode(f, luna::OpType_Call) == 1);
+
+    // Name is another local
+    f = GenerateFunction(state, "local function g(a) return a end local g = h local x = g(1)");
+    EXPECT_TRUE(CountOpCode(f, luna::OpType_Call) == 1);
+}
+
+TEST_CASE(inline3)
+{
+    luna::State state;
+
+    // Function has upvalues, vararg or child functions, or count of
+    // results is not fixed
+    auto f = GenerateFunction(state, "local function g(a) return g end local x = g(1)");
+    EXPECT_TRUE(CountOpCode(f, luna::OpType_Call) == 1);
+
+    f = GenerateFunction(state, "local function g(...) return 1 end local x = g(1)");
+    EXPECT_TRUE(CountOpCode(f, luna::OpType_Call) == 1);
+
+    f = GenerateFunction(state, "local function g() return function() end end local x = g()");
+    EXPECT_TRUE(CountOpCode(f, luna::OpType_Call) == 1);
+
+    f = GenerateFunction(state, "local function g(a) return a end print(g(1))");
+    EXPECT_TRUE(CountOpCode(f, luna::OpType_Call) == 2);
+}
+
+TEST_CASE(inline4)
+{
+    // Inlined code gives the same results as call
+    luna::State state;
+    auto f = GenerateFunction(state, "local function lp() local n = 0 "
+                                     "while n < 3 do n = n + 1 end return n end "
+                                     "local function h(a) local w = 0 "
+                                     "while w < 1 do w = w + 1 end return a end "
+                                     "local function m(x, y, z) return x, y, z end "
+                                     "local function two() return 1, 2 end "
+                                     "a = lp() b = 10 + lp() local x = h(3) c = x "
+                                     "local k = 7 d, e, g = m(k) d2 = m(8, 9, 10, 11) "
+                                     "local p, q, r = two() local s = two() "
+                                     "e1, e2, e3, e4 = p, q, r, s");
+    EXPECT_TRUE(CountOpCode(f, luna::OpType_Call) == 0);
+    state.DoString("t()");
+
+    auto expect_integer = [&state](const char *name, long long integer) {
+        auto v = GetGlobal(state, name);
+        return v.type_ == luna::ValueT_Integer && v.integer_ == integer;
+    };
+    auto expect_nil = [&state](const char *name) {
+        return GetGlobal(state, name).type_ == luna::ValueT_Nil;
+    };
+
+    // Loops of callee
+    EXPECT_TRUE(expect_integer("a", 3));
+    EXPECT_TRUE(expect_integer("b", 13));
+    EXPECT_TRUE(expect_integer("c", 3));
+
+    // Missing args are nil, extra args are dropped
+    EXPECT_TRUE(expect_integer("d", 7));
+    EXPECT_TRUE(expect_nil("e"));
+    EXPECT_TRUE(expect_nil("g"));
+    EXPECT_TRUE(expect_integer("d2", 8));
+
+    // Results are truncated or padded with nil
+    EXPECT_TRUE(expect_integer("e1", 1));
+    EXPECT_TRUE(expect_integer("e2", 2));
+    EXPECT_TRUE(expect_nil("e3"));
+    EXPECT_TRUE(expect_integer("e4", 1));
+}
+
+TEST_CASE(inline5)
+{
+    // Runtime error of inlined code names local variable of callee
+    luna::State state;
+    auto f = GenerateFunction(state, "local function e(t) return t.x end local r = e(nil)");
+    EXPECT_TRUE(CountOpCode(f, luna::OpType_Call) == 0);
+
+    std::string message;
+    try
+    {
+        state.DoString("t()");
+    }
+    catch (const luna::RuntimeException &e)
+    {
+        message = e.What();
+    }
+    EXPECT_TRUE(message.find("from local 't'") != std::string::npos);
+}
@@ -67,7 +67,11 @@ TEST_CASE(lex4)
 {
     LexerWrapper lexer("3 3.0 3.1416 314.16e-2 0.31416E1 0xff 0x0.1E 0xA23p-4 0X1.921FB54442D18P+1"
                        " 0x");
-    for (int i = 0; i < 9; ++i)
+    EXPECT_TRUE(lexer.GetToken() == luna::Token_Integer);
+    for (int i = 0; i < 4; ++i)
+        EXPECT_TRUE(lexer.GetToken() == luna::Token_Number);
+    EXPECT_TRUE(lexer.GetToken() == luna::Token_Integer);
+    for (int i = 0; i < 3; ++i)
         EXPECT_TRUE(lexer.GetToken() == luna::Token_Number);
 
     EXPECT_EXCEPTION(luna::LexException, {
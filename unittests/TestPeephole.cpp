@@ -0,0 +1,180 @@
+#include "UnitTest.h"
+#include "TestCommon.h"
+#include "luna/Peephole.h"
+#include <initializer_list>
+
+namespace
+{
+    using luna::Instruction;
+
+    // Optimize function which instructions are 'code'
+    luna::Function * Optimize(luna::State &state,
+                              std::initializer_list<Instruction> code,
+                              int captured = -1)
+    {
+        auto f = state.NewFunction();
+        for (auto i : code)
+            f->AddInstruction(i, 1);
+
+        // Child function captures register 'captured'
+        if (captured >= 0)
+        {
+            auto child = state.NewFunction();
+            child->AddUpvalue(state.GetString("u"), true, captured);
+            f->AddChildFunction(child);
+        }
+
+        luna::PeepholeOptimize(f);
+        return f;
+    }
+
+    Instruction Get(const luna::Function *f, int index)
+    {
+        return f->GetOpCodes()[index];
+    }
+
+    // Get instruction which jump at 'index' goes to
+    Instruction GetJumpTarget(const luna::Function *f, int index)
+    {
+        return Get(f, index + Instruction::GetJumpDiff(Get(f, index)));
+    }
+} // namespace
+
+TEST_CASE(peephole1)
+{
+    // Dead stores are removed
+    luna::State state;
+    auto f = Optimize(state, {
+        Instruction::ABCode(luna::OpType_LoadBool, 0, 1),
+        Instruction::ABCode(luna::OpType_LoadBool, 1, 1),
+        Instruction::ABCode(luna::OpType_LoadBool, 0, 0),
+        Instruction::AsBxCode(luna::OpType_Ret, 0, 1),
+    });
+    EXPECT_TRUE(f->OpCodeSize() == 2);
+    EXPECT_TRUE(CountOpCode(f, luna::OpType_LoadBool) == 1);
+    EXPECT_TRUE(Instruction::GetParamB(Get(f, 0)) == 0);
+}
+
+TEST_CASE(peephole2)
+{
+    // Copy of temporary register is propagated to its uses
+    luna::State state;
+    auto f = Optimize(state, {
+        Instruction::ABxCode(luna::OpType_GetGlobal, 1, 0),
+        Instruction::ABCode(luna::OpType_Move, 2, 1),
+        Instruction::ABCCode(luna::OpType_Add, 3, 2, 1),
+        Instruction::AsBxCode(luna::OpType_Ret, 3, 1),
+    });
+    EXPECT_TRUE(f->OpCodeSize() == 3);
+    EXPECT_TRUE(CountOpCode(f, luna::OpType_Move) == 0);
+    EXPECT_TRUE(Instruction::GetParamB(Get(f, 1)) == 1);
+    EXPECT_TRUE(Instruction::GetParamC(Get(f, 1)) == 1);
+}
+
+TEST_CASE(peephole3)
+{
+    // Result is written to the register which it is moved to
+    luna::State state;
+    auto f = Optimize(state, {
+        Instruction::ABxCode(luna::OpType_GetGlobal, 1, 0),
+        Instruction::ABxCode(luna::OpType_GetGlobal, 2, 1),
+        Instruction::ABCCode(luna::OpType_Add, 3, 1, 2),
+        Instruction::ABCode(luna::OpType_Move, 0, 3),
+        Instruction::AsBxCode(luna::OpType_Ret, 0, 1),
+    });
+    EXPECT_TRUE(f->OpCodeSize() == 4);
+    EXPECT_TRUE(CountOpCode(f, luna::OpType_Move) == 0);
+    EXPECT_TRUE(Instruction::GetParamA(Get(f, 2)) == 0);
+}
+
+TEST_CASE(peephole4)
+{
+    // Call is placed at the register which results are moved to
+    luna::State state;
+    auto f = Optimize(state, {
+        Instruction::ABxCode(luna::OpType_GetGlobal, 2, 0),
+        Instruction::ABxCode(luna::OpType_GetGlobal, 3, 1),
+        Instruction::ABCCode(luna::OpType_Call, 2, 2, 2),
+        Instruction::ABCode(luna::OpType_Move, 1, 2),
+        Instruction::AsBxCode(luna::OpType_Ret, 1, 1),
+    });
+    EXPECT_TRUE(f->OpCodeSize() == 4);
+    EXPECT_TRUE(CountOpCode(f, luna::OpType_Move) == 0);
+    EXPECT_TRUE(Instruction::GetParamA(Get(f, 0)) == 1);
+    EXPECT_TRUE(Instruction::GetParamA(Get(f, 1)) == 2);
+    EXPECT_TRUE(Instruction::GetParamA(Get(f, 2)) == 1);
+}
+
+TEST_CASE(peephole5)
+{
+    // Adjacent nil loads are coalesced
+    luna::State state;
+    auto f = Optimize(state, {
+        Instruction::ACode(luna::OpType_LoadNil, 0),
+        Instruction::ACode(luna::OpType_LoadNil, 1),
+        Instruction::ABCode(luna::OpType_FillNil, 2, 4),
+        Instruction::AsBxCode(luna::OpType_Ret, 0, 4),
+    });
+    EXPECT_TRUE(f->OpCodeSize() == 2);
+    EXPECT_TRUE(Instruction::GetOpCode(Get(f, 0)) == luna::OpType_FillNil);
+    EXPECT_TRUE(Instruction::GetParamA(Get(f, 0)) == 0);
+    EXPECT_TRUE(Instruction::GetParamB(Get(f, 0)) == 4);
+}
+
+TEST_CASE(peephole6)
+{
+    // Jump to jump goes to the final target, unreachable instructions
+    // and jumps to the next instruction are removed
+    luna::State state;
+    auto f = Optimize(state, {
+        Instruction::ABxCode(luna::OpType_GetGlobal, 0, 0),
+        Instruction::AsBxCode(luna::OpType_JmpFalse, 0, 3),
+        Instruction::ABCode(luna::OpType_LoadBool, 0, 1),
+        Instruction::AsBxCode(luna::OpType_Ret, 0, 1),
+        Instruction::sAxCode(luna::OpType_Jmp, 2),
+        Instruction::AsBxCode(luna::OpType_Ret, 0, 1),
+        Instruction::ABCode(luna::OpType_LoadBool, 0, 0),
+        Instruction::AsBxCode(luna::OpType_Ret, 0, 1),
+    });
+    EXPECT_TRUE(f->OpCodeSize() == 6);
+    EXPECT_TRUE(CountOpCode(f, luna::OpType_Jmp) == 0);
+    auto target = GetJumpTarget(f, 1);
+    EXPECT_TRUE(Instruction::GetOpCode(target) == luna::OpType_LoadBool &&
+                Instruction::GetParamB(target) == 0);
+}
+
+TEST_CASE(peephole7)
+{
+    // Stores to captured registers are kept
+    luna::State state;
+    std::initializer_list<Instruction> code = {
+        Instruction::ABCode(luna::OpType_LoadBool, 1, 1),
+        Instruction::ABxCode(luna::OpType_Closure, 2, 0),
+        Instruction::AsBxCode(luna::OpType_Ret, 2, 1),
+    };
+    EXPECT_TRUE(CountOpCode(Optimize(state, code), luna::OpType_LoadBool) == 0);
+    EXPECT_TRUE(CountOpCode(Optimize(state, code, 1), luna::OpType_LoadBool) == 1);
+
+    // Nil loads are not coalesced into FillNil which closes captured
+    // registers
+    auto f = Optimize(state, {
+        Instruction::ACode(luna::OpType_LoadNil, 0),
+        Instruction::ACode(luna::OpType_LoadNil, 1),
+        Instruction::AsBxCode(luna::OpType_Ret, 0, 2),
+    }, 1);
+    EXPECT_TRUE(CountOpCode(f, luna::OpType_LoadNil) == 2);
+
+    // Result is not forwarded over jump target, the jump still goes
+    // to the move
+    f = Optimize(state, {
+        Instruction::ABxCode(luna::OpType_GetGlobal, 0, 0),
+        Instruction::ABxCode(luna::OpType_GetGlobal, 1, 1),
+        Instruction::AsBxCode(luna::OpType_JmpTrue, 0, 2),
+        Instruction::ABxCode(luna::OpType_GetGlobal, 1, 2),
+        Instruction::ABCode(luna::OpType_Move, 2, 1),
+        Instruction::AsBxCode(luna::OpType_Ret, 2, 1),
+    });
+    EXPECT_TRUE(f->OpCodeSize() == 6);
+    EXPECT_TRUE(Instruction::GetParamA(Get(f, 3)) == 1);
+    EXPECT_TRUE(Instruction::GetOpCode(GetJumpTarget(f, 2)) == luna::OpType_Move);
+}
@@ -1,6 +1,7 @@
 #include "UnitTest.h"
 #include "luna/Table.h"
 #include "luna/String.h"
+#include "TestCommon.h"
 
 TEST_CASE(table1)
 {
@@ -17,8 +18,8 @@ TEST_CASE(table1)
     luna::Value key;
     luna::Value value;
     EXPECT_TRUE(t.FirstKeyValue(key, value));
-    EXPECT_TRUE(key.type_ == luna::ValueT_Number);
-    EXPECT_TRUE(key.num_ == static_cast<double>(1));
+    EXPECT_TRUE(key.type_ == luna::ValueT_Integer);
+    EXPECT_TRUE(key.integer_ == 1);
     EXPECT_TRUE(value.type_ == luna::ValueT_Number);
     EXPECT_TRUE(value.num_ == static_cast<double>(1));
 
@@ -27,8 +28,8 @@ TEST_CASE(table1)
         luna::Value next_key;
         luna::Value next_value;
         EXPECT_TRUE(t.NextKeyValue(key, next_key, next_value));
-        EXPECT_TRUE(next_key.type_ == luna::ValueT_Number);
-        EXPECT_TRUE(next_key.num_ == static_cast<double>(i + 1));
+        EXPECT_TRUE(next_key.type_ == luna::ValueT_Integer);
+        EXPECT_TRUE(next_key.integer_ == i + 1);
         EXPECT_TRUE(next_value.type_ == luna::ValueT_Number);
         EXPECT_TRUE(next_value.num_ == static_cast<double>(i + 1));
         key = next_key;
@@ -162,3 +163,54 @@ TEST_CASE(table5)
     EXPECT_TRUE(value.type_ == luna::ValueT_Number);
     EXPECT_TRUE(value.num_ == 4);
 }
+
+TEST_CASE(table6)
+{
+    // Cached hash value is invalid after the key is erased, and the
+    // key inserted again is found
+    luna::State state;
+    luna::Table t;
+    luna::Value key(state.GetString("x"));
+    t.SetValue(key, luna::Value(1ll));
+    auto version = t.GetVersion();
+    EXPECT_TRUE(t.GetHashValue(key)->integer_ == 1);
+
+    t.SetValue(key, luna::Value());
+    EXPECT_TRUE(t.GetVersion() != version);
+    t.SetValue(key, luna::Value(2ll));
+    EXPECT_TRUE(t.GetHashValue(key)->integer_ == 2);
+
+    // Inline caches of field and global access see the new value
+    state.DoString("local t = { x = 1 } local r = {} g = 1 "
+                   "for i = 1, 3 do "
+                   "r[i] = t.x t.x = nil t.x = 10 + i "
+                   "r[i + 3] = g g = nil g = 20 + i end "
+                   "a, b, c, d, e, f = r[1], r[2], r[3], r[4], r[5], r[6]");
+    const char *names[] = { "a", "b", "c", "d", "e", "f" };
+    const long long results[] = { 1, 11, 12, 1, 21, 22 };
+    for (int i = 0; i < 6; ++i)
+    {
+        auto v = GetGlobal(state, names[i]);
+        EXPECT_TRUE(v.type_ == luna::ValueT_Integer && v.integer_ == results[i]);
+    }
+}
+
+TEST_CASE(table7)
+{
+    // Versions are unique among tables
+    luna::State state;
+    luna::Table t1;
+    luna::Table t2;
+    EXPECT_TRUE(t1.GetVersion() != t2.GetVersion());
+
+    luna::Value key(state.GetString("x"));
+    auto version1 = t1.GetVersion();
+    auto version2 = t2.GetVersion();
+    t1.SetValue(key, luna::Value(1ll));
+    t1.SetValue(key, luna::Value());
+    t2.SetValue(key, luna::Value(1ll));
+    t2.SetValue(key, luna::Value());
+    EXPECT_TRUE(t1.GetVersion() != version1 && t1.GetVersion() != version2);
+    EXPECT_TRUE(t2.GetVersion() != version1 && t2.GetVersion() != version2);
+    EXPECT_TRUE(t1.GetVersion() != t2.GetVersion());
+}
@@ -0,0 +1,50 @@
+#include "UnitTest.h"
+#include "TestCommon.h"
+
+TEST_CASE(type1)
+{
+    luna::State state;
+
+    // Loop counter and results of arithmetic are numbers
+    auto f = GenerateFunction(state, "local s = 0 for i = 1, 100 do s = s + i * 2 end return s");
+    EXPECT_TRUE(CountOpCode(f, luna::OpType_AddNN) == 1);
+    EXPECT_TRUE(CountOpCode(f, luna::OpType_MulNK) == 1);
+    EXPECT_TRUE(CountOpCode(f, luna::OpType_Add) == 0);
+    EXPECT_TRUE(CountOpCode(f, luna::OpType_MulRK) == 0);
+}
+
+TEST_CASE(type2)
+{
+    luna::State state;
+
+    // Operand is a number after an arithmetic returns
+    auto f = GenerateFunction(state, "local a = f() local b = a + 1 local c = 2 * a return b, c");
+    EXPECT_TRUE(CountOpCode(f, luna::OpType_AddRK) == 1);
+    EXPECT_TRUE(CountOpCode(f, luna::OpType_MulNK) == 1);
+}
+
+TEST_CASE(type3)
+{
+    luna::State state;
+
+    // Not a number on one of paths
+    auto f = GenerateFunction(state, "local x = 1 if g then x = \"s\" end return x + 1");
+    EXPECT_TRUE(CountOpCode(f, luna::OpType_AddRK) == 1);
+    EXPECT_TRUE(CountOpCode(f, luna::OpType_AddNK) == 0);
+
+    f = GenerateFunction(state, "local n = 0 while n < 10 do n = n + 1 end return n");
+    EXPECT_TRUE(CountOpCode(f, luna::OpType_JmpLessNK) +
+                CountOpCode(f, luna::OpType_JmpGreaterEqualNK) == 1);
+    EXPECT_TRUE(CountOpCode(f, luna::OpType_AddNK) == 1);
+}
+
+TEST_CASE(type4)
+{
+    luna::State state;
+
+    // Captured local may be changed by the closure
+    auto f = GenerateFunction(state, "local s = 0 local c = function() s = \"x\" end "
+                                     "for i = 1, 3 do s = s + i end return s");
+    EXPECT_TRUE(CountOpCode(f, luna::OpType_Add) == 1);
+    EXPECT_TRUE(CountOpCode(f, luna::OpType_AddNN) == 0);
+}
@@ -0,0 +1,194 @@
+#include "UnitTest.h"
+#include "TestCommon.h"
+#include "luna/Table.h"
+#include "luna/LibMath.h"
+#include "luna/LibString.h"
+#include <algorithm>
+
+TEST_CASE(vm1)
+{
+    // Error of c function called by tail call is reported
+    EXPECT_EXCEPTION(luna::RuntimeException, {
+        luna::State state;
+        lib::string::RegisterLibString(&state);
+        state.DoString("local function g() return string.sub({}) end g()");
+    });
+    EXPECT_EXCEPTION(luna::RuntimeException, {
+        luna::State state;
+        lib::string::RegisterLibString(&state);
+        state.DoString("return string.sub({})");
+    });
+
+    // Results of c function called by tail call
+    luna::State state;
+    lib::string::RegisterLibString(&state);
+    state.DoString("local function g(s) return string.sub(s, 2) end "
+                   "local function h(...) return string.sub(...) end "
+                   "a, b = g(\"abc\"), h(\"hello\", 2, 3)");
+    EXPECT_TRUE(GetGlobal(state, "a").str_->GetStdString() == "bc");
+    EXPECT_TRUE(GetGlobal(state, "b").str_->GetStdString() == "el");
+}
+
+TEST_CASE(vm2)
+{
+    // Concat chain longer than count of registers
+    std::string chain = "x";
+    for (int i = 1; i < 300; ++i)
+        chain += " .. x";
+
+    luna::State state;
+    auto f = GenerateFunction(state, "local x = g return " + chain);
+    EXPECT_TRUE(CountOpCode(f, luna::OpType_ConcatRange) > 1);
+    state.DoString("g = \"a\" s = t()");
+    EXPECT_TRUE(GetGlobal(state, "s").str_->GetLength() == 300);
+
+    // Most of registers are used by locals
+    std::string locals;
+    chain = "l0";
+    for (int i = 0; i < 200; ++i)
+        locals += "local l" + std::to_string(i) + " = \"a\" ";
+    for (int i = 1; i < 400; ++i)
+        chain += " .. l" + std::to_string(i % 200);
+    state.DoString(locals + "s = " + chain);
+    EXPECT_TRUE(GetGlobal(state, "s").str_->GetLength() == 400);
+}
+
+TEST_CASE(vm3)
+{
+    // Math functions keep integers which float can not hold, called
+    // by intrinsic and by call, NaN-boxed Value holds less integers
+#ifdef LUNA_NAN_BOXING
+    std::string n = "140737488355329";
+#else
+    std::string n = "9007199254740993";
+#endif
+    luna::State state;
+    lib::math::RegisterLibMath(&state);
+    state.DoString("local n = " + n + " local m = math "
+                   "a = math.floor(n) b = math.ceil(n) c = math.abs(-n) "
+                   "d = math.min(n, n + 1) e = math.max(n, n - 1) "
+                   "f = m.floor(n) g = m.max(n - 1, n) "
+                   "h = math.floor(2.5) i = math.ceil(-2.5) j = math.floor(1e300)");
+    const char *names[] = { "a", "b", "c", "d", "e", "f", "g" };
+    for (auto name : names)
+    {
+        auto v = GetGlobal(state, name);
+        EXPECT_TRUE(v.type_ == luna::ValueT_Integer &&
+                    v.integer_ == std::stoll(n));
+    }
+
+    auto h = GetGlobal(state, "h");
+    auto i = GetGlobal(state, "i");
+    auto j = GetGlobal(state, "j");
+    EXPECT_TRUE(h.type_ == luna::ValueT_Integer && h.integer_ == 2);
+    EXPECT_TRUE(i.type_ == luna::ValueT_Integer && i.integer_ == -2);
+    EXPECT_TRUE(j.type_ == luna::ValueT_Number && j.num_ == 1e300);
+}
+
+TEST_CASE(vm4)
+{
+    // Integer results which both Value layouts hold are the same
+    luna::State state;
+    state.DoString("local n = 140737488355327 a = n + n - n b = -(-n - 1)");
+    auto a = GetGlobal(state, "a");
+    auto b = GetGlobal(state, "b");
+    EXPECT_TRUE(a.type_ == luna::ValueT_Integer && a.integer_ == 140737488355327LL);
+    EXPECT_TRUE(b.type_ == luna::ValueT_Integer && b.integer_ == 140737488355328LL);
+
+    // Integer results out of range of NaN-boxed Value are errors
+    // instead of floats
+    const char *scripts[] = {
+        "a = 281474976710655 + 1",
+        "local n = 281474976710655 a = n + 1",
+        "local n = -281474976710655 - 1 a = -n",
+        "local n = 16777216 a = n * 16777216",
+    };
+    for (auto script : scripts)
+    {
+#ifdef LUNA_NAN_BOXING
+        EXPECT_EXCEPTION(luna::RuntimeException, {
+            luna::State state;
+            state.DoString(script);
+        });
+#else
+        luna::State state;
+        state.DoString(script);
+        auto v = GetGlobal(state, "a");
+        EXPECT_TRUE(v.type_ == luna::ValueT_Integer && v.integer_ == 281474976710656LL);
+#endif
+    }
+
+#ifdef LUNA_NAN_BOXING
+    EXPECT_EXCEPTION(luna::LexException, {
+        luna::State state;
+        state.DoString("a = 9007199254740993");
+    });
+#else
+    state.DoString("a = 9007199254740993 + 0");
+    a = GetGlobal(state, "a");
+    EXPECT_TRUE(a.type_ == luna::ValueT_Integer && a.integer_ == 9007199254740993LL);
+#endif
+}
+
+TEST_CASE(vm5)
+{
+    // Consts are added once, consts out of range of Bx are loaded by
+    // LoadConstX, and jump over them is out of range of sBx
+    const int count = 70000;
+    std::string body = "local s = 0 if g then ";
+    for (int pass = 0; pass < 2; ++pass)
+    {
+        for (int i = 0; i < count; ++i)
+            body += "s = s + " + std::to_string(100000 + i) + " ";
+    }
+    body += "end return s";
+
+    luna::State state;
+    auto f = GenerateFunction(state, body);
+    // Consts are the integers, 0 and "g"
+    EXPECT_TRUE(f->GetConstValueCount() == count + 2);
+    EXPECT_TRUE(CountOpCode(f, luna::OpType_LoadConstX) > 0);
+
+    int max_diff = 0;
+    auto code = f->GetOpCodes();
+    for (std::size_t i = 0; i < f->OpCodeSize(); ++i)
+    {
+        int op = luna::Instruction::GetOpCode(code[i]);
+        if (op == luna::OpType_Jmp)
+            max_diff = std::max(max_diff, luna::Instruction::GetParamsAx(code[i]));
+        if (luna::HasDataWord(op))
+            ++i;
+    }
+    EXPECT_TRUE(max_diff > luna::kMaxsBx);
+
+    long long sum = 0;
+    for (int i = 0; i < count; ++i)
+        sum += 2 * (100000 + i);
+    state.DoString("g = true s = t() g = false z = t()");
+    auto s = GetGlobal(state, "s");
+    auto z = GetGlobal(state, "z");
+    EXPECT_TRUE(s.type_ == luna::ValueT_Integer && s.integer_ == sum);
+    EXPECT_TRUE(z.type_ == luna::ValueT_Integer && z.integer_ == 0);
+}
+
+TEST_CASE(vm6)
+{
+    // Stack grows for deep recursion which is not tail call
+    luna::State state;
+    state.DoString("local function sum(n) if n == 0 then return 0 end "
+                   "return n + sum(n - 1) end s = sum(50000)");
+    auto s = GetGlobal(state, "s");
+    EXPECT_TRUE(s.type_ == luna::ValueT_Integer && s.integer_ == 1250025000LL);
+
+    // Unbounded recursion is reported as stack overflow
+    std::string message;
+    try
+    {
+        state.DoString("local function f(n) return 1 + f(n + 1) end f(1)");
+    }
+    catch (const luna::RuntimeException &e)
+    {
+        message = e.What();
+    }
+    EXPECT_TRUE(message.find("stack overflow") != std::string::npos);
+}